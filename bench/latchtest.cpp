@@ -20,28 +20,34 @@
  */
 
 #include "latch_mutex.h"
+#include "latch_optimistic.h"
+#include "latch_bravo.h"
 
+#include <cstdlib>
+#include <cstring>
+#include <iostream>
 #include <random>
+#include <thread>
+#include <vector>
 
 constexpr int num_ops = 1000000;
-std::mt19937 rng;
 
-int main(int argc, char** argv)
+/**
+ * Usage: latchtest [threads] [mutex|optimistic|bravo] [write percentage]
+ */
+template <class Latch>
+void run(unsigned num_threads, int write_pct)
 {
-    foster::MutexLatch latch;
+    Latch latch;
     int var = 0;
 
-    unsigned num_threads = 2;
-    if (argc > 1) {
-        num_threads = atoi(argv[1]);
-    }
-
-    auto f = [&var,&latch] {
+    auto f = [&var,&latch,write_pct] (unsigned seed) {
         int local_var = 0;
-        std::uniform_int_distribution<int> should_write(0,1);
+        std::mt19937 rng{seed};
+        std::uniform_int_distribution<int> should_write(0,99);
 
         for (int i = 0; i < num_ops; i++) {
-            if (should_write(rng)) {
+            if (should_write(rng) < write_pct) {
                 latch.acquire_write();
                 var++;
                 latch.release_write();
@@ -57,11 +63,32 @@ int main(int argc, char** argv)
 
     std::vector<std::thread> threads;
     for (unsigned i = 0; i < num_threads; i++) {
-        threads.emplace_back(f);
+        threads.emplace_back(f, i);
     }
     for (unsigned i = 0; i < num_threads; i++) {
         threads[i].join();
     }
+}
+
+int main(int argc, char** argv)
+{
+    unsigned num_threads = 2;
+    if (argc > 1) {
+        num_threads = atoi(argv[1]);
+    }
+    const char* latch = argc > 2 ? argv[2] : "mutex";
+    int write_pct = argc > 3 ? atoi(argv[3]) : 50;
+
+    if (strcmp(latch, "mutex") == 0) {
+        run<foster::MutexLatch>(num_threads, write_pct);
+    } else if (strcmp(latch, "optimistic") == 0) {
+        run<foster::OptimisticLatch>(num_threads, write_pct);
+    } else if (strcmp(latch, "bravo") == 0) {
+        run<foster::BravoLatch>(num_threads, write_pct);
+    } else {
+        std::cerr << "Unknown latch type: " << latch << std::endl;
+        return 1;
+    }
 
     return 0;
 }
@@ -63,6 +63,259 @@ void compare_with_std_map(int count)
     }
 }
 
+template<template<class,class,unsigned> class Btree, unsigned Levels, class K, class V>
+void bulk_load_test(int count, double fill_factor)
+{
+    std::vector<std::pair<K, V>> input;
+    for (int i = 0; i < count; i++) {
+        input.emplace_back(convert<K>(i), convert<V>(i));
+    }
+    std::sort(input.begin(), input.end());
+
+    Stopwatch sw;
+    {
+        Btree<K, V, Levels-1> tree;
+        for (auto& p : input) { tree.put(p.first, p.second); }
+        sw.dump("foster", "insert", count);
+    }
+
+    sw.reset();
+    {
+        Btree<K, V, Levels-1> tree;
+        tree.bulk_load(input.begin(), input.end(), fill_factor);
+        sw.dump("foster_bulk_load", "insert", count);
+    }
+}
+
+template<template<class,class,unsigned> class Btree, unsigned Levels, class K, class V>
+void parallel_bulk_load_test(int num_threads, int count)
+{
+    using Tree = Btree<K, V, Levels-1>;
+    std::vector<std::pair<K, V>> input;
+    for (int i = 0; i < count; i++) {
+        input.emplace_back(convert<K>(i), convert<V>(i));
+    }
+    std::sort(input.begin(), input.end());
+    string name = "foster_parallel_" + std::to_string(num_threads);
+
+    TaskPool pool {size_t(num_threads)};
+    Tree tree;
+    Stopwatch sw;
+    tree.parallel_bulk_load(pool, input.begin(), input.end(), 0.9);
+    sw.dump(name, "insert", count);
+
+    // Aggregation over the whole tree, with one partial sum per range
+    const size_t max_ranges = 4 * num_threads;
+    std::vector<int64_t> sums(max_ranges, 0);
+    sw.reset();
+    tree.parallel_scan(pool, max_ranges, [&sums] (size_t range, typename Tree::Cursor& cursor) {
+        K key;
+        V value;
+        int64_t sum = 0;
+        while (cursor.next(&key, &value)) { sum += value; }
+        sums[range] = sum;
+    });
+    sw.dump(name, "scan", count);
+}
+
+template<class SA, class Search>
+void search_probes(const SA& slots, const std::vector<typename SA::KeyType>& probes,
+        const string& name)
+{
+    using SlotNumber = typename SA::SlotNumber;
+
+    size_t found = 0;
+    Stopwatch sw;
+    for (auto& k : probes) {
+        SlotNumber slot = 0;
+        found += Search{}(slots, k, slot, 0, slots.slot_count()) ? 1 : slot & 1;
+    }
+    sw.dump(name, "search", probes.size());
+    // Prevents the compiler from optimizing away the search calls
+    if (found == probes.size() + 1) { std::cout << found << std::endl; }
+}
+
+template<class PMNK_Type, template<class> class SlotArray = SArray>
+void search_test(int count, const string& prefix = "")
+{
+    using SA = SlotArray<PMNK_Type>;
+
+    SA slots;
+    while (slots.insert_slot(slots.slot_count())) {}
+    for (size_t i = 0; i < slots.slot_count(); i++) {
+        slots[i].key = static_cast<PMNK_Type>(i * 2);
+    }
+
+    std::mt19937 rng;
+    std::uniform_int_distribution<size_t> dist(0, slots.slot_count() * 2);
+    std::vector<PMNK_Type> probes;
+    for (int i = 0; i < count; i++) { probes.push_back(static_cast<PMNK_Type>(dist(rng))); }
+
+    string suffix = prefix + "_" + std::to_string(sizeof(PMNK_Type) * 8) + "bit_"
+        + std::to_string(slots.slot_count());
+    search_probes<SA, BinarySearch<SA>>(slots, probes, "binary" + suffix);
+    search_probes<SA, SimdSearch<SA, 16>>(slots, probes, "simd16" + suffix);
+    search_probes<SA, SimdSearch<SA, 64>>(slots, probes, "simd64" + suffix);
+    search_probes<SA, SimdSearch<SA, 256>>(slots, probes, "simd256" + suffix);
+}
+
+template<template<class,class,unsigned> class Btree, unsigned Levels, class K, class V>
+void multi_get_test(int count, size_t batch)
+{
+    std::vector<std::pair<K, V>> input;
+    for (int i = 0; i < count; i++) {
+        input.emplace_back(convert<K>(i), convert<V>(i));
+    }
+    std::sort(input.begin(), input.end());
+    Btree<K, V, Levels-1> tree;
+    tree.bulk_load(input.begin(), input.end(), 0.9);
+
+    std::mt19937 rng;
+    std::uniform_int_distribution<int> dist(0, count - 1);
+    std::vector<K> keys;
+    for (int i = 0; i < count; i++) { keys.push_back(convert<K>(dist(rng))); }
+
+    std::vector<V> values(batch);
+    std::unique_ptr<bool[]> found(new bool[batch]);
+    size_t total = 0;
+
+    Stopwatch sw;
+    for (auto& k : keys) { total += tree.get(k, values[0]); }
+    sw.dump("foster_get", "lookup", count);
+
+    for (size_t i = 0; i + batch <= keys.size(); i += batch) {
+        total += tree.multi_get(&keys[i], values.data(), found.get(), batch);
+    }
+    sw.dump("foster_multi_get_" + std::to_string(batch), "lookup", count);
+
+    if (total != 2 * count - count % batch) { std::cerr << "oops..." << std::endl; }
+}
+
+template<template<class,class,unsigned> class Btree, unsigned Levels, class K, class V>
+void table_size_test(const string& name, int count, int lookups)
+{
+    Btree<K, V, Levels-1> tree;
+    std::mt19937 rng;
+    std::uniform_int_distribution<int> gen(0, count - 1);
+
+    Stopwatch sw;
+    for (int i = 0; i < count; i++) {
+        Insert<Btree<K, V, Levels-1>, K, V>{}(tree, i);
+    }
+    sw.dump(name + "_" + std::to_string(count), "insert", count);
+
+    Lookup<Btree<K, V, Levels-1>, K, V> lookup;
+    for (int i = 0; i < lookups; i++) {
+        lookup(tree, gen(rng));
+    }
+    sw.dump(name + "_" + std::to_string(count), "lookup", lookups);
+}
+
+template<template<class,class,unsigned> class Btree, unsigned Levels, class K, class V>
+void random_insert_test(const string& name, int count, int lookups)
+{
+    std::vector<int> keys(count);
+    for (int i = 0; i < count; i++) { keys[i] = i; }
+    std::mt19937 rng;
+    std::shuffle(keys.begin(), keys.end(), rng);
+    std::uniform_int_distribution<int> gen(0, count - 1);
+
+    Btree<K, V, Levels-1> tree;
+    Stopwatch sw;
+    for (int k : keys) {
+        Insert<Btree<K, V, Levels-1>, K, V>{}(tree, k);
+    }
+    sw.dump(name, "insert", count);
+
+    Lookup<Btree<K, V, Levels-1>, K, V> lookup;
+    for (int i = 0; i < lookups; i++) {
+        lookup(tree, gen(rng));
+    }
+    sw.dump(name, "lookup", lookups);
+
+    auto cursor = tree.scan(convert<K>(0), convert<K>(count));
+    K key;
+    V value;
+    int scanned = 0;
+    while (cursor.next(&key, &value)) { scanned++; }
+    sw.dump(name, "scan", scanned);
+}
+
+template<template<class,class,unsigned> class Btree, unsigned Levels, class K, class V>
+void snapshot_test(int count)
+{
+    string path = "/tmp/foster_simplebench_snapshot";
+    Btree<K, V, Levels-1> tree;
+    Stopwatch sw;
+    for (int i = 0; i < count; i++) {
+        Insert<Btree<K, V, Levels-1>, K, V>{}(tree, i);
+    }
+    sw.dump("snapshot_" + std::to_string(count), "insert", count);
+
+    tree.save(path);
+    sw.dump("snapshot_" + std::to_string(count), "save", count);
+
+    Btree<K, V, Levels-1> loaded;
+    loaded.load(path);
+    sw.dump("snapshot_" + std::to_string(count), "load", count);
+    std::remove(path.c_str());
+}
+
+template<template<class,class,unsigned> class Btree, unsigned Levels, class K, class V>
+void hot_lookup_test(const string& name, int count, int hot_count, int lookups)
+{
+    Btree<K, V, Levels-1> tree;
+    for (int i = 0; i < count; i++) {
+        Insert<Btree<K, V, Levels-1>, K, V>{}(tree, i);
+    }
+
+    // Hot keys are spread over the whole key space, i.e., over many leaves
+    std::mt19937 rng;
+    std::uniform_int_distribution<int> gen(0, hot_count - 1);
+    int stride = count / hot_count;
+    Lookup<Btree<K, V, Levels-1>, K, V> lookup;
+    Stopwatch sw;
+    for (int i = 0; i < lookups; i++) {
+        lookup(tree, gen(rng) * stride);
+    }
+    sw.dump(name + "_" + std::to_string(hot_count), "lookup", lookups);
+}
+
+template<template<class,class,unsigned> class Btree, unsigned Levels, class K, class V>
+void buffer_pool_test(int count, int hot_count)
+{
+    string path = "/tmp/foster_simplebench_buffer_pool";
+    string name = "buffer_pool_" + std::to_string(count);
+    Btree<K, V, Levels-1> tree;
+    for (int i = 0; i < count; i++) {
+        Insert<Btree<K, V, Levels-1>, K, V>{}(tree, i);
+    }
+    tree.save(path);
+
+    Btree<K, V, Levels-1> loaded;
+    Lookup<Btree<K, V, Levels-1>, K, V> lookup;
+    Stopwatch sw;
+    loaded.load(path);
+    sw.dump(name, "load", count);
+
+    for (int i = 0; i < count; i++) { lookup(loaded, i); }
+    sw.dump(name, "cold_lookup", count);
+    for (int i = 0; i < count; i++) { lookup(loaded, i); }
+    sw.dump(name, "warm_lookup", count);
+
+    // Touch the hot set between two sweeps, so that only the cold leaves are evicted
+    loaded.evict(count);
+    for (int i = 0; i < hot_count; i++) { lookup(loaded, i); }
+    loaded.evict(count);
+    sw.reset();
+    for (int i = 0; i < count; i++) { lookup(loaded, i % hot_count); }
+    sw.dump(name, "hot_set_lookup", count);
+    for (int i = 0; i < count; i++) { lookup(tree, i % hot_count); }
+    sw.dump(name, "in_memory_lookup", count);
+
+    std::remove(path.c_str());
+}
+
 template<template<class,class,unsigned> class Btree, unsigned Levels, class K, class V>
 void concurrent_test(int num_threads, int count)
 {
@@ -124,8 +377,92 @@ int main(int, char**)
     // std::cout << "=== String keys, with PMNK ===" << std::endl;
     // foster::compare_with_std_map<foster::SBtree, 3, string, string>(max);
 
+    std::cout << "=== Slot array search ===" << std::endl;
+    foster::search_test<uint16_t>(max);
+    foster::search_test<uint32_t>(max);
+    foster::search_test<uint64_t>(max);
+    foster::search_test<uint16_t, foster::SoAArray>(max, "_soa");
+    foster::search_test<uint32_t, foster::SoAArray>(max, "_soa");
+    foster::search_test<uint64_t, foster::SoAArray>(max, "_soa");
+
+    std::cout << "=== Integer keys, bulk loading ===" << std::endl;
+    foster::bulk_load_test<foster::SBtreeNoPMNK, 3, int, int>(max, 0.9);
+
+    std::cout << "=== Integer keys, parallel bulk loading and scans, pooled allocator ===" << std::endl;
+    for (int i = 1; i <= 8; i *= 2) {
+        foster::parallel_bulk_load_test<foster::SBtreePooled, 3, int, int>(i, 4 * max);
+    }
+
+    std::cout << "=== Integer keys, batched lookups ===" << std::endl;
+    foster::multi_get_test<foster::SBtreeNoPMNK, 3, int, int>(max, 32);
+    foster::multi_get_test<foster::SBtreeNoPMNK, 3, int, int>(max, 256);
+    foster::multi_get_test<foster::SBtreeOptimistic, 3, int, int>(max, 256);
+
+    std::cout << "=== Integer keys, static vs. dynamic height ===" << std::endl;
+    foster::table_size_test<foster::SBtreeOptimistic, 3, int, int>("static", 1000, max);
+    foster::table_size_test<foster::DBtreeOptimistic, 5, int, int>("dynamic", 1000, max);
+    foster::table_size_test<foster::SBtreeOptimistic, 3, int, int>("static", max, max);
+    foster::table_size_test<foster::DBtreeOptimistic, 5, int, int>("dynamic", max, max);
+
+    std::cout << "=== Integer keys, encoded vs. inline vs. delta-compressed records ===" << std::endl;
+    foster::table_size_test<foster::SBtreeOptimistic, 3, int, int>("encoded", max, max);
+    foster::table_size_test<foster::SBtreeInline, 3, int, int>("inline", max, max);
+    foster::table_size_test<foster::SBtreeDelta, 3, int, int>("delta", max, max);
+
+    std::cout << "=== Integer keys, random insertions, without vs. with insert buffers ===" << std::endl;
+    foster::random_insert_test<foster::SBtreeOptimistic, 3, int, int>("slots", max, max);
+    foster::random_insert_test<foster::SBtreeInsertBuf, 3, int, int>("insert_buffer", max, max);
+
+    std::cout << "=== Integer keys, random insertions, 64 KB nodes without vs. with insert buffers ===" << std::endl;
+    foster::random_insert_test<foster::SBtreeLarge, 3, int, int>("slots_64k", max, max);
+    foster::random_insert_test<foster::SBtreeInsertBufLarge, 3, int, int>("insert_buffer_64k", max, max);
+
+    std::cout << "=== Integer keys, rebuild vs. snapshot reload ===" << std::endl;
+    foster::snapshot_test<foster::SBtreeOptimistic, 3, int, int>(max);
+
+    std::cout << "=== Integer keys, lookups of a hot set, without vs. with hash index ===" << std::endl;
+    for (int hot : {1000, 10000}) {
+        foster::hot_lookup_test<foster::SBtreeOptimistic, 3, int, int>("traversal", max, hot, max);
+        foster::hot_lookup_test<foster::SBtreeHashed, 3, int, int>("hash_index", max, hot, max);
+    }
+
+    std::cout << "=== Integer keys, random lookups, 4 KB vs. huge page nodes ===" << std::endl;
+    foster::table_size_test<foster::SBtreePooled, 3, int, int>("pooled", 10 * max, max);
+    foster::table_size_test<foster::SBtreeHugePages, 3, int, int>("huge_pages", 10 * max, max);
+
+    std::cout << "=== Integer keys, lazily loaded leaves vs. in-memory tree ===" << std::endl;
+    foster::buffer_pool_test<foster::SBtreeBuffered, 3, int, int>(max, max / 10);
+
+    std::cout << "=== Integer keys, mutex latch ===" << std::endl;
     for (int i = 1; i <= 8; i++) {
         int num_threads = i;
         foster::concurrent_test<foster::SBtreeNoPMNK, 3, int, int>(num_threads, max/num_threads);
     }
+
+    std::cout << "=== Integer keys, mutex latch, lazy adoption ===" << std::endl;
+    for (int i = 1; i <= 8; i++) {
+        int num_threads = i;
+        foster::concurrent_test<foster::SBtreeLazy, 3, int, int>(num_threads, max/num_threads);
+    }
+
+    std::cout << "=== Integer keys, mutex latch, background adoption ===" << std::endl;
+    for (int i = 1; i <= 8; i++) {
+        int num_threads = i;
+        foster::concurrent_test<foster::SBtreeBackground, 3, int, int>(num_threads,
+                max/num_threads);
+    }
+
+    std::cout << "=== Integer keys, optimistic latch ===" << std::endl;
+    for (int i = 1; i <= 8; i++) {
+        int num_threads = i;
+        foster::concurrent_test<foster::SBtreeOptimistic, 3, int, int>(num_threads,
+                max/num_threads);
+    }
+
+    std::cout << "=== Integer keys, optimistic latch, pooled allocator ===" << std::endl;
+    for (int i = 1; i <= 8; i++) {
+        int num_threads = i;
+        foster::concurrent_test<foster::SBtreePooled, 3, int, int>(num_threads,
+                max/num_threads);
+    }
 }
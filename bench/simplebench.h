@@ -28,34 +28,56 @@
  * Classes used to represent a single B-tree node.
  */
 
+#include <algorithm>
+#include <cstdio>
 #include <cstring>
 #include <chrono>
 #include <map>
+#include <memory>
 #include <random>
 #include <thread>
 #include <vector>
 #include <future>
 
 #include "slot_array.h"
+#include "slot_array_soa.h"
 #include "encoding.h"
 #include "search.h"
 #include "kv_array.h"
+#include "kv_array_inline.h"
+#include "kv_array_delta.h"
+#include "kv_array_buffered.h"
 #include "node.h"
 #include "node_mgr.h"
 #include "pointers.h"
 #include "btree_level.h"
 #include "btree_static.h"
+#include "btree_dynamic.h"
 #include "btree_adoption.h"
 #include "latch_mutex.h"
+#include "latch_optimistic.h"
+#include "alloc_pool.h"
+#include "alloc_hugepage.h"
+#include "buffer_pool.h"
+#include "hash_index.h"
+#include "task_pool.h"
 
 namespace foster {
 
 constexpr size_t DftArrayBytes = 4096;
 constexpr size_t DftAlignment = 8;
+// Nodes on which an insertion shifts enough slots for insert buffers to pay off
+constexpr size_t LargeArrayBytes = 65536;
 
 template<class PMNK_Type>
 using SArray = foster::SlotArray<PMNK_Type, DftArrayBytes, DftAlignment>;
 
+template<class PMNK_Type>
+using LargeSArray = foster::SlotArray<PMNK_Type, LargeArrayBytes, DftAlignment>;
+
+template<class PMNK_Type>
+using SoAArray = foster::SoASlotArray<PMNK_Type, DftArrayBytes, DftAlignment>;
+
 template<class K, class V>
 using KVArray = foster::KeyValueArray<K, V,
       SArray<uint16_t>,
@@ -72,6 +94,33 @@ using KVArrayNoPMNK = foster::KeyValueArray<K, V,
       // foster::DefaultEncoder<K, V, K>
 >;
 
+template<class K, class V>
+using KVArrayInline = foster::SelectKeyValueArray<K, V, KVArrayNoPMNK, DftArrayBytes, DftAlignment>;
+
+template<class K, class V>
+using KVArrayDelta = foster::DeltaKeyValueArray<K, V, DftArrayBytes, DftAlignment>;
+
+template<class K, class V>
+using KVArrayInsertBuf = foster::BufferedKeyValueArray<K, V,
+      SArray<K>,
+      foster::BinarySearch<SArray<K>>,
+      foster::CompoundEncoder<foster::AssignmentEncoder<K>, foster::AssignmentEncoder<V>, K>
+>;
+
+template<class K, class V>
+using KVArrayLarge = foster::KeyValueArray<K, V,
+      LargeSArray<K>,
+      foster::BinarySearch<LargeSArray<K>>,
+      foster::CompoundEncoder<foster::AssignmentEncoder<K>, foster::AssignmentEncoder<V>, K>
+>;
+
+template<class K, class V>
+using KVArrayInsertBufLarge = foster::BufferedKeyValueArray<K, V,
+      LargeSArray<K>,
+      foster::BinarySearch<LargeSArray<K>>,
+      foster::CompoundEncoder<foster::AssignmentEncoder<K>, foster::AssignmentEncoder<V>, K>
+>;
+
 template<class K, class V>
 using BTNode = foster::BtreeNode<K, V,
     KVArray,
@@ -87,9 +136,72 @@ using BTNodeNoPMNK = foster::BtreeNode<K, V,
     foster::MutexLatch
 >;
 
+template<class K, class V>
+using BTNodeOptimistic = foster::BtreeNode<K, V,
+    KVArrayNoPMNK,
+    foster::PlainPtr,
+    unsigned,
+    foster::OptimisticLatch
+>;
+
+template<class K, class V>
+using BTNodeInline = foster::BtreeNode<K, V,
+    KVArrayInline,
+    foster::PlainPtr,
+    unsigned,
+    foster::OptimisticLatch
+>;
+
+template<class K, class V>
+using BTNodeDelta = foster::BtreeNode<K, V,
+    KVArrayDelta,
+    foster::PlainPtr,
+    unsigned,
+    foster::OptimisticLatch
+>;
+
+template<class K, class V>
+using BTNodeInsertBuf = foster::BtreeNode<K, V,
+    KVArrayInsertBuf,
+    foster::PlainPtr,
+    unsigned,
+    foster::OptimisticLatch
+>;
+
+template<class K, class V>
+using BTNodeLarge = foster::BtreeNode<K, V,
+    KVArrayLarge,
+    foster::PlainPtr,
+    unsigned,
+    foster::OptimisticLatch
+>;
+
+template<class K, class V>
+using BTNodeInsertBufLarge = foster::BtreeNode<K, V,
+    KVArrayInsertBufLarge,
+    foster::PlainPtr,
+    unsigned,
+    foster::OptimisticLatch
+>;
+
+template<class K, class V>
+using BTNodeSwizzling = foster::BtreeNode<K, V,
+    KVArrayNoPMNK,
+    foster::SwizzlingPtr,
+    unsigned,
+    foster::OptimisticLatch
+>;
+
 template<class Node>
 using NodeMgr = foster::BtreeNodeManager<Node, foster::AtomicCounterIdGenerator<unsigned>>;
 
+template<class Node>
+using BufferedNodeMgr = foster::BufferedNodeManager<Node, foster::AtomicCounterIdGenerator<unsigned>>;
+
+template<class Node>
+using PooledNodeMgr = foster::BtreeNodeManager<Node, foster::AtomicCounterIdGenerator<unsigned>,
+      foster::PoolAllocator<Node>>;
+
 template<class K, class V, unsigned L>
 using BTLevel = foster::BtreeLevel<
     K, V, L,
@@ -106,12 +218,155 @@ using BTLevelNoPMNK = foster::BtreeLevel<
     NodeMgr
 >;
 
+template<class K, class V, unsigned L>
+using BTLevelOptimistic = foster::BtreeLevel<
+    K, V, L,
+    BTNodeOptimistic,
+    foster::EagerAdoption,
+    NodeMgr
+>;
+
+template<class K, class V, unsigned L>
+using BTLevelInline = foster::BtreeLevel<
+    K, V, L,
+    BTNodeInline,
+    foster::EagerAdoption,
+    NodeMgr
+>;
+
+template<class K, class V, unsigned L>
+using BTLevelDelta = foster::BtreeLevel<
+    K, V, L,
+    BTNodeDelta,
+    foster::EagerAdoption,
+    NodeMgr
+>;
+
+template<class K, class V, unsigned L>
+using BTLevelInsertBuf = foster::BtreeLevel<
+    K, V, L,
+    BTNodeInsertBuf,
+    foster::EagerAdoption,
+    NodeMgr
+>;
+
+template<class K, class V, unsigned L>
+using BTLevelLarge = foster::BtreeLevel<
+    K, V, L,
+    BTNodeLarge,
+    foster::EagerAdoption,
+    NodeMgr
+>;
+
+template<class K, class V, unsigned L>
+using BTLevelInsertBufLarge = foster::BtreeLevel<
+    K, V, L,
+    BTNodeInsertBufLarge,
+    foster::EagerAdoption,
+    NodeMgr
+>;
+
+template<class K, class V, unsigned L>
+using BTLevelPooled = foster::BtreeLevel<
+    K, V, L,
+    BTNodeOptimistic,
+    foster::EagerAdoption,
+    PooledNodeMgr
+>;
+
+// Branch nodes are interleaved over all NUMA nodes and leaves are local to the inserting thread
+template<class Node>
+using HugePageNodeMgr = foster::BtreeNodeManager<Node, foster::AtomicCounterIdGenerator<unsigned>,
+      foster::PoolAllocator<Node, 2 * 1024 * 1024, 64, foster::HugePageChunks<2 * 1024 * 1024,
+        Node::IsBranch ? foster::NumaPlacement::Interleave : foster::NumaPlacement::Local>>>;
+
+template<class K, class V, unsigned L>
+using BTLevelHugePages = foster::BtreeLevel<
+    K, V, L,
+    BTNodeOptimistic,
+    foster::EagerAdoption,
+    HugePageNodeMgr
+>;
+
+template<class K, class V, unsigned L>
+using BTLevelBuffered = foster::BtreeLevel<
+    K, V, L,
+    BTNodeSwizzling,
+    foster::EagerAdoption,
+    BufferedNodeMgr
+>;
+
+template<class K, class V, unsigned L>
+using BTLevelLazy = foster::BtreeLevel<
+    K, V, L,
+    BTNodeNoPMNK,
+    foster::LazyAdoption,
+    NodeMgr
+>;
+
+template<class K, class V, unsigned L>
+using BTLevelBackground = foster::BtreeLevel<
+    K, V, L,
+    BTNodeNoPMNK,
+    foster::BackgroundAdoption,
+    NodeMgr
+>;
+
+template<class K, class V, unsigned L>
+using BTLevelHashed = foster::BtreeLevel<
+    K, V, L,
+    BTNodeOptimistic,
+    foster::EagerAdoption,
+    NodeMgr,
+    foster::NoStatistics,
+    foster::AdaptiveHashIndex
+>;
+
 template<class K, class V, unsigned L>
 using SBtree = foster::StaticBtree<K, V, L, BTLevel>;
 
 template<class K, class V, unsigned L>
 using SBtreeNoPMNK = foster::StaticBtree<K, V, L, BTLevelNoPMNK>;
 
+template<class K, class V, unsigned L>
+using SBtreeOptimistic = foster::StaticBtree<K, V, L, BTLevelOptimistic>;
+
+template<class K, class V, unsigned L>
+using SBtreeInline = foster::StaticBtree<K, V, L, BTLevelInline>;
+
+template<class K, class V, unsigned L>
+using SBtreeDelta = foster::StaticBtree<K, V, L, BTLevelDelta>;
+
+template<class K, class V, unsigned L>
+using SBtreeInsertBuf = foster::StaticBtree<K, V, L, BTLevelInsertBuf>;
+
+template<class K, class V, unsigned L>
+using SBtreeLarge = foster::StaticBtree<K, V, L, BTLevelLarge>;
+
+template<class K, class V, unsigned L>
+using SBtreeInsertBufLarge = foster::StaticBtree<K, V, L, BTLevelInsertBufLarge>;
+
+template<class K, class V, unsigned L>
+using SBtreePooled = foster::StaticBtree<K, V, L, BTLevelPooled>;
+
+template<class K, class V, unsigned L>
+using SBtreeHugePages = foster::StaticBtree<K, V, L, BTLevelHugePages>;
+
+template<class K, class V, unsigned L>
+using SBtreeBuffered = foster::StaticBtree<K, V, L, BTLevelBuffered>;
+
+template<class K, class V, unsigned L>
+using SBtreeLazy = foster::StaticBtree<K, V, L, BTLevelLazy>;
+
+template<class K, class V, unsigned L>
+using SBtreeBackground = foster::StaticBtree<K, V, L, BTLevelBackground>;
+
+template<class K, class V, unsigned L>
+using SBtreeHashed = foster::StaticBtree<K, V, L, BTLevelHashed>;
+
+template<class K, class V, unsigned L>
+using DBtreeOptimistic = foster::DynamicBtree<K, V, L, BTLevelOptimistic>;
+
 template<class T> T convert(int n) { return static_cast<T>(n); }
 
 template<> string convert(int n)
@@ -126,12 +381,12 @@ public:
 
     void reset()
     {
-        start = std::chrono::system_clock::now();
+        start = std::chrono::steady_clock::now();
     }
 
     void dump(string name, string op, int count)
     {
-        auto end = std::chrono::system_clock::now();
+        auto end = std::chrono::steady_clock::now();
         auto elapsed = std::chrono::duration_cast<std::chrono::microseconds>(end - start);
         std::cout << "[" << name << "]\t" << op << "s: " << count
             << "\truntime_in_sec: " << elapsed.count() / 1000000.0
@@ -142,7 +397,7 @@ public:
     }
 
 private:
-    std::chrono::system_clock::time_point start;
+    std::chrono::steady_clock::time_point start;
 };
 
 template<class Tree, class K, class V>
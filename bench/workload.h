@@ -0,0 +1,300 @@
+/*
+ * MIT License
+ *
+ * Copyright (c) 2016 Caetano Sauer
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy of this software and
+ * associated documentation files (the "Software"), to deal in the Software without restriction,
+ * including without limitation the rights to use, copy, modify, merge, publish, distribute,
+ * sublicense, and/or sell copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all copies or
+ * substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR IMPLIED, INCLUDING BUT
+ * NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM,
+ * DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+#ifndef FOSTER_BENCH_WORKLOAD_H
+#define FOSTER_BENCH_WORKLOAD_H
+
+/**
+ * \file workload.h
+ *
+ * Key generators, request distributions, and latency histograms for the YCSB-style benchmark.
+ */
+
+#include <atomic>
+#include <chrono>
+#include <cmath>
+#include <cstdint>
+#include <ostream>
+#include <random>
+#include <string>
+#include <thread>
+#include <vector>
+
+#ifdef __linux__
+#include <pthread.h>
+#include <sched.h>
+#endif
+
+using std::string;
+
+namespace foster {
+namespace bench {
+
+/// \brief Bijective 64-bit mixer (SplitMix64 finalizer), which maps record numbers to unique keys
+inline uint64_t mix64(uint64_t x)
+{
+    x ^= x >> 30;
+    x *= 0xBF58476D1CE4E5B9ull;
+    x ^= x >> 27;
+    x *= 0x94D049BB133111EBull;
+    x ^= x >> 31;
+    return x;
+}
+
+/// \brief Kinds of keys generated for record numbers (\see make_key)
+enum class KeyKind { Int, String, LongString };
+
+/**
+ * \brief Key of the n-th record.
+ *
+ * Records are spread over the key space, as with hashed keys in YCSB. String keys resemble the
+ * YCSB ones ("user" followed by a number); long string keys share a long common prefix, like URLs.
+ */
+template <class K> K make_key(uint64_t n, KeyKind kind);
+
+template <> inline uint64_t make_key(uint64_t n, KeyKind) { return mix64(n); }
+
+template <> inline string make_key(uint64_t n, KeyKind kind)
+{
+    if (kind == KeyKind::LongString) {
+        return "https://www.example.com/catalog/items/region-eu/" + std::to_string(mix64(n));
+    }
+    return "user" + std::to_string(mix64(n));
+}
+
+/**
+ * \brief Zipfian distribution over [0, n), as in YCSB (Gray et al., "Quickly generating
+ * billion-record synthetic databases").
+ *
+ * The zeta constant is computed once in O(n) and then updated incrementally when the number of
+ * items grows, which is required by the "latest" distribution. Item 0 is the most popular one.
+ */
+class ZipfianGenerator
+{
+public:
+    ZipfianGenerator(uint64_t n, double theta = 0.99)
+        : theta_(theta), n_(0), zetan_(0.0)
+    {
+        zeta2_ = zeta(0, 2);
+        alpha_ = 1.0 / (1.0 - theta_);
+        grow(n);
+    }
+
+    uint64_t items() const { return n_; }
+
+    /// \brief Extends the distribution to the given number of items (never shrinks)
+    void grow(uint64_t n)
+    {
+        if (n <= n_) { return; }
+        zetan_ += zeta(n_, n);
+        n_ = n;
+        eta_ = (1.0 - std::pow(2.0 / n_, 1.0 - theta_)) / (1.0 - zeta2_ / zetan_);
+    }
+
+    template <class Rng>
+    uint64_t next(Rng& rng)
+    {
+        double u = std::uniform_real_distribution<double>(0.0, 1.0)(rng);
+        double uz = u * zetan_;
+        if (uz < 1.0) { return 0; }
+        if (uz < 1.0 + std::pow(0.5, theta_)) { return 1; }
+        uint64_t r = static_cast<uint64_t>(n_ * std::pow(eta_ * u - eta_ + 1.0, alpha_));
+        return r < n_ ? r : n_ - 1;
+    }
+
+private:
+    double theta_;
+    uint64_t n_;
+    double zetan_;
+    double zeta2_;
+    double alpha_;
+    double eta_;
+
+    double zeta(uint64_t from, uint64_t to) const
+    {
+        double sum = 0.0;
+        for (uint64_t i = from; i < to; i++) { sum += 1.0 / std::pow(i + 1, theta_); }
+        return sum;
+    }
+};
+
+/// \brief Request distributions of YCSB
+enum class Distribution { Uniform, Zipfian, Latest };
+
+/**
+ * \brief Chooses the record numbers of requests from the records inserted so far.
+ *
+ * Zipfian requests are scrambled, so that popular records are not clustered at the beginning of
+ * the insertion order. Latest requests favor the most recently inserted records.
+ */
+class RequestGenerator
+{
+public:
+    RequestGenerator(Distribution dist, const ZipfianGenerator& zipf, uint64_t seed)
+        : dist_(dist), zipf_(zipf), rng_(seed)
+    {}
+
+    uint64_t next(uint64_t records)
+    {
+        switch (dist_) {
+            case Distribution::Uniform:
+                return std::uniform_int_distribution<uint64_t>(0, records - 1)(rng_);
+            case Distribution::Zipfian:
+                zipf_.grow(records);
+                return mix64(zipf_.next(rng_)) % records;
+            case Distribution::Latest:
+            default:
+                zipf_.grow(records);
+                return records - 1 - zipf_.next(rng_) % records;
+        }
+    }
+
+    std::mt19937_64& rng() { return rng_; }
+
+private:
+    Distribution dist_;
+    ZipfianGenerator zipf_;
+    std::mt19937_64 rng_;
+};
+
+/**
+ * \brief Log-linear latency histogram (in nanoseconds) with a relative error below 1/16.
+ *
+ * Values below 16 have their own buckets; larger values are grouped by their most significant
+ * bit, and each group is divided into 16 linear sub-buckets.
+ */
+class LatencyHistogram
+{
+public:
+    static constexpr unsigned SubBits = 4;
+    static constexpr unsigned SubBuckets = 1u << SubBits;
+    static constexpr unsigned Buckets = (64 - SubBits + 1) * SubBuckets;
+
+    LatencyHistogram() : counts_(Buckets, 0), count_(0), max_(0) {}
+
+    void record(uint64_t value)
+    {
+        counts_[index(value)]++;
+        count_++;
+        if (value > max_) { max_ = value; }
+    }
+
+    LatencyHistogram& operator+=(const LatencyHistogram& other)
+    {
+        for (unsigned i = 0; i < Buckets; i++) { counts_[i] += other.counts_[i]; }
+        count_ += other.count_;
+        if (other.max_ > max_) { max_ = other.max_; }
+        return *this;
+    }
+
+    uint64_t count() const { return count_; }
+    uint64_t max() const { return max_; }
+
+    /// \brief Lower bound of the bucket containing the given fraction (0 to 1) of the values
+    uint64_t percentile(double fraction) const
+    {
+        if (count_ == 0) { return 0; }
+        uint64_t target = static_cast<uint64_t>(std::ceil(fraction * count_));
+        if (target == 0) { target = 1; }
+        uint64_t seen = 0;
+        for (unsigned i = 0; i < Buckets; i++) {
+            seen += counts_[i];
+            if (seen >= target) { return value_of(i); }
+        }
+        return max_;
+    }
+
+    void print_json(std::ostream& out) const
+    {
+        out << "{\"count\":" << count_ << ",\"p50\":" << percentile(0.5)
+            << ",\"p99\":" << percentile(0.99) << ",\"p999\":" << percentile(0.999)
+            << ",\"max\":" << max_ << "}";
+    }
+
+private:
+    std::vector<uint64_t> counts_;
+    uint64_t count_;
+    uint64_t max_;
+
+    static unsigned index(uint64_t v)
+    {
+        if (v < SubBuckets) { return static_cast<unsigned>(v); }
+        unsigned msb = 63 - __builtin_clzll(v);
+        unsigned group = msb - SubBits + 1;
+        return group * SubBuckets + static_cast<unsigned>((v >> (msb - SubBits)) & (SubBuckets - 1));
+    }
+
+    static uint64_t value_of(unsigned i)
+    {
+        unsigned group = i / SubBuckets, sub = i % SubBuckets;
+        if (group == 0) { return sub; }
+        return static_cast<uint64_t>(SubBuckets + sub) << (group - 1);
+    }
+};
+
+inline uint64_t now_ns()
+{
+    using namespace std::chrono;
+    return duration_cast<nanoseconds>(steady_clock::now().time_since_epoch()).count();
+}
+
+/// \brief Pins the calling thread to a CPU, chosen round-robin by thread number
+inline void pin_thread(unsigned thread)
+{
+#ifdef __linux__
+    unsigned cpus = std::thread::hardware_concurrency();
+    if (cpus == 0) { return; }
+    cpu_set_t set;
+    CPU_ZERO(&set);
+    CPU_SET(thread % cpus, &set);
+    pthread_setaffinity_np(pthread_self(), sizeof(set), &set);
+#else
+    (void) thread;
+#endif
+}
+
+/// \brief Barrier that makes all worker threads start a phase at the same time
+class SpinBarrier
+{
+public:
+    explicit SpinBarrier(unsigned threads) : threads_(threads), waiting_(0), phase_(0) {}
+
+    void wait()
+    {
+        unsigned phase = phase_.load();
+        if (waiting_.fetch_add(1) + 1 == threads_) {
+            waiting_.store(0);
+            phase_.fetch_add(1);
+            return;
+        }
+        while (phase_.load() == phase) { std::this_thread::yield(); }
+    }
+
+private:
+    const unsigned threads_;
+    std::atomic<unsigned> waiting_;
+    std::atomic<unsigned> phase_;
+};
+
+} // namespace bench
+} // namespace foster
+
+#endif
@@ -0,0 +1,340 @@
+/*
+ * MIT License
+ *
+ * Copyright (c) 2016 Caetano Sauer
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy of this software and
+ * associated documentation files (the "Software"), to deal in the Software without restriction,
+ * including without limitation the rights to use, copy, modify, merge, publish, distribute,
+ * sublicense, and/or sell copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all copies or
+ * substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR IMPLIED, INCLUDING BUT
+ * NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM,
+ * DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+/**
+ * \file ycsb.cpp
+ *
+ * YCSB-style workload driver. Each run loads a fresh tree, warms it up, and then executes a mix of
+ * operations on all threads, printing throughput and latency percentiles as one JSON object per
+ * line. Usage (all arguments optional):
+ *
+ *     ycsb --workload=a,b,c,d,e,f --dist=zipfian|uniform|latest --keys=int|string|longstring
+ *          --latch=optimistic|bravo|mutex --threads=1,2,4,8 --records=N --ops=N --warmup=N
+ *          --scan=N --theta=X --pin=1|0
+ *
+ * The request distribution defaults to the one of each YCSB workload, and ops and warmup are
+ * totals over all threads.
+ */
+
+#include <algorithm>
+#include <cctype>
+#include <cstdlib>
+#include <cstring>
+#include <iostream>
+#include <sstream>
+
+#include "simplebench.h"
+#include "latch_bravo.h"
+#include "workload.h"
+
+namespace foster {
+namespace bench {
+
+template<class K, class V>
+using KVArrayInt = foster::KeyValueArray<K, V,
+      SArray<K>,
+      foster::BinarySearch<SArray<K>>,
+      foster::DefaultEncoder<K, V, K>
+>;
+
+template<class K, class V>
+using KVArrayString = foster::KeyValueArray<K, V,
+      SArray<uint64_t>,
+      foster::BinarySearch<SArray<uint64_t>>,
+      foster::DefaultEncoder<K, V, uint64_t>
+>;
+
+/// \brief Static B-tree with four levels, given the key-value array and the latch types
+template <template<class,class> class KVArray, class Latch>
+struct TreeOf
+{
+    template<class K, class V>
+    using Node = foster::BtreeNode<K, V, KVArray, foster::PlainPtr, unsigned, Latch>;
+
+    template<class K, class V, unsigned L>
+    using Level = foster::BtreeLevel<K, V, L, Node, foster::EagerAdoption, NodeMgr>;
+
+    template<class K>
+    using Tree = foster::StaticBtree<K, uint64_t, 3, Level>;
+};
+
+enum OpType { Read, Update, Insert, Scan, ReadModifyWrite, NumOpTypes };
+
+static const char* op_names[NumOpTypes] = { "read", "update", "insert", "scan", "rmw" };
+
+/// \brief Operation mix and request distribution of a workload
+struct Workload
+{
+    char name;
+    double mix[NumOpTypes];
+    Distribution dist;
+};
+
+static const Workload ycsb_workloads[] = {
+    { 'a', { 0.50, 0.50, 0.00, 0.00, 0.00 }, Distribution::Zipfian },
+    { 'b', { 0.95, 0.05, 0.00, 0.00, 0.00 }, Distribution::Zipfian },
+    { 'c', { 1.00, 0.00, 0.00, 0.00, 0.00 }, Distribution::Zipfian },
+    { 'd', { 0.95, 0.00, 0.05, 0.00, 0.00 }, Distribution::Latest },
+    { 'e', { 0.00, 0.00, 0.05, 0.95, 0.00 }, Distribution::Zipfian },
+    { 'f', { 0.50, 0.00, 0.00, 0.00, 0.50 }, Distribution::Zipfian },
+};
+
+struct Options
+{
+    string workloads = "a,b,c,d,e,f";
+    string dist = "";
+    string keys = "int";
+    /// Defaults to optimistic for integer keys and bravo for string keys
+    string latch = "";
+    std::vector<unsigned> threads = {1};
+    uint64_t records = 1000000;
+    uint64_t ops = 1000000;
+    uint64_t warmup = 100000;
+    unsigned max_scan = 100;
+    double theta = 0.99;
+    bool pin = true;
+};
+
+const char* dist_name(Distribution d)
+{
+    return d == Distribution::Uniform ? "uniform" : (d == Distribution::Latest ? "latest" : "zipfian");
+}
+
+/**
+ * \brief Runs one workload on a freshly loaded tree.
+ */
+template <class Tree>
+void run(const Options& opt, const Workload& w, Distribution dist, KeyKind kind, unsigned threads)
+{
+    using K = typename Tree::KeyType;
+
+    // Load phase (bulk loading, since insertion performance is measured by workloads D and E)
+    Tree tree;
+    {
+        std::vector<std::pair<K, uint64_t>> input;
+        input.reserve(opt.records);
+        for (uint64_t i = 0; i < opt.records; i++) {
+            input.emplace_back(make_key<K>(i, kind), i);
+        }
+        std::sort(input.begin(), input.end());
+        tree.bulk_load(input.begin(), input.end(), 0.9);
+    }
+
+    std::atomic<uint64_t> next_record {opt.records};
+    std::atomic<uint64_t> inserted {opt.records};
+    ZipfianGenerator zipf {opt.records, opt.theta};
+    SpinBarrier barrier {threads};
+    std::vector<std::vector<LatencyHistogram>> histograms(threads,
+            std::vector<LatencyHistogram>(NumOpTypes));
+    uint64_t start = 0, end = 0;
+
+    auto worker = [&] (unsigned t) {
+        if (opt.pin) { pin_thread(t); }
+        RequestGenerator requests {dist, zipf, 4711 + t};
+        std::uniform_real_distribution<double> coin(0.0, 1.0);
+        std::uniform_int_distribution<unsigned> scan_length(1, opt.max_scan);
+        uint64_t sink = 0;
+
+        auto execute = [&] (LatencyHistogram* hist) {
+            double c = coin(requests.rng());
+            int op = 0;
+            while (op < NumOpTypes - 1 && c >= w.mix[op]) { c -= w.mix[op]; op++; }
+
+            K key;
+            uint64_t value = 0;
+            if (op == Insert) {
+                uint64_t n = next_record.fetch_add(1);
+                key = make_key<K>(n, kind);
+                value = n;
+            }
+            else {
+                key = make_key<K>(requests.next(inserted.load(std::memory_order_relaxed)), kind);
+            }
+
+            uint64_t t0 = now_ns();
+            switch (op) {
+                case Read:
+                    sink += tree.get(key, value);
+                    break;
+                case Update:
+                    tree.update(key, value);
+                    break;
+                case Insert:
+                    tree.put(key, value);
+                    inserted.fetch_add(1, std::memory_order_relaxed);
+                    break;
+                case Scan: {
+                    auto cursor = tree.lower_bound(key);
+                    unsigned len = scan_length(requests.rng());
+                    for (unsigned i = 0; i < len && cursor.next(nullptr, &value); i++) {
+                        sink += value;
+                    }
+                    break;
+                }
+                case ReadModifyWrite:
+                    if (tree.get(key, value)) { tree.update(key, value + 1); }
+                    break;
+            }
+            if (hist) { hist[op].record(now_ns() - t0); }
+        };
+
+        barrier.wait();
+        for (uint64_t i = t; i < opt.warmup; i += threads) { execute(nullptr); }
+
+        barrier.wait();
+        if (t == 0) { start = now_ns(); }
+        for (uint64_t i = t; i < opt.ops; i += threads) { execute(histograms[t].data()); }
+        barrier.wait();
+        if (t == 0) { end = now_ns(); }
+
+        // Prevents the compiler from optimizing away the lookups
+        if (sink == 1) { std::cerr << ""; }
+    };
+
+    std::vector<std::thread> workers;
+    for (unsigned t = 0; t < threads; t++) { workers.emplace_back(worker, t); }
+    for (auto& th : workers) { th.join(); }
+
+    std::vector<LatencyHistogram> total(NumOpTypes);
+    for (auto& h : histograms) {
+        for (int op = 0; op < NumOpTypes; op++) { total[op] += h[op]; }
+    }
+
+    double seconds = (end - start) / 1e9;
+    std::cout << "{\"workload\":\"" << w.name << "\",\"distribution\":\"" << dist_name(dist)
+        << "\",\"keys\":\"" << opt.keys << "\",\"latch\":\"" << opt.latch
+        << "\",\"threads\":" << threads << ",\"records\":" << opt.records
+        << ",\"operations\":" << opt.ops << ",\"seconds\":" << seconds
+        << ",\"throughput\":" << (seconds > 0 ? opt.ops / seconds : 0.0)
+        << ",\"latency_ns\":{";
+    bool first = true;
+    for (int op = 0; op < NumOpTypes; op++) {
+        if (total[op].count() == 0) { continue; }
+        if (!first) { std::cout << ","; }
+        std::cout << "\"" << op_names[op] << "\":";
+        total[op].print_json(std::cout);
+        first = false;
+    }
+    std::cout << "}}" << std::endl;
+}
+
+template <class Tree>
+void run_all(const Options& opt, KeyKind kind)
+{
+    for (char name : opt.workloads) {
+        if (name == ',') { continue; }
+        const Workload* w = nullptr;
+        for (auto& candidate : ycsb_workloads) {
+            if (candidate.name == std::tolower(name)) { w = &candidate; }
+        }
+        if (!w) {
+            std::cerr << "Unknown workload: " << name << std::endl;
+            std::exit(1);
+        }
+
+        Distribution dist = w->dist;
+        if (opt.dist == "uniform") { dist = Distribution::Uniform; }
+        else if (opt.dist == "zipfian") { dist = Distribution::Zipfian; }
+        else if (opt.dist == "latest") { dist = Distribution::Latest; }
+
+        for (unsigned threads : opt.threads) { run<Tree>(opt, *w, dist, kind, threads); }
+    }
+}
+
+template <template<class,class> class KVArray, class K>
+void dispatch_latch(const Options& opt, KeyKind kind)
+{
+    if (opt.latch == "bravo") {
+        run_all<typename TreeOf<KVArray, BravoLatch>::template Tree<K>>(opt, kind);
+    }
+    else if (opt.latch == "mutex") {
+        run_all<typename TreeOf<KVArray, MutexLatch>::template Tree<K>>(opt, kind);
+    }
+    else {
+        std::cerr << "Unknown latch type: " << opt.latch << std::endl;
+        std::exit(1);
+    }
+}
+
+Options parse_options(int argc, char** argv)
+{
+    Options opt;
+    for (int i = 1; i < argc; i++) {
+        string arg = argv[i];
+        size_t eq = arg.find('=');
+        string name = arg.substr(0, eq), value = eq == string::npos ? "" : arg.substr(eq + 1);
+
+        if (name == "--workload") { opt.workloads = value; }
+        else if (name == "--dist") { opt.dist = value; }
+        else if (name == "--keys") { opt.keys = value; }
+        else if (name == "--latch") { opt.latch = value; }
+        else if (name == "--records") { opt.records = std::strtoull(value.c_str(), nullptr, 10); }
+        else if (name == "--ops") { opt.ops = std::strtoull(value.c_str(), nullptr, 10); }
+        else if (name == "--warmup") { opt.warmup = std::strtoull(value.c_str(), nullptr, 10); }
+        else if (name == "--scan") { opt.max_scan = std::atoi(value.c_str()); }
+        else if (name == "--theta") { opt.theta = std::atof(value.c_str()); }
+        else if (name == "--pin") { opt.pin = value != "0"; }
+        else if (name == "--threads") {
+            opt.threads.clear();
+            std::stringstream ss(value);
+            string item;
+            while (std::getline(ss, item, ',')) { opt.threads.push_back(std::atoi(item.c_str())); }
+        }
+        else {
+            std::cerr << "Unknown option: " << arg << std::endl;
+            std::exit(1);
+        }
+    }
+    if (opt.records == 0 || opt.max_scan == 0 || opt.threads.empty()) {
+        std::cerr << "Invalid options" << std::endl;
+        std::exit(1);
+    }
+    return opt;
+}
+
+} // namespace bench
+} // namespace foster
+
+int main(int argc, char** argv)
+{
+    using namespace foster::bench;
+    Options opt = parse_options(argc, argv);
+
+    if (opt.latch.empty()) { opt.latch = opt.keys == "int" ? "optimistic" : "bravo"; }
+
+    if (opt.keys == "int") {
+        if (opt.latch == "optimistic") {
+            run_all<TreeOf<KVArrayInt, foster::OptimisticLatch>::Tree<uint64_t>>(opt, KeyKind::Int);
+        }
+        else { dispatch_latch<KVArrayInt, uint64_t>(opt, KeyKind::Int); }
+    }
+    else if (opt.keys == "string" || opt.keys == "longstring") {
+        // Optimistic latching is not safe with variable-length keys (\see traverse_optimistic)
+        KeyKind kind = opt.keys == "string" ? KeyKind::String : KeyKind::LongString;
+        dispatch_latch<KVArrayString, string>(opt, kind);
+    }
+    else {
+        std::cerr << "Unknown key type: " << opt.keys << std::endl;
+        return 1;
+    }
+
+    return 0;
+}
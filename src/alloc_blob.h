@@ -0,0 +1,148 @@
+/*
+ * MIT License
+ *
+ * Copyright (c) 2016 Caetano Sauer
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy of this software and
+ * associated documentation files (the "Software"), to deal in the Software without restriction,
+ * including without limitation the rights to use, copy, modify, merge, publish, distribute,
+ * sublicense, and/or sell copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all copies or
+ * substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR IMPLIED, INCLUDING BUT
+ * NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM,
+ * DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+#ifndef FOSTER_BTREE_ALLOC_BLOB_H
+#define FOSTER_BTREE_ALLOC_BLOB_H
+
+/**
+ * \file alloc_blob.h
+ *
+ * Allocator for large values (blobs) stored outside of B-tree nodes.
+ */
+
+#include <array>
+#include <atomic>
+#include <cstddef>
+#include <new>
+
+#include "alloc_pool.h"
+
+namespace foster {
+
+namespace internal {
+
+/**
+ * \brief Chain of pools with power-of-two block sizes, from BlockBytes up to MaxBytes.
+ *
+ * Each request is served by the smallest class that fits it. Requests larger than MaxBytes are
+ * forwarded to the global operator new by the last element of the chain (specialization below).
+ */
+template <size_t BlockBytes, size_t MaxBytes, size_t ChunkBytes,
+         bool Pooled = (BlockBytes <= MaxBytes)>
+class BlobSizeClasses
+{
+public:
+
+    char* allocate(size_t length)
+    {
+        if (length <= BlockBytes) { return pool_.allocate(1)->data(); }
+        return larger_.allocate(length);
+    }
+
+    void deallocate(char* p, size_t length)
+    {
+        if (length <= BlockBytes) { pool_.deallocate(reinterpret_cast<Block*>(p), 1); }
+        else { larger_.deallocate(p, length); }
+    }
+
+    size_t chunk_count() const { return pool_.chunk_count() + larger_.chunk_count(); }
+
+private:
+    using Block = std::array<char, BlockBytes>;
+
+    PoolAllocator<Block, ChunkBytes> pool_;
+    BlobSizeClasses<2 * BlockBytes, MaxBytes, ChunkBytes> larger_;
+};
+
+template <size_t BlockBytes, size_t MaxBytes, size_t ChunkBytes>
+class BlobSizeClasses<BlockBytes, MaxBytes, ChunkBytes, false>
+{
+public:
+    char* allocate(size_t length) { return static_cast<char*>(::operator new(length)); }
+    void deallocate(char* p, size_t) { ::operator delete(p); }
+    size_t chunk_count() const { return 0; }
+};
+
+} // namespace internal
+
+/**
+ * \brief Allocator for blobs, i.e., byte strings of arbitrary length kept outside of nodes.
+ *
+ * Blobs are served from PoolAllocator instances with power-of-two block sizes between MinBytes and
+ * MaxPooledBytes, so that medium-sized values of similar lengths share chunks and freed blocks are
+ * reused without invoking malloc. Larger blobs are allocated with the global operator new.
+ *
+ * The allocator is stateless from the point of view of its users -- all methods are static and
+ * refer to a single set of pools per template instantiation -- because it is invoked from encoders,
+ * which are static as well (\see OverflowEncoder). The caller must provide the length of a blob
+ * when freeing it, which is kept in the reference stored in the node anyway.
+ *
+ * \tparam MinBytes Block size of the smallest class (a power of two)
+ * \tparam MaxPooledBytes Block size of the largest class served from a pool
+ * \tparam ChunkBytes Size of the chunks requested from the system by each pool
+ */
+template <size_t MinBytes = 64, size_t MaxPooledBytes = 4096, size_t ChunkBytes = 2 * 1024 * 1024>
+class BlobAllocator
+{
+public:
+
+    static_assert((MinBytes & (MinBytes - 1)) == 0, "BlobAllocator: MinBytes must be a power of two");
+    static_assert(MinBytes >= 64, "BlobAllocator: blocks must be at least as large as a cache line");
+
+    static char* allocate(size_t length)
+    {
+        char* p = classes().allocate(length);
+        live_count()++;
+        return p;
+    }
+
+    static void deallocate(char* p, size_t length)
+    {
+        classes().deallocate(p, length);
+        live_count()--;
+    }
+
+    /// \brief Number of blobs currently allocated (for statistics and testing)
+    static size_t blob_count() { return live_count().load(); }
+
+    /// \brief Number of chunks allocated by all pools (for statistics and testing)
+    static size_t chunk_count() { return classes().chunk_count(); }
+
+private:
+
+    using Classes = internal::BlobSizeClasses<MinBytes, MaxPooledBytes, ChunkBytes>;
+
+    static Classes& classes()
+    {
+        static Classes instance;
+        return instance;
+    }
+
+    static std::atomic<size_t>& live_count()
+    {
+        static std::atomic<size_t> count {0};
+        return count;
+    }
+};
+
+} // namespace foster
+
+#endif
@@ -0,0 +1,217 @@
+/*
+ * MIT License
+ *
+ * Copyright (c) 2016 Caetano Sauer
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy of this software and
+ * associated documentation files (the "Software"), to deal in the Software without restriction,
+ * including without limitation the rights to use, copy, modify, merge, publish, distribute,
+ * sublicense, and/or sell copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all copies or
+ * substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR IMPLIED, INCLUDING BUT
+ * NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM,
+ * DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+
+#ifndef FOSTER_BTREE_ALLOC_HUGEPAGE_H
+#define FOSTER_BTREE_ALLOC_HUGEPAGE_H
+
+/**
+ * \file alloc_hugepage.h
+ *
+ * Chunk source for PoolAllocator that backs nodes with huge pages placed on NUMA nodes.
+ */
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <new>
+
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+#include "alloc_pool.h"
+
+namespace foster {
+
+/// Placement of the chunks of a HugePageChunks source on NUMA nodes
+enum class NumaPlacement {
+    /// Policy of the calling thread, usually the node on which pages are first touched
+    Default,
+    /// Pages are spread round-robin over all nodes, e.g., for branch nodes used by all threads
+    Interleave,
+    /// Pages are placed on the node of the thread that allocates them, e.g., for leaves
+    Local
+};
+
+namespace internal {
+
+// Memory policy constants of the kernel (see mbind(2)), defined here to avoid depending on libnuma
+constexpr int MpolPreferred = 1;
+constexpr int MpolInterleave = 3;
+constexpr unsigned long MpolMemsAllowed = 1 << 2;
+
+/// Maximum number of NUMA nodes considered, i.e., bits of the node masks
+constexpr unsigned MaxNumaNodes = 64;
+
+/// NUMA node of the CPU on which the calling thread runs, or zero if unknown
+inline unsigned current_numa_node()
+{
+    unsigned cpu = 0, node = 0;
+    if (syscall(SYS_getcpu, &cpu, &node, nullptr) != 0) { return 0; }
+    return node < MaxNumaNodes ? node : 0;
+}
+
+/**
+ * \brief Binds a range of pages not touched yet to NUMA nodes.
+ *
+ * Placement is a hint, so failures (e.g., a kernel without NUMA support, or a container that
+ * forbids mbind) are ignored, and the pages are placed by the default policy.
+ */
+inline void bind_pages(void* addr, size_t bytes, NumaPlacement placement, unsigned node)
+{
+    unsigned long mask = 0;
+    int mode;
+    switch (placement) {
+        case NumaPlacement::Interleave:
+            // All nodes on which the process may allocate memory
+            if (syscall(SYS_get_mempolicy, nullptr, &mask, MaxNumaNodes, nullptr,
+                        MpolMemsAllowed) != 0) { return; }
+            mode = MpolInterleave;
+            break;
+        case NumaPlacement::Local:
+            mask = 1ul << node;
+            mode = MpolPreferred;
+            break;
+        default:
+            return;
+    }
+    syscall(SYS_mbind, addr, bytes, mode, &mask, MaxNumaNodes, 0);
+}
+
+/// Number of chunks mapped from the huge page pool and with transparent huge pages, respectively
+inline std::atomic<size_t>* huge_page_chunk_counts()
+{
+    static std::atomic<size_t> counts[2] {{0}, {0}};
+    return counts;
+}
+
+} // namespace internal
+
+/**
+ * \brief Chunk source for PoolAllocator that maps chunks backed by huge pages, which reduces TLB
+ * misses of traversals when there are millions of nodes.
+ *
+ * Chunks consist of whole huge pages, i.e., the chunk size of the pool must be a multiple of the
+ * huge page size (e.g., 1 GB pages require chunks of 1 GB), since blocks are only carved from the
+ * chunk size and the rest of a rounded-up page would be wasted. They are mapped from the huge page
+ * pool of the kernel (MAP_HUGETLB), which must have pages reserved (e.g., in
+ * /proc/sys/vm/nr_hugepages). If that fails, the chunk is mapped with regular pages aligned to the
+ * huge page size, and transparent huge pages are requested for it with madvise, which the kernel
+ * honors if they are enabled.
+ *
+ * Before their first touch, pages are bound to NUMA nodes with the given placement (\see
+ * NumaPlacement). With local placement, there is one partition per NUMA node, so that a thread
+ * refills its free list with blocks of its own node (\see PoolAllocator). Placement is a hint, and
+ * nothing happens on machines or kernels without NUMA support.
+ *
+ * Since the node type determines the allocator, upper levels and leaves may be placed differently,
+ * e.g., branch nodes interleaved over all nodes and leaves local to the inserting threads:
+ *
+ * \code
+ * template <class Node>
+ * using HugePageNodeMgr = BtreeNodeManager<Node, AtomicCounterIdGenerator<unsigned>,
+ *      PoolAllocator<Node, 2 * 1024 * 1024, 64, HugePageChunks<2 * 1024 * 1024,
+ *          Node::IsBranch ? NumaPlacement::Interleave : NumaPlacement::Local>>>;
+ * \endcode
+ *
+ * \tparam PageBytes Size of the huge pages, i.e., 2 MB or 1 GB on x86-64.
+ * \tparam Placement Placement of the chunks on NUMA nodes.
+ */
+template <size_t PageBytes = 2 * 1024 * 1024, NumaPlacement Placement = NumaPlacement::Default>
+struct HugePageChunks
+{
+    static_assert((PageBytes & (PageBytes - 1)) == 0, "Huge page size must be a power of two");
+
+    static constexpr unsigned Partitions =
+        Placement == NumaPlacement::Local ? internal::MaxNumaNodes : 1;
+    static constexpr bool PageAligned = true;
+    static constexpr size_t PageSize = PageBytes;
+
+    static unsigned partition()
+    {
+        return Placement == NumaPlacement::Local ? internal::current_numa_node() : 0;
+    }
+
+    /// \throws std::bad_alloc if no memory can be mapped
+    static void* allocate(size_t bytes, unsigned partition)
+    {
+        size_t length = round_up(bytes);
+        void* addr = ::mmap(nullptr, length, PROT_READ | PROT_WRITE,
+                MAP_PRIVATE | MAP_ANONYMOUS | MAP_HUGETLB | huge_page_flag(), -1, 0);
+        if (addr != MAP_FAILED) {
+            internal::huge_page_chunk_counts()[0]++;
+        }
+        else {
+            addr = map_aligned(length);
+            ::madvise(addr, length, MADV_HUGEPAGE);
+            internal::huge_page_chunk_counts()[1]++;
+        }
+
+        internal::bind_pages(addr, length, Placement, partition);
+        return addr;
+    }
+
+    static void release(void* chunk, size_t bytes)
+    {
+        ::munmap(chunk, round_up(bytes));
+    }
+
+    /// \brief Number of chunks mapped from the huge page pool of the kernel by all sources
+    static size_t hugetlb_chunks() { return internal::huge_page_chunk_counts()[0].load(); }
+
+    /// \brief Number of chunks mapped with (possibly) transparent huge pages by all sources
+    static size_t transparent_chunks() { return internal::huge_page_chunk_counts()[1].load(); }
+
+private:
+
+    static size_t round_up(size_t bytes)
+    {
+        return (bytes + PageBytes - 1) / PageBytes * PageBytes;
+    }
+
+    /// Size of the huge pages encoded into mmap flags (see mmap(2)), zero for the default size
+    static int huge_page_flag()
+    {
+        int log = 0;
+        while ((size_t(1) << log) < PageBytes) { log++; }
+        return log << 26 /* MAP_HUGE_SHIFT */;
+    }
+
+    /// Maps regular pages aligned to the huge page size, so that they can be promoted to huge pages
+    static void* map_aligned(size_t length)
+    {
+        void* raw = ::mmap(nullptr, length + PageBytes, PROT_READ | PROT_WRITE,
+                MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+        if (raw == MAP_FAILED) { throw std::bad_alloc{}; }
+
+        uintptr_t addr = reinterpret_cast<uintptr_t>(raw);
+        uintptr_t aligned = (addr + PageBytes - 1) / PageBytes * PageBytes;
+        if (aligned > addr) { ::munmap(raw, aligned - addr); }
+        size_t tail = addr + length + PageBytes - (aligned + length);
+        if (tail > 0) { ::munmap(reinterpret_cast<void*>(aligned + length), tail); }
+        return reinterpret_cast<void*>(aligned);
+    }
+};
+
+} // namespace foster
+
+#endif
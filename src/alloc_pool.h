@@ -0,0 +1,288 @@
+/*
+ * MIT License
+ *
+ * Copyright (c) 2016 Caetano Sauer
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy of this software and
+ * associated documentation files (the "Software"), to deal in the Software without restriction,
+ * including without limitation the rights to use, copy, modify, merge, publish, distribute,
+ * sublicense, and/or sell copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all copies or
+ * substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR IMPLIED, INCLUDING BUT
+ * NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM,
+ * DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+#ifndef FOSTER_BTREE_ALLOC_POOL_H
+#define FOSTER_BTREE_ALLOC_POOL_H
+
+/**
+ * \file alloc_pool.h
+ *
+ * Pool allocator for fixed-size objects such as B-tree nodes.
+ */
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <new>
+#include <vector>
+
+#include "assertions.h"
+
+namespace foster {
+
+/**
+ * \brief Source of the chunks of a PoolAllocator, which requests them from the global heap.
+ *
+ * Chunk sources decide where the memory of a pool comes from (\see HugePageChunks). Chunks are
+ * split into partitions, each with its own shared free list in the pool, and a thread refills its
+ * private free list from the partition given by partition(). The heap has a single partition.
+ */
+struct HeapChunks
+{
+    /// Number of partitions, i.e., of shared free lists per pool
+    static constexpr unsigned Partitions = 1;
+    /// Whether chunks are aligned to pages, in which case the pool does not align them
+    static constexpr bool PageAligned = false;
+    /// Size of the pages of which chunks consist, which the chunk size must be a multiple of
+    static constexpr size_t PageSize = 1;
+
+    /// Partition from which the calling thread allocates
+    static unsigned partition() { return 0; }
+
+    /// Allocates a chunk of the given size for the given partition
+    static void* allocate(size_t bytes, unsigned /* partition */) { return ::operator new(bytes); }
+
+    static void release(void* chunk, size_t /* bytes */) { ::operator delete(chunk); }
+};
+
+/**
+ * \brief Allocator for fixed-size objects (i.e., nodes) that carves them out of large chunks.
+ *
+ * Memory is requested from the system in chunks of ChunkBytes, which are split into blocks of
+ * sizeof(T) rounded up to the given alignment (e.g., a cache line, or a page to avoid sharing pages
+ * among nodes). Freed blocks are kept in free lists and reused by later allocations, so that splits
+ * do not invoke malloc, and chunks are only returned to the system when the pool is destroyed.
+ *
+ * To avoid contention on the pool, each thread keeps a private free list per pool, from which
+ * blocks are allocated and into which they are freed without synchronization. Only when a private
+ * list is empty (or too long) a batch of blocks is transferred from (or into) the shared free list
+ * of the pool, which is protected by a mutex.
+ *
+ * Like std::allocator, this class is used through allocate() and deallocate(). Copies of an
+ * allocator share the same pool, which is destroyed together with the last copy. It plugs into the
+ * Allocator template parameter of BtreeNodeManager and SortedList. Only single-object allocations
+ * (n = 1) are served from the pool -- others are forwarded to the global operator new.
+ *
+ * Chunks are requested from the given chunk source, e.g., the heap or huge pages placed on NUMA
+ * nodes (\see HugePageChunks). If the source has several partitions, e.g., one per NUMA node, the
+ * pool keeps one shared free list per partition, and private lists are refilled from the partition
+ * of the calling thread. Blocks freed by a thread of another partition are handed back to that
+ * thread's partition, so placement is only approximate once blocks are reused.
+ *
+ * \tparam T Type of objects allocated.
+ * \tparam ChunkBytes Size of the chunks requested from the system.
+ * \tparam Align Alignment of each object, which must be a power of two.
+ * \tparam ChunkSource Policy that allocates and releases chunks (\see HeapChunks).
+ */
+template <class T, size_t ChunkBytes = 2 * 1024 * 1024, size_t Align = 64,
+         class ChunkSource = HeapChunks>
+class PoolAllocator
+{
+public:
+
+    using value_type = T;
+
+    /// Size of each block, i.e., sizeof(T) rounded up to the alignment
+    static constexpr size_t BlockSize = (sizeof(T) + Align - 1) / Align * Align;
+    /// Number of blocks transferred at once between a private and the shared free list
+    static constexpr size_t TransferCount = 32;
+
+    static_assert((Align & (Align - 1)) == 0, "PoolAllocator: alignment must be a power of two");
+    static_assert(Align >= alignof(T), "PoolAllocator: alignment must be at least that of T");
+    static_assert(BlockSize >= sizeof(void*), "PoolAllocator: objects too small for free list");
+    static_assert(ChunkBytes >= BlockSize, "PoolAllocator: chunk must fit at least one object");
+    static_assert(ChunkBytes % ChunkSource::PageSize == 0,
+            "PoolAllocator: chunk size must be a multiple of the page size of the chunk source");
+
+    PoolAllocator() : pool_(std::make_shared<Pool>()) {}
+
+    T* allocate(size_t n)
+    {
+        if (n != 1) { return static_cast<T*>(::operator new(n * sizeof(T))); }
+
+        ThreadCache& cache = thread_cache();
+        if (!cache.head) { pool_->refill(cache); }
+
+        FreeBlock* block = cache.head;
+        cache.head = block->next;
+        cache.count--;
+        return reinterpret_cast<T*>(block);
+    }
+
+    void deallocate(T* p, size_t n)
+    {
+        if (n != 1) { ::operator delete(p); return; }
+
+        ThreadCache& cache = thread_cache();
+        FreeBlock* block = reinterpret_cast<FreeBlock*>(p);
+        block->next = cache.head;
+        cache.head = block;
+        cache.count++;
+
+        if (cache.count >= 2 * TransferCount) { pool_->drain(cache, TransferCount); }
+    }
+
+    /// \brief Number of chunks currently allocated from the system (for statistics and testing)
+    size_t chunk_count() const { return pool_->chunk_count(); }
+
+private:
+
+    struct FreeBlock { FreeBlock* next; };
+
+    struct ThreadCache;
+
+    /// Shared state of a pool: chunks and shared free list
+    class Pool
+    {
+    public:
+        Pool() : id_(next_id())
+        {
+            for (auto& f : free_) { f = nullptr; }
+        }
+
+        ~Pool()
+        {
+            for (void* c : chunks_) { ChunkSource::release(c, AllocatedBytes); }
+        }
+
+        uint64_t id() const { return id_; }
+
+        size_t chunk_count() const
+        {
+            std::lock_guard<std::mutex> lock(mutex_);
+            return chunks_.size();
+        }
+
+        /// Transfers a batch of blocks into the private list, allocating a new chunk if needed
+        void refill(ThreadCache& cache)
+        {
+            unsigned p = ChunkSource::partition();
+            std::lock_guard<std::mutex> lock(mutex_);
+            FreeBlock*& free = free_[p];
+            if (!free) { allocate_chunk(p); }
+
+            for (size_t i = 0; i < TransferCount && free; i++) {
+                FreeBlock* block = free;
+                free = block->next;
+                block->next = cache.head;
+                cache.head = block;
+                cache.count++;
+            }
+        }
+
+        /// Transfers count blocks (or all, if fewer) from the private list into the shared one
+        void drain(ThreadCache& cache, size_t count)
+        {
+            unsigned p = ChunkSource::partition();
+            std::lock_guard<std::mutex> lock(mutex_);
+            while (cache.head && count-- > 0) {
+                FreeBlock* block = cache.head;
+                cache.head = block->next;
+                cache.count--;
+                block->next = free_[p];
+                free_[p] = block;
+            }
+        }
+
+    private:
+        /// Chunks are over-allocated by the alignment, unless the source aligns them
+        static constexpr size_t AllocatedBytes =
+            ChunkSource::PageAligned ? ChunkBytes : ChunkBytes + Align;
+
+        const uint64_t id_;
+        mutable std::mutex mutex_;
+        std::vector<void*> chunks_;
+        FreeBlock* free_[ChunkSource::Partitions];
+
+        static uint64_t next_id()
+        {
+            // Zero is reserved to mark a thread cache slot as unused
+            static std::atomic<uint64_t> counter{0};
+            return ++counter;
+        }
+
+        void allocate_chunk(unsigned partition)
+        {
+            char* raw = static_cast<char*>(ChunkSource::allocate(AllocatedBytes, partition));
+            chunks_.push_back(raw);
+
+            uintptr_t addr = reinterpret_cast<uintptr_t>(raw);
+            char* begin = raw + ((Align - addr % Align) % Align);
+            char* end = raw + AllocatedBytes;
+
+            // Blocks are pushed in reverse so that they are handed out in address order
+            size_t count = (end - begin) / BlockSize;
+            for (size_t i = count; i > 0; i--) {
+                FreeBlock* block = reinterpret_cast<FreeBlock*>(begin + (i - 1) * BlockSize);
+                block->next = free_[partition];
+                free_[partition] = block;
+            }
+        }
+    };
+
+    /**
+     * Private free list of a thread for a given pool. Each thread has a small direct-mapped table
+     * of these, indexed by pool ID. If a slot is taken over by another pool, or if the thread
+     * exits, the blocks are handed back to the previous pool if it still exists. Otherwise, they
+     * belong to chunks that were already released, so they are simply forgotten.
+     */
+    struct ThreadCache
+    {
+        uint64_t owner_id = 0;
+        std::weak_ptr<Pool> owner;
+        FreeBlock* head = nullptr;
+        size_t count = 0;
+
+        void release()
+        {
+            std::shared_ptr<Pool> pool = owner.lock();
+            if (pool) { pool->drain(*this, count); }
+            head = nullptr;
+            count = 0;
+        }
+
+        ~ThreadCache() { release(); }
+    };
+
+    static constexpr size_t ThreadCacheSlots = 16;
+
+    ThreadCache& thread_cache()
+    {
+        static thread_local ThreadCache caches[ThreadCacheSlots];
+
+        uint64_t id = pool_->id();
+        ThreadCache& cache = caches[id % ThreadCacheSlots];
+        if (cache.owner_id != id) {
+            cache.release();
+            cache.owner_id = id;
+            cache.owner = pool_;
+        }
+        return cache;
+    }
+
+    std::shared_ptr<Pool> pool_;
+};
+
+} // namespace foster
+
+#endif
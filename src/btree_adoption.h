@@ -28,10 +28,69 @@
  * Btree logic built on top of a node data structure with support for foster relationships.
  */
 
+#include <algorithm>
+#include <condition_variable>
+#include <mutex>
+#include <vector>
+
 #include "assertions.h"
+#include "statistics.h"
 
 namespace foster {
 
+namespace internal {
+
+/// Whether the calling thread is the adoption worker of a tree (\see BackgroundAdoption)
+inline bool& is_adoption_worker()
+{
+    static thread_local bool worker = false;
+    return worker;
+}
+
+/// Set when an adoption attempted by the adoption worker fails to upgrade a latch
+inline bool& adoption_failed()
+{
+    static thread_local bool failed = false;
+    return failed;
+}
+
+/**
+ * \brief Counts the foster children following the given node, up to the given limit.
+ *
+ * The foster nodes are latched in shared mode, from left to right as in a traversal, since their
+ * foster pointers may be changed by splits.
+ */
+template <class NodePointer>
+unsigned foster_chain_length(NodePointer node, unsigned limit)
+{
+    NodePointer foster = node->get_foster_child();
+    if (!foster) { return 0; }
+
+    unsigned length = 1;
+    foster->acquire_read();
+    while (length < limit) {
+        NodePointer next = foster->get_foster_child();
+        if (!next) { break; }
+        next->acquire_read();
+        foster->release_read();
+        foster = next;
+        length++;
+    }
+    foster->release_read();
+    return length;
+}
+
+} // namespace internal
+
+/**
+ * \brief Adoption policy that adopts whenever a traversal finds a foster child.
+ *
+ * Adoptions are attempted by any traversal, including read-only lookups, which must then upgrade
+ * their latches on the parent and the child (\see try_adopt). Policies are instantiated once per
+ * branch level, and the instance decides whether a traversal attempts an adoption at all
+ * (\see should_adopt), while the adoption itself and merges are performed by the static methods
+ * below, which all policies share by deriving from this class.
+ */
 template <
     class ParentNodePointer,
     class ChildNodePointer
@@ -40,8 +99,28 @@ struct EagerAdoption
 {
     static constexpr bool Latching = ParentNodePointer::PointeeType::LatchingEnabled;
 
-    template <class NodeMgr>
-    static bool try_adopt(ParentNodePointer& parent, ChildNodePointer child, NodeMgr& node_mgr)
+    /// Whether adoptions are deferred to a worker thread of the tree (\see BackgroundAdoption)
+    static constexpr bool Background = false;
+
+    /**
+     * \brief Decides whether a traversal attempts to adopt the foster child of the given child,
+     * which is latched by the caller, as is its parent with optimistic latching.
+     */
+    bool should_adopt(ChildNodePointer, bool /* for_update */) { return true; }
+
+    /// Requests are never queued by this policy (\see BackgroundAdoption::set_queue)
+    template <class Queue>
+    void set_queue(Queue*) {}
+
+    /**
+     * \brief Adopts the foster child of the given child into the parent, if latches can be upgraded.
+     *
+     * Adoptions, splits of the parent, and failed latch upgrades are counted in the given
+     * statistics object (\see NoStatistics).
+     */
+    template <class NodeMgr, class Stats>
+    static bool try_adopt(ParentNodePointer& parent, ChildNodePointer child, NodeMgr& node_mgr,
+            Stats& stats)
     {
         if (!child) { return false; }
 
@@ -52,28 +131,116 @@ struct EagerAdoption
         bool child_latch_upgraded = false;
 
         // Parent is always latched in shared mode
-        if (!parent->attempt_upgrade()) { return false; }
+        if (!parent->attempt_upgrade()) {
+            stats.add(Counter::ParentUpgradeFailures);
+            return false;
+        }
         if (child->has_reader()) {
             if (!child->attempt_upgrade()) {
                 parent->downgrade();
+                stats.add(Counter::ChildUpgradeFailures);
                 return false;
             }
             child_latch_upgraded = true;
         }
 
         // Latching was successful or it's disabled -- proceed with adoption
-        bool success = do_adopt(parent, child, foster, node_mgr);
+        bool success = do_adopt(parent, child, foster, node_mgr, stats);
 
         // Release/downgrade acquired latches
         parent->downgrade();
         if (child_latch_upgraded) { child->downgrade(); }
 
+        if (success) { stats.add(Counter::Adoptions); }
         return success;
     }
 
     template <class NodeMgr>
+    static bool try_adopt(ParentNodePointer& parent, ChildNodePointer child, NodeMgr& node_mgr)
+    {
+        NoStatistics stats;
+        return try_adopt(parent, child, node_mgr, stats);
+    }
+
+    /// A node is considered underflown if less than this percentage of its space is used
+    static constexpr size_t MergeFillPercent = 25;
+
+    /// \brief Checks if the given node is a candidate for a merge with a sibling
+    template <class NodePointer>
+    static bool is_underflown(NodePointer node)
+    {
+        using Node = typename NodePointer::PointeeType;
+        // Space occupied by ghosts counts as free, since it is reclaimed on demand
+        size_t used = Node::Capacity - node->free_space() - node->ghost_space();
+        return used * 100 < Node::Capacity * MergeFillPercent;
+    }
+
+    /**
+     * \brief Attempts to merge two adjacent children of the given parent.
+     *
+     * The right node is first de-adopted, i.e., the left node takes it as a foster child and its
+     * separator is removed from the parent. Then, the left node absorbs all records of its new
+     * foster child, which becomes unreachable and must be retired by the caller. If the records do
+     * not fit, the right node simply stays as a foster child, to be adopted again by a later
+     * traversal.
+     *
+     * As in try_adopt, the parent must be latched in shared mode by the caller, and the latch must
+     * be upgraded to exclusive for the merge to proceed. Both children are then latched in exclusive
+     * mode, in key order. This cannot deadlock, since no thread is able to reach the children via
+     * the parent while it is latched exclusively, and children are never latched right-to-left.
+     *
+     * \param[in] parent Parent node, latched in shared mode
+     * \param[in] left,right Adjacent children of the parent, not latched by the caller
+     * \param[in] separator Key associated with the right node in the parent
+     * \returns the right node, if it was absorbed; null otherwise.
+     */
+    template <class KeyType>
+    static ChildNodePointer try_merge(ParentNodePointer parent, ChildNodePointer left,
+            ChildNodePointer right, const KeyType& separator)
+    {
+        if (!parent->attempt_upgrade()) { return ChildNodePointer{nullptr}; }
+        left->acquire_write();
+        right->acquire_write();
+
+        ChildNodePointer merged {nullptr};
+        if (can_merge(left, right, separator) && left->adopt_sibling_as_foster(right)) {
+            bool removed = parent->template remove<false>(separator);
+            assert<1>(removed, "Separator of merged node not found in parent");
+            // Branch slots are read by position during traversals, so no ghost may remain there
+            parent->compact();
+            if (left->absorb_foster_child()) { merged = right; }
+        }
+
+        right->release_write();
+        left->release_write();
+        parent->downgrade();
+
+        return merged;
+    }
+
+    template <class KeyType>
+    static bool can_merge(ChildNodePointer left, ChildNodePointer right, const KeyType& separator)
+    {
+        using Node = typename ChildNodePointer::PointeeType;
+
+        // Nodes with pending adoptions are not merged
+        if (left->get_foster_child() || right->get_foster_child()) { return false; }
+
+        // Left node must be the immediate neighbor of the right one
+        KeyType left_high, right_low;
+        left->get_fence_keys(nullptr, &left_high);
+        right->get_fence_keys(&right_low, nullptr);
+        if (left->is_high_key_infinity() || right->is_low_key_infinity()) { return false; }
+        if (!(left_high == separator) || !(right_low == separator)) { return false; }
+
+        // Used space of the right node also includes its metadata, so this leaves some slack
+        size_t right_used = Node::Capacity - right->free_space() - right->ghost_space();
+        return left->free_space() + left->ghost_space() >= right_used;
+    }
+
+    template <class NodeMgr, class Stats>
     static bool do_adopt(ParentNodePointer& parent, ChildNodePointer child, ChildNodePointer foster,
-            NodeMgr& node_mgr)
+            NodeMgr& node_mgr, Stats& stats)
     {
         using KeyType = typename NodeMgr::KeyType;
 
@@ -87,6 +254,7 @@ struct EagerAdoption
             auto new_node = node_mgr.construct_node();
             parent = parent->split_for_insertion(foster_key, new_node);
             inserted = parent->insert(foster_key, foster);
+            stats.add(Counter::BranchSplits);
         }
 
         // Clear foster relationship on child
@@ -96,6 +264,156 @@ struct EagerAdoption
     }
 };
 
+/**
+ * \brief Adoption policy that spares read-only lookups from upgrading latches.
+ *
+ * Adoptions are attempted only by update traversals, which latch the leaf exclusively anyway, or
+ * by lookups that find a foster chain of at least MaxChainLength nodes, since following such a
+ * chain on every lookup would cost more than an adoption. In read-mostly workloads, foster
+ * children thus remain in place until the next update in their key range.
+ */
+template <class ParentNodePointer, class ChildNodePointer, unsigned MaxChainLength>
+struct BasicLazyAdoption : public EagerAdoption<ParentNodePointer, ChildNodePointer>
+{
+    static_assert(MaxChainLength > 0, "Invalid foster chain length threshold");
+
+    bool should_adopt(ChildNodePointer child, bool for_update)
+    {
+        if (for_update) { return true; }
+        return internal::foster_chain_length(child, MaxChainLength) >= MaxChainLength;
+    }
+};
+
+/// Lazy adoption in which lookups adopt foster chains of four or more nodes
+template <class ParentNodePointer, class ChildNodePointer>
+using LazyAdoption = BasicLazyAdoption<ParentNodePointer, ChildNodePointer, 4>;
+
+/**
+ * \brief Queue of adoption requests, consumed in batches by a single worker thread.
+ *
+ * A request is the foster key of a child with a pending adoption, i.e., a key whose traversal
+ * leads to that child. Producers never block: a request is dropped if the queue is latched by
+ * another thread or full, since a later traversal will find the foster child again.
+ */
+template <class K>
+class AdoptionQueue
+{
+public:
+
+    /// Requests beyond this number are dropped until the worker takes the next batch
+    static constexpr size_t MaxPending = 4096;
+
+    AdoptionQueue() : stopped_(false) {}
+
+    void push(const K& key)
+    {
+        std::unique_lock<std::mutex> lock {mutex_, std::try_to_lock};
+        if (!lock.owns_lock() || keys_.size() >= MaxPending) { return; }
+        // Consecutive lookups tend to find the same foster child
+        if (!keys_.empty() && keys_.back() == key) { return; }
+
+        keys_.push_back(key);
+        if (keys_.size() == 1) { cond_.notify_one(); }
+    }
+
+    /**
+     * \brief Waits for requests and takes all of them, sorted and without duplicates.
+     *
+     * \returns false if the queue was stopped, in which case the batch is empty.
+     */
+    bool take(std::vector<K>& batch)
+    {
+        batch.clear();
+        {
+            std::unique_lock<std::mutex> lock {mutex_};
+            cond_.wait(lock, [this] { return stopped_ || !keys_.empty(); });
+            if (stopped_) { return false; }
+            batch.swap(keys_);
+        }
+
+        std::sort(batch.begin(), batch.end());
+        batch.erase(std::unique(batch.begin(), batch.end()), batch.end());
+        return true;
+    }
+
+    /// \brief Wakes up the worker, which then exits. Pending requests are discarded.
+    void stop()
+    {
+        std::lock_guard<std::mutex> lock {mutex_};
+        stopped_ = true;
+        cond_.notify_all();
+    }
+
+private:
+
+    std::mutex mutex_;
+    std::condition_variable cond_;
+    std::vector<K> keys_;
+    bool stopped_;
+};
+
+/**
+ * \brief Adoption policy that defers the adoptions found by lookups to a maintenance thread.
+ *
+ * Read-only traversals never adopt, and thus never upgrade latches. Instead, they queue the
+ * foster key of the child in which they found a foster child (\see AdoptionQueue), and a worker
+ * thread owned by the tree (\see StaticBtree) takes the requests in batches and performs
+ * traversals towards each key, in which it adopts eagerly. Sorting a batch lets the worker visit
+ * the affected nodes in key order, and duplicates from concurrent lookups collapse into one
+ * request.
+ *
+ * Update traversals still adopt right away, as with LazyAdoption: they create foster children at
+ * a rate that a single worker cannot keep up with, so the foster chains of insertion hot spots
+ * would otherwise keep growing.
+ *
+ * If no queue was set, e.g., in a tree without a worker thread, adoptions are eager.
+ *
+ * Note that a child read optimistically may yield an inconsistent foster key, which is harmless
+ * for fixed-length keys, since the worker only uses it to pick a traversal path.
+ */
+template <class ParentNodePointer, class ChildNodePointer>
+class BackgroundAdoption : public EagerAdoption<ParentNodePointer, ChildNodePointer>
+{
+public:
+
+    using KeyType = typename ChildNodePointer::PointeeType::KeyType;
+
+    static constexpr bool Background = true;
+
+    BackgroundAdoption() : queue_(nullptr) {}
+
+    bool should_adopt(ChildNodePointer child, bool for_update)
+    {
+        if (for_update || !queue_ || internal::is_adoption_worker()) { return true; }
+
+        KeyType key;
+        child->get_foster_key(&key);
+        queue_->push(key);
+        return false;
+    }
+
+    /**
+     * \brief Adopts as EagerAdoption::try_adopt, but lets the worker know about failures, which
+     * usually mean that another traversal holds the parent and waits for the child latched by
+     * the worker. The worker then backs off before it retries.
+     */
+    template <class NodeMgr, class Stats>
+    bool try_adopt(ParentNodePointer& parent, ChildNodePointer child, NodeMgr& node_mgr,
+            Stats& stats)
+    {
+        using Base = EagerAdoption<ParentNodePointer, ChildNodePointer>;
+        bool adopted = Base::try_adopt(parent, child, node_mgr, stats);
+        if (!adopted && internal::is_adoption_worker()) { internal::adoption_failed() = true; }
+        return adopted;
+    }
+
+    void set_queue(AdoptionQueue<KeyType>* queue) { queue_ = queue; }
+
+private:
+
+    AdoptionQueue<KeyType>* queue_;
+};
+
 } // namespace foster
 
 #endif
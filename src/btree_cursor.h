@@ -0,0 +1,229 @@
+/*
+ * MIT License
+ *
+ * Copyright (c) 2016 Caetano Sauer
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy of this software and
+ * associated documentation files (the "Software"), to deal in the Software without restriction,
+ * including without limitation the rights to use, copy, modify, merge, publish, distribute,
+ * sublicense, and/or sell copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all copies or
+ * substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR IMPLIED, INCLUDING BUT
+ * NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM,
+ * DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+#ifndef FOSTER_BTREE_BTREE_CURSOR_H
+#define FOSTER_BTREE_BTREE_CURSOR_H
+
+/**
+ * \file btree_cursor.h
+ *
+ * Cursor for ordered range scans over the leaf level of a B-tree.
+ */
+
+#include <algorithm>
+#include <array>
+
+namespace foster {
+
+/**
+ * \brief Cursor for ordered range scans over the leaf level.
+ *
+ * A cursor keeps a shared latch on the leaf it is currently positioned on. When all records of
+ * a leaf have been read, it moves to the next one without a new traversal if the leaf has a
+ * foster child, using latch coupling. Otherwise, the next leaf is the one whose low fence key
+ * is equal to the current high fence key, and a traversal with that key is performed after the
+ * current latch is released. This is the only way to reach the next leaf, since there are no
+ * sibling pointers in a Foster B-tree.
+ *
+ * The latch is released (and the epoch entered by the tree on creation of the cursor is left)
+ * as soon as the scan is exhausted or the cursor is destroyed.
+ *
+ * If leaves buffer insertions (\see BufferedKeyValueArray), each leaf is latched in exclusive mode
+ * first, so that its buffer can be merged into the slots read by the cursor, and the latch is then
+ * downgraded to shared mode (\see latch_leaf).
+ *
+ * If leaves decode keys in bulk (\see DeltaKeyValueArray), the cursor decodes the keys of up to
+ * KeyBatch slots at once and returns them from its own buffer.
+ *
+ * \tparam Tree B-tree class, which must declare the cursor a friend and provide the types K, V, and
+ *      LeafPointer, an EpochManager member epochs_, and a method traverse(key, for_update) that
+ *      returns a latched leaf.
+ */
+template <class Tree>
+class BtreeCursor
+{
+public:
+    using K = typename Tree::KeyType;
+    using V = typename Tree::ValueType;
+    using LeafPointer = typename Tree::LeafPointer;
+
+    /// The given leaf must be latched, and the cursor takes over the epoch entered on the tree.
+    BtreeCursor(Tree* tree, LeafPointer node, const K& lo, const K* hi)
+        : tree_(tree), node_(node), slot_(0), batch_begin_(0), batch_end_(0),
+        has_upper_(hi != nullptr)
+    {
+        if (has_upper_) { upper_ = *hi; }
+        if (node_) { slot_ = node_->lower_bound(lo); }
+    }
+
+    /**
+     * \brief Traverses the tree to the leaf that contains the given key, which is latched in shared
+     * mode and ready to be scanned. Trees use this to create cursors.
+     */
+    static LeafPointer traverse(Tree* tree, const K& key)
+    {
+        if (!BufferedLeaves::value) { return tree->traverse(key, false /* for_update */); }
+        LeafPointer node = tree->traverse(key, true /* for_update */);
+        internal::merge_insert_buffer(node, BufferedLeaves{});
+        node->downgrade();
+        return node;
+    }
+
+    BtreeCursor(BtreeCursor&& other)
+        : tree_(other.tree_), node_(other.node_), slot_(other.slot_),
+        batch_begin_(other.batch_begin_), batch_end_(other.batch_end_),
+        keys_(other.keys_), has_upper_(other.has_upper_), upper_(other.upper_)
+    {
+        other.node_ = LeafPointer{nullptr};
+        other.tree_ = nullptr;
+    }
+
+    BtreeCursor(const BtreeCursor&) = delete;
+    BtreeCursor& operator=(const BtreeCursor&) = delete;
+
+    ~BtreeCursor() { close(); }
+
+    /**
+     * \brief Reads the next key-value pair of the scan into the given pointers.
+     * \returns false if there are no more records in the scanned range.
+     */
+    bool next(K* key, V* value)
+    {
+        while (node_) {
+            // Skip removed records, which are not purged from leaves right away
+            while (slot_ < node_->slot_count() && node_->is_ghost(slot_)) { slot_++; }
+            if (slot_ < node_->slot_count()) {
+                K k;
+                read_slot(&k, value, DecodedLeaves{});
+                if (has_upper_ && !(k < upper_)) {
+                    close();
+                    return false;
+                }
+                if (key) { *key = k; }
+                slot_++;
+                return true;
+            }
+
+            next_leaf();
+        }
+
+        return false;
+    }
+
+    /// \brief Releases the latch on the current leaf, which terminates the scan.
+    void close()
+    {
+        if (node_) {
+            node_->release_read();
+            node_ = LeafPointer{nullptr};
+        }
+        if (tree_) {
+            tree_->epochs_.leave();
+            tree_ = nullptr;
+        }
+    }
+
+private:
+    using BufferedLeaves = internal::BuffersInserts<typename LeafPointer::PointeeType>;
+    using DecodedLeaves = internal::DecodesKeys<typename LeafPointer::PointeeType>;
+    using SlotNumber = typename LeafPointer::PointeeType::SlotNumber;
+
+    /// Number of keys decoded at once, if leaves decode keys in bulk
+    static constexpr size_t KeyBatch = DecodedLeaves::value ? 64 : 1;
+
+    Tree* tree_;
+    LeafPointer node_;
+    SlotNumber slot_;
+    /// Range of slots of the current leaf whose keys are in keys_
+    SlotNumber batch_begin_;
+    SlotNumber batch_end_;
+    std::array<K, KeyBatch> keys_;
+    bool has_upper_;
+    K upper_;
+
+    /// Reads the current slot, taking its key from a batch decoded in bulk
+    void read_slot(K* key, V* value, std::true_type)
+    {
+        if (slot_ < batch_begin_ || slot_ >= batch_end_) {
+            size_t count = std::min(node_->slot_count() - slot_, keys_.size());
+            node_->decode_keys(slot_, count, keys_.data());
+            batch_begin_ = slot_;
+            batch_end_ = slot_ + count;
+        }
+        *key = keys_[slot_ - batch_begin_];
+        node_->read_slot(slot_, nullptr, value);
+    }
+
+    void read_slot(K* key, V* value, std::false_type)
+    {
+        node_->read_slot(slot_, key, value);
+    }
+
+    void next_leaf()
+    {
+        // Move into foster child with latch coupling
+        LeafPointer foster = node_->get_foster_child();
+        if (foster) {
+            latch_leaf(foster);
+            node_->release_read();
+            node_ = foster;
+            slot_ = 0;
+            batch_begin_ = batch_end_ = 0;
+            return;
+        }
+
+        // No foster child and infinite high fence key -- end of the leaf level
+        if (node_->is_high_key_infinity()) {
+            close();
+            return;
+        }
+
+        // Next leaf starts at the high fence key of the current one
+        K high;
+        node_->get_fence_keys(nullptr, &high);
+        node_->release_read();
+        node_ = LeafPointer{nullptr};
+        if (has_upper_ && !(high < upper_)) {
+            close();
+            return;
+        }
+
+        node_ = traverse(tree_, high);
+        slot_ = node_->lower_bound(high);
+        batch_begin_ = batch_end_ = 0;
+    }
+
+    /// Latches a leaf in shared mode, after merging its insert buffer if it has one
+    static void latch_leaf(LeafPointer node)
+    {
+        if (!BufferedLeaves::value) {
+            node->acquire_read();
+            return;
+        }
+        node->acquire_write();
+        internal::merge_insert_buffer(node, BufferedLeaves{});
+        node->downgrade();
+    }
+};
+
+} // namespace foster
+
+#endif
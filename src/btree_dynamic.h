@@ -0,0 +1,442 @@
+/*
+ * MIT License
+ *
+ * Copyright (c) 2016 Caetano Sauer
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy of this software and
+ * associated documentation files (the "Software"), to deal in the Software without restriction,
+ * including without limitation the rights to use, copy, modify, merge, publish, distribute,
+ * sublicense, and/or sell copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all copies or
+ * substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR IMPLIED, INCLUDING BUT
+ * NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM,
+ * DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+#ifndef FOSTER_BTREE_BTREE_DYNAMIC_H
+#define FOSTER_BTREE_BTREE_DYNAMIC_H
+
+/**
+ * \file btree_dynamic.h
+ *
+ * Btree whose height grows at runtime, up to a maximum number of levels given at compile time.
+ */
+
+#include <atomic>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <iostream> // for print
+#include <type_traits>
+
+#include "assertions.h"
+#include "btree_cursor.h"
+#include "epoch.h"
+#include "exceptions.h"
+#include "kv_array.h"
+#include "statistics.h"
+
+namespace foster {
+
+/**
+ * \brief B-tree whose height grows when the root node splits.
+ *
+ * Unlike StaticBtree, where every traversal goes through Level branch nodes, this tree starts with
+ * a single leaf as root. Once the root has a foster child (i.e., it was split), a new root is
+ * installed one level above it, with the old root as its only child. The foster child of the old
+ * root is then adopted by the new root like any other foster child, i.e., by the next traversal
+ * that goes through it (\see EagerAdoption).
+ *
+ * Because node types are different on each level, the levels are still instantiated statically, up
+ * to MaxLevel (\see BtreeLevel). The root of each level, once installed, remains part of the tree,
+ * so the roots are kept in a type-erased array indexed by level, and the current height selects
+ * which one is used as the entry point. Operations translate the height into a statically typed
+ * level with tag dispatch. Once MaxLevel is reached, the root simply grows a foster chain, just like
+ * the root of a StaticBtree.
+ *
+ * A thread that read an old height starts from a root that is no longer the top of the tree. This
+ * is harmless as long as the key is within the fence keys of that node, which is verified before
+ * descending. Otherwise, the traversal is restarted with the current height.
+ *
+ * The tree is grown when a leaf split is performed by put, since splits of upper levels are always
+ * caused by adoptions of leaf splits. The root may thus have a foster chain for a while before the
+ * new root is installed.
+ */
+template <
+    class K,
+    class V,
+    unsigned MaxLevel,
+    template <class,class,unsigned> class BtreeLevel
+>
+class DynamicBtree
+{
+public:
+
+    static_assert(MaxLevel > 0, "A dynamic B-tree requires at least one branch level");
+
+    template <unsigned L>
+    using BtreeLevelType = BtreeLevel<K, V, L>;
+    template <unsigned L>
+    using NodePointerType = typename BtreeLevelType<L>::NodePointer;
+    using LeafPointer = NodePointerType<0>;
+    using KeyType = K;
+    using ValueType = V;
+    using Adoption = typename BtreeLevelType<MaxLevel>::Adoption;
+    /// Cursor for ordered range scans (\see BtreeCursor)
+    using Cursor = BtreeCursor<DynamicBtree>;
+    /// Statistics policy of the levels (\see StaticBtree::statistics)
+    using Statistics = typename BtreeLevelType<MaxLevel>::StatisticsType;
+
+    static constexpr bool OptimisticLatching =
+        BtreeLevelType<MaxLevel>::ThisNodeType::OptimisticLatching;
+
+    /**
+     * Levels are constructed with a nonzero depth, because the current root is always latched
+     * here, before invoking any level (\see BtreeLevel::BtreeLevel).
+     */
+    DynamicBtree() :
+        top_level_(new BtreeLevelType<MaxLevel>(1, &epochs_, &stats_)),
+        height_(0)
+    {
+        for (unsigned i = 0; i <= MaxLevel; i++) { roots_[i].store(nullptr); }
+        set_root<0>(level_at<0>()->construct_node());
+    }
+
+    /// \brief Destroys all nodes. No other thread may be accessing the tree.
+    ~DynamicBtree()
+    {
+        // Retired nodes must be destroyed while their node managers still exist
+        epochs_.drain();
+        destroy(height(), LevelTag<MaxLevel>{});
+    }
+
+    /// \brief Current height, i.e., level of the root node (zero if root is a leaf)
+    unsigned height() const { return height_.load(std::memory_order_acquire); }
+
+    /**
+     * \brief Inserts a key-value pair, trying the last leaf first (\see StaticBtree::put)
+     * \throws ExistentKeyException if the key already exists, after all latches are released
+     */
+    void put(const K& key, const V& value)
+    {
+        if (put_pair<PutMode::Insert>(key, value) == PutStatus::KeyExists) {
+            throw ExistentKeyException<K>(key);
+        }
+    }
+
+    /// \brief Inserts a key-value pair, unless the key exists (\see StaticBtree::try_insert)
+    PutStatus try_insert(const K& key, const V& value)
+    {
+        return put_pair<PutMode::Insert>(key, value);
+    }
+
+    /// \brief Overwrites the value of an existing key (\see StaticBtree::update)
+    PutStatus update(const K& key, const V& value)
+    {
+        return put_pair<PutMode::Update>(key, value);
+    }
+
+    /// \brief Inserts a key-value pair or overwrites its value (\see StaticBtree::upsert)
+    PutStatus upsert(const K& key, const V& value)
+    {
+        return put_pair<PutMode::Upsert>(key, value);
+    }
+
+    bool get(const K& key, V& value)
+    {
+        EpochGuard guard {epochs_};
+        LeafPointer node = traverse(key, false /* for_update */);
+        bool res = node->find(key, &value);
+        node->release_read();
+        return res;
+    }
+
+    bool remove(const K& key)
+    {
+        EpochGuard guard {epochs_};
+        LeafPointer node = traverse(key, true /* for_update */);
+        bool res = node->template remove<false>(key);
+        bool underflown = res && Adoption::is_underflown(node);
+        node->release_write();
+
+        if (underflown) {
+            while (!merge_underflown(height(), key, LevelTag<MaxLevel>{})) {}
+        }
+        return res;
+    }
+
+    /// \brief Yields a cursor positioned on the first key greater than or equal to the given one.
+    Cursor lower_bound(const K& key)
+    {
+        epochs_.enter();
+        LeafPointer node = Cursor::traverse(this, key);
+        return Cursor{this, node, key, nullptr};
+    }
+
+    /// \brief Yields a cursor that scans all keys in the half-open interval [lo, hi).
+    Cursor scan(const K& lo, const K& hi)
+    {
+        epochs_.enter();
+        LeafPointer node = Cursor::traverse(this, lo);
+        return Cursor{this, node, lo, &hi};
+    }
+
+    void print(std::ostream& out)
+    {
+        print(height(), out, LevelTag<MaxLevel>{});
+    }
+
+    /// \brief Aggregates the statistics collected by all threads so far.
+    StatisticsSnapshot statistics() const
+    {
+        return stats_.snapshot();
+    }
+
+    void reset_statistics()
+    {
+        stats_.reset();
+    }
+
+private:
+
+    friend class BtreeCursor<DynamicBtree>;
+
+    template <unsigned L>
+    using LevelTag = std::integral_constant<unsigned, L>;
+
+    /// \brief Common implementation of put, try_insert, update, and upsert
+    template <PutMode Mode>
+    PutStatus put_pair(const K& key, const V& value)
+    {
+        EpochGuard guard {epochs_};
+        LeafPointer node = level_at<0>()->latch_hinted_leaf(key);
+        if (!node) { node = traverse(key, true /* for_update */); }
+        PutStatus status = node->template put<Mode>(key, value);
+        bool split = status == PutStatus::NoSpace;
+
+        while (status == PutStatus::NoSpace) {
+            // Node is full -- split required
+            LeafPointer new_node = level_at<0>()->construct_node();
+            node = node->split_for_insertion(key, new_node);
+            status = node->template put<Mode>(key, value);
+            stats_.add(Counter::LeafSplits);
+        }
+
+        if (!split) { level_at<0>()->set_leaf_hint(node); }
+        node->release_write();
+
+        if (split) { grow(height(), LevelTag<MaxLevel>{}); }
+        return status;
+    }
+
+    /// Traverses from the current root, restarting if the height changed in the meantime
+    LeafPointer traverse(const K& key, bool for_update)
+    {
+        stats_.add(Counter::Traversals);
+        while (true) {
+            LeafPointer leaf = traverse(height(), key, for_update, LevelTag<MaxLevel>{});
+            if (leaf) { return leaf; }
+            stats_.add(Counter::TraversalRestarts);
+        }
+    }
+
+    template <unsigned L>
+    LeafPointer traverse(unsigned height, const K& key, bool for_update, LevelTag<L>)
+    {
+        if (height != L) { return traverse(height, key, for_update, LevelTag<L-1>{}); }
+        return traverse_branch(level_at<L>(), root_at<L>(), key, for_update,
+                std::integral_constant<bool, OptimisticLatching>{});
+    }
+
+    /// Root is a leaf, which is latched directly
+    LeafPointer traverse(unsigned, const K& key, bool for_update, LevelTag<0>)
+    {
+        LeafPointer node = root_at<0>();
+        latch_leaf(node, for_update);
+        if (!node->fence_contains(key)) {
+            unlatch_leaf(node, for_update);
+            return LeafPointer{nullptr};
+        }
+
+        while (!node->key_range_contains(key)) {
+            LeafPointer foster = node->get_foster_child();
+            assert<1>(foster, "Traversal reached null pointer");
+            latch_leaf(foster, for_update);
+            unlatch_leaf(node, for_update);
+            node = foster;
+        }
+        return node;
+    }
+
+    template <class Level, class NodePointer>
+    LeafPointer traverse_branch(Level* level, NodePointer root, const K& key, bool for_update,
+            std::true_type /* optimistic */)
+    {
+        uint64_t version = root->optimistic_read();
+        bool contains = root->fence_contains(key);
+        if (!root->validate_read(version) || !contains) { return LeafPointer{nullptr}; }
+        return level->traverse_optimistic(root, version, key, for_update);
+    }
+
+    template <class Level, class NodePointer>
+    LeafPointer traverse_branch(Level* level, NodePointer root, const K& key, bool for_update,
+            std::false_type /* optimistic */)
+    {
+        root->acquire_read();
+        if (!root->fence_contains(key)) {
+            root->release_read();
+            return LeafPointer{nullptr};
+        }
+        return level->traverse(root, key, for_update);
+    }
+
+    /// \returns false if the height changed in the meantime and the merge must be restarted.
+    template <unsigned L>
+    bool merge_underflown(unsigned height, const K& key, LevelTag<L>)
+    {
+        if (height != L) { return merge_underflown(height, key, LevelTag<L-1>{}); }
+
+        NodePointerType<L> root = root_at<L>();
+        root->acquire_read();
+        if (!root->fence_contains(key)) {
+            root->release_read();
+            return false;
+        }
+        level_at<L>()->merge_underflown(root, key);
+        return true;
+    }
+
+    /// A leaf root has no siblings to be merged with
+    bool merge_underflown(unsigned, const K&, LevelTag<0>)
+    {
+        return true;
+    }
+
+    /// Installs a new root if the current one was split
+    template <unsigned L>
+    void grow(unsigned height, LevelTag<L>)
+    {
+        if (height != L) { grow(height, LevelTag<L-1>{}); }
+        else { grow_root<L>(std::integral_constant<bool, (L < MaxLevel)>{}); }
+    }
+
+    void grow(unsigned, LevelTag<0>)
+    {
+        grow_root<0>(std::true_type{});
+    }
+
+    template <unsigned L>
+    void grow_root(std::true_type)
+    {
+        std::lock_guard<std::mutex> lock {grow_mutex_};
+        if (height() != L) { return; }
+
+        NodePointerType<L> root = root_at<L>();
+        root->acquire_read();
+        bool split = root->get_foster_child();
+        root->release_read();
+        if (!split) { return; }
+
+        NodePointerType<L+1> new_root = level_at<L+1>()->construct_node();
+        bool inserted = new_root->insert(internal::GetMinimumKeyValue<K>(), root);
+        assert<1>(inserted, "Could not install new root");
+
+        // New root must be visible before the height that leads to it
+        set_root<L+1>(new_root);
+        height_.store(L + 1, std::memory_order_release);
+    }
+
+    /// Maximum height reached -- root keeps growing its foster chain
+    template <unsigned L>
+    void grow_root(std::false_type)
+    {
+    }
+
+    template <unsigned L>
+    void destroy(unsigned height, LevelTag<L>)
+    {
+        if (height != L) { destroy(height, LevelTag<L-1>{}); }
+        else { level_at<L>()->destroy_recursively(root_at<L>()); }
+    }
+
+    void destroy(unsigned, LevelTag<0>)
+    {
+        level_at<0>()->destroy_recursively(root_at<0>());
+    }
+
+    template <unsigned L>
+    void print(unsigned height, std::ostream& out, LevelTag<L>)
+    {
+        if (height != L) { print(height, out, LevelTag<L-1>{}); }
+        else { level_at<L>()->print(root_at<L>(), out); }
+    }
+
+    void print(unsigned, std::ostream& out, LevelTag<0>)
+    {
+        level_at<0>()->print(root_at<0>(), out);
+    }
+
+    template <unsigned L>
+    BtreeLevelType<L>* level_at()
+    {
+        return find_level<L>(top_level_.get(), std::integral_constant<bool, L == MaxLevel>{});
+    }
+
+    template <unsigned L, unsigned M>
+    BtreeLevelType<L>* find_level(BtreeLevelType<M>* level, std::true_type)
+    {
+        return level;
+    }
+
+    template <unsigned L, unsigned M>
+    BtreeLevelType<L>* find_level(BtreeLevelType<M>* level, std::false_type)
+    {
+        return find_level<L, M-1>(level->lower_level(), std::integral_constant<bool, L == M-1>{});
+    }
+
+    template <unsigned L>
+    NodePointerType<L> root_at()
+    {
+        using Node = typename NodePointerType<L>::PointeeType;
+        return NodePointerType<L>{static_cast<Node*>(roots_[L].load(std::memory_order_acquire))};
+    }
+
+    template <unsigned L>
+    void set_root(NodePointerType<L> root)
+    {
+        roots_[L].store(&(*root), std::memory_order_release);
+    }
+
+    void latch_leaf(LeafPointer node, bool ex_mode)
+    {
+        if (ex_mode) { node->acquire_write(); }
+        else { node->acquire_read(); }
+    }
+
+    void unlatch_leaf(LeafPointer node, bool ex_mode)
+    {
+        if (ex_mode) { node->release_write(); }
+        else { node->release_read(); }
+    }
+
+    EpochManager epochs_;
+    Statistics stats_;
+    std::unique_ptr<BtreeLevelType<MaxLevel>> top_level_;
+
+    /// Root node of each level, of which the one at index height_ is the current root
+    std::atomic<void*> roots_[MaxLevel + 1];
+    std::atomic<unsigned> height_;
+
+    /// Serializes installation of new roots
+    std::mutex grow_mutex_;
+};
+
+} // namespace foster
+
+#endif
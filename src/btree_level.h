@@ -28,12 +28,25 @@
  * Types and utilities used to represent a single level in a B-tree data structure.
  */
 
+#include <algorithm>
+#include <atomic>
+#include <cstdint>
 #include <memory>
 #include <limits>
+#include <type_traits>
+#include <unordered_set>
+#include <utility>
+#include <vector>
 #include <iostream> // for print
 
 #include "metaprog.h"
 #include "assertions.h"
+#include "epoch.h"
+#include "hash_index.h"
+#include "buffer_pool.h"
+#include "snapshot.h"
+#include "statistics.h"
+#include "task_pool.h"
 
 namespace foster {
 
@@ -52,6 +65,136 @@ namespace internal {
 template <class K> K GetMinimumKeyValue() { return std::numeric_limits<K>::min(); }
 template <> string GetMinimumKeyValue() { return ""; }
 
+/**
+ * \brief Builds a sequence of packed nodes of the same level from sorted input (bulk loading).
+ *
+ * Records are appended into a node until it reaches the given fill factor; then a new node is
+ * constructed. Whenever a node is completed, its fence keys are set: the low fence is its first key
+ * and the high fence is the first key of the next node. If the fence keys do not fit into a node
+ * (which can only happen with variable-length keys), its last records are moved into the next node.
+ * On the leaf level, fence keys are shortened as in a leaf split (\see
+ * BtreeNode::rebalance_foster_child), and the shortened keys are the ones given to the next level.
+ *
+ * \param[in] begin,end Range of sorted key-value pairs (accessed with first and second)
+ * \param[in] fill_factor Fraction of the node space to be filled, between 0 and 1
+ * \param[in] node_mgr Node manager used to construct the new nodes
+ * \param[out] nodes First key and pointer to each constructed node, in key order. The key of the
+ *      first node is the minimum key value (or low_fence), so that the output can be used as input
+ *      for the next level up.
+ * \param[in] low_fence,high_fence Fence keys of the sequence, if it is a partition of the level
+ *      (\see BtreeLevel::parallel_bulk_load); null stands for infinity.
+ */
+template <class Iter, class NodeMgr, class K, class NodePointer>
+void bulk_load_nodes(Iter begin, Iter end, double fill_factor, NodeMgr& node_mgr,
+        std::vector<std::pair<K, NodePointer>>& nodes,
+        K* low_fence = nullptr, K* high_fence = nullptr)
+{
+    using Node = typename NodePointer::PointeeType;
+    using SlotNumber = typename Node::SlotNumber;
+
+    assert<1>(fill_factor > 0.0 && fill_factor <= 1.0, DBGINFO, "Invalid fill factor");
+
+    // Shortens the first key of the next node into a separator, if the nodes are leaves
+    auto shorten = [] (NodePointer node, K& next_key) {
+        if (Node::IsBranch) { return; }
+        K last_key;
+        node->read_slot(SlotNumber(node->size() - 1), &last_key, nullptr);
+        next_key = internal::shortest_separator(last_key, next_key);
+    };
+
+    // Sets fence keys of a completed node, given the next node and its first key. If the keys do
+    // not fit, records are moved into the next node, which is the one being currently filled.
+    auto set_fence_keys = [&nodes, &shorten, low_fence] (NodePointer node, NodePointer next,
+            K& next_key) {
+        K* low = nodes.size() > 1 ? &nodes.back().first : low_fence;
+        shorten(node, next_key);
+        while (!node->reset_fenster(low, &next_key, nullptr, NodePointer{nullptr})) {
+            assert<1>(node->size() > 1, "No space left for fence keys in bulk loading");
+            bool moved = internal::move_kv_records(*next, SlotNumber(0),
+                    *node, SlotNumber(node->size() - 1), 1);
+            assert<1>(moved, "No space left for fence keys in bulk loading");
+            next->read_slot(0, &next_key, nullptr);
+            shorten(node, next_key);
+        }
+    };
+
+    NodePointer node {nullptr};
+    size_t reserved = 0;
+    for (Iter it = begin; it != end; ++it) {
+        if (node && node->append(it->first, it->second, reserved)) { continue; }
+
+        // Current node reached the fill factor -- continue on a new node
+        NodePointer next = node_mgr.construct_node();
+        if (!node) { reserved = (1.0 - fill_factor) * next->free_space(); }
+        bool appended = next->append(it->first, it->second);
+        assert<1>(appended, "Record does not fit into an empty node");
+
+        K next_key = it->first;
+        if (node) { set_fence_keys(node, next, next_key); }
+        nodes.emplace_back(next_key, next);
+        node = next;
+    }
+
+    // Last node has infinity (or high_fence) as high fence key, but the keys might still not fit
+    if (node) {
+        K* low = nodes.size() > 1 ? &nodes.back().first : low_fence;
+        if (!node->reset_fenster(low, high_fence, nullptr, NodePointer{nullptr})) {
+            NodePointer next = node_mgr.construct_node();
+            K next_key;
+            node->read_slot(SlotNumber(node->size() - 1), &next_key, nullptr);
+            bool moved = internal::move_kv_records(*next, SlotNumber(0),
+                    *node, SlotNumber(node->size() - 1), 1);
+            assert<1>(moved);
+            set_fence_keys(node, next, next_key);
+            nodes.emplace_back(next_key, next);
+
+            bool success = next->reset_fenster(&nodes.back().first, high_fence, nullptr,
+                    NodePointer{nullptr});
+            assert<1>(success, "No space left for fence keys in bulk loading");
+        }
+    }
+
+    if (!nodes.empty()) { nodes[0].first = low_fence ? *low_fence : GetMinimumKeyValue<K>(); }
+}
+
+/**
+ * \brief Links nodes of the same level into a foster chain, i.e., makes them a single logical node.
+ *
+ * This is used on the root level after bulk loading, since the root must be a single node.
+ */
+template <class K, class NodePointer>
+void link_foster_chain(std::vector<std::pair<K, NodePointer>>& nodes)
+{
+    for (size_t i = 0; i < nodes.size(); i++) {
+        K* low = i > 0 ? &nodes[i].first : nullptr;
+        K* foster = i + 1 < nodes.size() ? &nodes[i+1].first : nullptr;
+        NodePointer foster_ptr = i + 1 < nodes.size() ? nodes[i+1].second : NodePointer{nullptr};
+
+        bool success = nodes[i].second->reset_fenster(low, nullptr, foster, foster_ptr);
+        assert<1>(success, "No space left to link foster chain in bulk loading");
+    }
+}
+
+/**
+ * \brief Hands a node to the epoch manager, which destroys it using the given node manager once
+ * no thread can reach it anymore. Without an epoch manager, the node is destroyed right away.
+ */
+template <class NodeMgr, class NodePointer>
+void retire_node(EpochManager* epochs, NodeMgr& node_mgr, NodePointer node)
+{
+    using Node = typename NodePointer::PointeeType;
+
+    if (!epochs) {
+        node_mgr.destroy_node(node);
+        return;
+    }
+
+    auto deleter = [] (void* context, void* object) {
+        static_cast<NodeMgr*>(context)->destroy_node(NodePointer{static_cast<Node*>(object)});
+    };
+    epochs->retire(&(*node), deleter, &node_mgr);
+}
+
 } // namespace internal
 
 /**
@@ -104,8 +247,16 @@ struct LeveledNode<0, LeafType> {
  * \tparam Level Level number.
  * \tparam LeadNode Template for the leaf node class. Upper-level node types are determined
  *      recursively from this.
+ * \tparam AdoptionPolicy Template for the policy that decides when foster children are adopted
+ *      by traversals and performs adoptions and merges (\see EagerAdoption, LazyAdoption, and
+ *      BackgroundAdoption). It is instantiated once per branch level.
  * \tparam NodeMgr Template for the node manager object, used to construct and destroy nodes of
  *      this level.
+ * \tparam Statistics Policy that collects statistics about traversals, latch waits, and
+ *      adoptions (\see TreeStatistics). The default NoStatistics has no overhead.
+ * \tparam HashIndex Template for the hash index policy of the leaf level, instantiated with the
+ *      key type and the leaf pointer type (\see AdaptiveHashIndex). The default NoHashIndex has no
+ *      overhead.
  */
 template <
     class K,
@@ -113,7 +264,9 @@ template <
     unsigned Level,
     template <class,class> class LeafNode,
     template <class,class> class AdoptionPolicy,
-    template <class> class NodeMgr
+    template <class> class NodeMgr,
+    class Statistics = NoStatistics,
+    template <class,class> class HashIndex = NoHashIndex
 >
 class BtreeLevel
 {
@@ -125,76 +278,354 @@ public:
     using NodePointer = typename ThisNodeType::NodePointer;
     using ChildPointer = typename LeveledNode<Level-1, LeafNodeType>::type::NodePointer;
     using LeafPointer = typename LeveledNode<0, LeafNodeType>::type::NodePointer;
-    using ThisType = BtreeLevel<K, V, Level, LeafNode, AdoptionPolicy, NodeMgr>;
-    using LowerLevel = BtreeLevel<K, V, Level-1, LeafNode, AdoptionPolicy, NodeMgr>;
+    using ThisType = BtreeLevel<K, V, Level, LeafNode, AdoptionPolicy, NodeMgr, Statistics,
+          HashIndex>;
+    using LowerLevel = BtreeLevel<K, V, Level-1, LeafNode, AdoptionPolicy, NodeMgr, Statistics,
+          HashIndex>;
     using Adoption = AdoptionPolicy<NodePointer, ChildPointer>;
     using IdType = typename NodeMgr<LeafNodeType>::IdType;
+    using SlotNumber = typename ThisNodeType::SlotNumber;
+    using LeafLevel = typename LowerLevel::LeafLevel;
+    using StatisticsType = Statistics;
 
-    BtreeLevel(unsigned depth = 0) :
-        next_level_(new LowerLevel(depth+1)),
+    /**
+     * \param[in] depth Distance from the root level. Only the level of depth zero latches the root
+     *      node at the beginning of a pessimistic traversal; nodes given to other levels must
+     *      already be latched by the caller.
+     * \param[in] epochs Epoch manager used to retire nodes. If null, nodes are destroyed right
+     *      away when retired, which is only safe in single-threaded use.
+     * \param[in] stats Statistics object shared by all levels of a tree. If null, each level
+     *      collects statistics into a private object.
+     */
+    BtreeLevel(unsigned depth = 0, EpochManager* epochs = nullptr, Statistics* stats = nullptr) :
+        next_level_(new LowerLevel(depth+1, epochs, stats)),
         node_mgr_(NodeMgr<ThisNodeType>{}),
+        epochs_(epochs),
+        own_stats_(stats ? nullptr : new Statistics),
+        stats_(stats ? stats : own_stats_.get()),
         depth_(depth)
     {
     }
 
     static constexpr unsigned level() { return Level; }
 
+    LowerLevel* lower_level() { return next_level_.get(); }
+
+    LeafLevel* leaf_level() { return next_level_->leaf_level(); }
+
+    /**
+     * \brief Traverses from the given branch node down to the leaf node containing the given key.
+     *
+     * The returned leaf is latched in exclusive mode if for_update is true, or in shared mode
+     * otherwise. If the node type uses a latch with optimistic reads (\see OptimisticLatch), the
+     * branch nodes are not latched at all (\see traverse_optimistic).
+     */
     LeafPointer traverse(NodePointer branch, const K& key, bool for_update)
     {
-        // If this is root node, latch it here
-        if (depth_ == 0) { branch->acquire_read(); }
+        return traverse(branch, key, for_update,
+                std::integral_constant<bool, ThisNodeType::OptimisticLatching>{});
+    }
 
+    /**
+     * \brief Optimistic traversal of a branch node (i.e., optimistic lock coupling).
+     *
+     * The given branch node is not latched -- instead, the caller obtains its version with
+     * optimistic_read() and passes it here. Every piece of information read from the node is only
+     * used after the version is validated, and the version of a child node is always obtained
+     * before validating the version of its parent. Real latches are only acquired on leaf nodes
+     * and on nodes taking part in an adoption (which might also split the parent).
+     *
+     * Note that data read from a node might be inconsistent until validated, which is harmless for
+     * fixed-length keys, but a torn length field may cause variable-length keys to be read beyond
+     * the node boundary. Optimistic latching is therefore recommended for fixed-length keys only.
+     *
+     * \returns the latched leaf node or a null pointer if validation failed, in which case the
+     *      traversal must be restarted from the root.
+     */
+    LeafPointer traverse_optimistic(NodePointer branch, uint64_t version, const K& key,
+            bool for_update)
+    {
         ChildPointer child {nullptr};
+        uint64_t child_version {0};
 
-        // Descend into the target child node
-        while (branch) {
-            // Branch nodes that participate in a traversal must not be empty
-            assert<1>(branch->size() > 0 || !branch->is_foster_empty());
-            assert<1>(branch->has_reader());
-
+        while (true) {
             // If current branch does not contain the key, it must be in a foster child
             if (!branch->key_range_contains(key)) {
                 NodePointer foster = branch->get_foster_child();
+                if (!branch->validate_read(version)) { return LeafPointer{nullptr}; }
                 assert<1>(foster);
-                foster->acquire_read();
-                branch->release_read();
+                uint64_t foster_version = foster->optimistic_read();
+                if (!branch->validate_read(version)) { return LeafPointer{nullptr}; }
                 branch = foster;
+                version = foster_version;
+                stats_->add(Counter::FosterHops);
                 continue;
             }
 
-            // find method guarantees that the next child will contain the value (i.e., the branch
-            // pointer) associated with the slot where the key would be inserted if not found. The
-            // return value (a Boolean "found") can be safely ignored.
             branch->find(key, &child);
+            if (!branch->validate_read(version)) { return LeafPointer{nullptr}; }
             assert<1>(child);
 
-            // Latch child node before proceeding
-            latch_pointer(child, for_update);
+            // Leaf nodes are latched; branch nodes are read optimistically
+            if (Level == 1) {
+                latch_pointer(child, for_update);
+            }
+            else {
+                child_version = child->optimistic_read();
+            }
+            if (!branch->validate_read(version)) {
+                if (Level == 1) { unlatch_pointer(child, for_update); }
+                return LeafPointer{nullptr};
+            }
 
-            // Try do adopt child's foster child -- restart traversal if it works
-            if (Adoption::try_adopt(branch, child, node_mgr_)) {
-                unlatch_pointer(child, for_update);
-                continue;
+            // Adoption requires real latches on both parent and child, so we attempt to convert the
+            // optimistic reads into shared latches with the versions read above. The policy is only
+            // consulted afterwards, since it may follow the foster pointer of the child, which is
+            // not valid until the child is latched.
+            if (child->get_foster_child()) {
+                if (!branch->attempt_read(version)) {
+                    if (Level == 1) { unlatch_pointer(child, for_update); }
+                    return LeafPointer{nullptr};
+                }
+                if (Level > 1 && !child->attempt_read(child_version)) {
+                    branch->release_read();
+                    return LeafPointer{nullptr};
+                }
+
+                bool adopted = adoption_.should_adopt(child, for_update)
+                    && adoption_.try_adopt(branch, child, node_mgr_, *stats_);
+
+                if (Level > 1) { child->release_read(); }
+                branch->release_read();
+
+                // Restart on the same branch node if adoption worked
+                if (adopted) {
+                    if (Level == 1) { unlatch_pointer(child, for_update); }
+                    version = branch->optimistic_read();
+                    continue;
+                }
             }
 
             break;
         }
 
-        // Release latch on parent
-        branch->release_read();
-
-        // Now we found the target child node, but key may be somewhere in the foster chain
-        assert<1>(child->fence_contains(key));
-        while (child && !child->key_range_contains(key)) {
+        // Key may be somewhere in the foster chain of the child
+        uint64_t chain = 0;
+        while (!child->key_range_contains(key)) {
             ChildPointer foster = child->get_foster_child();
-            latch_pointer(foster, for_update);
-            unlatch_pointer(child, for_update);
+            if (Level == 1) {
+                assert<1>(foster, "Traversal reached null pointer");
+                latch_pointer(foster, for_update);
+                unlatch_pointer(child, for_update);
+            }
+            else {
+                if (!child->validate_read(child_version)) { return LeafPointer{nullptr}; }
+                assert<1>(foster, "Traversal reached null pointer");
+                uint64_t foster_version = foster->optimistic_read();
+                if (!child->validate_read(child_version)) { return LeafPointer{nullptr}; }
+                child_version = foster_version;
+            }
             child = foster;
+            chain++;
         }
+        record_foster_chain(chain);
 
-        assert<1>(child, "Traversal reached null pointer");
+        return next_level_->traverse_optimistic(child, child_version, key, for_update);
+    }
 
-        return next_level_->traverse(child, key, for_update);
+    /**
+     * \brief Traverses many keys in lockstep, one level at a time, to compute leaf pointers.
+     *
+     * For each key, the node of this level is searched for the child pointer, and a prefetch is
+     * issued for the child. Children are only touched on the next level, after the prefetches of
+     * all keys were issued, so that the cache misses of the whole batch overlap instead of being
+     * serialized along a single root-to-leaf path (i.e., group prefetching).
+     *
+     * Nodes are latched only while being searched (or read optimistically), so the resulting leaf
+     * pointers are merely hints: they must be latched and verified with fence_contains by the
+     * caller (\see StaticBtree::multi_get). A null pointer is returned for keys whose optimistic
+     * read could not be validated. Foster children are followed, but adoptions are not performed.
+     *
+     * \param[in] nodes Node of this level in which to search each key (may be null)
+     * \param[in] keys Keys to search for
+     * \param[in] n Number of keys
+     * \param[out] leaves Leaf pointer hints for each key
+     */
+    void multi_traverse(const NodePointer* nodes, const K* keys, size_t n, LeafPointer* leaves)
+    {
+        std::vector<ChildPointer> children(n, ChildPointer{nullptr});
+        for (size_t i = 0; i < n; i++) {
+            if (!nodes[i]) { continue; }
+            children[i] = find_child(nodes[i], keys[i],
+                    std::integral_constant<bool, ThisNodeType::OptimisticLatching>{});
+            if (children[i]) { children[i]->prefetch(); }
+        }
+
+        next_level_->multi_traverse(children.data(), keys, n, leaves);
+    }
+
+    /**
+     * \brief Sets the queue into which the adoption policy of this and all lower levels puts its
+     * requests, if it defers adoptions (\see BackgroundAdoption).
+     */
+    template <class Queue>
+    void set_adoption_queue(Queue* queue)
+    {
+        adoption_.set_queue(queue);
+        next_level_->set_adoption_queue(queue);
+    }
+
+    /**
+     * \brief Traverses towards the given key, merging underflown nodes along the way.
+     *
+     * This is invoked after a deletion leaves a leaf underflown (\see Adoption::is_underflown).
+     * All nodes are latched in shared mode with lock coupling, as in the pessimistic traversal. On
+     * each level, if the child that contains the key is underflown, it is merged with its right
+     * sibling, or with its left sibling if it is the last child (\see Adoption::try_merge). The
+     * absorbed node is retired. Merges are opportunistic: if latches cannot be upgraded or records
+     * do not fit, the traversal simply proceeds. The caller must be inside an epoch.
+     */
+    void merge_underflown(NodePointer branch, const K& key)
+    {
+        // If this is root node, latch it here
+        if (depth_ == 0) { branch->acquire_read(); }
+
+        while (!branch->key_range_contains(key)) {
+            NodePointer foster = branch->get_foster_child();
+            assert<1>(foster, "Traversal reached null pointer");
+            foster->acquire_read();
+            branch->release_read();
+            branch = foster;
+        }
+
+        SlotNumber slot = child_slot(branch, key);
+        ChildPointer child {nullptr};
+        branch->read_slot(slot, nullptr, &child);
+
+        child->acquire_read();
+        if (Adoption::is_underflown(child)) {
+            child->release_read();
+
+            ChildPointer merged {nullptr};
+            if (size_t(slot) + 1 < branch->size()) { merged = merge_children(branch, slot + 1); }
+            if (!merged && slot > 0) { merged = merge_children(branch, slot); }
+            if (merged) {
+                next_level_->retire_node(merged);
+                slot = child_slot(branch, key);
+                branch->read_slot(slot, nullptr, &child);
+            }
+
+            child->acquire_read();
+        }
+        branch->release_read();
+
+        next_level_->merge_underflown(child, key);
+    }
+
+    /**
+     * \brief Builds this level from the sorted input (\see internal::bulk_load_nodes).
+     *
+     * The levels below are built first, and then the first key and pointer of each child node are
+     * used as the input records of this level.
+     */
+    template <class Iter>
+    void bulk_load(Iter begin, Iter end, double fill_factor,
+            std::vector<std::pair<K, NodePointer>>& nodes)
+    {
+        std::vector<std::pair<K, ChildPointer>> children;
+        next_level_->bulk_load(begin, end, fill_factor, children);
+        internal::bulk_load_nodes(children.begin(), children.end(), fill_factor, node_mgr_, nodes);
+    }
+
+    /**
+     * \brief Same as bulk_load, but the leaves are built by tasks of the given pool (\see
+     * BtreeLevel<K,V,0,...>::parallel_bulk_load).
+     *
+     * Branch levels are then stitched together on top of all leaves by the calling thread, since
+     * they are smaller than the leaf level by a factor of the fanout.
+     */
+    template <class Iter>
+    void parallel_bulk_load(Iter begin, Iter end, double fill_factor, TaskPool& pool,
+            std::vector<std::pair<K, NodePointer>>& nodes)
+    {
+        std::vector<std::pair<K, ChildPointer>> children;
+        next_level_->parallel_bulk_load(begin, end, fill_factor, pool, children);
+        internal::bulk_load_nodes(children.begin(), children.end(), fill_factor, node_mgr_, nodes);
+    }
+
+    /**
+     * \brief Appends the keys of all nodes that are depth levels below the given node, in key
+     * order, which are the separators of their child ranges (\see StaticBtree::parallel_scan).
+     *
+     * Nodes are latched in shared mode one at a time, so the keys may be outdated by concurrent
+     * splits and merges.
+     */
+    void collect_separators(NodePointer node, unsigned depth, std::vector<K>& keys)
+    {
+        std::vector<ChildPointer> children;
+        node->acquire_read();
+        while (true) {
+            typename ThisNodeType::Iterator iter = node->iterate();
+            K key;
+            ChildPointer child;
+            while (iter.next(&key, &child)) {
+                if (depth == 0) { keys.push_back(key); }
+                else { children.push_back(child); }
+            }
+
+            NodePointer foster = node->get_foster_child();
+            if (foster) { foster->acquire_read(); }
+            node->release_read();
+            if (!foster) { break; }
+            node = foster;
+        }
+
+        for (ChildPointer child : children) {
+            next_level_->collect_separators(child, depth - 1, keys);
+        }
+    }
+
+    /**
+     * \brief Writes the given nodes of this level, i.e., the whole level in key order, into a
+     * snapshot, followed by the levels below (\see snapshot.h).
+     *
+     * The child level consists of the children of each node, in order, each followed by its foster
+     * chain. No other thread may modify the tree.
+     */
+    void save(const std::vector<NodePointer>& nodes, SnapshotWriter& writer)
+    {
+        std::vector<ChildPointer> children;
+        for (NodePointer node : nodes) {
+            typename ThisNodeType::Iterator iter = node->iterate();
+            ChildPointer child;
+            while (iter.next(nullptr, &child)) { internal::append_foster_chain(children, child); }
+        }
+
+        internal::save_level(writer, Level, nodes, internal::ChildPageNumbers<ChildPointer>{children});
+        next_level_->save(children, writer);
+    }
+
+    /// \brief Loads the nodes of this level and the levels below from a snapshot (\see save)
+    void load(const std::shared_ptr<const SnapshotReader>& reader, std::vector<NodePointer>& nodes)
+    {
+        std::vector<ChildPointer> children;
+        next_level_->load(reader, children);
+        try {
+            internal::load_level(*reader, Level, node_mgr_, nodes,
+                    internal::ChildPointers<ChildPointer>{children, *reader});
+        }
+        catch (...) {
+            // The level below is complete, so it is destroyed from the heads of its foster chains
+            std::unordered_set<const void*> fosters;
+            for (ChildPointer child : children) {
+                ChildPointer foster = child->get_foster_child();
+                if (foster) { fosters.insert(&(*foster)); }
+            }
+            for (ChildPointer child : children) {
+                if (!fosters.count(&(*child))) { next_level_->destroy_recursively(child); }
+            }
+            throw;
+        }
     }
 
     NodePointer construct_node()
@@ -218,17 +649,46 @@ public:
         return node;
     }
 
+    /**
+     * \brief Retires a node that was unlinked from the tree, destroying it when no thread can
+     * reach it anymore (\see EpochManager). The caller must be inside an epoch.
+     */
+    void retire_node(NodePointer node)
+    {
+        internal::retire_node(epochs_, node_mgr_, node);
+    }
+
+    /**
+     * \brief Destroys the given node, its foster chain, and all their descendants.
+     *
+     * This is used when the tree is destroyed, so no latches are acquired.
+     */
+    void destroy_recursively(NodePointer node)
+    {
+        while (node) {
+            typename ThisNodeType::Iterator iter = node->iterate();
+            ChildPointer child;
+            while (iter.next(nullptr, &child)) {
+                next_level_->destroy_recursively(child);
+            }
+
+            NodePointer foster = node->get_foster_child();
+            node_mgr_.destroy_node(node);
+            node = foster;
+        }
+    }
+
     void print(NodePointer node, std::ostream& out, unsigned rootLevel = Level)
     {
         // Print indentation
-        for (int i = 0; i < rootLevel - Level; i++) {
+        for (unsigned i = 0; i < rootLevel - Level; i++) {
             out << "    ";
         }
         out << "Node " << node->id() << " with " << node->size() << " items" << std::endl;
 
         NodePointer foster_child = node->get_foster_child();
         while (foster_child) {
-            for (int i = 0; i < rootLevel - Level; i++) {
+            for (unsigned i = 0; i < rootLevel - Level; i++) {
                 out << "    ";
             }
             out << "Foster child " << foster_child->id() << " with " << foster_child->size()
@@ -245,12 +705,174 @@ public:
 
 private:
 
+    /// Optimistic traversal from the root, which is restarted until validation succeeds.
+    LeafPointer traverse(NodePointer root, const K& key, bool for_update, std::true_type)
+    {
+        stats_->add(Counter::Traversals);
+        while (true) {
+            LeafPointer leaf = traverse_optimistic(root, root->optimistic_read(), key, for_update);
+            if (leaf) { return leaf; }
+            stats_->add(Counter::TraversalRestarts);
+        }
+    }
+
+    /// Pessimistic traversal, which latches every node in shared mode (lock coupling).
+    LeafPointer traverse(NodePointer branch, const K& key, bool for_update, std::false_type)
+    {
+        // If this is root node, latch it here
+        if (depth_ == 0) {
+            stats_->add(Counter::Traversals);
+            auto timer = stats_->start_timer();
+            branch->acquire_read();
+            stats_->record_time(Histogram::ReadLatchWait, timer);
+        }
+
+        ChildPointer child {nullptr};
+
+        // Descend into the target child node
+        while (branch) {
+            // Branch nodes that participate in a traversal must not be empty
+            assert<1>(branch->size() > 0 || !branch->is_foster_empty());
+            assert<1>(branch->has_reader());
+
+            // If current branch does not contain the key, it must be in a foster child
+            if (!branch->key_range_contains(key)) {
+                NodePointer foster = branch->get_foster_child();
+                assert<1>(foster);
+                auto timer = stats_->start_timer();
+                foster->acquire_read();
+                stats_->record_time(Histogram::ReadLatchWait, timer);
+                branch->release_read();
+                branch = foster;
+                stats_->add(Counter::FosterHops);
+                continue;
+            }
+
+            // find method guarantees that the next child will contain the value (i.e., the branch
+            // pointer) associated with the slot where the key would be inserted if not found. The
+            // return value (a Boolean "found") can be safely ignored.
+            branch->find(key, &child);
+            assert<1>(child);
+
+            // Latch child node before proceeding
+            latch_pointer(child, for_update);
+
+            // Try do adopt child's foster child -- restart traversal if it works
+            if (child->get_foster_child() && adoption_.should_adopt(child, for_update)
+                    && adoption_.try_adopt(branch, child, node_mgr_, *stats_))
+            {
+                unlatch_pointer(child, for_update);
+                continue;
+            }
+
+            break;
+        }
+
+        // Release latch on parent
+        branch->release_read();
+
+        // Now we found the target child node, but key may be somewhere in the foster chain
+        assert<1>(child->fence_contains(key));
+        uint64_t chain = 0;
+        while (child && !child->key_range_contains(key)) {
+            ChildPointer foster = child->get_foster_child();
+            latch_pointer(foster, for_update);
+            unlatch_pointer(child, for_update);
+            child = foster;
+            chain++;
+        }
+        record_foster_chain(chain);
+
+        assert<1>(child, "Traversal reached null pointer");
+
+        return next_level_->traverse(child, key, for_update);
+    }
+
+    /// Slot of the child pointer that a traversal for the given key follows
+    static SlotNumber child_slot(NodePointer branch, const K& key)
+    {
+        SlotNumber slot = branch->lower_bound(key);
+        if (slot < branch->size()) {
+            K slot_key;
+            branch->read_slot(slot, &slot_key, nullptr);
+            if (slot_key == key) { return slot; }
+        }
+        assert<1>(slot > 0);
+        return slot - 1;
+    }
+
+    /// Merges the child at the given slot into its left sibling (\see Adoption::try_merge)
+    ChildPointer merge_children(NodePointer branch, SlotNumber right_slot)
+    {
+        K separator;
+        ChildPointer left {nullptr}, right {nullptr};
+        branch->read_slot(right_slot - 1, nullptr, &left);
+        branch->read_slot(right_slot, &separator, &right);
+        ChildPointer merged = Adoption::try_merge(branch, left, right, separator);
+        if (merged) { stats_->add(Counter::Merges); }
+        return merged;
+    }
+
+    /// Searches for the child pointer of a key with an optimistic read (for multi_traverse)
+    ChildPointer find_child(NodePointer node, const K& key, std::true_type)
+    {
+        ChildPointer child {nullptr};
+        uint64_t version = node->optimistic_read();
+
+        while (!node->key_range_contains(key)) {
+            NodePointer foster = node->get_foster_child();
+            if (!node->validate_read(version) || !foster) { return ChildPointer{nullptr}; }
+            uint64_t foster_version = foster->optimistic_read();
+            if (!node->validate_read(version)) { return ChildPointer{nullptr}; }
+            node = foster;
+            version = foster_version;
+        }
+
+        node->find(key, &child);
+        if (!node->validate_read(version)) { return ChildPointer{nullptr}; }
+        return child;
+    }
+
+    /// Searches for the child pointer of a key with a shared latch (for multi_traverse)
+    ChildPointer find_child(NodePointer node, const K& key, std::false_type)
+    {
+        ChildPointer child {nullptr};
+        node->acquire_read();
+
+        while (!node->key_range_contains(key)) {
+            NodePointer foster = node->get_foster_child();
+            assert<1>(foster, "Traversal reached null pointer");
+            foster->acquire_read();
+            node->release_read();
+            node = foster;
+        }
+
+        node->find(key, &child);
+        node->release_read();
+        return child;
+    }
+
     void latch_pointer(ChildPointer child, bool ex_mode)
     {
         // Exclusive latch is only required at leaf nodes during normal traversal.
         // (If required, splits, merges, and adoptions will attempt upgrade on branch nodes)
-        if (Level == 1 && ex_mode) { child->acquire_write(); }
-        else { child->acquire_read(); }
+        auto timer = stats_->start_timer();
+        if (Level == 1 && ex_mode) {
+            child->acquire_write();
+            stats_->record_time(Histogram::WriteLatchWait, timer);
+        }
+        else {
+            child->acquire_read();
+            stats_->record_time(Histogram::ReadLatchWait, timer);
+        }
+    }
+
+    /// Records the number of foster pointers followed from the child found on this level
+    void record_foster_chain(uint64_t length)
+    {
+        if (length == 0) { return; }
+        stats_->add(Counter::FosterHops, length);
+        stats_->record(Histogram::FosterChainLength, length);
     }
 
     void unlatch_pointer(ChildPointer child, bool ex_mode)
@@ -263,6 +885,11 @@ private:
 
     std::unique_ptr<LowerLevel> next_level_;
     NodeMgr<ThisNodeType> node_mgr_;
+    Adoption adoption_;
+    EpochManager* epochs_;
+    /// Statistics object of a level constructed without one
+    std::unique_ptr<Statistics> own_stats_;
+    Statistics* stats_;
     const unsigned depth_;
 };
 
@@ -271,27 +898,202 @@ template <
     class V,
     template <class,class> class LeafNode,
     template <class,class> class AdoptionPolicy,
-    template <class> class NodeMgr
+    template <class> class NodeMgr,
+    class Statistics,
+    template <class,class> class HashIndex
 >
-class BtreeLevel<K, V, 0, LeafNode, AdoptionPolicy, NodeMgr>
+class BtreeLevel<K, V, 0, LeafNode, AdoptionPolicy, NodeMgr, Statistics, HashIndex>
 {
 public:
 
     using NodePointer = typename LeafNode<K,V>::NodePointer;
+    using LeafLevel = BtreeLevel;
 
-    BtreeLevel(unsigned depth = 0) :
+    /// Number of input partitions per worker in a parallel bulk load (\see parallel_bulk_load)
+    static constexpr size_t PartitionsPerWorker = 4;
+    /// Minimum number of records of a partition, below which fewer partitions are used
+    static constexpr size_t MinPartitionSize = 4096;
+
+    BtreeLevel(unsigned depth = 0, EpochManager* epochs = nullptr, Statistics* = nullptr) :
         node_mgr_(NodeMgr<LeafNode<K,V>>{}),
-        depth_(depth)
+        epochs_(epochs),
+        depth_(depth),
+        leaf_hint_(nullptr)
     {
     }
 
     static constexpr unsigned level() { return 0; }
 
+    BtreeLevel* leaf_level() { return this; }
+
+    /**
+     * \brief Returns the leaf of the last insertion (\see set_leaf_hint) if it contains the key.
+     *
+     * This allows insertions of monotonically increasing keys to skip the traversal. The hinted
+     * leaf is latched in exclusive mode and then validated with key_range_contains, so a hint that
+     * became stale because of a split or merge is simply a miss, in which case null is returned.
+     * A leaf with a foster child is also a miss, since its foster chain would otherwise grow
+     * without ever being adopted (e.g., with decreasing keys, which keep hitting the leaf that
+     * split). The caller must be inside an epoch, since the hint is only cleared when a leaf is
+     * retired.
+     */
+    NodePointer latch_hinted_leaf(const K& key)
+    {
+        using Node = typename NodePointer::PointeeType;
+        NodePointer node {static_cast<Node*>(leaf_hint_.load())};
+        if (!node) { return node; }
+
+        node->acquire_write();
+        if (!node->get_foster_child() && node->key_range_contains(key)) { return node; }
+        node->release_write();
+        return NodePointer{nullptr};
+    }
+
+    /**
+     * \brief Remembers the given leaf as the one to try first on the next insertion.
+     *
+     * The leaf must be latched by the caller. Since adoptions are only triggered by traversals,
+     * the hint should not be set right after a split, so that the new foster child gets adopted.
+     */
+    void set_leaf_hint(NodePointer node)
+    {
+        leaf_hint_.store(&(*node));
+    }
+
+    /**
+     * \brief Looks a key up through the hash index, without a traversal (\see AdaptiveHashIndex).
+     *
+     * The caller must be inside an epoch.
+     *
+     * \param[out] found Whether the key exists, which is only valid if true is returned
+     * \returns false if the key must be looked up with a traversal, followed by record_lookup
+     */
+    bool probe_hash_index(const K& key, V* value, bool& found)
+    {
+        return hash_index_.probe(key, value, found);
+    }
+
+    /// \brief Records a lookup answered by a traversal, whose leaf is latched by the caller
+    void record_lookup(const K& key, NodePointer node)
+    {
+        hash_index_.record(key, node);
+    }
+
     NodePointer traverse(NodePointer n, const K&, bool)
     {
         return n;
     }
 
+    NodePointer traverse_optimistic(NodePointer n, uint64_t, const K&, bool)
+    {
+        return n;
+    }
+
+    void multi_traverse(const NodePointer* nodes, const K*, size_t n, NodePointer* leaves)
+    {
+        std::copy(nodes, nodes + n, leaves);
+    }
+
+    /// End of the merge traversal, which only releases the latch acquired on the leaf
+    void merge_underflown(NodePointer n, const K&)
+    {
+        n->release_read();
+    }
+
+    template <class Iter>
+    void bulk_load(Iter begin, Iter end, double fill_factor,
+            std::vector<std::pair<K, NodePointer>>& nodes)
+    {
+        internal::bulk_load_nodes(begin, end, fill_factor, node_mgr_, nodes);
+    }
+
+    /**
+     * \brief Builds the leaves from sorted input given by random-access iterators, with one task
+     * of the given pool per partition of the input.
+     *
+     * Partitions have the same number of records, and their fence keys are the separators between
+     * the last key of a partition and the first key of the next one, i.e., the same fence keys that
+     * bulk_load would set between two leaves (\see internal::bulk_load_nodes). The output of all
+     * partitions thus forms a valid leaf level, which is returned in nodes.
+     *
+     * There are more partitions than workers, so that workers that finish early steal the
+     * remaining ones. All tasks construct leaves with the node manager of the level, which must be
+     * safe to use from multiple threads, as it is for splits. With a PoolAllocator, each worker then
+     * allocates from its own free list (\see PoolAllocator), while the nodes still belong to the
+     * pool of the level, which destroys them.
+     */
+    template <class Iter>
+    void parallel_bulk_load(Iter begin, Iter end, double fill_factor, TaskPool& pool,
+            std::vector<std::pair<K, NodePointer>>& nodes)
+    {
+        size_t count = end - begin;
+        size_t partitions = std::min(pool.size() * PartitionsPerWorker, count / MinPartitionSize);
+        if (partitions <= 1) {
+            internal::bulk_load_nodes(begin, end, fill_factor, node_mgr_, nodes);
+            return;
+        }
+
+        // Fence key between each partition and the previous one (none for the first)
+        std::vector<Iter> bounds;
+        std::vector<K> fences(partitions);
+        for (size_t i = 0; i <= partitions; i++) { bounds.push_back(begin + count * i / partitions); }
+        for (size_t i = 1; i < partitions; i++) {
+            fences[i] = internal::shortest_separator((bounds[i] - 1)->first, bounds[i]->first);
+        }
+
+        std::vector<std::vector<std::pair<K, NodePointer>>> parts(partitions);
+        TaskPool::Group group;
+        for (size_t i = 0; i < partitions; i++) {
+            pool.submit([this, &bounds, &fences, &parts, fill_factor, partitions, i] {
+                K* low = i > 0 ? &fences[i] : nullptr;
+                K* high = i + 1 < partitions ? &fences[i + 1] : nullptr;
+                internal::bulk_load_nodes(bounds[i], bounds[i + 1], fill_factor, node_mgr_,
+                        parts[i], low, high);
+            }, group);
+        }
+        pool.wait(group);
+
+        for (auto& part : parts) { nodes.insert(nodes.end(), part.begin(), part.end()); }
+    }
+
+    /// Leaves have no separators to collect (\see BtreeLevel::collect_separators)
+    void collect_separators(NodePointer, unsigned, std::vector<K>&) {}
+
+    void save(const std::vector<NodePointer>& nodes, SnapshotWriter& writer)
+    {
+        internal::save_level(writer, 0, nodes, internal::NoChildren{});
+    }
+
+    /**
+     * \brief Loads the leaves from a snapshot, either eagerly or, if the node manager supports it,
+     * lazily through a buffer pool (\see BufferedNodeManager), which keeps the reader.
+     */
+    void load(const std::shared_ptr<const SnapshotReader>& reader, std::vector<NodePointer>& nodes)
+    {
+        load(reader, nodes, internal::LoadsLazily<NodeMgr<LeafNode<K,V>>>{});
+    }
+
+    /**
+     * \brief Evicts up to max_pages cold leaves that were loaded lazily (\see BufferPool::evict).
+     *
+     * No other thread may access the tree.
+     */
+    size_t evict(size_t max_pages)
+    {
+        leaf_hint_.store(nullptr);
+        hash_index_.clear();
+        return node_mgr_.evict(max_pages);
+    }
+
+    size_t resident_pages() const
+    {
+        return node_mgr_.resident_pages();
+    }
+
+    /// Leaves have no children to adopt
+    template <class Queue>
+    void set_adoption_queue(Queue*) {}
+
     NodePointer construct_node()
     {
         return node_mgr_.construct_node();
@@ -306,17 +1108,38 @@ public:
     {
         return construct_node();
     }
+
+    void retire_node(NodePointer node)
+    {
+        // Threads entering from now on must not find the node as a hint either
+        void* expected = &(*node);
+        leaf_hint_.compare_exchange_strong(expected, nullptr);
+        hash_index_.invalidate(&(*node));
+        internal::retire_node(epochs_, node_mgr_, node);
+    }
+
+    void destroy_recursively(NodePointer node)
+    {
+        leaf_hint_.store(nullptr);
+        hash_index_.clear();
+        while (node) {
+            NodePointer foster = node->get_foster_child();
+            node_mgr_.destroy_node(node);
+            node = foster;
+        }
+    }
+
     void print(NodePointer node, std::ostream& out, unsigned rootLevel = 0)
     {
         // Print indentation
-        for (int i = 0; i < rootLevel; i++) {
+        for (unsigned i = 0; i < rootLevel; i++) {
             out << "    ";
         }
         out << "Leaf node " << node->id() << " with " << node->size() << " items" << std::endl;
 
         NodePointer foster_child = node->get_foster_child();
         while (foster_child) {
-            for (int i = 0; i < rootLevel; i++) {
+            for (unsigned i = 0; i < rootLevel; i++) {
                 out << "    ";
             }
             out << "Foster child " << foster_child->id() << " with " << foster_child->size()
@@ -326,8 +1149,26 @@ public:
     }
 
 private:
+    void load(const std::shared_ptr<const SnapshotReader>& reader, std::vector<NodePointer>& nodes,
+            std::false_type /* lazy */)
+    {
+        internal::load_level(*reader, 0, node_mgr_, nodes, internal::NoChildren{});
+    }
+
+    void load(const std::shared_ptr<const SnapshotReader>& reader, std::vector<NodePointer>& nodes,
+            std::true_type /* lazy */)
+    {
+        node_mgr_.attach_snapshot(reader, 0, nodes);
+    }
+
     NodeMgr<LeafNode<K,V>> node_mgr_;
+    EpochManager* epochs_;
     const unsigned depth_;
+
+    /// Leaf of the last insertion that did not split (\see latch_hinted_leaf)
+    std::atomic<void*> leaf_hint_;
+
+    HashIndex<K, NodePointer> hash_index_;
 };
 
 } // namespace foster
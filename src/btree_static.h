@@ -28,10 +28,24 @@
  * Btree logic built on top of a node data structure with support for foster relationships.
  */
 
+#include <algorithm>
+#include <chrono>
 #include <memory>
+#include <mutex>
 #include <iostream> // for print
+#include <thread>
+#include <utility>
+#include <vector>
 
 #include "assertions.h"
+#include "btree_adoption.h"
+#include "btree_cursor.h"
+#include "epoch.h"
+#include "exceptions.h"
+#include "kv_array.h"
+#include "snapshot.h"
+#include "statistics.h"
+#include "task_pool.h"
 
 namespace foster {
 
@@ -49,53 +63,496 @@ public:
     using BtreeLevelType = BtreeLevel<K, V, L>;
     using NodePointer = typename BtreeLevelType<Level>::NodePointer;
     using LeafPointer = typename BtreeLevelType<0>::NodePointer;
+    using KeyType = K;
+    using ValueType = V;
+    /// Cursor for ordered range scans (\see BtreeCursor)
+    using Cursor = BtreeCursor<StaticBtree>;
+    using Adoption = typename BtreeLevelType<Level>::Adoption;
+    /// Statistics policy of the levels (\see NoStatistics and TreeStatistics)
+    using Statistics = typename BtreeLevelType<Level>::StatisticsType;
 
     StaticBtree() :
-        root_level_(new BtreeLevelType<Level>),
+        root_level_(new BtreeLevelType<Level>(0, &epochs_, &stats_)),
         root_(root_level_->construct_recursively())
     {
+        if (Adoption::Background) {
+            adoption_queue_.reset(new AdoptionQueue<K>);
+            root_level_->set_adoption_queue(adoption_queue_.get());
+            adoption_worker_ = std::thread {&StaticBtree::run_adoptions, this};
+        }
     }
 
-    void put(const K& key, const V& value)
+    /// \brief Destroys all nodes. No other thread may be accessing the tree.
+    ~StaticBtree()
     {
-        LeafPointer node = root_level_->traverse(root_, key, true /* for_update */);
-        bool inserted = node->insert(key, value);
+        if (adoption_worker_.joinable()) {
+            adoption_queue_->stop();
+            adoption_worker_.join();
+        }
+        // Retired nodes must be destroyed while their node managers still exist
+        epochs_.drain();
+        root_level_->destroy_recursively(root_);
+    }
 
-        while (!inserted) {
-            // Node is full -- split required
-            LeafPointer new_node = root_level_->construct_leaf();
-            node = node->split_for_insertion(key, new_node);
-            inserted = node->insert(key, value);
+    /**
+     * \brief Inserts a key-value pair.
+     *
+     * The leaf of the last insertion is tried first, and a traversal is only performed if it does
+     * not contain the key (\see BtreeLevel::latch_hinted_leaf). This makes insertions of increasing
+     * keys (e.g., timestamps or sequence numbers) much cheaper. The hint is not updated after a
+     * split, so that the next insertion traverses the tree and adopts the new foster child.
+     *
+     * \throws ExistentKeyException if the key already exists, after all latches are released
+     *      (\see try_insert for a non-throwing alternative)
+     */
+    void put(const K& key, const V& value)
+    {
+        if (put_pair<PutMode::Insert>(key, value) == PutStatus::KeyExists) {
+            throw ExistentKeyException<K>(key);
         }
+    }
 
-        node->release_write();
+    /**
+     * \brief Inserts a key-value pair, unless the key already exists.
+     * \returns PutStatus::Inserted or PutStatus::KeyExists
+     */
+    PutStatus try_insert(const K& key, const V& value)
+    {
+        return put_pair<PutMode::Insert>(key, value);
+    }
+
+    /**
+     * \brief Overwrites the value of a key, unless the key does not exist.
+     *
+     * The value is overwritten in place if its encoded length does not change (\see
+     * KeyValueArray::put); otherwise, the leaf may have to be split.
+     *
+     * \returns PutStatus::Updated or PutStatus::KeyNotFound
+     */
+    PutStatus update(const K& key, const V& value)
+    {
+        return put_pair<PutMode::Update>(key, value);
+    }
+
+    /**
+     * \brief Inserts a key-value pair or overwrites the value of the key if it already exists.
+     * \returns PutStatus::Inserted or PutStatus::Updated
+     */
+    PutStatus upsert(const K& key, const V& value)
+    {
+        return put_pair<PutMode::Upsert>(key, value);
+    }
+
+    /**
+     * \brief Builds the tree bottom-up from a range of key-value pairs sorted by key.
+     *
+     * Leaves are packed up to the given fill factor, and branch nodes are built from the low fence
+     * keys of their children, so that no foster relationships are left behind -- except on the
+     * root level, whose nodes are linked in a foster chain if they do not fit into a single node.
+     *
+     * This must be invoked on an empty tree. Keys must be unique and sorted in ascending order.
+     *
+     * \param[in] begin,end Range of sorted pairs (e.g., std::pair<K,V>) accessed with first and second
+     * \param[in] fill_factor Fraction of the node space to be filled, between 0 and 1
+     */
+    template <class Iter>
+    void bulk_load(Iter begin, Iter end, double fill_factor = 1.0)
+    {
+        if (begin == end) { return; }
+        std::lock_guard<std::mutex> lock {maintenance_mutex_};
+
+        // Discard the empty root-to-leaf path
+        root_level_->destroy_recursively(root_);
+
+        std::vector<std::pair<K, NodePointer>> nodes;
+        root_level_->bulk_load(begin, end, fill_factor, nodes);
+        internal::link_foster_chain(nodes);
+        root_ = nodes[0].second;
+    }
+
+    /**
+     * \brief Same as bulk_load, but the leaves are built in parallel by the tasks of the given pool.
+     *
+     * The input is split into partitions of the same size, each built into a sequence of leaves by
+     * a task, and the branch levels are then built on top of them by the calling thread (\see
+     * BtreeLevel::parallel_bulk_load). The resulting tree is the same as with bulk_load, except that
+     * the last leaf of each partition may be less full.
+     *
+     * \param[in] pool Pool that runs the tasks, which is waited for
+     * \param[in] begin,end Range of sorted pairs given by random-access iterators
+     * \param[in] fill_factor Fraction of the node space to be filled, between 0 and 1
+     */
+    template <class Iter>
+    void parallel_bulk_load(TaskPool& pool, Iter begin, Iter end, double fill_factor = 1.0)
+    {
+        if (begin == end) { return; }
+        std::lock_guard<std::mutex> lock {maintenance_mutex_};
+
+        root_level_->destroy_recursively(root_);
+
+        std::vector<std::pair<K, NodePointer>> nodes;
+        root_level_->parallel_bulk_load(begin, end, fill_factor, pool, nodes);
+        internal::link_foster_chain(nodes);
+        root_ = nodes[0].second;
+    }
+
+    /**
+     * \brief Writes the images of all nodes into a snapshot file (\see snapshot.h).
+     *
+     * Nodes are copied without latches, so no other thread may access the tree in the meantime --
+     * not even readers, since traversals may adopt foster children.
+     *
+     * \throws SnapshotException if the file cannot be written
+     */
+    void save(const string& path)
+    {
+        std::lock_guard<std::mutex> lock {maintenance_mutex_};
+        SnapshotWriter writer {path, Level + 1};
+        std::vector<NodePointer> nodes;
+        internal::append_foster_chain(nodes, root_);
+        root_level_->save(nodes, writer);
+        writer.finish();
     }
 
+    /**
+     * \brief Replaces the contents of the tree with those of a snapshot written by save.
+     *
+     * The file is mapped into memory, and each node is allocated and copied from it, translating
+     * page numbers back into pointers. If the leaf node manager is a BufferedNodeManager, leaves
+     * are instead faulted in on first access, and the mapping is kept until all of them are
+     * destroyed. No other thread may access the tree.
+     *
+     * \throws SnapshotException if the file cannot be read or was written by a different type of
+     *      tree, in which case the tree is not modified
+     */
+    void load(const string& path)
+    {
+        std::lock_guard<std::mutex> lock {maintenance_mutex_};
+        auto reader = std::make_shared<const SnapshotReader>(path, Level + 1);
+        std::vector<NodePointer> nodes;
+        root_level_->load(reader, nodes);
+
+        epochs_.drain();
+        root_level_->destroy_recursively(root_);
+        root_ = nodes[0];
+    }
+
+    /**
+     * \brief Evicts up to max_pages cold leaves faulted in from a snapshot, which requires a
+     * BufferedNodeManager (\see BufferPool::evict).
+     *
+     * No other thread may access the tree.
+     *
+     * \returns the number of leaves evicted
+     */
+    size_t evict(size_t max_pages)
+    {
+        std::lock_guard<std::mutex> lock {maintenance_mutex_};
+        epochs_.drain();
+        return root_level_->leaf_level()->evict(max_pages);
+    }
+
+    /// \brief Number of leaves faulted in from a snapshot that are currently in memory
+    size_t resident_pages() const
+    {
+        return root_level_->leaf_level()->resident_pages();
+    }
+
+    /**
+     * \brief Looks a key up, returning whether it exists and its value in value.
+     *
+     * If the levels have a hash index (\see AdaptiveHashIndex), it is probed first, and the
+     * traversal is only performed if the key is not hot or its leaf changed.
+     */
     bool get(const K& key, V& value)
     {
+        EpochGuard guard {epochs_};
+        auto leaf_level = root_level_->leaf_level();
+        bool found;
+        if (leaf_level->probe_hash_index(key, &value, found)) {
+            stats_.add(Counter::HashIndexHits);
+            return found;
+        }
+
         LeafPointer node = root_level_->traverse(root_, key, false /* for_update */);
         bool res = node->find(key, &value);
+        leaf_level->record_lookup(key, node);
         node->release_read();
         return res;
     }
 
+    /**
+     * \brief Looks up a batch of keys, overlapping the cache misses of their traversals.
+     *
+     * Keys are first traversed in lockstep with software prefetching (\see
+     * BtreeLevel::multi_traverse), which yields a leaf pointer hint for each key. Each hint is then
+     * latched and accepted if its fence keys contain the key, in which case the key is either in the
+     * leaf or in its foster chain. Otherwise (e.g., if the leaf was split and adopted in the
+     * meantime), a regular traversal is performed for that key.
+     *
+     * \param[in] keys Keys to search for
+     * \param[out] values Value of each key found (untouched for keys not found)
+     * \param[out] found Whether each key was found
+     * \param[in] n Number of keys
+     * \returns number of keys found
+     */
+    size_t multi_get(const K* keys, V* values, bool* found, size_t n)
+    {
+        EpochGuard guard {epochs_};
+        std::vector<NodePointer> roots(n < MultiGetBatch ? n : MultiGetBatch, root_);
+        std::vector<LeafPointer> leaves(roots.size(), LeafPointer{nullptr});
+        size_t count = 0;
+
+        for (size_t b = 0; b < n; b += MultiGetBatch) {
+            size_t batch = n - b < MultiGetBatch ? n - b : MultiGetBatch;
+            root_level_->multi_traverse(roots.data(), keys + b, batch, leaves.data());
+
+            for (size_t i = 0; i < batch; i++) {
+                LeafPointer node = leaves[i];
+                const K& key = keys[b + i];
+
+                if (node) {
+                    node->acquire_read();
+                    if (node->fence_contains(key)) {
+                        while (!node->key_range_contains(key)) {
+                            LeafPointer foster = node->get_foster_child();
+                            assert<1>(foster, "Traversal reached null pointer");
+                            foster->acquire_read();
+                            node->release_read();
+                            node = foster;
+                        }
+                    }
+                    else {
+                        node->release_read();
+                        node = LeafPointer{nullptr};
+                    }
+                }
+                if (!node) {
+                    node = root_level_->traverse(root_, key, false /* for_update */);
+                }
+
+                found[b + i] = node->find(key, &values[b + i]);
+                count += found[b + i];
+                node->release_read();
+            }
+        }
+
+        return count;
+    }
+
     bool remove(const K& key)
     {
+        EpochGuard guard {epochs_};
         LeafPointer node = root_level_->traverse(root_, key, true /* for_update */);
         bool res = node->template remove<false>(key);
+        bool underflown = res && Adoption::is_underflown(node);
         node->release_write();
+
+        if (underflown) { root_level_->merge_underflown(root_, key); }
         return res;
     }
 
+    /// \brief Yields a cursor positioned on the first key greater than or equal to the given one.
+    Cursor lower_bound(const K& key)
+    {
+        epochs_.enter();
+        LeafPointer node = Cursor::traverse(this, key);
+        return Cursor{this, node, key, nullptr};
+    }
+
+    /// \brief Yields a cursor that scans all keys in the half-open interval [lo, hi).
+    Cursor scan(const K& lo, const K& hi)
+    {
+        epochs_.enter();
+        LeafPointer node = Cursor::traverse(this, lo);
+        return Cursor{this, node, lo, &hi};
+    }
+
+    /**
+     * \brief Scans the whole tree with the tasks of the given pool, each of which scans a range of
+     * keys.
+     *
+     * The key space is split along the separator keys of the highest branch level that has enough
+     * of them (\see split_keys), so that the ranges are of similar size. For each range, a task
+     * invokes fn(range, cursor), where range is the number of the range in key order and cursor
+     * scans it. Other threads may modify the tree meanwhile, with the same guarantees as for scan.
+     *
+     * \returns the number of ranges, at most max_ranges, so that callers can keep per-range state
+     *      (e.g., partial aggregates) in an array of max_ranges entries
+     */
+    template <class Fn>
+    size_t parallel_scan(TaskPool& pool, size_t max_ranges, Fn fn)
+    {
+        std::vector<K> splits = split_keys(max_ranges);
+        size_t ranges = splits.size() + 1;
+
+        TaskPool::Group group;
+        for (size_t i = 0; i < ranges; i++) {
+            pool.submit([this, &splits, &fn, ranges, i] {
+                K lo = i > 0 ? splits[i - 1] : internal::GetMinimumKeyValue<K>();
+                Cursor cursor = i + 1 < ranges ? scan(lo, splits[i]) : lower_bound(lo);
+                fn(i, cursor);
+            }, group);
+        }
+        pool.wait(group);
+
+        return ranges;
+    }
+
+    /**
+     * \brief Yields up to max_ranges - 1 increasing keys that split the key space into ranges with
+     * similar numbers of records.
+     *
+     * The keys of the root are used if there are enough of them; otherwise, the keys of the level
+     * below, and so on up to the parents of the leaves. If there are more keys than needed, they
+     * are picked at even intervals.
+     */
+    std::vector<K> split_keys(size_t max_ranges)
+    {
+        assert<1>(max_ranges > 0, DBGINFO, "Invalid number of ranges");
+        EpochGuard guard {epochs_};
+        std::vector<K> keys;
+        for (unsigned depth = 0; depth < Level; depth++) {
+            keys.clear();
+            root_level_->collect_separators(root_, depth, keys);
+            if (keys.size() >= max_ranges) { break; }
+        }
+
+        // The first key is the minimum key value, and keys may be outdated by concurrent updates
+        std::sort(keys.begin(), keys.end());
+        keys.erase(std::unique(keys.begin(), keys.end()), keys.end());
+        if (!keys.empty()) { keys.erase(keys.begin()); }
+
+        if (keys.size() >= max_ranges) {
+            std::vector<K> picked;
+            for (size_t i = 1; i < max_ranges; i++) {
+                picked.push_back(keys[i * keys.size() / max_ranges]);
+            }
+            keys.swap(picked);
+        }
+        return keys;
+    }
+
     void print(std::ostream& out)
     {
         root_level_->print(root_, out);
     }
 
+    /**
+     * \brief Aggregates the statistics collected by all threads so far.
+     *
+     * With the default policy (NoStatistics), all values are zero.
+     */
+    StatisticsSnapshot statistics() const
+    {
+        return stats_.snapshot();
+    }
+
+    void reset_statistics()
+    {
+        stats_.reset();
+    }
+
 private:
 
+    friend class BtreeCursor<StaticBtree>;
+
+    /**
+     * \brief Common implementation of put, try_insert, update, and upsert.
+     *
+     * The leaf is found with a single traversal (or none, if the leaf hint matches) and searched
+     * only once, and no exception is thrown while it is latched.
+     */
+    template <PutMode Mode>
+    PutStatus put_pair(const K& key, const V& value)
+    {
+        EpochGuard guard {epochs_};
+        auto leaf_level = root_level_->leaf_level();
+        LeafPointer node = leaf_level->latch_hinted_leaf(key);
+        if (!node) { node = root_level_->traverse(root_, key, true /* for_update */); }
+        PutStatus status = node->template put<Mode>(key, value);
+        bool split = status == PutStatus::NoSpace;
+
+        while (status == PutStatus::NoSpace) {
+            // Node is full -- split required
+            LeafPointer new_node = root_level_->construct_leaf();
+            node = node->split_for_insertion(key, new_node);
+            status = node->template put<Mode>(key, value);
+            stats_.add(Counter::LeafSplits);
+        }
+
+        if (!split) { leaf_level->set_leaf_hint(node); }
+        node->release_write();
+        return status;
+    }
+
+    LeafPointer traverse(const K& key, bool for_update)
+    {
+        return root_level_->traverse(root_, key, for_update);
+    }
+
+    /// Maximum number of traversals performed by the adoption worker for a single request
+    static constexpr unsigned MaxAdoptionTraversals = 64;
+    /// Pause of the adoption worker after a failed adoption, before it retries
+    static constexpr unsigned AdoptionBackoffMicros = 20;
+
+    /**
+     * \brief Main loop of the adoption worker, which only runs with BackgroundAdoption.
+     *
+     * Each request is processed with read-only traversals, in which the policy adopts eagerly
+     * since it runs on the worker thread. A traversal adopts at most the first two nodes of a
+     * foster chain (\see BtreeLevel::traverse), so as long as the leaf reached has a foster child,
+     * the worker traverses again towards its foster key. An adoption that failed because a latch
+     * could not be upgraded (e.g., while a lookup holds the parent to queue a request) is retried
+     * with the same key after a pause. Operations that replace the nodes of the tree (e.g.,
+     * load) exclude the worker with the maintenance mutex.
+     */
+    void run_adoptions()
+    {
+        internal::is_adoption_worker() = true;
+        std::vector<K> batch;
+        while (adoption_queue_->take(batch)) {
+            std::lock_guard<std::mutex> lock {maintenance_mutex_};
+            for (const K& key : batch) {
+                K next = key;
+                for (unsigned i = 0; i < MaxAdoptionTraversals; i++) {
+                    internal::adoption_failed() = false;
+                    bool pending;
+                    {
+                        EpochGuard guard {epochs_};
+                        LeafPointer node = traverse(next, false /* for_update */);
+                        pending = node->get_foster_child();
+                        // A failed adoption is retried with the same key
+                        if (pending && !internal::adoption_failed()) {
+                            node->get_foster_key(&next);
+                        }
+                        node->release_read();
+                    }
+                    if (internal::adoption_failed()) {
+                        std::chrono::microseconds backoff {AdoptionBackoffMicros};
+                        std::this_thread::sleep_for(backoff);
+                        continue;
+                    }
+                    if (!pending) { break; }
+                }
+            }
+        }
+    }
+
+    /// Number of keys traversed in lockstep by multi_get
+    static constexpr size_t MultiGetBatch = 64;
+
+    EpochManager epochs_;
+    Statistics stats_;
     std::unique_ptr<BtreeLevelType<Level>> root_level_;
     NodePointer root_;
+
+    /// Requests taken by the adoption worker, which only exist with BackgroundAdoption
+    std::unique_ptr<AdoptionQueue<K>> adoption_queue_;
+    std::thread adoption_worker_;
+    /// Held by the adoption worker while it processes a batch, and by operations that save or
+    /// replace the nodes of the tree
+    std::mutex maintenance_mutex_;
 };
 
 } // namespace foster
@@ -0,0 +1,358 @@
+/*
+ * MIT License
+ *
+ * Copyright (c) 2016 Caetano Sauer
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy of this software and
+ * associated documentation files (the "Software"), to deal in the Software without restriction,
+ * including without limitation the rights to use, copy, modify, merge, publish, distribute,
+ * sublicense, and/or sell copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all copies or
+ * substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR IMPLIED, INCLUDING BUT
+ * NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM,
+ * DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+#ifndef FOSTER_BTREE_BUFFER_POOL_H
+#define FOSTER_BTREE_BUFFER_POOL_H
+
+/**
+ * \file buffer_pool.h
+ *
+ * Buffer pool that faults leaves in from a snapshot file on first access and evicts cold ones, so
+ * that trees larger than memory can be served with the hot set resident.
+ *
+ * The leaves of a snapshot loaded with a BufferedNodeManager are referenced by unswizzled pointers
+ * (\see SwizzlingPtr), which are resolved through the page table of a BufferPool. Branch nodes are
+ * still loaded eagerly, since they are few and always hot. Nodes created after loading, e.g., by
+ * splits, are allocated by the node manager as usual and referenced by swizzled pointers.
+ */
+
+#include <algorithm>
+#include <atomic>
+#include <cstring>
+#include <memory>
+#include <mutex>
+#include <type_traits>
+#include <unordered_map>
+#include <vector>
+
+#include "assertions.h"
+#include "exceptions.h"
+#include "node_mgr.h"
+#include "pointers.h"
+#include "snapshot.h"
+
+namespace foster {
+
+/**
+ * \brief Page table and frames of the leaves of one snapshot section.
+ *
+ * A page is faulted in by the first thread that dereferences a pointer to it (\see fix), which
+ * copies the page image into a newly allocated node. Concurrent faults of the same page are
+ * resolved by keeping the first frame installed.
+ *
+ * Each page has a reference bit, which is set on every access and cleared by the clock hand of
+ * evict, so that only pages that were not accessed during a whole revolution (i.e., cold pages)
+ * are evicted. Only clean pages -- whose image is still identical to the one in the file -- are
+ * evicted, since there is no write path back to the file. Pages modified since they were faulted
+ * in remain resident until they are destroyed.
+ *
+ * \tparam Node The leaf node type, whose NodePointer must be a SwizzlingPtr.
+ */
+template <class Node>
+class BufferPool
+{
+public:
+
+    using NodePointer = typename Node::NodePointer;
+
+    BufferPool(std::shared_ptr<const SnapshotReader> reader, unsigned level) :
+        reader_(std::move(reader)),
+        level_(level),
+        page_count_(reader_->page_count(level, Node::PageBytes)),
+        slots_(new Slot[page_count_]),
+        live_pages_(page_count_),
+        resident_pages_(0),
+        clock_hand_(0)
+    {
+        id_ = internal::PageResolvers::add(&BufferPool::resolve, this);
+        if (id_ == internal::PageResolvers::MaxCount) {
+            throw SnapshotException(reader_->path(), "too many buffer pools");
+        }
+    }
+
+    /// \brief Frees all resident frames. No pointer to a page of this pool may be dereferenced.
+    ~BufferPool()
+    {
+        internal::PageResolvers::remove(id_);
+        for (size_t i = 0; i < page_count_; i++) { delete slots_[i].node.load(); }
+    }
+
+    BufferPool(const BufferPool&) = delete;
+    BufferPool& operator=(const BufferPool&) = delete;
+
+    unsigned id() const { return id_; }
+
+    size_t page_count() const { return page_count_; }
+
+    /// Number of pages that were not destroyed yet, whether resident or not
+    size_t live_pages() const { return live_pages_; }
+
+    size_t resident_pages() const { return resident_pages_; }
+
+    NodePointer page_pointer(uint64_t page) const
+    {
+        return NodePointer::unswizzled(id_, page);
+    }
+
+    /// \brief Returns the frame of a page, faulting it in if it is not resident
+    Node* fix(uint64_t page)
+    {
+        assert<1>(page < page_count_, "Page number out of bounds");
+        Slot& slot = slots_[page];
+        Node* node = slot.node.load(std::memory_order_acquire);
+        if (!node) { return fault(page); }
+
+        // Avoid writing to the cache line of the slot if the page is already marked as hot
+        if (!slot.referenced.load(std::memory_order_relaxed)) {
+            slot.referenced.store(true, std::memory_order_relaxed);
+        }
+        return node;
+    }
+
+    /**
+     * \brief Destroys a page, which must have been unlinked from the tree, freeing its frame if
+     * it is resident.
+     */
+    void forget(uint64_t page)
+    {
+        std::lock_guard<std::mutex> lock {mutex_};
+        Node* node = slots_[page].node.exchange(nullptr);
+        if (node) { drop_frame(node); }
+        live_pages_--;
+    }
+
+    /// \brief Destroys the page whose frame is given, returning false if it is not a frame of this pool
+    bool forget_frame(Node* node)
+    {
+        std::lock_guard<std::mutex> lock {mutex_};
+        auto it = frames_.find(node);
+        if (it == frames_.end()) { return false; }
+        slots_[it->second].node.store(nullptr);
+        drop_frame(node);
+        live_pages_--;
+        return true;
+    }
+
+    /**
+     * \brief Evicts up to max_pages cold and clean pages, sweeping the clock hand over at most one
+     * revolution (\see BufferPool).
+     *
+     * A page is cold if it was not accessed since the previous sweep, so that calling this
+     * periodically keeps the pages accessed in each period resident.
+     *
+     * No other thread may access the tree, since frames are freed right away; pointers to evicted
+     * pages remain valid and fault the page in again on the next access.
+     *
+     * \returns the number of pages evicted
+     */
+    size_t evict(size_t max_pages)
+    {
+        std::lock_guard<std::mutex> lock {mutex_};
+        std::unique_ptr<Node> scratch {new Node};
+        std::vector<char> image(Node::PageBytes);
+
+        size_t evicted = 0;
+        for (size_t step = 0; step < page_count_; step++) {
+            if (evicted == max_pages || resident_pages_ == 0) { break; }
+
+            uint64_t page = clock_hand_;
+            clock_hand_ = (clock_hand_ + 1) % page_count_;
+            Slot& slot = slots_[page];
+            Node* node = slot.node.load();
+            if (!node) { continue; }
+            if (slot.referenced.exchange(false, std::memory_order_relaxed)) { continue; }
+
+            if (is_clean(page, *node, *scratch, image)) {
+                slot.node.store(nullptr);
+                drop_frame(node);
+                evicted++;
+            }
+        }
+        return evicted;
+    }
+
+private:
+
+    struct Slot
+    {
+        std::atomic<Node*> node {nullptr};
+        /// Reference bit, i.e., whether the page was accessed since the clock hand last passed
+        std::atomic<bool> referenced {false};
+    };
+
+    std::shared_ptr<const SnapshotReader> reader_;
+    const unsigned level_;
+    const size_t page_count_;
+    std::unique_ptr<Slot[]> slots_;
+    unsigned id_;
+
+    /// Protects the fields below as well as the installation and removal of frames
+    std::mutex mutex_;
+    /// Page number of each resident frame, for nodes destroyed by address (\see forget_frame)
+    std::unordered_map<const Node*, uint64_t> frames_;
+    size_t live_pages_;
+    size_t resident_pages_;
+    uint64_t clock_hand_;
+
+    static void* resolve(void* context, uint64_t page)
+    {
+        return static_cast<BufferPool*>(context)->fix(page);
+    }
+
+    Node* fault(uint64_t page)
+    {
+        // The page is copied without holding the mutex, so that faults of different pages overlap
+        std::unique_ptr<Node> node {new Node};
+        node->read_page(reader_->page(level_, page));
+        NodePointer foster = node->get_foster_child();
+        if (foster) {
+            uint64_t foster_page = internal::pointer_to_page(foster);
+            reader_->check_page_number(foster_page, page_count_);
+            node->set_foster_ptr(page_pointer(foster_page));
+        }
+
+        std::lock_guard<std::mutex> lock {mutex_};
+        Slot& slot = slots_[page];
+        Node* current = slot.node.load();
+        if (current) { return current; }
+
+        frames_[node.get()] = page;
+        resident_pages_++;
+        slot.referenced.store(true, std::memory_order_relaxed);
+        slot.node.store(node.get(), std::memory_order_release);
+        return node.release();
+    }
+
+    void drop_frame(Node* node)
+    {
+        frames_.erase(node);
+        resident_pages_--;
+        delete node;
+    }
+
+    /// \brief Whether the image of a frame, with its foster pointer encoded back, matches the file
+    bool is_clean(uint64_t page, const Node& node, Node& scratch, std::vector<char>& image) const
+    {
+        node.write_page(image.data());
+        NodePointer foster = node.get_foster_child();
+        if (foster) {
+            // A foster child created in memory means that the page was split
+            if (foster.is_swizzled() || foster.pool_id() != id_) { return false; }
+            scratch.read_page(image.data());
+            scratch.set_foster_ptr(internal::page_to_pointer<NodePointer>(foster.page_id()));
+            scratch.write_page(image.data());
+        }
+        return memcmp(image.data(), reader_->page(level_, page), Node::PageBytes) == 0;
+    }
+};
+
+/**
+ * \brief Node manager that loads the leaves of snapshots lazily, through buffer pools.
+ *
+ * Nodes are constructed as in BtreeNodeManager, but a node being destroyed may also be a page of
+ * a buffer pool, in which case it is handed back to its pool. One pool exists for each snapshot
+ * whose pages are still part of the tree; pools are dropped once all their pages are destroyed.
+ *
+ * Only leaves are loaded lazily, so that the node manager can be given to all levels of a tree;
+ * branch levels never attach a snapshot and behave as with BtreeNodeManager.
+ */
+template <
+    class Node,
+    class IdGenerator,
+    class Allocator = std::allocator<Node>
+>
+class BufferedNodeManager : public BtreeNodeManager<Node, IdGenerator, Allocator>
+{
+public:
+
+    using SuperType = BtreeNodeManager<Node, IdGenerator, Allocator>;
+    using NodePointer = typename Node::NodePointer;
+
+    /// Whether snapshots are loaded lazily (\see internal::LoadsLazily)
+    static constexpr bool LazyLoading = !Node::IsBranch;
+
+    void destroy_node(NodePointer node)
+    {
+        for (auto& pool : pools_) {
+            if (!node.is_swizzled()) {
+                if (node.pool_id() != pool->id()) { continue; }
+                pool->forget(node.page_id());
+                return;
+            }
+            if (pool->forget_frame(&(*node))) { return; }
+        }
+        SuperType::destroy_node(node);
+    }
+
+    /**
+     * \brief Creates a buffer pool for a section of a snapshot and returns pointers to all its
+     * pages in nodes, without reading any of them.
+     *
+     * No other thread may access the tree.
+     */
+    void attach_snapshot(const std::shared_ptr<const SnapshotReader>& reader, unsigned level,
+            std::vector<NodePointer>& nodes)
+    {
+        pools_.erase(std::remove_if(pools_.begin(), pools_.end(),
+                    [] (const std::unique_ptr<BufferPool<Node>>& p) { return p->live_pages() == 0; }),
+                pools_.end());
+
+        std::unique_ptr<BufferPool<Node>> pool {new BufferPool<Node>(reader, level)};
+        nodes.reserve(pool->page_count());
+        for (size_t i = 0; i < pool->page_count(); i++) { nodes.push_back(pool->page_pointer(i)); }
+        pools_.push_back(std::move(pool));
+    }
+
+    /// \brief Evicts up to max_pages cold pages from the pools (\see BufferPool::evict)
+    size_t evict(size_t max_pages)
+    {
+        size_t evicted = 0;
+        for (auto& pool : pools_) { evicted += pool->evict(max_pages - evicted); }
+        return evicted;
+    }
+
+    size_t resident_pages() const
+    {
+        size_t count = 0;
+        for (auto& pool : pools_) { count += pool->resident_pages(); }
+        return count;
+    }
+
+private:
+
+    std::vector<std::unique_ptr<BufferPool<Node>>> pools_;
+};
+
+namespace internal {
+
+/// Whether a node manager loads snapshots lazily (\see BufferedNodeManager)
+template <class NodeMgr, class = void>
+struct LoadsLazily : std::false_type {};
+
+template <class NodeMgr>
+struct LoadsLazily<NodeMgr, typename std::enable_if<NodeMgr::LazyLoading>::type>
+    : std::true_type {};
+
+} // namespace internal
+
+} // namespace foster
+
+#endif
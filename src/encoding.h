@@ -38,7 +38,8 @@
  * These functions only support scalar types for fixed-length keys and payloads and string for
  * variable length. Other variable-length types like vector result in a compilation error due to a
  * static assertion failure. This is not considered a serious restriction though, as strings can
- * easily be used to encode binary data in C++.
+ * easily be used to encode binary data in C++. Composite keys are supported as tuples of such types
+ * (\see TupleEncoder and NormalizedEncoder).
  */
 
 #include <climits>
@@ -46,8 +47,12 @@
 #include <cstdint>
 #include <cstring>
 #include <string>
+#include <tuple>
 
+#include "alloc_blob.h"
 #include "assertions.h"
+#include "key_view.h"
+#include "metaprog.h"
 
 using std::string;
 
@@ -135,12 +140,13 @@ struct PoormanPrefixing
  * \brief Specialization of PoormanPrefixing for string keys.
  *
  * This is probably the common case, where keys are of variable length. In this case, the first
- * sizeof(PMNK_Type) bytes are extracted and converted into little-endian representation.
+ * sizeof(PMNK_Type) bytes are extracted and converted into little-endian representation. The key is
+ * taken as a view, so that PMNKs of keys encoded in a node can be extracted without copying them.
  */
 template <class PMNK_Type>
 struct PoormanPrefixing<string, PMNK_Type>
 {
-    PMNK_Type operator()(const string& key)
+    PMNK_Type operator()(const KeyView& key)
     {
         union {
             unsigned char bytes[sizeof(PMNK_Type)];
@@ -158,6 +164,150 @@ struct PoormanPrefixing<string, PMNK_Type>
     }
 };
 
+namespace internal {
+
+/**
+ * \brief Destination of the bytes of a normalized key, which ignores bytes beyond its capacity.
+ *
+ * A PMNK only requires the first few bytes of a normalized key, so the rest is never produced.
+ */
+struct NormalizedKeyWriter
+{
+    unsigned char* dest;
+    size_t remaining;
+
+    bool full() const { return remaining == 0; }
+
+    void put(unsigned char byte)
+    {
+        if (remaining > 0) { *dest++ = byte; remaining--; }
+    }
+};
+
+/// Writes an unsigned integer with the most significant byte first, i.e., in memcmp order
+template <class U>
+void put_big_endian(U u, NormalizedKeyWriter& w)
+{
+    for (size_t i = sizeof(U); i > 0 && !w.full(); i--) {
+        w.put(static_cast<unsigned char>(u >> (8 * (i - 1))));
+    }
+}
+
+/*
+ * The normalize functions below write the normalized form of a value, whose bytes compare with
+ * memcmp in the same order as the value itself. The last argument tells whether other values follow
+ * in the same key (i.e., the value is not the last field of a tuple), in which case a string must
+ * be terminated so that it does not run into the next field.
+ */
+
+template <class T>
+meta::EnableIf<std::is_integral<T>::value && std::is_unsigned<T>::value>
+normalize(const T& value, NormalizedKeyWriter& w, bool)
+{
+    put_big_endian(value, w);
+}
+
+/// Signed integers are stored in two's complement, so flipping the sign bit restores their order
+template <class T>
+meta::EnableIf<std::is_integral<T>::value && std::is_signed<T>::value>
+normalize(const T& value, NormalizedKeyWriter& w, bool)
+{
+    using U = typename std::make_unsigned<T>::type;
+    U u = static_cast<U>(value) ^ (U(1) << (sizeof(T) * CHAR_BIT - 1));
+    put_big_endian(u, w);
+}
+
+/**
+ * IEEE 754 numbers are ordered by their bits if positive, and reversely if negative. Thus, the sign
+ * bit is set on positive numbers and all bits are flipped on negative ones. Negative zero is first
+ * converted to zero, because both are equal.
+ */
+template <class T>
+meta::EnableIf<std::is_floating_point<T>::value>
+normalize(const T& value, NormalizedKeyWriter& w, bool)
+{
+    using U = meta::UnsignedInteger<sizeof(T)>;
+    static_assert(sizeof(U) == sizeof(T), "Unsupported floating-point type");
+
+    T v = value == 0 ? T(0) : value;
+    U u;
+    memcpy(&u, &v, sizeof(T));
+    U sign = U(1) << (sizeof(T) * CHAR_BIT - 1);
+    u = (u & sign) ? U(~u) : U(u | sign);
+    put_big_endian(u, w);
+}
+
+/**
+ * A string at the end of a key is normalized into its own bytes. Otherwise, a terminator 0x00 0x00
+ * is appended, and every zero byte is escaped as 0x00 0xFF, so that a shorter string still sorts
+ * before any longer string with the same prefix, regardless of the fields that follow.
+ */
+inline void normalize(const KeyView& value, NormalizedKeyWriter& w, bool terminate)
+{
+    for (size_t i = 0; i < value.length() && !w.full(); i++) {
+        unsigned char c = value[i];
+        w.put(c);
+        if (terminate && c == 0) { w.put(0xFF); }
+    }
+    if (terminate) { w.put(0); w.put(0); }
+}
+
+template <class... T>
+void normalize(const std::tuple<T...>& value, NormalizedKeyWriter& w, bool terminate);
+
+template <size_t I, class... T>
+meta::EnableIf<I == sizeof...(T)>
+normalize_fields(const std::tuple<T...>&, NormalizedKeyWriter&, bool) {}
+
+template <size_t I, class... T>
+meta::EnableIf<(I < sizeof...(T))>
+normalize_fields(const std::tuple<T...>& value, NormalizedKeyWriter& w, bool terminate)
+{
+    normalize(std::get<I>(value), w, terminate || I + 1 < sizeof...(T));
+    normalize_fields<I + 1>(value, w, terminate);
+}
+
+/// Tuples are normalized by concatenating their fields, i.e., they are ordered lexicographically
+template <class... T>
+void normalize(const std::tuple<T...>& value, NormalizedKeyWriter& w, bool terminate)
+{
+    normalize_fields<0>(value, w, terminate);
+}
+
+} // namespace internal
+
+/**
+ * \brief Prefixing function that extracts the first bytes of a normalized key as PMNK.
+ *
+ * Unlike PoormanPrefixing, the resulting PMNK preserves the order of signed integers,
+ * floating-point numbers, and tuples of those and strings (\see internal::normalize), so that a
+ * difference in the PMNKs of two keys always decides their order. A comparison of full keys is then
+ * only required when PMNKs are equal.
+ *
+ * The PMNK type must be an unsigned integer; its size is independent of the key size. With an 8-byte
+ * PMNK, most comparisons of string keys are decided on the slot array alone.
+ */
+template <class K, class PMNK_Type>
+struct NormalizedPrefixing
+{
+    static_assert(std::is_integral<PMNK_Type>::value && std::is_unsigned<PMNK_Type>::value,
+            "The PMNK type of normalized keys must be an unsigned integer");
+
+    PMNK_Type operator()(const typename KeyViewOf<K>::type& key)
+    {
+        // Missing bytes (e.g., of short strings) are zero, which keeps prefixes before longer keys
+        unsigned char bytes[sizeof(PMNK_Type)] = {0};
+        internal::NormalizedKeyWriter w {bytes, sizeof(PMNK_Type)};
+        internal::normalize(key, w, false);
+
+        PMNK_Type prefix = 0;
+        for (size_t i = 0; i < sizeof(PMNK_Type); i++) {
+            prefix = static_cast<PMNK_Type>(prefix << CHAR_BIT) | bytes[i];
+        }
+        return prefix;
+    }
+};
+
 template <class T>
 class DummyEncoder
 {
@@ -226,7 +376,7 @@ public:
     using LengthType = uint16_t;
 
     /** \brief Returns encoded length of a decoded value */
-    static size_t get_payload_length(const string& value)
+    static size_t get_payload_length(const KeyView& value)
     {
         return sizeof(LengthType) + value.length();
     }
@@ -238,7 +388,7 @@ public:
     }
 
     /** \brief Encodes a string using a length field followed by the contents */
-    static char* encode(const string& value, char* dest)
+    static char* encode(const KeyView& value, char* dest)
     {
         *(reinterpret_cast<LengthType*>(dest)) = value.length();
         dest += sizeof(LengthType);
@@ -261,26 +411,155 @@ public:
         }
         return src + sizeof(LengthType) + length;
     }
+
+    /// \brief Decodes a view on the encoded string, i.e., without copying its contents
+    static const char* decode(const char* src, KeyView* value_p)
+    {
+        LengthType length = *(reinterpret_cast<const LengthType*>(src));
+        if (value_p) {
+            *value_p = KeyView{src + sizeof(LengthType), length};
+        }
+        return src + sizeof(LengthType) + length;
+    }
+};
+
+/**
+ * \brief Encoder for string values that stores values longer than a threshold out of line.
+ *
+ * Values up to Threshold bytes are encoded as in VariableLengthEncoder. Longer values are copied
+ * into a blob obtained from the given allocator (\see BlobAllocator), and only a reference to it
+ * (a pointer and a length) is stored in the node. This has two purposes: values larger than a
+ * node, or than the 16-bit length field, can be stored at all; and medium-sized values do not
+ * leave just a handful of records in each leaf, which would ruin the fan-out of the tree.
+ *
+ * Decoding into a KeyView yields a view on the blob, i.e., it does not copy the value. Like views
+ * on encoded keys, it is only valid while the node is latched and the value is not overwritten.
+ *
+ * Since the payload owns the blob, this encoder has a release method, which KeyValueArray invokes
+ * when a payload is discarded, i.e., when a value is overwritten, when a removed pair is purged,
+ * and when the array is destroyed. Payloads moved between arrays carry their blob along.
+ *
+ * \tparam Threshold Length (in bytes) of the longest value stored inside the node
+ * \tparam Allocator Class with static allocate and deallocate methods for blobs
+ */
+template <size_t Threshold = 256, class Allocator = BlobAllocator<>>
+class OverflowEncoder
+{
+public:
+
+    using Type = string;
+    using LengthType = uint16_t;
+
+    /// Length field of an overflow value, which is followed by a BlobRef
+    static constexpr LengthType OverflowMarker = ~LengthType(0);
+
+    static_assert(Threshold < OverflowMarker, "OverflowEncoder: threshold too large");
+
+    /** \brief Returns encoded length of a decoded value */
+    static size_t get_payload_length(const KeyView& value)
+    {
+        if (value.length() > Threshold) { return sizeof(LengthType) + sizeof(BlobRef); }
+        return sizeof(LengthType) + value.length();
+    }
+
+    /** \brief Returns length of an encoded value */
+    static size_t get_payload_length(void* ptr)
+    {
+        LengthType length = *(reinterpret_cast<LengthType*>(ptr));
+        if (length == OverflowMarker) { return sizeof(LengthType) + sizeof(BlobRef); }
+        return sizeof(LengthType) + length;
+    }
+
+    /** \brief Encodes a string inline or, if longer than the threshold, into a new blob */
+    static char* encode(const KeyView& value, char* dest)
+    {
+        if (value.length() <= Threshold) {
+            *(reinterpret_cast<LengthType*>(dest)) = value.length();
+            dest += sizeof(LengthType);
+            memcpy(dest, value.data(), value.length());
+            return dest + value.length();
+        }
+
+        BlobRef ref {Allocator::allocate(value.length()), value.length()};
+        memcpy(ref.data, value.data(), value.length());
+        *(reinterpret_cast<LengthType*>(dest)) = OverflowMarker;
+        dest += sizeof(LengthType);
+        // The reference is not necessarily aligned inside the payload
+        memcpy(dest, &ref, sizeof(BlobRef));
+        return dest + sizeof(BlobRef);
+    }
+
+    static const char* decode(const char* src, string* value_p)
+    {
+        KeyView view;
+        src = decode(src, &view);
+        if (value_p) { value_p->assign(view.data(), view.length()); }
+        return src;
+    }
+
+    /// \brief Decodes a view on the value, which points into the blob if stored out of line
+    static const char* decode(const char* src, KeyView* value_p)
+    {
+        LengthType length = *(reinterpret_cast<const LengthType*>(src));
+        src += sizeof(LengthType);
+        if (length != OverflowMarker) {
+            if (value_p) { *value_p = KeyView{src, length}; }
+            return src + length;
+        }
+
+        if (value_p) {
+            BlobRef ref;
+            memcpy(&ref, src, sizeof(BlobRef));
+            *value_p = KeyView{ref.data, ref.length};
+        }
+        return src + sizeof(BlobRef);
+    }
+
+    /// \brief Frees the blob of an encoded value, if any
+    static void release(void* ptr)
+    {
+        const char* src = reinterpret_cast<const char*>(ptr);
+        if (!is_overflow(src)) { return; }
+        BlobRef ref;
+        memcpy(&ref, src + sizeof(LengthType), sizeof(BlobRef));
+        Allocator::deallocate(ref.data, ref.length);
+    }
+
+    /// \brief Whether an encoded value is stored out of line
+    static bool is_overflow(const void* ptr)
+    {
+        return *(reinterpret_cast<const LengthType*>(ptr)) == OverflowMarker;
+    }
+
+private:
+
+    struct BlobRef {
+        char* data;
+        size_t length;
+    };
 };
 
 /**
  * \brief Base class of all encoders which use a common PMNK extraction mechanism.
  */
-template <class K, class PMNK_Type = K>
+template <class K, class PMNK_Type = K,
+         template <class, class> class Prefixing = PoormanPrefixing>
 class PMNKEncoder
 {
 public:
     /**
      * The function is picked at compile time based on the type parameters. If key and PMNK are of
-     * the same type, no conversion is required and the dummy NoPrefixing is used. Otherwise,
-     * PoormanPrefixing, the default PMNK extractor, is chosen.
+     * the same type, no conversion is required and the dummy NoPrefixing is used. Otherwise, the
+     * given PMNK extractor is chosen -- PoormanPrefixing by default.
      */
     using PrefixingFunction = typename
         std::conditional<std::is_same<PMNK_Type, K>::value,
         NoPrefixing<K>,
-        PoormanPrefixing<K, PMNK_Type>>::type;
+        Prefixing<K, PMNK_Type>>::type;
+
+    using KeyView = typename KeyViewOf<K>::type;
 
-    static PMNK_Type get_pmnk(const K& key)
+    static PMNK_Type get_pmnk(const KeyView& key)
     {
         // TODO: compiler should be able to inline this -- verify!
         return PrefixingFunction{}(key);
@@ -288,11 +567,13 @@ public:
 };
 
 template <class KeyEncoder, class ValueEncoder,
-         class PMNK_Type = typename KeyEncoder::Type>
-class CompoundEncoder : public PMNKEncoder<typename KeyEncoder::Type, PMNK_Type>
+         class PMNK_Type = typename KeyEncoder::Type,
+         template <class, class> class Prefixing = PoormanPrefixing>
+class CompoundEncoder : public PMNKEncoder<typename KeyEncoder::Type, PMNK_Type, Prefixing>
 {
     using K = typename KeyEncoder::Type;
     using V = typename ValueEncoder::Type;
+    using KeyView = typename KeyViewOf<K>::type;
 
     using ActualKeyEncoder = typename std::conditional<std::is_same<K, PMNK_Type>::value,
         DummyEncoder<K>, KeyEncoder>::type;
@@ -300,7 +581,7 @@ class CompoundEncoder : public PMNKEncoder<typename KeyEncoder::Type, PMNK_Type>
 public:
 
     /** \brief Returns encoded length of a key-value pair */
-    static size_t get_payload_length(const K& key, const V& value)
+    static size_t get_payload_length(const KeyView& key, const V& value)
     {
         return ActualKeyEncoder::get_payload_length(key) + ValueEncoder::get_payload_length(value);
     }
@@ -314,8 +595,21 @@ public:
         return ksize + vsize;
     }
 
+    /**
+     * \brief Releases resources owned by an encoded payload that is discarded.
+     *
+     * Only available if the value encoder owns resources outside of the payload (\see
+     * OverflowEncoder), which is detected by KeyValueArray to skip the call otherwise.
+     */
+    template <class E = ValueEncoder>
+    static auto release(void* addr) -> decltype(E::release(addr))
+    {
+        char* p = reinterpret_cast<char*>(addr) + ActualKeyEncoder::get_payload_length(addr);
+        E::release(p);
+    }
+
     /** \breif Encodes a given key-value pair into a given memory area */
-    static void encode(const K& key, const V& value, void* dest)
+    static void encode(const KeyView& key, const V& value, void* dest)
     {
         char* p = reinterpret_cast<char*>(dest);
         p = ActualKeyEncoder::encode(key, p);
@@ -335,11 +629,39 @@ public:
         ValueEncoder::decode(p, value);
 
         // If we are not encoding key explicitly, but just reusing PMNK, we assign it here
-        if (key && std::is_same<K, PMNK_Type>::value) {
+        assign_pmnk(key, pmnk, std::is_same<K, PMNK_Type>{});
+    }
+
+    /**
+     * \brief Same as decode, but the key is decoded into a view on the given memory area.
+     *
+     * For string keys, this avoids copying the key into a string, e.g., when it is only required
+     * for a comparison. The view is only valid as long as the encoded payload is not modified.
+     */
+    static void decode_view(const void* src, KeyView* key, V* value = nullptr,
+            PMNK_Type* pmnk = nullptr)
+    {
+        const char* p = reinterpret_cast<const char*>(src);
+        p = ActualKeyEncoder::decode(p, key);
+        ValueEncoder::decode(p, value);
+        assign_pmnk(key, pmnk, std::is_same<K, PMNK_Type>{});
+    }
+
+private:
+
+    // A key (or its view) may not be assignable from a PMNK of a different type, so this must be
+    // resolved statically
+    template <class Key>
+    static void assign_pmnk(Key* key, PMNK_Type* pmnk, std::true_type)
+    {
+        if (key) {
             assert<1>(pmnk, "PMNK required to decode this key");
             *key = *pmnk;
         }
     }
+
+    template <class Key>
+    static void assign_pmnk(Key*, PMNK_Type*, std::false_type) {}
 };
 
 template <class K, class V, class PMNK_Type = K>
@@ -362,6 +684,137 @@ class DefaultEncoder<string, string, PMNK_Type> :
     public CompoundEncoder<VariableLengthEncoder<string>, VariableLengthEncoder<string>, PMNK_Type>
 {};
 
+template <class... T>
+class TupleEncoder;
+
+/**
+ * \brief Type function that picks the encoder of a single key or value type.
+ *
+ * Strings use VariableLengthEncoder, tuples use TupleEncoder, and any other type is assigned.
+ */
+template <class T>
+struct FieldEncoder { using type = AssignmentEncoder<T>; };
+
+template <>
+struct FieldEncoder<string> { using type = VariableLengthEncoder<string>; };
+
+template <class... T>
+struct FieldEncoder<std::tuple<T...>> { using type = TupleEncoder<T...>; };
+
+/**
+ * \brief Encodes a tuple by concatenating the encoding of each of its fields.
+ *
+ * This supports composite keys such as std::tuple<string, int>, which compare lexicographically.
+ */
+template <class... T>
+class TupleEncoder
+{
+public:
+
+    using Type = std::tuple<T...>;
+
+    /** \brief Returns encoded length of a decoded value */
+    static size_t get_payload_length(const Type& value)
+    {
+        return decoded_length<0>(value);
+    }
+
+    /** \brief Returns length of an encoded value */
+    static size_t get_payload_length(void* ptr)
+    {
+        char* p = reinterpret_cast<char*>(ptr);
+        return skip_fields<0>(p) - p;
+    }
+
+    static char* encode(const Type& value, char* dest)
+    {
+        return encode_fields<0>(value, dest);
+    }
+
+    static const char* decode(const char* src, Type* value_p)
+    {
+        return decode_fields<0>(src, value_p);
+    }
+
+private:
+
+    template <size_t I>
+    using Encoder = typename FieldEncoder<typename std::tuple_element<I, Type>::type>::type;
+
+    template <size_t I>
+    static meta::EnableIf<I == sizeof...(T), size_t> decoded_length(const Type&) { return 0; }
+
+    template <size_t I>
+    static meta::EnableIf<(I < sizeof...(T)), size_t> decoded_length(const Type& value)
+    {
+        return Encoder<I>::get_payload_length(std::get<I>(value)) + decoded_length<I + 1>(value);
+    }
+
+    template <size_t I>
+    static meta::EnableIf<I == sizeof...(T), char*> skip_fields(char* p) { return p; }
+
+    template <size_t I>
+    static meta::EnableIf<(I < sizeof...(T)), char*> skip_fields(char* p)
+    {
+        return skip_fields<I + 1>(p + Encoder<I>::get_payload_length(static_cast<void*>(p)));
+    }
+
+    template <size_t I>
+    static meta::EnableIf<I == sizeof...(T), char*> encode_fields(const Type&, char* dest)
+    {
+        return dest;
+    }
+
+    template <size_t I>
+    static meta::EnableIf<(I < sizeof...(T)), char*> encode_fields(const Type& value, char* dest)
+    {
+        return encode_fields<I + 1>(value, Encoder<I>::encode(std::get<I>(value), dest));
+    }
+
+    template <size_t I>
+    static meta::EnableIf<I == sizeof...(T), const char*> decode_fields(const char* src, Type*)
+    {
+        return src;
+    }
+
+    template <size_t I>
+    static meta::EnableIf<(I < sizeof...(T)), const char*> decode_fields(const char* src,
+            Type* value_p)
+    {
+        using FieldType = typename std::tuple_element<I, Type>::type;
+        FieldType* field = value_p ? &std::get<I>(*value_p) : nullptr;
+        return decode_fields<I + 1>(Encoder<I>::decode(src, field), value_p);
+    }
+};
+
+/**
+ * \brief Encoder whose PMNKs are prefixes of order-preserving normalized keys.
+ *
+ * Supports scalar, string, and tuple keys (\see NormalizedPrefixing). The default 8-byte PMNK is
+ * the size of choice for string keys, since shorter PMNKs are mostly equal on realistic keys.
+ */
+template <class K, class V, class PMNK_Type = uint64_t>
+class NormalizedEncoder :
+    public CompoundEncoder<typename FieldEncoder<K>::type, typename FieldEncoder<V>::type,
+        PMNK_Type, NormalizedPrefixing>
+{};
+
+/**
+ * \brief Same as DefaultEncoder, except that string values longer than Threshold are stored out of
+ * line (\see OverflowEncoder).
+ *
+ * Other value types are encoded as usual, so the same encoder can be used for branch nodes, whose
+ * values are child pointers.
+ */
+template <class K, class V, class PMNK_Type = K, size_t Threshold = 256,
+         class Allocator = BlobAllocator<>>
+class OverflowDefaultEncoder :
+    public CompoundEncoder<typename FieldEncoder<K>::type,
+        typename std::conditional<std::is_same<V, string>::value,
+            OverflowEncoder<Threshold, Allocator>, typename FieldEncoder<V>::type>::type,
+        PMNK_Type>
+{};
+
 } // namespace foster
 
 #endif
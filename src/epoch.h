@@ -0,0 +1,254 @@
+/*
+ * MIT License
+ *
+ * Copyright (c) 2016 Caetano Sauer
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy of this software and
+ * associated documentation files (the "Software"), to deal in the Software without restriction,
+ * including without limitation the rights to use, copy, modify, merge, publish, distribute,
+ * sublicense, and/or sell copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all copies or
+ * substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR IMPLIED, INCLUDING BUT
+ * NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM,
+ * DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+#ifndef FOSTER_BTREE_EPOCH_H
+#define FOSTER_BTREE_EPOCH_H
+
+/**
+ * \file epoch.h
+ *
+ * Epoch-based memory reclamation, used to free nodes that might still be read by other threads.
+ */
+
+#include <atomic>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+#include "assertions.h"
+
+namespace foster {
+
+/**
+ * \brief Epoch-based reclamation (EBR) of objects removed from a concurrent data structure.
+ *
+ * Threads *enter* an epoch before accessing the data structure and *leave* it afterwards (\see
+ * EpochGuard). An object that is unlinked from the data structure (e.g., a node merged into its
+ * neighbor) cannot be freed right away, because threads that entered before the unlink might still
+ * hold pointers to it. Instead, it is *retired* into a limbo list of the retiring thread, together
+ * with the current global epoch.
+ *
+ * The global epoch is advanced when all threads currently inside an epoch have observed its
+ * current value. Once the global epoch is two steps ahead of the epoch of a retired object, no
+ * thread can still hold a pointer to it, and its deleter is invoked. Limbo lists are processed
+ * periodically by the retiring threads themselves, so no background thread is required.
+ *
+ * Each thread has its own record per manager, registered on first use. Records are only freed
+ * with the manager, which also invokes the deleters of all objects still in limbo. Thus, the
+ * objects referenced by a deleter (e.g., a node manager) must outlive the epoch manager, and no
+ * thread may access it during destruction.
+ */
+class EpochManager
+{
+public:
+
+    /// Function that frees a retired object, given a context pointer (e.g., the node manager)
+    using Deleter = void (*)(void* context, void* object);
+
+    /// Number of retired objects in a thread's limbo list that triggers an attempt to reclaim
+    static constexpr size_t ReclaimThreshold = 64;
+
+    EpochManager() : id_(next_id()), global_epoch_(1) {}
+
+    EpochManager(const EpochManager&) = delete;
+    EpochManager& operator=(const EpochManager&) = delete;
+
+    ~EpochManager() { drain(); }
+
+    /**
+     * \brief Invokes the deleters of all retired objects, regardless of their epochs.
+     *
+     * This is meant for the destruction of the data structure, when no thread is inside an epoch.
+     */
+    void drain()
+    {
+        std::lock_guard<std::mutex> lock(records_mutex_);
+        for (auto& r : records_) {
+            assert<1>(r->epoch.load() == 0, "Draining epoch manager while a thread is inside");
+            for (auto& e : r->limbo) { e.deleter(e.context, e.object); }
+            r->limbo.clear();
+        }
+    }
+
+    /// \brief Enters an epoch on the calling thread. Calls may be nested.
+    void enter()
+    {
+        ThreadRecord& r = record();
+        if (r.depth++ == 0) {
+            r.epoch.store(global_epoch_.load());
+            // Announcement must be visible before any pointer is read from the data structure
+            std::atomic_thread_fence(std::memory_order_seq_cst);
+        }
+    }
+
+    /// \brief Leaves the epoch entered by the matching call to enter()
+    void leave()
+    {
+        ThreadRecord& r = record();
+        assert<1>(r.depth > 0, "Leaving an epoch not entered");
+        if (--r.depth == 0) {
+            r.epoch.store(0, std::memory_order_release);
+        }
+    }
+
+    /**
+     * \brief Retires an object that is no longer reachable by threads entering from now on.
+     *
+     * The deleter is invoked once all threads have left the epochs in which the object was still
+     * reachable, either by the calling thread in a later call or on destruction of the manager.
+     */
+    void retire(void* object, Deleter deleter, void* context)
+    {
+        ThreadRecord& r = record();
+        r.limbo.push_back(LimboEntry{global_epoch_.load(), object, deleter, context});
+        if (r.limbo.size() >= ReclaimThreshold) { reclaim(r); }
+    }
+
+    /**
+     * \brief Tries to advance the global epoch and frees objects retired by the calling thread.
+     * \returns the number of objects still in the limbo list of the calling thread.
+     */
+    size_t reclaim()
+    {
+        ThreadRecord& r = record();
+        reclaim(r);
+        return r.limbo.size();
+    }
+
+    /// \brief Current value of the global epoch (for statistics and testing)
+    uint64_t global_epoch() const { return global_epoch_.load(); }
+
+private:
+
+    struct LimboEntry
+    {
+        uint64_t epoch;
+        void* object;
+        Deleter deleter;
+        void* context;
+    };
+
+    struct ThreadRecord
+    {
+        /// Epoch observed by the thread on enter, or zero if it is not inside an epoch
+        std::atomic<uint64_t> epoch {0};
+        /// Nesting depth of enter calls -- only accessed by the owning thread
+        unsigned depth {0};
+        /// Objects retired by this thread -- only accessed by the owning thread
+        std::vector<LimboEntry> limbo;
+        std::thread::id owner;
+    };
+
+    const uint64_t id_;
+    std::atomic<uint64_t> global_epoch_;
+
+    std::mutex records_mutex_;
+    std::vector<std::unique_ptr<ThreadRecord>> records_;
+
+    static uint64_t next_id()
+    {
+        // Zero is reserved to mark a thread-local cache slot as unused
+        static std::atomic<uint64_t> counter{0};
+        return ++counter;
+    }
+
+    /**
+     * Returns the record of the calling thread. A small direct-mapped thread-local table, indexed
+     * by manager ID, caches the result of the lookup in the shared list of records. Manager IDs are
+     * never reused, so entries of destroyed managers are simply overwritten.
+     */
+    ThreadRecord& record()
+    {
+        struct CacheEntry { uint64_t id; ThreadRecord* record; };
+        static constexpr size_t CacheSlots = 16;
+        static thread_local CacheEntry cache[CacheSlots];
+
+        CacheEntry& entry = cache[id_ % CacheSlots];
+        if (entry.id != id_) {
+            entry.record = register_thread();
+            entry.id = id_;
+        }
+        return *entry.record;
+    }
+
+    ThreadRecord* register_thread()
+    {
+        std::lock_guard<std::mutex> lock(records_mutex_);
+        std::thread::id self = std::this_thread::get_id();
+        for (auto& r : records_) {
+            if (r->owner == self) { return r.get(); }
+        }
+
+        records_.emplace_back(new ThreadRecord);
+        records_.back()->owner = self;
+        return records_.back().get();
+    }
+
+    /// Advances the global epoch if all threads inside an epoch have observed its current value
+    void try_advance()
+    {
+        uint64_t current = global_epoch_.load();
+        {
+            std::lock_guard<std::mutex> lock(records_mutex_);
+            for (auto& r : records_) {
+                uint64_t e = r->epoch.load();
+                if (e != 0 && e != current) { return; }
+            }
+        }
+        global_epoch_.compare_exchange_strong(current, current + 1);
+    }
+
+    void reclaim(ThreadRecord& r)
+    {
+        try_advance();
+
+        uint64_t safe = global_epoch_.load();
+        size_t kept = 0;
+        for (size_t i = 0; i < r.limbo.size(); i++) {
+            LimboEntry& e = r.limbo[i];
+            if (e.epoch + 2 <= safe) { e.deleter(e.context, e.object); }
+            else { r.limbo[kept++] = e; }
+        }
+        r.limbo.resize(kept);
+    }
+};
+
+/**
+ * \brief Scope guard that enters an epoch on construction and leaves it on destruction.
+ */
+class EpochGuard
+{
+public:
+    explicit EpochGuard(EpochManager& epochs) : epochs_(epochs) { epochs_.enter(); }
+    ~EpochGuard() { epochs_.leave(); }
+
+    EpochGuard(const EpochGuard&) = delete;
+    EpochGuard& operator=(const EpochGuard&) = delete;
+
+private:
+    EpochManager& epochs_;
+};
+
+} // namespace foster
+
+#endif
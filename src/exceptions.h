@@ -29,11 +29,45 @@
  */
 
 #include <sstream>
+#include <tuple>
+#include <type_traits>
 
 using std::string;
 
 namespace foster {
 
+namespace internal {
+
+/// Writes a key into an exception message. Tuples are written as (a, b, ...).
+template <class K>
+void print_key(std::ostream& out, const K& key) { out << key; }
+
+template <class... T>
+void print_key(std::ostream& out, const std::tuple<T...>& key);
+
+template <size_t I, class... T>
+typename std::enable_if<I == sizeof...(T)>::type
+print_fields(std::ostream&, const std::tuple<T...>&) {}
+
+template <size_t I, class... T>
+typename std::enable_if<(I < sizeof...(T))>::type
+print_fields(std::ostream& out, const std::tuple<T...>& key)
+{
+    if (I > 0) { out << ", "; }
+    print_key(out, std::get<I>(key));
+    print_fields<I + 1>(out, key);
+}
+
+template <class... T>
+void print_key(std::ostream& out, const std::tuple<T...>& key)
+{
+    out << "(";
+    print_fields<0>(out, key);
+    out << ")";
+}
+
+} // namespace internal
+
 /**
  * \brief Base class for all Foster B-tree exceptions
  *
@@ -67,7 +101,8 @@ protected:
 
     virtual void build_msg(std::stringstream& msg) const
     {
-        msg << "Key already exists: " << key_;
+        msg << "Key already exists: ";
+        internal::print_key(msg, key_);
     }
 };
 
@@ -83,7 +118,8 @@ protected:
 
     virtual void build_msg(std::stringstream& msg) const
     {
-        msg << "Key not found: " << key_;
+        msg << "Key not found: ";
+        internal::print_key(msg, key_);
     }
 };
 
@@ -107,6 +143,22 @@ protected:
     }
 };
 
+/// Thrown when a snapshot cannot be written or read, or when it does not match the tree type
+struct SnapshotException : protected FosterBtreeException
+{
+    SnapshotException(const string& path, const string& msg) : path_(path), msg_(msg)
+    {}
+
+protected:
+    string path_;
+    string msg_;
+
+    virtual void build_msg(std::stringstream& msg) const
+    {
+        msg << "Snapshot " << path_ << ": " << msg_;
+    }
+};
+
 } // namespace foster
 
 #endif
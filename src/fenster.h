@@ -31,6 +31,7 @@
 
 #include "assertions.h"
 #include "exceptions.h"
+#include "key_view.h"
 
 namespace foster {
 
@@ -112,12 +113,30 @@ public:
         }
     }
 
+    /// \brief Checks if low fence <= key < high fence, where the low fence is inclusive
+    bool fence_contains(const Key& key) const
+    {
+        bool low_ok = is_low_key_infinity_ || !(key < low_fence);
+        bool high_ok = is_high_key_infinity_ || key < high_fence;
+        return low_ok && high_ok;
+    }
+
+    /// \brief Same as fence_contains, but keys from the foster key onwards are excluded
+    bool key_range_contains(const Key& key) const
+    {
+        if (!fence_contains(key)) { return false; }
+        return is_foster_empty_ || key < foster_key;
+    }
+
     bool is_low_key_infinity() const { return is_low_key_infinity_; }
     bool is_high_key_infinity() const { return is_high_key_infinity_; }
     bool is_foster_empty() const { return is_foster_empty_; }
 
     PointerType get_foster_ptr() const { return foster_ptr; }
 
+    /// \brief Replaces the foster pointer, e.g., to translate it (\see snapshot.h)
+    void set_foster_ptr(PointerType ptr) { foster_ptr = ptr; }
+
 protected:
     Key low_fence;
     Key high_fence;
@@ -206,12 +225,12 @@ public:
         char* dest = get_data_offset();
         memcpy(dest, low->data(), prefix_len);
         dest += prefix_len;
-        memcpy(dest, low->substr(prefix_len).data(), low_fence_len);
+        memcpy(dest, low->data() + prefix_len, low_fence_len);
         dest += low_fence_len;
-        memcpy(dest, high->substr(prefix_len).data(), high_fence_len);
+        memcpy(dest, high->data() + prefix_len, high_fence_len);
         dest += high_fence_len;
         if (!foster->empty()) {
-            memcpy(dest, foster->substr(prefix_len).data(), foster_key_len);
+            memcpy(dest, foster->data() + prefix_len, foster_key_len);
         }
     }
 
@@ -222,7 +241,7 @@ public:
             + prefix_len + low_fence_len + high_fence_len + foster_key_len;
     }
 
-    size_t get_prefix_size() { return prefix_len; }
+    size_t get_prefix_size() const { return prefix_len; }
 
     /// \brief Returns the number of bytes required to encode the given keys in a fenster object
     static size_t compute_size(string* low, string* high, string* foster)
@@ -290,8 +309,36 @@ public:
         prefix.assign(get_data_offset(), prefix_len);
     }
 
+    /// \brief Returns a view on the common prefix of all keys, which is valid as long as this object
+    KeyView get_prefix_view() const
+    {
+        return KeyView{get_data_offset(), prefix_len};
+    }
+
+    /**
+     * \brief Checks if low fence <= key < high fence, where the low fence is inclusive.
+     *
+     * Keys are compared in their encoded form, i.e., the truncated high fence key is compared
+     * together with the prefix without decoding it into a string.
+     */
+    bool fence_contains(const KeyView& key) const
+    {
+        if (!is_low_key_infinity() && key.compare(get_low_view()) < 0) { return false; }
+        return is_high_key_infinity() || key.compare(get_prefix_view(), get_high_suffix()) < 0;
+    }
+
+    /// \brief Same as fence_contains, but keys from the foster key onwards are excluded
+    bool key_range_contains(const KeyView& key) const
+    {
+        if (!fence_contains(key)) { return false; }
+        return is_foster_empty() || key.compare(get_prefix_view(), get_foster_suffix()) < 0;
+    }
+
     PointerType get_foster_ptr () const { return foster_ptr; }
 
+    /// \brief Replaces the foster pointer, e.g., to translate it (\see snapshot.h)
+    void set_foster_ptr(PointerType ptr) { foster_ptr = ptr; }
+
     /**
      * The infinity keys are encoded simply as empty strings. Note that the user can still use an
      * empty string as a valid key -- it does not affect the behavior of a B-tree with regard to
@@ -316,6 +363,23 @@ protected:
     LengthType foster_key_len;
     PointerType foster_ptr;
 
+    /// Low fence key is stored contiguously with the prefix, so it can be viewed as a whole
+    KeyView get_low_view() const
+    {
+        return KeyView{get_data_offset(), size_t(prefix_len) + low_fence_len};
+    }
+
+    KeyView get_high_suffix() const
+    {
+        return KeyView{get_data_offset() + prefix_len + low_fence_len, high_fence_len};
+    }
+
+    KeyView get_foster_suffix() const
+    {
+        return KeyView{get_data_offset() + prefix_len + low_fence_len + high_fence_len,
+            foster_key_len};
+    }
+
     /// \brief Return pointer to the offload area, where keys are encoded.
     char* get_data_offset()
     {
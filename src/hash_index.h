@@ -0,0 +1,240 @@
+/*
+ * MIT License
+ *
+ * Copyright (c) 2016 Caetano Sauer
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy of this software and
+ * associated documentation files (the "Software"), to deal in the Software without restriction,
+ * including without limitation the rights to use, copy, modify, merge, publish, distribute,
+ * sublicense, and/or sell copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all copies or
+ * substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR IMPLIED, INCLUDING BUT
+ * NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM,
+ * DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+#ifndef FOSTER_BTREE_HASH_INDEX_H
+#define FOSTER_BTREE_HASH_INDEX_H
+
+/**
+ * \file hash_index.h
+ *
+ * Policies for an adaptive hash index on the leaf level, which answers point lookups of frequently
+ * accessed keys with a single probe into a hash table and a single leaf access, bypassing the
+ * traversal (\see BtreeLevel::probe_hash_index).
+ */
+
+#include <atomic>
+#include <cstdint>
+#include <functional>
+#include <memory>
+
+#include "assertions.h"
+#include "kv_array.h"
+
+namespace foster {
+
+/**
+ * \brief Hash index policy that does not index anything, which is the default.
+ *
+ * As with NoStatistics, all methods are empty and inlined, so lookups compile to the same code as
+ * without a hash index.
+ */
+template <class K, class LeafPointer>
+struct NoHashIndex
+{
+    static constexpr bool Enabled = false;
+
+    template <class V>
+    bool probe(const K&, V*, bool&) { return false; }
+
+    void record(const K&, LeafPointer) {}
+    void invalidate(const void*) {}
+    void clear() {}
+};
+
+/**
+ * \brief Direct-mapped hash table from hot keys to the leaves that contain them.
+ *
+ * Each entry holds a tag of a key's hash, a popularity counter, a pointer to the leaf, and a hint
+ * for the slot of the key in the leaf. Lookups that miss the index are recorded after their
+ * traversal (\see record): the popularity of the key that owns the entry is incremented, and once
+ * it reaches HotThreshold, the leaf is installed. Lookups of other keys that map to the same entry
+ * decrement it instead, so that the entry is only taken over once the owner is no longer hot.
+ *
+ * Entries are not kept consistent with the tree. Instead, each probe latches the leaf in shared
+ * mode and validates it with key_range_contains, which fails if the key was moved out of the leaf
+ * by a split (the fence keys or foster key of the leaf changed) or if the leaf was absorbed by a
+ * merge (its fence keys are reset to an empty range). The slot hint is verified by comparing keys
+ * and replaced by a search of the leaf if records were shifted. A failed probe falls back to a
+ * regular traversal, which then installs the current leaf again.
+ *
+ * Memory safety follows from epochs: the fields of an entry are updated independently and thus
+ * may be inconsistent, but a leaf is only installed while latched by a traversal, and retired
+ * leaves are removed from the table before they are handed to the epoch manager (\see invalidate).
+ * A probe is performed inside an epoch, so a leaf read from the table cannot be freed before the
+ * probe ends.
+ *
+ * \tparam LogEntries Base-2 logarithm of the number of entries (of 16 bytes each).
+ * \tparam HotThreshold Number of lookups of a key after which its leaf is installed.
+ */
+template <class K, class LeafPointer, unsigned LogEntries, unsigned HotThreshold>
+class BasicAdaptiveHashIndex
+{
+public:
+
+    static constexpr bool Enabled = true;
+
+    using Node = typename LeafPointer::PointeeType;
+
+    /// Saturation value of the popularity counters
+    static constexpr uint16_t MaxHits = 255;
+    /// Slot hints are kept in 16 bits, so larger slots are clamped to this value and searched for
+    static constexpr size_t MaxSlotHint = UINT16_MAX;
+
+    static_assert(LogEntries > 0 && LogEntries < 32, "Invalid hash index size");
+    static_assert(HotThreshold > 0 && HotThreshold < MaxHits, "Invalid hot threshold");
+
+    BasicAdaptiveHashIndex() : entries_(new Entry[size_t(1) << LogEntries]()) {}
+
+    /**
+     * \brief Looks the key up in the leaf installed for it, if any.
+     *
+     * \param[out] found Whether the key exists, which is only valid if true is returned
+     * \returns false if the index has no valid leaf for the key, in which case a traversal is needed
+     */
+    template <class V>
+    bool probe(const K& key, V* value, bool& found)
+    {
+        uint64_t h = hash(key);
+        Entry& e = entry(h);
+        if (e.tag.load(std::memory_order_relaxed) != tag(h)) { return false; }
+        void* leaf = e.leaf.load(std::memory_order_acquire);
+        if (!leaf) { return false; }
+
+        LeafPointer node {static_cast<Node*>(leaf)};
+        node->acquire_read();
+        if (!node->key_range_contains(key)) {
+            node->release_read();
+            return false;
+        }
+
+        size_t slot = e.slot.load(std::memory_order_relaxed);
+        found = matches(node, slot, key);
+        if (!found) {
+            slot = node->lower_bound(key);
+            found = matches(node, slot, key);
+            e.slot.store(slot <= MaxSlotHint ? slot : MaxSlotHint, std::memory_order_relaxed);
+        }
+        if (found) { node->read_slot(slot, nullptr, value); }
+        else if (internal::BuffersInserts<Node>::value) {
+            // The key may be buffered outside of the slots (\see BufferedKeyValueArray)
+            found = node->find(key, value);
+        }
+        node->release_read();
+
+        uint16_t hits = e.hits.load(std::memory_order_relaxed);
+        if (hits < MaxHits) { e.hits.store(hits + 1, std::memory_order_relaxed); }
+        return true;
+    }
+
+    /**
+     * \brief Records a lookup that was answered by a traversal, installing the leaf if the key
+     * became hot. The leaf must be latched by the caller.
+     */
+    void record(const K& key, LeafPointer node)
+    {
+        uint64_t h = hash(key);
+        Entry& e = entry(h);
+        uint16_t hits = e.hits.load(std::memory_order_relaxed);
+
+        if (e.tag.load(std::memory_order_relaxed) != tag(h)) {
+            if (hits > 0) {
+                e.hits.store(hits - 1, std::memory_order_relaxed);
+                return;
+            }
+            e.leaf.store(nullptr, std::memory_order_relaxed);
+            e.tag.store(tag(h), std::memory_order_relaxed);
+            e.hits.store(1, std::memory_order_relaxed);
+            return;
+        }
+
+        if (hits < MaxHits) { e.hits.store(++hits, std::memory_order_relaxed); }
+        if (hits >= HotThreshold) {
+            size_t slot = node->lower_bound(key);
+            e.slot.store(slot <= MaxSlotHint ? slot : MaxSlotHint, std::memory_order_relaxed);
+            e.leaf.store(&(*node), std::memory_order_release);
+        }
+    }
+
+    /**
+     * \brief Removes a leaf from all entries, which must be done when it is retired.
+     *
+     * This scans the whole table, which is acceptable since it only happens on merges.
+     */
+    void invalidate(const void* leaf)
+    {
+        for (size_t i = 0; i < (size_t(1) << LogEntries); i++) {
+            if (entries_[i].leaf.load(std::memory_order_relaxed) == leaf) {
+                entries_[i].leaf.store(nullptr, std::memory_order_relaxed);
+            }
+        }
+    }
+
+    /// \brief Empties the table, e.g., when all leaves are destroyed. No probe may be running.
+    void clear()
+    {
+        for (size_t i = 0; i < (size_t(1) << LogEntries); i++) {
+            entries_[i].leaf.store(nullptr, std::memory_order_relaxed);
+            entries_[i].tag.store(0, std::memory_order_relaxed);
+            entries_[i].hits.store(0, std::memory_order_relaxed);
+        }
+    }
+
+private:
+
+    struct Entry
+    {
+        /// Bits of the hash of the key that owns the entry, never zero once owned
+        std::atomic<uint32_t> tag;
+        /// Popularity of the owner, incremented on its lookups and decremented on collisions
+        std::atomic<uint16_t> hits;
+        /// Slot of the key in the leaf when last found
+        std::atomic<uint16_t> slot;
+        std::atomic<void*> leaf;
+    };
+
+    std::unique_ptr<Entry[]> entries_;
+
+    /// Multiplicative hashing, since std::hash is the identity for integers on common platforms
+    static uint64_t hash(const K& key)
+    {
+        return std::hash<K>{}(key) * 0x9E3779B97F4A7C15ull;
+    }
+
+    static uint32_t tag(uint64_t h) { return static_cast<uint32_t>(h) | 1; }
+
+    Entry& entry(uint64_t h) { return entries_[h >> (64 - LogEntries)]; }
+
+    static bool matches(LeafPointer node, size_t slot, const K& key)
+    {
+        if (slot >= node->slot_count() || node->is_ghost(slot)) { return false; }
+        K found_key;
+        node->read_slot(slot, &found_key, nullptr);
+        return found_key == key;
+    }
+};
+
+/// Adaptive hash index with 64K entries (1 MB) and a hot threshold of 8 lookups
+template <class K, class LeafPointer>
+using AdaptiveHashIndex = BasicAdaptiveHashIndex<K, LeafPointer, 16, 8>;
+
+} // namespace foster
+
+#endif
@@ -0,0 +1,147 @@
+/*
+ * MIT License
+ *
+ * Copyright (c) 2016 Caetano Sauer
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy of this software and
+ * associated documentation files (the "Software"), to deal in the Software without restriction,
+ * including without limitation the rights to use, copy, modify, merge, publish, distribute,
+ * sublicense, and/or sell copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all copies or
+ * substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR IMPLIED, INCLUDING BUT
+ * NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM,
+ * DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+#ifndef FOSTER_BTREE_KEY_VIEW_H
+#define FOSTER_BTREE_KEY_VIEW_H
+
+/**
+ * \file key_view.h
+ *
+ * Non-owning references to variable-length keys, which allow comparing a search key against keys
+ * encoded inside a node without decoding them into a string first.
+ */
+
+#include <cstring>
+#include <ostream>
+#include <string>
+
+using std::string;
+
+namespace foster {
+
+/**
+ * \brief Non-owning view of the bytes of a string key.
+ *
+ * A view is just a pointer and a length, so it can be created for a string or for a key encoded in
+ * a node (\see VariableLengthEncoder and Fenster) without any allocation or copy. Comparisons
+ * follow the same (lexicographical, unsigned byte) order as std::string.
+ *
+ * The viewed memory must not be modified or freed while the view is in use. In a B-tree node, this
+ * means that views on encoded keys are only valid while the node is latched and not modified.
+ */
+class KeyView
+{
+public:
+
+    KeyView() : data_(nullptr), length_(0) {}
+
+    KeyView(const char* data, size_t length) : data_(data), length_(length) {}
+
+    /// Implicit conversion allows passing strings wherever a key view is expected. Note that a
+    /// view on a temporary string must not outlive the expression in which it is created.
+    KeyView(const string& s) : data_(s.data()), length_(s.length()) {}
+
+    KeyView(const char* s) : data_(s), length_(strlen(s)) {}
+
+    const char* data() const { return data_; }
+    size_t length() const { return length_; }
+    size_t size() const { return length_; }
+    bool empty() const { return length_ == 0; }
+
+    char operator[](size_t i) const { return data_[i]; }
+
+    /// \brief Returns a view on a part of this one (no bytes are copied)
+    KeyView substr(size_t pos, size_t len = string::npos) const
+    {
+        if (pos > length_) { pos = length_; }
+        if (len > length_ - pos) { len = length_ - pos; }
+        return KeyView{data_ + pos, len};
+    }
+
+    /// \brief Returns a negative, zero, or positive value if this key is <, ==, or > than other
+    int compare(const KeyView& other) const
+    {
+        size_t len = length_ < other.length_ ? length_ : other.length_;
+        int cmp = len > 0 ? memcmp(data_, other.data_, len) : 0;
+        if (cmp != 0) { return cmp; }
+        return length_ < other.length_ ? -1 : (length_ > other.length_ ? 1 : 0);
+    }
+
+    /**
+     * \brief Compares this key with the concatenation of a prefix and a suffix.
+     *
+     * This is how keys are compared against prefix-truncated keys, which are not stored
+     * contiguously (\see Fenster), without building the full key.
+     */
+    int compare(const KeyView& prefix, const KeyView& suffix) const
+    {
+        KeyView head = substr(0, prefix.length_);
+        int cmp = head.compare(prefix);
+        if (cmp != 0) { return cmp; }
+        return substr(prefix.length_).compare(suffix);
+    }
+
+    /// \brief Copies the viewed bytes into a string, which is only required to store a key
+    string to_string() const { return string(data_, length_); }
+
+    explicit operator string() const { return to_string(); }
+
+private:
+    const char* data_;
+    size_t length_;
+};
+
+inline bool operator==(const KeyView& a, const KeyView& b)
+{
+    return a.length() == b.length() && a.compare(b) == 0;
+}
+
+inline bool operator!=(const KeyView& a, const KeyView& b) { return !(a == b); }
+inline bool operator<(const KeyView& a, const KeyView& b) { return a.compare(b) < 0; }
+inline bool operator>(const KeyView& a, const KeyView& b) { return a.compare(b) > 0; }
+inline bool operator<=(const KeyView& a, const KeyView& b) { return a.compare(b) <= 0; }
+inline bool operator>=(const KeyView& a, const KeyView& b) { return a.compare(b) >= 0; }
+
+inline std::ostream& operator<<(std::ostream& out, const KeyView& key)
+{
+    return out.write(key.data(), key.length());
+}
+
+/**
+ * \brief Type used to pass and compare keys of type K without copying them.
+ *
+ * Fixed-length keys are cheap to copy, so they are their own view. String keys use KeyView.
+ */
+template <class K>
+struct KeyViewOf
+{
+    using type = K;
+};
+
+template <>
+struct KeyViewOf<string>
+{
+    using type = KeyView;
+};
+
+} // namespace foster
+
+#endif
@@ -31,18 +31,81 @@
 
 #include <cstddef>
 #include <iostream>
+#include <type_traits>
 
 #include "exceptions.h"
 #include "assertions.h"
+#include "key_view.h"
 
 namespace foster {
 
 // Forward declaration for friend function declaration below
 namespace internal {
     template<class T, class S>
-    bool move_kv_records(T&, S, T&, S, size_t);
+    typename std::enable_if<!T::InlineRecords, bool>::type
+    move_kv_records(T&, S, T&, S, size_t);
+
+    /// Whether an encoder owns resources outside of its payloads (\see OverflowEncoder)
+    template <class Encoder, class = void>
+    struct ReleasesPayloads : std::false_type {};
+
+    template <class Encoder>
+    struct ReleasesPayloads<Encoder,
+        decltype(Encoder::release(static_cast<void*>(nullptr)))> : std::true_type {};
+
+    template <class Encoder>
+    void release_payload(void* payload, std::true_type) { Encoder::release(payload); }
+
+    template <class Encoder>
+    void release_payload(void*, std::false_type) {}
+
+    /// Whether an array keeps new pairs out of its slot vector (\see BufferedKeyValueArray)
+    template <class KVArray, class = void>
+    struct BuffersInserts : std::false_type {};
+
+    template <class KVArray>
+    struct BuffersInserts<KVArray, typename std::enable_if<KVArray::BufferedInserts>::type>
+        : std::true_type {};
+
+    template <class NodePointer>
+    void merge_insert_buffer(NodePointer node, std::true_type) { node->merge_buffer(); }
+
+    template <class NodePointer>
+    void merge_insert_buffer(NodePointer, std::false_type) {}
+
+    /// Whether an array decodes ranges of keys in bulk (\see DeltaKeyValueArray::decode_keys)
+    template <class KVArray, class = void>
+    struct DecodesKeys : std::false_type {};
+
+    template <class KVArray>
+    struct DecodesKeys<KVArray, typename std::enable_if<KVArray::BatchDecoding>::type>
+        : std::true_type {};
 }
 
+/// \brief Which pairs are written by KeyValueArray::put, depending on whether the key exists
+enum class PutMode
+{
+    /// Only insert new keys
+    Insert,
+    /// Only overwrite the values of existing keys
+    Update,
+    /// Insert new keys and overwrite the values of existing ones
+    Upsert
+};
+
+/// \brief Outcome of a put operation (\see KeyValueArray::put)
+enum class PutStatus
+{
+    Inserted,
+    Updated,
+    /// The key exists and the mode is PutMode::Insert, so nothing was written
+    KeyExists,
+    /// The key does not exist and the mode is PutMode::Update, so nothing was written
+    KeyNotFound,
+    /// There is not enough free space, so nothing was written
+    NoSpace
+};
+
 /**
  * \brief Provides ordered storage and search of key-value pairs in a slot array.
  *
@@ -73,20 +136,36 @@ public:
      * Type aliases for convenience and allowing other classes to use this one's template arguments.
      */
     using KeyType = K;
+    /// Keys are passed as views, so that a string key does not have to be copied for a search
+    using KeyView = typename KeyViewOf<K>::type;
     using ValueType = V;
     using EncoderType = Encoder;
+    using SlotArrayType = SlotArray;
     using SlotNumber = typename SlotArray::SlotNumber;
     using PayloadPtr = typename SlotArray::PayloadPtr;
     using PMNK_Type = typename SlotArray::KeyType;
     using ThisType = KeyValueArray<K, V, SlotArray, Search, Encoder>;
 
     static constexpr size_t Alignment = SlotArray::AlignmentSize;
+    /// Pairs are encoded into payloads (\see InlineKeyValueArray)
+    static constexpr bool InlineRecords = false;
+    /// Whether payloads refer to data stored out of line (\see OverflowEncoder)
+    static constexpr bool ExternalPayloads = internal::ReleasesPayloads<Encoder>::value;
+    /// Total size in bytes of the underlying slot array
+    static constexpr size_t Capacity = SlotArray::MaxPayloadCount * SlotArray::AlignmentSize;
+
+    /// Resources owned by the payloads are released (\see release_payload)
+    ~KeyValueArray()
+    {
+        if (!internal::ReleasesPayloads<Encoder>::value) { return; }
+        for (SlotNumber i = 0; i < this->slot_count(); i++) { release_payload(i); }
+    }
 
     /**
      * \brief Insert a key-value pair into the array.
      * \returns true if insertion succeeded (i.e., if there was enough free space)
      */
-    bool insert(const K& key, const V& value)
+    bool insert(const KeyView& key, const V& value)
     {
         // 1. Insert key and allocate empty payload space for the pair
         SlotNumber slot {0};
@@ -105,63 +184,126 @@ public:
     }
 
     /**
-     * \brief Insert a slot with the given key and reserve the given amount of payload.
+     * \brief Inserts a pair, overwrites the value of an existing key, or both, depending on Mode.
      *
-     * This method is a building block of the main insert method that does all steps of an insertion
-     * except for encoding the value into the reserved payload area.
+     * Unlike insert, an existing key does not raise an exception, and the slot is searched only
+     * once. Overwritten values are encoded in place if they occupy the same number of payload
+     * blocks as the old ones; otherwise, the payload is reallocated.
      *
-     * \returns true if insertion succeeded (i.e., if there was enough free space)
+     * \returns the outcome of the operation; nothing is modified unless it is Inserted or Updated
      */
-    bool insert_key(const K& key, size_t payload_length, SlotNumber& slot)
+    template <PutMode Mode = PutMode::Upsert>
+    PutStatus put(const KeyView& key, const V& value)
     {
-        // 1. Find slot into which to insert new pair.
+        SlotNumber slot {0};
         if (find_slot(key, nullptr, slot)) {
-            throw ExistentKeyException<K>(key);
+            if (Mode == PutMode::Insert) { return PutStatus::KeyExists; }
+            return overwrite_slot(slot, key, value) ? PutStatus::Updated : PutStatus::NoSpace;
         }
+        if (Mode == PutMode::Update) { return PutStatus::KeyNotFound; }
 
-        // 2. Allocate space in the slot array for the encoded payload.
-        PayloadPtr payload;
-        if (!this->allocate_payload(payload, payload_length)) {
-            // No space left
-            return false;
+        if (!insert_key_at(key, Encoder::get_payload_length(key, value), slot)) {
+            return PutStatus::NoSpace;
         }
+        Encoder::encode(key, value, this->get_payload_for_slot(slot));
+        assert<3>(is_sorted());
 
-        // 3. Insert slot with PMNK and pointer to the allocated payload.
+        return PutStatus::Inserted;
+    }
+
+    /**
+     * \brief Appends a key-value pair after the last slot, without searching for its position.
+     *
+     * This supports building arrays from sorted input (e.g., bulk loading), so the given key must
+     * be greater than all keys in the array. The pair is not appended if the free space left after
+     * the insertion would be less than the given amount of reserved bytes.
+     *
+     * \returns true if insertion succeeded (i.e., if there was enough free space)
+     */
+    bool append(const KeyView& key, const V& value, size_t reserved = 0)
+    {
+        size_t payload_length = Encoder::get_payload_length(key, value);
+        size_t required = this->get_payload_count(payload_length) * Alignment
+            + SlotArray::SlotSize + reserved;
+        if (this->free_space() < required) { return false; }
+
+        PayloadPtr payload {0};
+        SlotNumber slot = this->slot_count();
+        if (!this->allocate_payload(payload, payload_length)) { return false; }
         if (!this->insert_slot(slot)) {
-            // No space left -- free previously allocated payload.
             this->free_payload(payload, payload_length);
             return false;
         }
+
         this->get_slot(slot).key = Encoder::get_pmnk(key);
         this->get_slot(slot).ptr = payload;
-        this->get_slot(slot).ghost = false;
+        Encoder::encode(key, value, this->get_payload_for_slot(slot));
+        assert<3>(is_sorted());
 
         return true;
     }
 
+    /**
+     * \brief Insert a slot with the given key and reserve the given amount of payload.
+     *
+     * This method is a building block of the main insert method that does all steps of an insertion
+     * except for encoding the value into the reserved payload area.
+     *
+     * If the key was removed before and its ghost slot is still there, the slot is reused, along
+     * with its payload if the same number of payload blocks is required. If there is not enough
+     * free space, ghosts are purged before giving up (\see compact).
+     *
+     * \returns true if insertion succeeded (i.e., if there was enough free space)
+     * \throws ExistentKeyException if the key already exists in the array (\see put)
+     */
+    bool insert_key(const KeyView& key, size_t payload_length, SlotNumber& slot)
+    {
+        // 1. Find slot into which to insert new pair.
+        if (find_slot(key, nullptr, slot)) {
+            throw ExistentKeyException<K>(K(key));
+        }
+
+        return insert_key_at(key, payload_length, slot);
+    }
+
     /**
      * \brief Removes a key-value pair from the array.
+     *
+     * The slot is only marked as a ghost, which is skipped by searches and iterators. Its payload
+     * stays in place until reused by an insertion of the same key or until the space is required
+     * by an insertion of a different key, so that a removal does not have to shift payloads.
+     *
      * \throws KeyNotFoundException if key does not exist in the array.
      */
     template <bool MustExist = true>
-    bool remove(const K& key)
+    bool remove(const KeyView& key)
     {
         // 1. Find slot containing the given key.
         SlotNumber slot;
         if (!find_slot(key, nullptr, slot)) {
-            if (MustExist) { throw KeyNotFoundException<K>(key); }
+            if (MustExist) { throw KeyNotFoundException<K>(K(key)); }
             else { return false; }
         }
 
-        // 2. Free the payload and delete the slot.
-        PayloadPtr payload = this->get_slot(slot).ptr;
-        size_t payload_length = Encoder::get_payload_length(this->get_payload(payload));
-        this->free_payload(payload, payload_length);
-        this->delete_slot(slot);
+        // 2. Mark the slot as a ghost.
+        size_t payload_length = Encoder::get_payload_length(this->get_payload_for_slot(slot));
+        this->set_ghost(slot, true, payload_length);
 
         return true;
     }
 
+    /**
+     * \brief Deletes all ghost slots and their payloads in a single pass.
+     * \see SlotArray::purge_ghosts
+     */
+    void compact()
+    {
+        this->purge_ghosts([] (void* payload) {
+            internal::release_payload<Encoder>(payload, internal::ReleasesPayloads<Encoder>{});
+            return Encoder::get_payload_length(payload);
+        });
+    }
+
     void truncate_keys(size_t length)
     {
         static_assert(std::is_same<K, string>::value,
@@ -169,11 +311,14 @@ public:
 
         if (length == 0) { return; }
 
+        // Ghost payloads would change size, so get rid of them first
+        compact();
+
         K key;
         V value;
         SlotNumber i = 0;
         while (i < this->slot_count()) {
-            auto& slot = this->get_slot(i);
+            auto&& slot = this->get_slot(i);
             Encoder::decode(this->get_payload(slot.ptr), &key, &value, &slot.key);
 
             void* payload_addr = this->get_payload_for_slot(i);
@@ -184,6 +329,7 @@ public:
             slot.key = Encoder::get_pmnk(key);
 
             // update payload with truncated key
+            release_payload(i);
             Encoder::encode(key, value, payload_addr);
             size_t new_len = this->get_payload_count(Encoder::get_payload_length(payload_addr));
 
@@ -202,25 +348,64 @@ public:
      * \brief Searches for a given key in the array.
      * \see find_slot
      */
-    bool find(const K& key, V* value = nullptr)
+    bool find(const KeyView& key, V* value = nullptr)
     {
         SlotNumber slot {0};
         return find_slot(key, value, slot);
     }
 
-    /// \brief Number of key-value pairs currently present in the array.
+    /**
+     * \brief Returns the slot of the first key that is greater than or equal to the given key.
+     *
+     * If all keys are smaller than the given one, the slot count is returned. This supports
+     * positioning a cursor for range scans.
+     */
+    SlotNumber lower_bound(const KeyView& key)
+    {
+        SlotNumber slot {0};
+        find_slot(key, nullptr, slot);
+        return slot;
+    }
+
+    /// \brief Amount of free space (in bytes) in the underlying slot array.
+    using SlotArray::free_space;
+
+    /// \brief Amount of space (in bytes) occupied by ghosts, which is reclaimed by compact().
+    using SlotArray::ghost_space;
+
+    /// \brief Number of slots, including ghosts, i.e., the upper bound for slot numbers.
+    using SlotArray::slot_count;
+
+    /// \brief Number of key-value pairs currently present in the array, i.e., excluding ghosts.
     size_t size()
     {
-        return this->slot_count();
+        return this->slot_count() - this->ghost_count();
+    }
+
+    /// \brief Whether the pair in the given slot was removed (\see remove)
+    bool is_ghost(SlotNumber s) const
+    {
+        return this->get_slot(s).ghost;
     }
 
     /// \brief Decodes key and value associated with a given slot number
     void read_slot(SlotNumber s, K* key, V* value)
     {
-        auto& slot = this->get_slot(s);
+        auto&& slot = this->get_slot(s);
         Encoder::decode(this->get_payload(slot.ptr), key, value, &slot.key);
     }
 
+    /**
+     * \brief Same as read_slot, but the key is decoded into a view on the payload.
+     *
+     * The view is only valid until the array is modified (\see KeyView).
+     */
+    void read_slot_view(SlotNumber s, KeyView* key, V* value)
+    {
+        auto&& slot = this->get_slot(s);
+        Encoder::decode_view(this->get_payload(slot.ptr), key, value, &slot.key);
+    }
+
     /**
      * \brief Simple iterator class to support sequentially reading all key-value pairs
      */
@@ -233,7 +418,10 @@ public:
 
         bool next(K* key, V* value)
         {
-            if (current_slot_ >= kv_->size()) { return false; }
+            while (current_slot_ < kv_->slot_count() && kv_->is_ghost(current_slot_)) {
+                current_slot_++;
+            }
+            if (current_slot_ >= kv_->slot_count()) { return false; }
 
             kv_->read_slot(current_slot_, key, value);
             current_slot_++;
@@ -254,12 +442,111 @@ public:
 
 protected:
 
+    /**
+     * \brief Second half of insert_key, given the slot into which the absent key is inserted.
+     *
+     * The slot is the one yielded by find_slot, and it is updated if ghosts are purged.
+     */
+    bool insert_key_at(const KeyView& key, size_t payload_length, SlotNumber& slot)
+    {
+        if (slot < this->slot_count() && this->get_slot(slot).ghost) {
+            KeyView ghost_key;
+            read_slot_view(slot, &ghost_key, nullptr);
+            if (ghost_key == key) {
+                release_payload(slot);
+                PayloadPtr ghost_payload = this->get_slot(slot).ptr;
+                size_t ghost_length = Encoder::get_payload_length(this->get_payload(ghost_payload));
+                this->set_ghost(slot, false, ghost_length);
+                if (this->get_payload_count(ghost_length) == this->get_payload_count(payload_length)) {
+                    return true;
+                }
+                this->free_payload(ghost_payload, ghost_length);
+                this->delete_slot(slot);
+            }
+        }
+
+        size_t required = this->get_payload_count(payload_length) * Alignment + SlotArray::SlotSize;
+        if (this->free_space() < required && this->ghost_count() > 0) {
+            compact();
+            find_slot(key, nullptr, slot);
+        }
+
+        // 2. Allocate space in the slot array for the encoded payload.
+        PayloadPtr payload;
+        if (!this->allocate_payload(payload, payload_length)) {
+            // No space left
+            return false;
+        }
+
+        // 3. Insert slot with PMNK and pointer to the allocated payload.
+        if (!this->insert_slot(slot)) {
+            // No space left -- free previously allocated payload.
+            this->free_payload(payload, payload_length);
+            return false;
+        }
+        this->get_slot(slot).key = Encoder::get_pmnk(key);
+        this->get_slot(slot).ptr = payload;
+
+        return true;
+    }
+
+    /**
+     * \brief Overwrites the value in a given slot, which must contain the given key.
+     *
+     * If the encoded pair occupies a different number of payload blocks, the old payload is freed
+     * and a new one is allocated. Ghosts are purged if that is required to make room.
+     *
+     * \returns false if there is not enough free space, in which case the old value is kept
+     */
+    bool overwrite_slot(SlotNumber& slot, const KeyView& key, const V& value)
+    {
+        size_t old_length = Encoder::get_payload_length(this->get_payload_for_slot(slot));
+        size_t new_length = Encoder::get_payload_length(key, value);
+        size_t old_count = this->get_payload_count(old_length);
+        size_t new_count = this->get_payload_count(new_length);
+
+        if (new_count != old_count) {
+            if (this->free_space() + old_count * Alignment < new_count * Alignment) {
+                if (this->ghost_count() == 0) { return false; }
+                compact();
+                find_slot(key, nullptr, slot);
+                if (this->free_space() + old_count * Alignment < new_count * Alignment) {
+                    return false;
+                }
+            }
+
+            PayloadPtr payload {0};
+            release_payload(slot);
+            this->free_payload(this->get_slot(slot).ptr, old_length);
+            // Freeing compacts the payload area, so the space checked above is contiguous
+            bool allocated = this->allocate_payload(payload, new_length);
+            assert<1>(allocated, "Payload allocation failed despite available space");
+            this->get_slot(slot).ptr = payload;
+        }
+        else {
+            release_payload(slot);
+        }
+
+        Encoder::encode(key, value, this->get_payload_for_slot(slot));
+        return true;
+    }
+
+    /**
+     * \brief Releases resources owned by the payload of a slot that is about to be discarded or
+     * overwritten. This is a no-op unless the encoder stores data out of line (\see OverflowEncoder).
+     */
+    void release_payload(SlotNumber slot)
+    {
+        internal::release_payload<Encoder>(this->get_payload_for_slot(slot),
+                internal::ReleasesPayloads<Encoder>{});
+    }
+
     /**
      * \brief Internal implementation of the find method.
      *
      * Uses the search policy to locate the slot based on the PMNK. Then, it decodes the full key to
      * check against false positives -- if keys do not match, continue searching sequentially as
-     * long as the PMNK matches.
+     * long as the PMNK matches. Keys are decoded as views, so string keys are compared in place.
      *
      * \param[in] key Key for which to search.
      * \param[in] value It not null, value data will be decoded into the pointed object. If key is
@@ -270,18 +557,20 @@ protected:
      * \returns true if key was found in the array; false otherwise.
      */
     // TODO parametrize comparison function
-    bool find_slot(const K& key, V* value, SlotNumber& slot)
+    bool find_slot(const KeyView& key, V* value, SlotNumber& slot)
     {
         PMNK_Type pmnk = Encoder::get_pmnk(key);
         if (Search{}(*this, pmnk, slot, 0, this->slot_count())) {
             // Found poor man's normalized key -- now check if rest of the key matches
             PMNK_Type found_pmnk = pmnk;
             while (found_pmnk == pmnk) {
-                K found_key;
-                Encoder::decode(this->get_payload_for_slot(slot), &found_key, value, &pmnk);
+                KeyView found_key;
+                Encoder::decode_view(this->get_payload_for_slot(slot), &found_key, value, &pmnk);
 
                 if (found_key == key) {
-                    return true;
+                    // A ghost is not a match, but it is the position into which key is inserted
+                    if (!this->get_slot(slot).ghost) { return true; }
+                    break;
                 }
                 else if (found_key > key) {
                     // Already passed the searched key
@@ -318,7 +607,8 @@ protected:
      * function.
      */
     template<class T, class S>
-    friend bool internal::move_kv_records(T&, S, T&, S, size_t);
+    friend typename std::enable_if<!T::InlineRecords, bool>::type
+    internal::move_kv_records(T&, S, T&, S, size_t);
 
 public:
 
@@ -376,12 +666,18 @@ namespace internal {
  * \param[in] slot_count Number of slots to move
  * \returns true if movement succeeds; false otherwise
  *
- * One important aspect of this function is that the movement is atomic; i.e., if any of the
- * individual movements fails (possibliy due to lack of free space on destination) then the whole
- * movement is "rolled back" by reinserting the already-moved pairs into the source array.
+ * One important aspect of this function is that the movement is atomic; i.e., if there is not
+ * enough free space on the destination for all pairs, none of them is moved and both arrays are
+ * left unchanged.
+ *
+ * The movement is performed in bulk, i.e., with a linear number of operations: all slots are
+ * inserted into the destination with a single shift of its slot vector, and their payloads are
+ * copied into a single contiguous area. The source array is then compacted in one pass (\see
+ * SlotArray::delete_slots). Ghosts are moved as such.
  */
 template <class KVArray, class SlotNumber = typename KVArray::SlotNumber>
-bool move_kv_records(
+typename std::enable_if<!KVArray::InlineRecords, bool>::type
+move_kv_records(
         KVArray& dest, SlotNumber dest_slot,
         KVArray& src, SlotNumber src_slot,
         size_t slot_count)
@@ -389,67 +685,51 @@ bool move_kv_records(
     using Encoder = typename KVArray::EncoderType;
     using PayloadPtr = typename KVArray::PayloadPtr;
 
-    SlotNumber last_slot = src_slot + slot_count - 1;
-    assert<1>(last_slot < src.slot_count());
+    assert<1>(src_slot + slot_count <= src.slot_count());
     assert<1>(src.is_sorted());
 
-    bool success = true;
-    SlotNumber i = src_slot, j = dest_slot;
-
-    // First copy slots from the source array into the destination one. If an insertion or payload
-    // allocation fails in the destination, we break out of the loop and success is set to false.
-    while (i <= last_slot) {
-        // 1. Insert slot
-        success = dest.insert_slot(j);
-        if (!success) { break; }
+    // 1. Check if there is space for all slots and payloads, so that nothing must be rolled back
+    size_t payload_blocks = 0;
+    for (size_t i = src_slot; i < src_slot + slot_count; i++) {
+        payload_blocks += src.get_payload_count(
+                Encoder::get_payload_length(src.get_payload_for_slot(i)));
+    }
+    using SlotArray = typename KVArray::SlotArrayType;
+    size_t required = payload_blocks * KVArray::Alignment + slot_count * SlotArray::SlotSize;
+    if (dest.free_space() < required) { return false; }
+
+    // 2. Reserve a single area for all payloads and open a gap in the destination slot vector
+    PayloadPtr payload_dest_ptr {0};
+    size_t payload_bytes = payload_blocks * KVArray::Alignment;
+    if (!dest.allocate_payload(payload_dest_ptr, payload_bytes)) { return false; }
+    if (!dest.insert_slots(dest_slot, slot_count)) {
+        dest.free_payload(payload_dest_ptr, payload_bytes);
+        return false;
+    }
 
-        // 2. Allocate payload
+    // 3. Copy slot and payload data into the reserved space
+    for (size_t k = 0; k < slot_count; k++) {
+        SlotNumber i = src_slot + k, j = dest_slot + k;
         void* payload_src = src.get_payload_for_slot(i);
         size_t length = Encoder::get_payload_length(payload_src);
 
-        PayloadPtr payload_dest_ptr;
-        success = dest.allocate_payload(payload_dest_ptr, length);
-        if (!success) {
-            dest.delete_slot(j);
-            break;
-        }
-
-        // 3. Copy slot and payload data into the reserved space.
-        // TODO add Slot::init or reset or something like that
         dest.get_slot(j).key = src.get_slot(i).key;
         dest.get_slot(j).ptr = payload_dest_ptr;
-        dest.get_slot(j).ghost = src.get_slot(i).ghost;
-
+        dest.set_ghost(j, src.get_slot(i).ghost, length);
         memcpy(dest.get_payload(payload_dest_ptr), payload_src, length);
 
-        i++;
-        j++;
+        payload_dest_ptr += dest.get_payload_count(length);
     }
 
-    // If copy failed above, we need to roll back by removing the entries that were already copied
-    if (!success) {
-        while (j > dest_slot) {
-            j--;
-            dest.free_payload(dest.get_slot(j).ptr,
-                    Encoder::get_payload_length(dest.get_payload_for_slot(j)));
-            dest.delete_slot(j);
-        }
-    }
-    // Otherwise, we delete the copied slots on the source array, thus completing the move operation
-    else {
-        assert<1>(i == last_slot + 1);
-        while (i > src_slot) {
-            i--;
-            src.free_payload(src.get_slot(i).ptr,
-                    Encoder::get_payload_length(src.get_payload_for_slot(i)));
-            src.delete_slot(i);
-        }
-    }
+    // 4. Delete the moved slots from the source array, thus completing the move operation
+    src.delete_slots(src_slot, slot_count, [] (void* payload) {
+        return Encoder::get_payload_length(payload);
+    });
 
     assert<1>(dest.is_sorted());
     assert<1>(src.is_sorted());
 
-    return success;
+    return true;
 }
 
 } // namespace internal
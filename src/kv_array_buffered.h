@@ -0,0 +1,352 @@
+/*
+ * MIT License
+ *
+ * Copyright (c) 2016 Caetano Sauer
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy of this software and
+ * associated documentation files (the "Software"), to deal in the Software without restriction,
+ * including without limitation the rights to use, copy, modify, merge, publish, distribute,
+ * sublicense, and/or sell copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all copies or
+ * substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR IMPLIED, INCLUDING BUT
+ * NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM,
+ * DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+#ifndef FOSTER_BTREE_KV_ARRAY_BUFFERED_H
+#define FOSTER_BTREE_KV_ARRAY_BUFFERED_H
+
+/**
+ * \file kv_array_buffered.h
+ *
+ * Key-value array that collects inserted pairs in a small unsorted buffer and merges them into the
+ * slot vector in batches.
+ */
+
+#include <cstdint>
+#include <cstring>
+#include <type_traits>
+
+#include "assertions.h"
+#include "kv_array.h"
+#include "metaprog.h"
+
+namespace foster {
+
+namespace internal {
+    /// Whether values are node pointers, i.e., whether an array belongs to a branch node
+    template <class V, class = void>
+    struct IsPointerValue : std::false_type {};
+
+    template <class V>
+    struct IsPointerValue<V, meta::VoidType<typename V::PointeeType>> : std::true_type {};
+}
+
+/**
+ * \brief Key-value array that buffers insertions of new keys, so that they do not shift slots.
+ *
+ * In a KeyValueArray, each insertion opens a gap in the slot vector, which moves half of it on
+ * average with random keys. Here, the slot of a new key is appended to an unsorted buffer of
+ * BufferSlots entries kept after the slot array, while its payload is allocated and encoded as
+ * usual. When the buffer is full, its entries are sorted and merged into the slot vector in a
+ * single backward pass, which moves each slot at most once for the whole batch (\see
+ * merge_buffer). Free space for the slots of buffered pairs is reserved when they are inserted,
+ * so a merge never fails.
+ *
+ * Buffering pays off when an insertion shifts many slots, i.e., with large nodes. On 4 KB nodes,
+ * shifting half of the slot vector is about as cheap as scanning the buffer on each search, so
+ * insertion throughput is not improved (see the insert buffer benchmarks in simplebench).
+ *
+ * Searches (find and put) scan the buffer before searching the slot vector, which only costs a
+ * comparison of PMNKs per entry in the common case. All other operations see the slot vector
+ * only, so the buffer is merged before any operation that modifies existing slots or payloads
+ * (removals, overwrites, compaction, moves of records in splits and merges, and shifts of the
+ * fenster by a BtreeNode). Methods that read slots by number (slot_count, lower_bound,
+ * read_slot, etc.) do not cover buffered pairs: readers that scan the array in order must merge
+ * the buffer first, which requires exclusive access (\see BtreeCursor), and readers that only
+ * search for a key must use find (\see BasicAdaptiveHashIndex::probe).
+ *
+ * Only new keys are buffered, and only on leaves: in branch nodes (i.e., if V is a node pointer),
+ * the buffer is disabled, since traversals rely on the slot vector to find the child of a key.
+ *
+ * \tparam BufferSlots Maximum number of buffered pairs, which bounds the cost of a search miss
+ */
+template <
+    class K,
+    class V,
+    class SlotArray,
+    class Search,
+    class Encoder,
+    size_t BufferSlots = 16
+>
+class BufferedKeyValueArray : public KeyValueArray<K, V, SlotArray, Search, Encoder>
+{
+public:
+
+    using BaseType = KeyValueArray<K, V, SlotArray, Search, Encoder>;
+    using KeyView = typename BaseType::KeyView;
+    using SlotNumber = typename BaseType::SlotNumber;
+    using PayloadPtr = typename BaseType::PayloadPtr;
+    using PMNK_Type = typename BaseType::PMNK_Type;
+    using Iterator = typename BaseType::Iterator;
+
+    /// Number of buffer entries, which is zero on branch nodes
+    static constexpr size_t BufferCapacity = internal::IsPointerValue<V>::value ? 0 : BufferSlots;
+    /// Whether new keys may be kept out of the slot vector (\see internal::BuffersInserts)
+    static constexpr bool BufferedInserts = BufferCapacity > 0;
+
+    static_assert(std::is_trivially_copyable<PMNK_Type>::value,
+            "Buffered slots are moved with memmove, so PMNKs must be trivially copyable");
+    static_assert(BufferSlots < 256, "Buffer size exceeds the range of its counter");
+
+    BufferedKeyValueArray() : buffer_(), positions_(), buffered_(0) {}
+
+    /// Buffered slots are merged, so that resources of their payloads are released by the base class
+    ~BufferedKeyValueArray() { merge_buffer(); }
+
+    /**
+     * \brief Same as KeyValueArray::put, but new keys are buffered if there is space for them.
+     *
+     * If the key exists or was removed and its ghost is still in the slot vector, the buffer is
+     * merged and the pair is written by KeyValueArray::put, which also reports lack of space.
+     */
+    template <PutMode Mode = PutMode::Upsert>
+    PutStatus put(const KeyView& key, const V& value)
+    {
+        if (Mode == PutMode::Update || !BufferedInserts) {
+            merge_buffer();
+            return BaseType::template put<Mode>(key, value);
+        }
+
+        // Merging changes the slot vector, so it must precede the search for the position
+        if (buffered_ == BufferCapacity) { merge_buffer(); }
+
+        SlotNumber slot {0};
+        bool exists = find_buffered(key) < buffered_ || this->find_slot(key, nullptr, slot);
+        if (exists && Mode == PutMode::Insert) { return PutStatus::KeyExists; }
+        if (exists || is_ghost_of(slot, key)) {
+            merge_buffer();
+            return BaseType::template put<Mode>(key, value);
+        }
+
+        size_t payload_length = Encoder::get_payload_length(key, value);
+        size_t required = this->get_payload_count(payload_length) * BaseType::Alignment
+            + (buffered_ + 1) * SlotArray::SlotSize;
+        if (SlotArray::free_space() < required) {
+            // Let the base class purge ghosts or report lack of space
+            merge_buffer();
+            return BaseType::template put<Mode>(key, value);
+        }
+
+        PayloadPtr payload {0};
+        if (!this->allocate_payload(payload, payload_length)) {
+            merge_buffer();
+            return BaseType::template put<Mode>(key, value);
+        }
+        Encoder::encode(key, value, this->get_payload(payload));
+
+        Slot& entry = buffer_[buffered_];
+        entry.key = Encoder::get_pmnk(key);
+        entry.ptr = payload;
+        entry.ghost = false;
+        positions_[buffered_] = slot;
+        buffered_++;
+
+        return PutStatus::Inserted;
+    }
+
+    /// \brief Searches for a given key in the buffer and then in the slot vector.
+    bool find(const KeyView& key, V* value = nullptr)
+    {
+        size_t i = find_buffered(key);
+        if (i < buffered_) {
+            if (value) {
+                Encoder::decode(this->get_payload(buffer_[i].ptr), nullptr, value, nullptr);
+            }
+            return true;
+        }
+        return BaseType::find(key, value);
+    }
+
+    /**
+     * \brief Inserts all buffered slots into the slot vector.
+     *
+     * The slot vector is not modified while pairs are buffered, so the position of each entry is
+     * the one found by put. Entries are sorted by position (and by key within a position), the
+     * slot vector is grown by the number of entries, and its slots are moved from the end towards
+     * the front, each segment between two insertion positions being moved only once, directly to
+     * its final place.
+     */
+    void merge_buffer()
+    {
+        // Branches never buffer, so their instances compile to nothing
+        if (!BufferedInserts || buffered_ == 0) { return; }
+        size_t count = buffered_;
+
+        // 1. Sort the buffer (insertion sort, since it is small)
+        for (size_t i = 1; i < count; i++) {
+            Slot entry = buffer_[i];
+            SlotNumber position = positions_[i];
+            size_t j = i;
+            while (j > 0 && (position < positions_[j - 1]
+                        || (position == positions_[j - 1] && key_less(entry, buffer_[j - 1]))))
+            {
+                buffer_[j] = buffer_[j - 1];
+                positions_[j] = positions_[j - 1];
+                j--;
+            }
+            buffer_[j] = entry;
+            positions_[j] = position;
+        }
+
+        // 2. Grow the slot vector, whose space was reserved by put, and move slots backwards
+        SlotNumber end = this->slot_count();
+        bool success = this->insert_slots(end, count);
+        assert<1>(success, "Slot space of buffered pairs was not reserved");
+        buffered_ = 0;
+
+        Slot* slots = &this->get_slot(0);
+        for (size_t i = count; i-- > 0;) {
+            SlotNumber begin = positions_[i];
+            memmove(&slots[begin + i + 1], &slots[begin], (end - begin) * sizeof(Slot));
+            slots[begin + i] = buffer_[i];
+            end = begin;
+        }
+        assert<3>(this->is_sorted());
+    }
+
+    /// \brief Number of pairs waiting in the buffer
+    size_t buffered_count() const { return buffered_; }
+
+    /// \brief Free space, excluding the space reserved for the slots of buffered pairs
+    size_t free_space()
+    {
+        return SlotArray::free_space() - buffered_ * SlotArray::SlotSize;
+    }
+
+    /// \brief Number of key-value pairs currently present in the array, including buffered ones
+    size_t size()
+    {
+        return BaseType::size() + buffered_;
+    }
+
+    /** @name Operations that require all pairs in the slot vector, which merge the buffer first **/
+    /**@{**/
+
+    bool insert(const KeyView& key, const V& value)
+    {
+        merge_buffer();
+        return BaseType::insert(key, value);
+    }
+
+    bool append(const KeyView& key, const V& value, size_t reserved = 0)
+    {
+        merge_buffer();
+        return BaseType::append(key, value, reserved);
+    }
+
+    bool insert_key(const KeyView& key, size_t payload_length, SlotNumber& slot)
+    {
+        merge_buffer();
+        return BaseType::insert_key(key, payload_length, slot);
+    }
+
+    template <bool MustExist = true>
+    bool remove(const KeyView& key)
+    {
+        merge_buffer();
+        return BaseType::template remove<MustExist>(key);
+    }
+
+    void compact()
+    {
+        merge_buffer();
+        BaseType::compact();
+    }
+
+    void truncate_keys(size_t length)
+    {
+        merge_buffer();
+        BaseType::truncate_keys(length);
+    }
+
+    Iterator iterate()
+    {
+        merge_buffer();
+        return BaseType::iterate();
+    }
+
+    void print(std::ostream& o)
+    {
+        merge_buffer();
+        BaseType::print(o);
+    }
+
+    /**@}**/
+
+protected:
+
+    using Slot = typename SlotArray::Slot;
+
+    /// Payloads are shifted by a BtreeNode to resize its fenster, which only adjusts the slot vector
+    bool shift_payloads(PayloadPtr to, PayloadPtr from, size_t count)
+    {
+        merge_buffer();
+        return SlotArray::shift_payloads(to, from, count);
+    }
+
+private:
+
+    static constexpr size_t BufferEntries = BufferCapacity > 0 ? BufferCapacity : 1;
+
+    Slot buffer_[BufferEntries];
+    /// Position in the slot vector into which each buffered slot is inserted
+    SlotNumber positions_[BufferEntries];
+    uint8_t buffered_;
+
+    /// Position of the given key in the buffer, or the number of buffered entries if not found
+    size_t find_buffered(const KeyView& key)
+    {
+        if (buffered_ == 0) { return 0; }
+
+        PMNK_Type pmnk = Encoder::get_pmnk(key);
+        for (size_t i = 0; i < buffered_; i++) {
+            if (buffer_[i].key != pmnk) { continue; }
+            KeyView found_key;
+            PMNK_Type found_pmnk = pmnk;
+            Encoder::decode_view(this->get_payload(buffer_[i].ptr), &found_key, nullptr,
+                    &found_pmnk);
+            if (found_key == key) { return i; }
+        }
+        return buffered_;
+    }
+
+    /// Whether a slot yielded by find_slot is a ghost of the given key
+    bool is_ghost_of(SlotNumber slot, const KeyView& key)
+    {
+        if (slot >= this->slot_count() || !this->get_slot(slot).ghost) { return false; }
+        KeyView ghost_key;
+        this->read_slot_view(slot, &ghost_key, nullptr);
+        return ghost_key == key;
+    }
+
+    bool key_less(const Slot& a, const Slot& b)
+    {
+        if (a.key != b.key) { return a.key < b.key; }
+        KeyView key_a, key_b;
+        PMNK_Type pmnk_a = a.key, pmnk_b = b.key;
+        Encoder::decode_view(this->get_payload(a.ptr), &key_a, nullptr, &pmnk_a);
+        Encoder::decode_view(this->get_payload(b.ptr), &key_b, nullptr, &pmnk_b);
+        return key_a < key_b;
+    }
+};
+
+} // namespace foster
+
+#endif
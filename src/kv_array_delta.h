@@ -0,0 +1,744 @@
+/*
+ * MIT License
+ *
+ * Copyright (c) 2016 Caetano Sauer
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy of this software and
+ * associated documentation files (the "Software"), to deal in the Software without restriction,
+ * including without limitation the rights to use, copy, modify, merge, publish, distribute,
+ * sublicense, and/or sell copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all copies or
+ * substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR IMPLIED, INCLUDING BUT
+ * NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM,
+ * DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+#ifndef FOSTER_BTREE_KV_ARRAY_DELTA_H
+#define FOSTER_BTREE_KV_ARRAY_DELTA_H
+
+/**
+ * \file kv_array_delta.h
+ *
+ * Key-value array for integer keys, which are stored as deltas from a per-array base value
+ * (frame-of-reference compression).
+ */
+
+#include <algorithm>
+#include <array>
+#include <cstdint>
+#include <cstring>
+#include <iostream>
+#include <type_traits>
+
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+
+#include "assertions.h"
+#include "exceptions.h"
+#include "kv_array.h"
+#include "kv_array_inline.h"
+#include "metaprog.h"
+
+namespace foster {
+
+namespace internal {
+
+#ifdef __SSE2__
+
+/// Interleaves the lower or upper lanes of a vector of From-byte integers with zeros
+template <size_t From> struct SimdUnpack;
+template <> struct SimdUnpack<1>
+{
+    static __m128i lo(__m128i v) { return _mm_unpacklo_epi8(v, _mm_setzero_si128()); }
+    static __m128i hi(__m128i v) { return _mm_unpackhi_epi8(v, _mm_setzero_si128()); }
+};
+template <> struct SimdUnpack<2>
+{
+    static __m128i lo(__m128i v) { return _mm_unpacklo_epi16(v, _mm_setzero_si128()); }
+    static __m128i hi(__m128i v) { return _mm_unpackhi_epi16(v, _mm_setzero_si128()); }
+};
+template <> struct SimdUnpack<4>
+{
+    static __m128i lo(__m128i v) { return _mm_unpacklo_epi32(v, _mm_setzero_si128()); }
+    static __m128i hi(__m128i v) { return _mm_unpackhi_epi32(v, _mm_setzero_si128()); }
+};
+
+/// Lane-wise addition and broadcast of To-byte integers
+template <size_t To> struct SimdAdd;
+template <> struct SimdAdd<1>
+{
+    static __m128i set(uint8_t b) { return _mm_set1_epi8(static_cast<char>(b)); }
+    static __m128i add(__m128i a, __m128i b) { return _mm_add_epi8(a, b); }
+};
+template <> struct SimdAdd<2>
+{
+    static __m128i set(uint16_t b) { return _mm_set1_epi16(static_cast<short>(b)); }
+    static __m128i add(__m128i a, __m128i b) { return _mm_add_epi16(a, b); }
+};
+template <> struct SimdAdd<4>
+{
+    static __m128i set(uint32_t b) { return _mm_set1_epi32(static_cast<int>(b)); }
+    static __m128i add(__m128i a, __m128i b) { return _mm_add_epi32(a, b); }
+};
+template <> struct SimdAdd<8>
+{
+    static __m128i set(uint64_t b) { return _mm_set1_epi64x(static_cast<long long>(b)); }
+    static __m128i add(__m128i a, __m128i b) { return _mm_add_epi64(a, b); }
+};
+
+/**
+ * \brief Zero-extends a vector of From-byte deltas into To-byte lanes and adds the base to them.
+ *
+ * The 16 / From deltas of the vector yield To / From output vectors, which are written to out.
+ */
+template <size_t From, size_t To>
+struct SimdWiden
+{
+    static void apply(__m128i v, __m128i base, char* out)
+    {
+        SimdWiden<2 * From, To>::apply(SimdUnpack<From>::lo(v), base, out);
+        SimdWiden<2 * From, To>::apply(SimdUnpack<From>::hi(v), base, out + 8 * To / From);
+    }
+};
+
+template <size_t To>
+struct SimdWiden<To, To>
+{
+    static void apply(__m128i v, __m128i base, char* out)
+    {
+        _mm_storeu_si128(reinterpret_cast<__m128i*>(out), SimdAdd<To>::add(v, base));
+    }
+};
+
+#endif // __SSE2__
+
+} // namespace internal
+
+/**
+ * \brief Key-value array that stores integer keys as deltas from a base value.
+ *
+ * Dense integer keys (e.g., IDs allocated sequentially) only differ in their lower bits within a
+ * node, so storing all bytes of each key wastes most of the node space. This class keeps the
+ * layout of InlineKeyValueArray (a key vector followed by a value vector), but each entry of the
+ * key vector is the difference between the key and a base value kept in the header, with a width
+ * of 1, 2, 4, or 8 bytes chosen per array -- the smallest one that fits the difference between the
+ * largest key and the base:
+ *
+ *     | header (base, width) | delta vector -> | value vector -> | free space | <- payloads |
+ *
+ * The base is the smallest key (i.e., the tightest low fence of the node), and thus it does not
+ * depend on the fence keys of a BtreeNode, which are infinite on the edges of the tree. When an
+ * inserted key does not fit into the current frame, the array is re-encoded in place with a new
+ * base and width, or the insertion fails if there is not enough space for the wider vector, which
+ * causes a split. Pairs moved out of an array (e.g., in a split) are re-encoded into the frame of
+ * the destination, and the source is re-encoded into its tightest frame, so that both halves of a
+ * split shrink their width whenever possible.
+ *
+ * Keys are decoded in bulk with SIMD instructions (\see decode_keys), which is used by iterators
+ * and by cursors of trees whose leaves use this array (\see BtreeCursor).
+ *
+ * \tparam K Type of keys (must be integral)
+ * \tparam V Type of values (must be trivially copyable)
+ * \tparam ArrayBytes The total size of the array in bytes
+ * \tparam PayloadAlignment The size of a payload block
+ */
+template <class K, class V, size_t ArrayBytes = 8192, size_t PayloadAlignment = 8>
+class DeltaKeyValueArray
+{
+public:
+
+    using KeyType = K;
+    using KeyView = K;
+    using ValueType = V;
+    using ThisType = DeltaKeyValueArray<K, V, ArrayBytes, PayloadAlignment>;
+    using UnsignedKey = typename std::make_unsigned<K>::type;
+
+    static constexpr size_t Alignment = PayloadAlignment;
+
+    /// Pairs are not encoded into payloads (\see internal::move_kv_records)
+    static constexpr bool InlineRecords = true;
+    /// Values are never stored out of line (\see KeyValueArray::ExternalPayloads)
+    static constexpr bool ExternalPayloads = false;
+    /// Keys are read in batches by iterators and cursors (\see internal::DecodesKeys)
+    static constexpr bool BatchDecoding = true;
+
+    /** @name Compile-time constants and types **/
+    /**@{**/
+    /** Upper bound for the number of pairs that fit into the allocated memory (1-byte deltas) */
+    static constexpr size_t MaxSlotCount = ArrayBytes / (1 + sizeof(V));
+    /** Slot number type, large enough to address all slots */
+    using SlotNumber = typename meta::UnsignedInteger<meta::get_pointer_size(MaxSlotCount)>;
+    /** Number of payload blocks that fit into the allocated memory */
+    static constexpr size_t MaxPayloadCount = ArrayBytes / Alignment;
+    /** Type of payload block pointers */
+    using PayloadPtr = typename meta::UnsignedInteger<meta::get_pointer_size(MaxPayloadCount)>;
+    /** Type of payload blocks (a fixed-length byte array) */
+    using PayloadBlock = typename std::array<char, Alignment>;
+    /**@}**/
+
+private:
+
+    struct alignas(Alignment) HeaderData {
+        K base;
+        SlotNumber slot_end;
+        PayloadPtr payload_begin;
+        uint8_t key_width;
+    };
+
+    /** Actual maximum number of payload blocks, taking space occupied by header into account */
+    static constexpr size_t PayloadCount = (ArrayBytes - sizeof(HeaderData)) / Alignment;
+
+public:
+
+    /// Total size in bytes of the area shared by the vectors and payloads
+    static constexpr size_t Capacity = PayloadCount * Alignment;
+
+    DeltaKeyValueArray() : header_{K{0}, 0, PayloadCount, 1} {}
+
+    /**
+     * \brief Insert a key-value pair into the array.
+     * \returns true if insertion succeeded (i.e., if there was enough free space)
+     * \throws ExistentKeyException if the key already exists in the array (\see put)
+     */
+    bool insert(const K& key, const V& value)
+    {
+        SlotNumber slot {0};
+        if (find_slot(key, nullptr, slot)) {
+            throw ExistentKeyException<K>(key);
+        }
+        return insert_at(slot, key, value);
+    }
+
+    /// \brief Inserts, overwrites, or both, depending on Mode (\see KeyValueArray::put)
+    template <PutMode Mode = PutMode::Upsert>
+    PutStatus put(const K& key, const V& value)
+    {
+        SlotNumber slot {0};
+        if (find_slot(key, nullptr, slot)) {
+            if (Mode == PutMode::Insert) { return PutStatus::KeyExists; }
+            memcpy(value_at(slot), &value, sizeof(V));
+            return PutStatus::Updated;
+        }
+        if (Mode == PutMode::Update) { return PutStatus::KeyNotFound; }
+        return insert_at(slot, key, value) ? PutStatus::Inserted : PutStatus::NoSpace;
+    }
+
+    /// \brief Appends a pair after the last slot (\see KeyValueArray::append)
+    bool append(const K& key, const V& value, size_t reserved = 0)
+    {
+        assert<1>(slot_count() == 0 || key_at(slot_count() - 1) < key, "Appended key is not the largest");
+        return insert_at(SlotNumber(slot_count()), key, value, reserved);
+    }
+
+    /**
+     * \brief Removes a key-value pair from the array, shifting the subsequent pairs.
+     *
+     * The frame is not re-encoded, since removals never make a key fall out of it.
+     *
+     * \throws KeyNotFoundException if key does not exist in the array.
+     */
+    template <bool MustExist = true>
+    bool remove(const K& key)
+    {
+        SlotNumber slot;
+        if (!find_slot(key, nullptr, slot)) {
+            if (MustExist) { throw KeyNotFoundException<K>(key); }
+            else { return false; }
+        }
+        delete_slots(slot, 1);
+        return true;
+    }
+
+    /// \brief Nothing to do, since there are no ghosts
+    void compact() {}
+
+    /// \brief Searches for a given key in the array (\see KeyValueArray::find)
+    bool find(const K& key, V* value = nullptr)
+    {
+        SlotNumber slot {0};
+        return find_slot(key, value, slot);
+    }
+
+    /// \brief Returns the slot of the first key that is greater than or equal to the given key.
+    SlotNumber lower_bound(const K& key)
+    {
+        SlotNumber slot {0};
+        find_slot(key, nullptr, slot);
+        return slot;
+    }
+
+    /** \brief Amount of free space (in bytes) between end of value vector and begin of payloads. */
+    size_t free_space() const
+    {
+        return header_.payload_begin * sizeof(PayloadBlock) - header_.slot_end * slot_size();
+    }
+
+    size_t ghost_space() const { return 0; }
+    size_t ghost_count() const { return 0; }
+    bool is_ghost(SlotNumber) const { return false; }
+
+    size_t slot_count() const { return header_.slot_end; }
+    size_t size() const { return header_.slot_end; }
+
+    /// \brief Width in bytes of each entry of the delta vector
+    size_t key_width() const { return header_.key_width; }
+
+    void read_slot(SlotNumber s, K* key, V* value)
+    {
+        if (key) { *key = key_at(s); }
+        if (value) { memcpy(value, value_at(s), sizeof(V)); }
+    }
+
+    void read_slot_view(SlotNumber s, K* key, V* value)
+    {
+        read_slot(s, key, value);
+    }
+
+    /**
+     * \brief Decodes the keys of a range of slots into the given buffer.
+     *
+     * With SSE2, deltas are zero-extended and added to the base 16 bytes at a time.
+     */
+    void decode_keys(SlotNumber first, size_t count, K* out) const
+    {
+        assert<1>(first + count <= slot_count(), "Slot number out of bounds");
+        switch (header_.key_width) {
+            case 1: decode_deltas<DeltaType<1>>(first, count, out); break;
+            case 2: decode_deltas<DeltaType<2>>(first, count, out); break;
+            case 4: decode_deltas<DeltaType<4>>(first, count, out); break;
+            default: decode_deltas<DeltaType<8>>(first, count, out); break;
+        }
+    }
+
+    /**
+     * \brief Sequentially reads all key-value pairs, decoding keys in batches
+     * \see KeyValueArray::Iterator
+     */
+    class Iterator
+    {
+    public:
+        Iterator(ThisType* kv) :
+            current_slot_{0}, batch_begin_{0}, batch_end_{0}, kv_{kv}
+        {}
+
+        bool next(K* key, V* value)
+        {
+            if (current_slot_ >= kv_->slot_count()) { return false; }
+            if (current_slot_ >= batch_end_) {
+                batch_begin_ = current_slot_;
+                size_t count = std::min(kv_->slot_count() - current_slot_, size_t(BatchSize));
+                kv_->decode_keys(batch_begin_, count, keys_.data());
+                batch_end_ = batch_begin_ + count;
+            }
+            if (key) { *key = keys_[current_slot_ - batch_begin_]; }
+            kv_->read_slot(current_slot_, nullptr, value);
+            current_slot_++;
+            return true;
+        }
+
+    private:
+        static constexpr size_t BatchSize = 64;
+
+        SlotNumber current_slot_;
+        SlotNumber batch_begin_;
+        SlotNumber batch_end_;
+        ThisType* kv_;
+        std::array<K, BatchSize> keys_;
+    };
+
+    Iterator iterate()
+    {
+        return Iterator{this};
+    }
+
+    /// Debugging/utility function to print the array's contents.
+    void print(std::ostream& o)
+    {
+        o << "Base = " << header_.base << ", width = " << key_width() << std::endl;
+        for (SlotNumber i = 0; i < slot_count(); i++) {
+            K key;
+            V value;
+            read_slot(i, &key, &value);
+            o << "Slot " << i << " k = " << key << ", v = " << value << std::endl;
+        }
+    }
+
+    /// Debugging/testing function to verify if contents are sorted
+    bool is_sorted() const
+    {
+        for (size_t i = 1; i < slot_count(); i++) {
+            if (!(key_at(i - 1) < key_at(i))) { return false; }
+        }
+        return true;
+    }
+
+protected:
+
+    /** @name Payload management methods (\see SlotArray) **/
+    /**@{**/
+
+    static size_t get_payload_count(size_t length)
+    {
+        return length / sizeof(PayloadBlock) + (length % sizeof(PayloadBlock) != 0);
+    }
+
+    bool allocate_payload(PayloadPtr& ptr, size_t length)
+    {
+        size_t space_needed = get_payload_count(length) * Alignment;
+        if (free_space() < space_needed) { return false; }
+        header_.payload_begin -= get_payload_count(length);
+        ptr = header_.payload_begin;
+        return true;
+    }
+
+    void free_payload(PayloadPtr ptr, size_t length)
+    {
+        assert<3>(ptr >= header_.payload_begin, DBGINFO, "Invalid payload pointer");
+        size_t count = get_payload_count(length);
+        size_t shift = ptr - header_.payload_begin;
+        shift_payloads(header_.payload_begin + count, header_.payload_begin, shift);
+    }
+
+    /// No slot pointers must be adjusted (\see InlineKeyValueArray::shift_payloads)
+    bool shift_payloads(PayloadPtr to, PayloadPtr from, size_t count)
+    {
+        PayloadPtr first_affected = std::min(from, to);
+        int shift = to - from;
+
+        if (shift < 0 && free_space() < sizeof(PayloadBlock) * (-shift)) {
+            return false;
+        }
+
+        memmove(&payloads_[to], &payloads_[from], count * sizeof(PayloadBlock));
+        if (first_affected <= header_.payload_begin) {
+            header_.payload_begin += shift;
+        }
+
+        return true;
+    }
+
+    PayloadPtr get_first_payload() const { return header_.payload_begin; }
+
+    void* get_payload(PayloadPtr ptr) { return payloads_[ptr].data(); }
+    const void* get_payload(PayloadPtr ptr) const { return payloads_[ptr].data(); }
+
+    /**@}**/
+
+    /**
+     * \brief Searches the delta vector (\see KeyValueArray::find_slot)
+     *
+     * Keys outside the frame are positioned without a search. If the key is not found and value
+     * is not null, the value of the previous slot is read, which supports traversal of branch nodes.
+     */
+    bool find_slot(const K& key, V* value, SlotNumber& slot)
+    {
+        size_t n = slot_count();
+        if (n == 0 || key < header_.base) {
+            slot = 0;
+            return false;
+        }
+
+        UnsignedKey delta = delta_of(key);
+        if (delta > max_delta(header_.key_width)) {
+            slot = n;
+        }
+        else {
+            switch (header_.key_width) {
+                case 1: slot = lower_bound_delta<DeltaType<1>>(delta); break;
+                case 2: slot = lower_bound_delta<DeltaType<2>>(delta); break;
+                case 4: slot = lower_bound_delta<DeltaType<4>>(delta); break;
+                default: slot = lower_bound_delta<DeltaType<8>>(delta); break;
+            }
+            if (slot < n && load_delta(slot) == delta) {
+                if (value) { read_slot(slot, nullptr, value); }
+                return true;
+            }
+        }
+
+        if (value && slot > 0) { read_slot(slot - 1, nullptr, value); }
+        return false;
+    }
+
+    /**
+     * \brief Inserts a pair into the given slot, re-encoding the array if the key is out of frame.
+     * \returns false if the pair (with the given amount of reserved bytes) does not fit
+     */
+    bool insert_at(SlotNumber slot, const K& key, const V& value, size_t reserved = 0)
+    {
+        size_t n = slot_count();
+        K base = header_.base;
+        unsigned width = header_.key_width;
+
+        if (n == 0) {
+            base = key;
+            width = 1;
+        }
+        else if (key < base || delta_of(key) > max_delta(width)) {
+            K first = key_at(0), last = key_at(n - 1);
+            base = std::min(key, first);
+            width = width_for(UnsignedKey(std::max(key, last)) - UnsignedKey(base));
+        }
+
+        size_t required = (n + 1) * (width + sizeof(V)) + reserved;
+        if (header_.payload_begin * sizeof(PayloadBlock) < required) { return false; }
+
+        if (base != header_.base || width != header_.key_width) { reencode(base, width); }
+        bool success = insert_slots(slot, 1);
+        assert<1>(success, "Slot insertion failed despite available space");
+        store_delta(slot, delta_of(key));
+        memcpy(value_at(slot), &value, sizeof(V));
+        assert<3>(is_sorted());
+
+        return true;
+    }
+
+    /// \brief Opens a gap of count slots in both vectors (\see InlineKeyValueArray::insert_slots)
+    bool insert_slots(SlotNumber slot, size_t count)
+    {
+        assert<1>(slot <= slot_count(), "Slot number out of bounds");
+        if (free_space() < count * slot_size()) { return false; }
+
+        size_t n = slot_count(), w = header_.key_width;
+        char* old_values = values();
+        char* new_values = deltas() + (n + count) * w;
+
+        memmove(new_values + (slot + count) * sizeof(V), old_values + slot * sizeof(V),
+                sizeof(V) * (n - slot));
+        memmove(new_values, old_values, sizeof(V) * slot);
+        memmove(deltas() + (slot + count) * w, deltas() + slot * w, w * (n - slot));
+        header_.slot_end += count;
+
+        return true;
+    }
+
+    /// \brief Deletes a range of slots from both vectors, shifting each vector only once
+    void delete_slots(SlotNumber slot, size_t count)
+    {
+        assert<1>(slot + count <= slot_count(), "Slot number out of bounds");
+
+        size_t n = slot_count(), w = header_.key_width;
+        char* old_values = values();
+        char* new_values = deltas() + (n - count) * w;
+
+        memmove(deltas() + slot * w, deltas() + (slot + count) * w, w * (n - slot - count));
+        memmove(new_values, old_values, sizeof(V) * slot);
+        memmove(new_values + slot * sizeof(V), old_values + (slot + count) * sizeof(V),
+                sizeof(V) * (n - slot - count));
+        header_.slot_end -= count;
+    }
+
+    /**
+     * \brief Moves pairs from another array (\see internal::move_kv_records)
+     *
+     * The frame of this array is extended to the moved keys if required, and the source array is
+     * re-encoded into the tightest frame of its remaining keys.
+     */
+    bool move_records(SlotNumber dest_slot, ThisType& src, SlotNumber src_slot, size_t slot_count)
+    {
+        assert<1>(src_slot + slot_count <= src.slot_count());
+        if (slot_count == 0) { return true; }
+
+        size_t n = this->slot_count();
+        K lo = src.key_at(src_slot), hi = src.key_at(src_slot + slot_count - 1);
+        if (n > 0) {
+            lo = std::min(lo, header_.base);
+            hi = std::max(hi, key_at(n - 1));
+        }
+        unsigned width = width_for(UnsignedKey(hi) - UnsignedKey(lo));
+
+        size_t required = (n + slot_count) * (width + sizeof(V));
+        if (header_.payload_begin * sizeof(PayloadBlock) < required) { return false; }
+
+        if (n == 0 || lo != header_.base || width != header_.key_width) { reencode(lo, width); }
+        bool success = insert_slots(dest_slot, slot_count);
+        assert<1>(success, "Slot insertion failed despite available space");
+        for (size_t i = 0; i < slot_count; i++) {
+            store_delta(dest_slot + i, delta_of(src.key_at(src_slot + i)));
+        }
+        memcpy(value_at(dest_slot), src.value_at(src_slot), sizeof(V) * slot_count);
+
+        src.delete_slots(src_slot, slot_count);
+        src.shrink_frame();
+
+        assert<1>(is_sorted());
+        assert<1>(src.is_sorted());
+
+        return true;
+    }
+
+    template<class T, class S>
+    friend typename std::enable_if<T::InlineRecords, bool>::type
+    internal::move_kv_records(T&, S, T&, S, size_t);
+
+private:
+
+    HeaderData header_;
+
+    union {
+        alignas(Alignment) char bytes_[PayloadCount * Alignment];
+        PayloadBlock payloads_[PayloadCount];
+    };
+
+    static_assert(std::is_integral<K>::value, "DeltaKeyValueArray requires integer keys");
+    static_assert(std::is_trivially_copyable<V>::value,
+            "DeltaKeyValueArray requires trivially copyable values");
+    static_assert(ArrayBytes % Alignment == 0,
+            "DeltaKeyValueArray template argument error: ArrayBytes must be a multiple of Aligment");
+    static_assert(sizeof(HeaderData) % Alignment == 0,
+            "DeltaKeyValueArray::HeaderData is not aligned properly");
+
+    /// Type of deltas with the given width, which never exceeds the key size
+    template <size_t Width>
+    using DeltaType = meta::UnsignedInteger<(Width < sizeof(K) ? Width : sizeof(K))>;
+
+    size_t slot_size() const { return header_.key_width + sizeof(V); }
+
+    char* deltas() { return bytes_; }
+    const char* deltas() const { return bytes_; }
+
+    /// The value vector begins right after the last delta, so values are accessed with memcpy
+    char* values() { return bytes_ + header_.slot_end * header_.key_width; }
+    char* value_at(SlotNumber slot) { return values() + slot * sizeof(V); }
+
+    UnsignedKey delta_of(K key) const
+    {
+        return UnsignedKey(key) - UnsignedKey(header_.base);
+    }
+
+    static UnsignedKey max_delta(unsigned width)
+    {
+        return width >= sizeof(UnsignedKey) ? ~UnsignedKey(0)
+            : UnsignedKey((uint64_t(1) << (8 * width)) - 1);
+    }
+
+    /// Smallest width (1, 2, 4, or 8 bytes, but at most the key size) that fits the given delta
+    static unsigned width_for(UnsignedKey delta)
+    {
+        unsigned width = 1;
+        while (width < sizeof(UnsignedKey) && delta > max_delta(width)) { width *= 2; }
+        return width;
+    }
+
+    UnsignedKey load_delta(SlotNumber slot, unsigned width) const
+    {
+        const char* p = deltas() + slot * width;
+        switch (width) {
+            case 1: return *reinterpret_cast<const uint8_t*>(p);
+            case 2: return *reinterpret_cast<const uint16_t*>(p);
+            case 4: return *reinterpret_cast<const uint32_t*>(p);
+            default: return static_cast<UnsignedKey>(*reinterpret_cast<const uint64_t*>(p));
+        }
+    }
+
+    UnsignedKey load_delta(SlotNumber slot) const { return load_delta(slot, header_.key_width); }
+
+    void store_delta(SlotNumber slot, UnsignedKey delta, unsigned width)
+    {
+        char* p = deltas() + slot * width;
+        switch (width) {
+            case 1: *reinterpret_cast<uint8_t*>(p) = static_cast<uint8_t>(delta); break;
+            case 2: *reinterpret_cast<uint16_t*>(p) = static_cast<uint16_t>(delta); break;
+            case 4: *reinterpret_cast<uint32_t*>(p) = static_cast<uint32_t>(delta); break;
+            default: *reinterpret_cast<uint64_t*>(p) = static_cast<uint64_t>(delta); break;
+        }
+    }
+
+    void store_delta(SlotNumber slot, UnsignedKey delta)
+    {
+        store_delta(slot, delta, header_.key_width);
+    }
+
+    K key_at(SlotNumber slot) const
+    {
+        return K(UnsignedKey(header_.base) + load_delta(slot));
+    }
+
+    /// Branch-free lower bound on the delta vector (\see InlineKeyValueArray::find_slot)
+    template <class D>
+    SlotNumber lower_bound_delta(UnsignedKey delta) const
+    {
+        const D* begin = reinterpret_cast<const D*>(deltas());
+        const D* base = begin;
+        D d = static_cast<D>(delta);
+        size_t n = slot_count();
+        while (n > 1) {
+            size_t half = n / 2;
+            base = base[half] < d ? base + half : base;
+            n -= half;
+        }
+        return (base - begin) + (n == 1 && *base < d);
+    }
+
+    template <class D>
+    void decode_deltas(SlotNumber first, size_t count, K* out) const
+    {
+        const D* in = reinterpret_cast<const D*>(deltas()) + first;
+        UnsignedKey base = header_.base;
+        size_t i = 0;
+#ifdef __SSE2__
+        constexpr size_t PerVector = 16 / sizeof(D);
+        __m128i base_vector = internal::SimdAdd<sizeof(K)>::set(base);
+        for (; i + PerVector <= count; i += PerVector) {
+            __m128i v = _mm_loadu_si128(reinterpret_cast<const __m128i*>(in + i));
+            internal::SimdWiden<sizeof(D), sizeof(K)>::apply(v, base_vector,
+                    reinterpret_cast<char*>(out + i));
+        }
+#endif
+        for (; i < count; i++) { out[i] = K(base + in[i]); }
+    }
+
+    /// \brief Re-encodes all keys with a new base and width, after all keys have shrunk
+    void shrink_frame()
+    {
+        size_t n = slot_count();
+        if (n == 0) { return; }
+        K first = key_at(0);
+        unsigned width = width_for(UnsignedKey(key_at(n - 1)) - UnsignedKey(first));
+        if (first != header_.base || width != header_.key_width) { reencode(first, width); }
+    }
+
+    /**
+     * \brief Re-encodes the delta vector in place with a new base and width.
+     *
+     * If the vector grows, the value vector is moved first and deltas are rewritten back to
+     * front; otherwise, deltas are rewritten front to back and the value vector is moved after.
+     * The caller must make sure that all keys fit into the new frame and that there is enough space.
+     */
+    void reencode(K base, unsigned width)
+    {
+        size_t n = slot_count();
+        unsigned old_width = header_.key_width;
+        UnsignedKey old_base = header_.base, new_base = base;
+        char* old_values = values();
+        char* new_values = deltas() + n * width;
+
+        if (width >= old_width) {
+            memmove(new_values, old_values, n * sizeof(V));
+            for (size_t i = n; i > 0; i--) {
+                UnsignedKey key = old_base + load_delta(i - 1, old_width);
+                store_delta(i - 1, key - new_base, width);
+            }
+        }
+        else {
+            for (size_t i = 0; i < n; i++) {
+                UnsignedKey key = old_base + load_delta(i, old_width);
+                store_delta(i, key - new_base, width);
+            }
+            memmove(new_values, old_values, n * sizeof(V));
+        }
+
+        header_.base = base;
+        header_.key_width = width;
+    }
+};
+
+} // namespace foster
+
+#endif
@@ -0,0 +1,501 @@
+/*
+ * MIT License
+ *
+ * Copyright (c) 2016 Caetano Sauer
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy of this software and
+ * associated documentation files (the "Software"), to deal in the Software without restriction,
+ * including without limitation the rights to use, copy, modify, merge, publish, distribute,
+ * sublicense, and/or sell copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all copies or
+ * substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR IMPLIED, INCLUDING BUT
+ * NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM,
+ * DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+#ifndef FOSTER_BTREE_KV_ARRAY_INLINE_H
+#define FOSTER_BTREE_KV_ARRAY_INLINE_H
+
+/**
+ * \file kv_array_inline.h
+ *
+ * Key-value array for fixed-size keys and values, which are stored inline in two dense vectors
+ * instead of being encoded into payloads.
+ */
+
+#include <algorithm>
+#include <array>
+#include <cstring>
+#include <iostream>
+#include <type_traits>
+
+#include "assertions.h"
+#include "exceptions.h"
+#include "kv_array.h"
+#include "metaprog.h"
+
+namespace foster {
+
+// Forward declaration for friend function declaration below
+template <class K, class V, size_t ArrayBytes, size_t PayloadAlignment>
+class InlineKeyValueArray;
+
+namespace internal {
+    template<class T, class S>
+    typename std::enable_if<T::InlineRecords, bool>::type
+    move_kv_records(T&, S, T&, S, size_t);
+}
+
+/**
+ * \brief Whether pairs of the given types can be stored in an InlineKeyValueArray.
+ *
+ * Keys must be numeric, so that they can be compared natively, and values must be trivially
+ * copyable (e.g., integers or the child pointers of branch nodes).
+ */
+template <class K, class V>
+struct IsInlineRecord : std::integral_constant<bool,
+    std::is_arithmetic<K>::value && std::is_trivially_copyable<V>::value>
+{};
+
+/**
+ * \brief Key-value array that stores fixed-size keys and values directly in two dense vectors.
+ *
+ * This is an alternative to KeyValueArray (with the same interface, so that BtreeNode and
+ * BtreeLevel can use it without changes) for pairs of fixed-size types, such as int to int. Such
+ * pairs do not need an Encoder, a PMNK, or a payload per pair; a KeyValueArray would nevertheless
+ * spend a slot and a payload block on each pair, and a successful search would access the payload
+ * to compare the full key and to read the value. Here, keys are kept sorted in a *key vector*,
+ * which is immediately followed by a parallel *value vector*, like the slot data vector of
+ * SoASlotArray:
+ *
+ *     | header | key vector -> | value vector -> | free space | <- payloads |
+ *
+ * Searches only touch the key vector, and the value of the slot found is read with a single access
+ * to the value vector. Since there are no payload pointers, payloads never have to be shifted for
+ * an insertion or deletion. Payloads can still be allocated from the end of the array, but only for
+ * metadata of a derived class (e.g., the fenster object of a BtreeNode).
+ *
+ * Removed pairs are deleted right away instead of being left behind as ghosts, since deleting a
+ * slot costs the same as inserting one. Thus, ghost_count() and ghost_space() are always zero.
+ *
+ * \tparam K Type of keys (must be integral or floating-point)
+ * \tparam V Type of values (must be trivially copyable)
+ * \tparam ArrayBytes The total size of the array in bytes
+ * \tparam PayloadAlignment The size of a payload block
+ * \see SelectKeyValueArray
+ */
+template <class K, class V, size_t ArrayBytes = 8192, size_t PayloadAlignment = 8>
+class InlineKeyValueArray
+{
+public:
+
+    using KeyType = K;
+    using KeyView = K;
+    using ValueType = V;
+    using ThisType = InlineKeyValueArray<K, V, ArrayBytes, PayloadAlignment>;
+
+    static constexpr size_t Alignment = PayloadAlignment;
+
+    /// Pairs are not encoded into payloads (\see internal::move_kv_records)
+    static constexpr bool InlineRecords = true;
+    /// Values are never stored out of line (\see KeyValueArray::ExternalPayloads)
+    static constexpr bool ExternalPayloads = false;
+
+    /** @name Compile-time constants and types **/
+    /**@{**/
+    /** Space occupied by a single pair (i.e., one entry of each vector) */
+    static constexpr size_t SlotSize = sizeof(K) + sizeof(V);
+    /** Upper bound for the number of pairs that fit into the allocated memory */
+    static constexpr size_t MaxSlotCount = ArrayBytes / SlotSize;
+    /** Slot number type, large enough to address all slots */
+    using SlotNumber = typename meta::UnsignedInteger<meta::get_pointer_size(MaxSlotCount)>;
+    /** Number of payload blocks that fit into the allocated memory */
+    static constexpr size_t MaxPayloadCount = ArrayBytes / Alignment;
+    /** Type of payload block pointers */
+    using PayloadPtr = typename meta::UnsignedInteger<meta::get_pointer_size(MaxPayloadCount)>;
+    /** Type of payload blocks (a fixed-length byte array) */
+    using PayloadBlock = typename std::array<char, Alignment>;
+    /**@}**/
+
+private:
+
+    struct alignas(Alignment) HeaderData {
+        SlotNumber slot_end;
+        PayloadPtr payload_begin;
+    };
+
+    /** Actual maximum number of payload blocks, taking space occupied by header into account */
+    static constexpr size_t PayloadCount = (ArrayBytes - sizeof(HeaderData)) / Alignment;
+
+public:
+
+    /// Total size in bytes of the area shared by the vectors and payloads
+    static constexpr size_t Capacity = PayloadCount * Alignment;
+
+    InlineKeyValueArray() : header_{0, PayloadCount} {}
+
+    /**
+     * \brief Insert a key-value pair into the array.
+     * \returns true if insertion succeeded (i.e., if there was enough free space)
+     * \throws ExistentKeyException if the key already exists in the array (\see put)
+     */
+    bool insert(const K& key, const V& value)
+    {
+        SlotNumber slot {0};
+        if (find_slot(key, nullptr, slot)) {
+            throw ExistentKeyException<K>(key);
+        }
+        return insert_at(slot, key, value);
+    }
+
+    /// \brief Inserts, overwrites, or both, depending on Mode (\see KeyValueArray::put)
+    template <PutMode Mode = PutMode::Upsert>
+    PutStatus put(const K& key, const V& value)
+    {
+        SlotNumber slot {0};
+        if (find_slot(key, nullptr, slot)) {
+            if (Mode == PutMode::Insert) { return PutStatus::KeyExists; }
+            // Values are fixed-size, so they are always overwritten in place
+            memcpy(value_at(slot), &value, sizeof(V));
+            return PutStatus::Updated;
+        }
+        if (Mode == PutMode::Update) { return PutStatus::KeyNotFound; }
+        return insert_at(slot, key, value) ? PutStatus::Inserted : PutStatus::NoSpace;
+    }
+
+    /// \brief Appends a pair after the last slot (\see KeyValueArray::append)
+    bool append(const K& key, const V& value, size_t reserved = 0)
+    {
+        if (free_space() < SlotSize + reserved) { return false; }
+        assert<1>(slot_count() == 0 || keys()[slot_count() - 1] < key, "Appended key is not the largest");
+        return insert_at(SlotNumber(slot_count()), key, value);
+    }
+
+    /**
+     * \brief Removes a key-value pair from the array, shifting the subsequent pairs.
+     * \throws KeyNotFoundException if key does not exist in the array.
+     */
+    template <bool MustExist = true>
+    bool remove(const K& key)
+    {
+        SlotNumber slot;
+        if (!find_slot(key, nullptr, slot)) {
+            if (MustExist) { throw KeyNotFoundException<K>(key); }
+            else { return false; }
+        }
+        delete_slots(slot, 1);
+        return true;
+    }
+
+    /// \brief Nothing to do, since there are no ghosts
+    void compact() {}
+
+    /// \brief Searches for a given key in the array (\see KeyValueArray::find)
+    bool find(const K& key, V* value = nullptr)
+    {
+        SlotNumber slot {0};
+        return find_slot(key, value, slot);
+    }
+
+    /// \brief Returns the slot of the first key that is greater than or equal to the given key.
+    SlotNumber lower_bound(const K& key)
+    {
+        SlotNumber slot {0};
+        find_slot(key, nullptr, slot);
+        return slot;
+    }
+
+    /** \brief Amount of free space (in bytes) between end of value vector and begin of payloads. */
+    size_t free_space() const
+    {
+        return header_.payload_begin * sizeof(PayloadBlock) - header_.slot_end * SlotSize;
+    }
+
+    size_t ghost_space() const { return 0; }
+    size_t ghost_count() const { return 0; }
+    bool is_ghost(SlotNumber) const { return false; }
+
+    size_t slot_count() const { return header_.slot_end; }
+    size_t size() const { return header_.slot_end; }
+
+    void read_slot(SlotNumber s, K* key, V* value)
+    {
+        if (key) { *key = keys()[s]; }
+        if (value) { memcpy(value, value_at(s), sizeof(V)); }
+    }
+
+    void read_slot_view(SlotNumber s, K* key, V* value)
+    {
+        read_slot(s, key, value);
+    }
+
+    /// \brief Sequentially reads all key-value pairs (\see KeyValueArray::Iterator)
+    class Iterator
+    {
+    public:
+        Iterator(ThisType* kv) :
+            current_slot_{0}, kv_{kv}
+        {}
+
+        bool next(K* key, V* value)
+        {
+            if (current_slot_ >= kv_->slot_count()) { return false; }
+            kv_->read_slot(current_slot_, key, value);
+            current_slot_++;
+            return true;
+        }
+
+    private:
+        SlotNumber current_slot_;
+        ThisType* kv_;
+    };
+
+    Iterator iterate()
+    {
+        return Iterator{this};
+    }
+
+    /// Debugging/utility function to print the array's contents.
+    void print(std::ostream& o)
+    {
+        for (SlotNumber i = 0; i < slot_count(); i++) {
+            V value;
+            read_slot(i, nullptr, &value);
+            o << "Slot " << i << " k = " << keys()[i] << ", v = " << value << std::endl;
+        }
+    }
+
+    /// Debugging/testing function to verify if contents are sorted
+    bool is_sorted() const
+    {
+        return std::is_sorted(keys(), keys() + slot_count());
+    }
+
+protected:
+
+    /** @name Payload management methods (\see SlotArray) **/
+    /**@{**/
+
+    static size_t get_payload_count(size_t length)
+    {
+        return length / sizeof(PayloadBlock) + (length % sizeof(PayloadBlock) != 0);
+    }
+
+    bool allocate_payload(PayloadPtr& ptr, size_t length)
+    {
+        size_t space_needed = get_payload_count(length) * Alignment;
+        if (free_space() < space_needed) { return false; }
+        header_.payload_begin -= get_payload_count(length);
+        ptr = header_.payload_begin;
+        return true;
+    }
+
+    void free_payload(PayloadPtr ptr, size_t length)
+    {
+        assert<3>(ptr >= header_.payload_begin, DBGINFO, "Invalid payload pointer");
+        size_t count = get_payload_count(length);
+        size_t shift = ptr - header_.payload_begin;
+        shift_payloads(header_.payload_begin + count, header_.payload_begin, shift);
+    }
+
+    /// Unlike SlotArray::shift_payloads, no slot pointers must be adjusted
+    bool shift_payloads(PayloadPtr to, PayloadPtr from, size_t count)
+    {
+        PayloadPtr first_affected = std::min(from, to);
+        int shift = to - from;
+
+        if (shift < 0 && free_space() < sizeof(PayloadBlock) * (-shift)) {
+            return false;
+        }
+
+        memmove(&payloads_[to], &payloads_[from], count * sizeof(PayloadBlock));
+        if (first_affected <= header_.payload_begin) {
+            header_.payload_begin += shift;
+        }
+
+        return true;
+    }
+
+    PayloadPtr get_first_payload() const { return header_.payload_begin; }
+
+    void* get_payload(PayloadPtr ptr) { return payloads_[ptr].data(); }
+    const void* get_payload(PayloadPtr ptr) const { return payloads_[ptr].data(); }
+
+    /**@}**/
+
+    /**
+     * \brief Searches the key vector (\see KeyValueArray::find_slot)
+     *
+     * If the key is not found and value is not null, the value of the previous slot is read, which
+     * supports traversal of branch nodes.
+     */
+    bool find_slot(const K& key, V* value, SlotNumber& slot)
+    {
+        // Branch-free lower bound, since the dense key vector makes the probes cheap
+        const K* begin = keys();
+        const K* base = begin;
+        size_t n = slot_count();
+        while (n > 1) {
+            size_t half = n / 2;
+            base = base[half] < key ? base + half : base;
+            n -= half;
+        }
+        slot = (base - begin) + (n == 1 && *base < key);
+        if (slot < slot_count() && begin[slot] == key) {
+            if (value) { read_slot(slot, nullptr, value); }
+            return true;
+        }
+        if (value && slot > 0) { read_slot(slot - 1, nullptr, value); }
+        return false;
+    }
+
+    bool insert_at(SlotNumber slot, const K& key, const V& value)
+    {
+        if (!insert_slots(slot, 1)) { return false; }
+        keys()[slot] = key;
+        memcpy(value_at(slot), &value, sizeof(V));
+        assert<3>(is_sorted());
+        return true;
+    }
+
+    /**
+     * \brief Opens a gap of count slots in both vectors (\see SoASlotArray::insert_slot)
+     *
+     * The value vector is shifted first (from the back), since the key vector grows into its space.
+     */
+    bool insert_slots(SlotNumber slot, size_t count)
+    {
+        assert<1>(slot <= slot_count(), "Slot number out of bounds");
+        if (free_space() < count * SlotSize) { return false; }
+
+        size_t n = slot_count();
+        char* old_values = values();
+        char* new_values = reinterpret_cast<char*>(keys() + n + count);
+
+        memmove(new_values + (slot + count) * sizeof(V), old_values + slot * sizeof(V),
+                sizeof(V) * (n - slot));
+        memmove(new_values, old_values, sizeof(V) * slot);
+        memmove(&keys()[slot + count], &keys()[slot], sizeof(K) * (n - slot));
+        header_.slot_end += count;
+
+        return true;
+    }
+
+    /// \brief Deletes a range of slots from both vectors, shifting each vector only once
+    void delete_slots(SlotNumber slot, size_t count)
+    {
+        assert<1>(slot + count <= slot_count(), "Slot number out of bounds");
+
+        size_t n = slot_count();
+        char* old_values = values();
+        char* new_values = reinterpret_cast<char*>(keys() + n - count);
+
+        memmove(&keys()[slot], &keys()[slot + count], sizeof(K) * (n - slot - count));
+        memmove(new_values, old_values, sizeof(V) * slot);
+        memmove(new_values + slot * sizeof(V), old_values + (slot + count) * sizeof(V),
+                sizeof(V) * (n - slot - count));
+        header_.slot_end -= count;
+    }
+
+    /**
+     * \brief Moves pairs from another array (\see internal::move_kv_records)
+     *
+     * Keys and values are copied with one memcpy per vector.
+     */
+    bool move_records(SlotNumber dest_slot, ThisType& src, SlotNumber src_slot, size_t slot_count)
+    {
+        assert<1>(src_slot + slot_count <= src.slot_count());
+        if (free_space() < slot_count * SlotSize) { return false; }
+
+        bool success = insert_slots(dest_slot, slot_count);
+        assert<1>(success, "Slot insertion failed despite available space");
+        memcpy(&keys()[dest_slot], &src.keys()[src_slot], sizeof(K) * slot_count);
+        memcpy(value_at(dest_slot), src.value_at(src_slot), sizeof(V) * slot_count);
+        src.delete_slots(src_slot, slot_count);
+
+        assert<1>(is_sorted());
+        assert<1>(src.is_sorted());
+
+        return true;
+    }
+
+    template<class T, class S>
+    friend typename std::enable_if<T::InlineRecords, bool>::type
+    internal::move_kv_records(T&, S, T&, S, size_t);
+
+private:
+
+    HeaderData header_;
+
+    union {
+        alignas(Alignment) char bytes_[PayloadCount * Alignment];
+        PayloadBlock payloads_[PayloadCount];
+    };
+
+    static_assert(IsInlineRecord<K, V>::value,
+            "InlineKeyValueArray requires numeric keys and trivially copyable values");
+    static_assert(ArrayBytes % Alignment == 0,
+            "InlineKeyValueArray template argument error: ArrayBytes must be a multiple of Aligment");
+    static_assert(sizeof(HeaderData) % Alignment == 0,
+            "InlineKeyValueArray::HeaderData is not aligned properly");
+
+    K* keys() { return reinterpret_cast<K*>(bytes_); }
+    const K* keys() const { return reinterpret_cast<const K*>(bytes_); }
+
+    /**
+     * The value vector begins right after the last key, i.e., its position depends on slot_end.
+     * Values may be misaligned (e.g., pointers after 4-byte keys), so they are accessed with memcpy.
+     */
+    char* values() { return reinterpret_cast<char*>(keys() + header_.slot_end); }
+    char* value_at(SlotNumber slot) { return values() + slot * sizeof(V); }
+};
+
+namespace internal {
+
+/**
+ * \brief Moves pairs between arrays that store records inline (e.g., InlineKeyValueArray).
+ *
+ * Such arrays implement the movement themselves, since it depends on their layout. As with the
+ * KeyValueArray version of this function, the movement is atomic, i.e., nothing is moved if the
+ * destination does not have space for all pairs.
+ */
+template <class KVArray, class SlotNumber>
+typename std::enable_if<KVArray::InlineRecords, bool>::type
+move_kv_records(
+        KVArray& dest, SlotNumber dest_slot,
+        KVArray& src, SlotNumber src_slot,
+        size_t slot_count)
+{
+    return dest.move_records(dest_slot, src, src_slot, slot_count);
+}
+
+} // namespace internal
+
+/**
+ * \brief Selects InlineKeyValueArray for fixed-size pairs and the given fallback otherwise.
+ *
+ * This is meant to define the key-value array template of a BtreeNode, whose branch nodes (with
+ * node pointers as values) then also use the inline layout if the keys are numeric:
+ *
+ *     template <class K, class V>
+ *     using KVArray = SelectKeyValueArray<K, V, FallbackKVArray, 4096>;
+ *
+ * \tparam Fallback Key-value array class template (e.g., an alias of KeyValueArray) used for pairs
+ *      that cannot be stored inline
+ */
+template <class K, class V, template <class,class> class Fallback, size_t ArrayBytes,
+         size_t PayloadAlignment = 8>
+using SelectKeyValueArray = typename std::conditional<IsInlineRecord<K, V>::value,
+      InlineKeyValueArray<K, V, ArrayBytes, PayloadAlignment>,
+      Fallback<K, V>
+>::type;
+
+} // namespace foster
+
+#endif
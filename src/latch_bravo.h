@@ -0,0 +1,489 @@
+/*
+ * MIT License
+ *
+ * Copyright (c) 2016 Caetano Sauer
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy of this software and
+ * associated documentation files (the "Software"), to deal in the Software without restriction,
+ * including without limitation the rights to use, copy, modify, merge, publish, distribute,
+ * sublicense, and/or sell copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all copies or
+ * substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR IMPLIED, INCLUDING BUT
+ * NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM,
+ * DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+#ifndef FOSTER_LATCH_BRAVO_H
+#define FOSTER_LATCH_BRAVO_H
+
+/**
+ * \file latch_bravo.h
+ *
+ * Reader-writer latch with reader bias (BRAVO), in which readers announce themselves in striped
+ * per-thread slots instead of incrementing a shared counter.
+ */
+
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <thread>
+
+#ifdef __linux__
+#include <linux/futex.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#endif
+
+#include "assertions.h"
+
+namespace foster {
+
+namespace internal {
+
+/// \brief Hints the CPU that the caller is in a spin-wait loop
+inline void cpu_relax()
+{
+#if defined(__x86_64__) || defined(__i386__)
+    __builtin_ia32_pause();
+#elif defined(__aarch64__) || defined(__arm__)
+    asm volatile("yield" ::: "memory");
+#else
+    std::atomic_signal_fence(std::memory_order_seq_cst);
+#endif
+}
+
+/// \brief Blocks the caller while the given word still contains the expected value
+inline void futex_wait(std::atomic<uint32_t>* word, uint32_t expected)
+{
+    static_assert(sizeof(std::atomic<uint32_t>) == sizeof(uint32_t), "Cannot futex on atomic");
+#ifdef __linux__
+    syscall(SYS_futex, reinterpret_cast<uint32_t*>(word), FUTEX_WAIT_PRIVATE, expected,
+            nullptr, nullptr, 0);
+#else
+    (void) word; (void) expected;
+    std::this_thread::yield();
+#endif
+}
+
+/// \brief Wakes up all threads blocked on futex_wait() for the given word
+inline void futex_wake_all(std::atomic<uint32_t>* word)
+{
+#ifdef __linux__
+    syscall(SYS_futex, reinterpret_cast<uint32_t*>(word), FUTEX_WAKE_PRIVATE, INT32_MAX,
+            nullptr, nullptr, 0);
+#else
+    (void) word;
+#endif
+}
+
+/**
+ * \brief Exponential backoff for spin-wait loops.
+ *
+ * Each call to spin() executes twice as many pause instructions as the previous one, until the
+ * spin budget is exhausted, after which spin() returns false and the caller should block.
+ */
+class Backoff
+{
+public:
+    Backoff() : round_(0) {}
+
+    bool spin()
+    {
+        if (round_ >= SpinRounds) { return false; }
+        for (unsigned i = 0; i < (1u << round_); i++) { cpu_relax(); }
+        round_++;
+        return true;
+    }
+
+    void reset() { round_ = 0; }
+
+private:
+    unsigned round_;
+
+    /// Up to 2^SpinRounds - 1 (about 1K) pauses before parking
+    static constexpr unsigned SpinRounds = 10;
+};
+
+/**
+ * \brief Global table of visible readers shared by all BravoLatch instances.
+ *
+ * The table is divided into stripes, each of which is assigned to a thread on its first shared
+ * latch acquisition and occupies a single cache line. A fast-path reader publishes the address of
+ * the latch in one slot of its stripe, chosen by hashing the latch address. Readers of the same
+ * latch on different threads therefore never write to the same cache line, and a writer only has to
+ * inspect the one slot per stripe to which its latch address hashes.
+ *
+ * In processes with more threads than stripes, threads share stripes. This is still correct, since
+ * a slot is only claimed with a compare-and-swap from null, and each thread keeps track of the
+ * slots it claimed itself in a thread-local mask.
+ *
+ * The dummy template parameter allows defining the static members in this header.
+ */
+template <class = void>
+struct VisibleReaders
+{
+    static constexpr unsigned Stripes = 64;
+    static constexpr unsigned SlotsPerStripe = 8;
+    static constexpr unsigned SlotBits = 3;
+
+    using Slot = std::atomic<const void*>;
+
+    struct alignas(64) Stripe
+    {
+        Slot slots[SlotsPerStripe];
+    };
+
+    /// Stripe of the calling thread and slots of that stripe which the thread currently owns
+    struct ThreadState
+    {
+        unsigned stripe;
+        uint32_t owned;
+    };
+
+    static Stripe stripes[Stripes];
+
+    static ThreadState& thread_state()
+    {
+        static thread_local ThreadState state = {Stripes, 0};
+        static std::atomic<unsigned> next_stripe{0};
+        if (state.stripe == Stripes) {
+            state.stripe = next_stripe.fetch_add(1, std::memory_order_relaxed) % Stripes;
+        }
+        return state;
+    }
+
+    /// \brief Slot (inside each stripe) used by the given latch (Fibonacci hashing)
+    static unsigned slot_of(const void* latch)
+    {
+        uint64_t h = static_cast<uint64_t>(reinterpret_cast<uintptr_t>(latch));
+        return static_cast<unsigned>((h * 0x9E3779B97F4A7C15ull) >> (64 - SlotBits));
+    }
+};
+
+template <class T>
+typename VisibleReaders<T>::Stripe VisibleReaders<T>::stripes[VisibleReaders<T>::Stripes];
+
+} // namespace internal
+
+/**
+ * \brief Scalable reader-writer latch based on BRAVO (Biased Locking for Reader-Writer Locks).
+ *
+ * As in OptimisticLatch, the underlying latch is a single 32-bit word:
+ *
+ *     | 31 ... 2     | 1       | 0      |
+ *     | reader count | waiters | writer |
+ *
+ * While the latch is in read-biased mode, however, readers do not increment the shared count;
+ * instead, they publish the latch address in a per-thread slot of a global table (\see
+ * internal::VisibleReaders). Readers of a hot node (e.g., the root) thus do not invalidate each
+ * other's caches. A writer first acquires the underlying latch, which blocks new slow-path
+ * readers, and then revokes the reader bias and waits until the visible readers of its latch have
+ * left. Because revocation scans the table, the bias stays disabled for a period proportional to
+ * the time the revocation took (InhibitMultiplier), after which the next slow-path reader enables it
+ * again. Write-heavy latches therefore mostly behave like a plain reader-writer latch.
+ *
+ * Threads waiting for the underlying latch spin with exponential backoff (\see internal::Backoff)
+ * and, once the spin budget is exhausted, set the waiters bit and block on the latch word with a
+ * futex. Releasing threads only issue a wake-up system call if the waiters bit is set.
+ *
+ * The attempt_upgrade() and downgrade() methods behave like the ones in MutexLatch, i.e., an
+ * upgrade only succeeds (without waiting) if the caller is the only shared holder, regardless of
+ * whether it holds the latch on the fast or the slow path. This is required by EagerAdoption.
+ * A latch held in exclusive mode (including after an upgrade) is held on the underlying word,
+ * so that a downgrade always results in a slow-path shared latch.
+ *
+ * The same thread must not acquire a shared latch recursively.
+ */
+class BravoLatch {
+public:
+
+    BravoLatch()
+        : word_(0), read_bias_(true), inhibit_until_(0)
+    {}
+
+    BravoLatch(const BravoLatch&) = delete;
+    BravoLatch& operator=(const BravoLatch&) = delete;
+
+    bool attempt_read()
+    {
+        if (fast_read()) { return true; }
+
+        uint32_t w = word_.load();
+        if (w & WRITER_MASK) { return false; }
+        if (!word_.compare_exchange_strong(w, w + READER_UNIT)) { return false; }
+
+        std::atomic_thread_fence(std::memory_order_acquire);
+        return true;
+    }
+
+    void acquire_read()
+    {
+        if (fast_read()) { return; }
+
+        internal::Backoff backoff;
+        uint32_t w = word_.load();
+        while (true) {
+            if (w & WRITER_MASK) {
+                wait(w, backoff);
+                w = word_.load();
+                continue;
+            }
+            assert<1>((w & READER_BITS) != READER_BITS, "Reader count overflow");
+            if (word_.compare_exchange_weak(w, w + READER_UNIT)) { break; }
+        }
+        std::atomic_thread_fence(std::memory_order_acquire);
+
+        // Re-enable reader bias once the inhibition period after the last revocation is over.
+        // This is done while holding the shared latch, so that a writer sees it after draining.
+        if (!read_bias_.load(std::memory_order_relaxed) &&
+                now() >= inhibit_until_.load(std::memory_order_relaxed))
+        {
+            read_bias_.store(true);
+        }
+    }
+
+    void release_read()
+    {
+        if (fast_release()) { return; }
+
+        assert<1>(word_.load() & READER_BITS);
+        uint32_t w = word_.fetch_sub(READER_UNIT, std::memory_order_release) - READER_UNIT;
+        // Last reader to leave wakes up a writer waiting for readers to drain
+        if ((w & READER_BITS) == 0 && (w & WAITER_MASK)) { wake(); }
+    }
+
+    bool attempt_write()
+    {
+        uint32_t w = word_.load();
+        if (w & (READER_BITS | WRITER_MASK)) { return false; }
+        if (!word_.compare_exchange_strong(w, w | WRITER_MASK)) { return false; }
+
+        if (!revoke_bias(false /* wait */, nullptr)) {
+            undo_write(0);
+            return false;
+        }
+
+        std::atomic_thread_fence(std::memory_order_acquire);
+        return true;
+    }
+
+    void acquire_write()
+    {
+        // First block out other writers and new slow-path readers by setting the writer bit
+        internal::Backoff backoff;
+        uint32_t w = word_.load();
+        while (true) {
+            if (w & WRITER_MASK) {
+                wait(w, backoff);
+                w = word_.load();
+                continue;
+            }
+            if (word_.compare_exchange_weak(w, w | WRITER_MASK)) { break; }
+        }
+
+        // Then wait for slow-path readers to leave
+        backoff.reset();
+        w = word_.load();
+        while (w & READER_BITS) {
+            wait(w, backoff);
+            w = word_.load();
+        }
+
+        // Finally, block out new fast-path readers and wait for the visible ones to leave
+        revoke_bias(true /* wait */, nullptr);
+
+        std::atomic_thread_fence(std::memory_order_acquire);
+    }
+
+    void release_write()
+    {
+        assert<1>((word_.load() & (READER_BITS | WRITER_MASK)) == WRITER_MASK);
+        uint32_t old = word_.fetch_and(~(WRITER_MASK | WAITER_MASK), std::memory_order_release);
+        if (old & WAITER_MASK) { internal::futex_wake_all(&word_); }
+    }
+
+    bool attempt_upgrade()
+    {
+        assert<1>(has_reader());
+
+        // Caller either holds a slot in the table or is counted in the latch word
+        const void* own_slot = owns_fast_slot() ? this : nullptr;
+        uint32_t own_count = own_slot ? 0 : READER_UNIT;
+
+        uint32_t w = word_.load();
+        if ((w & (READER_BITS | WRITER_MASK)) != own_count) { return false; }
+        if (!word_.compare_exchange_strong(w, (w - own_count) | WRITER_MASK)) { return false; }
+
+        // Other fast-path readers may still be around -- give up instead of waiting for them
+        if (!revoke_bias(false /* wait */, own_slot)) {
+            undo_write(own_count);
+            return false;
+        }
+        if (own_slot) { fast_release(); }
+
+        std::atomic_thread_fence(std::memory_order_acquire);
+        return true;
+    }
+
+    void downgrade()
+    {
+        assert<1>((word_.load() & (READER_BITS | WRITER_MASK)) == WRITER_MASK);
+        // Clear writer bit and add one (slow-path) reader in one step
+        uint32_t old = word_.fetch_add(READER_UNIT - WRITER_MASK, std::memory_order_acq_rel);
+        if (old & WAITER_MASK) { wake(); }
+    }
+
+    bool has_reader() const
+    {
+        return (word_.load() & READER_BITS) || has_fast_reader(nullptr);
+    }
+
+    bool has_writer() const
+    {
+        return word_.load() & WRITER_MASK;
+    }
+
+    /// \brief Whether readers currently take the fast path (mainly for tests and debugging)
+    bool is_read_biased() const
+    {
+        return read_bias_.load();
+    }
+
+private:
+    using Readers = internal::VisibleReaders<>;
+
+    std::atomic<uint32_t> word_;
+    std::atomic<bool> read_bias_;
+    /// Timestamp (in nanoseconds) until which reader bias must not be re-enabled
+    std::atomic<uint64_t> inhibit_until_;
+
+    static constexpr uint32_t WRITER_MASK = 0x01;
+    static constexpr uint32_t WAITER_MASK = 0x02;
+    static constexpr uint32_t READER_UNIT = 0x04;
+    static constexpr uint32_t READER_BITS = ~(WRITER_MASK | WAITER_MASK);
+
+    /// Reader bias stays disabled for this many times the duration of the last revocation
+    static constexpr uint64_t InhibitMultiplier = 9;
+
+    static uint64_t now()
+    {
+        using namespace std::chrono;
+        return duration_cast<nanoseconds>(steady_clock::now().time_since_epoch()).count();
+    }
+
+    Readers::Slot& slot_in(unsigned stripe) const
+    {
+        return Readers::stripes[stripe].slots[Readers::slot_of(this)];
+    }
+
+    bool fast_read()
+    {
+        if (!read_bias_.load(std::memory_order_relaxed)) { return false; }
+
+        Readers::ThreadState& ts = Readers::thread_state();
+        Readers::Slot& slot = slot_in(ts.stripe);
+        const void* expected = nullptr;
+        if (!slot.compare_exchange_strong(expected, this)) { return false; }
+
+        // Re-check after publishing ourselves; this pairs with the store in revoke_bias()
+        if (read_bias_.load()) {
+            ts.owned |= 1u << Readers::slot_of(this);
+            return true;
+        }
+        slot.store(nullptr, std::memory_order_release);
+        return false;
+    }
+
+    bool owns_fast_slot() const
+    {
+        Readers::ThreadState& ts = Readers::thread_state();
+        return (ts.owned & (1u << Readers::slot_of(this))) &&
+            slot_in(ts.stripe).load(std::memory_order_relaxed) == this;
+    }
+
+    bool fast_release()
+    {
+        if (!owns_fast_slot()) { return false; }
+
+        Readers::ThreadState& ts = Readers::thread_state();
+        ts.owned &= ~(1u << Readers::slot_of(this));
+        slot_in(ts.stripe).store(nullptr, std::memory_order_release);
+        return true;
+    }
+
+    /// \brief Checks for visible readers other than the given slot owner (i.e., the caller)
+    bool has_fast_reader(const void* ignore_own) const
+    {
+        unsigned own_stripe = ignore_own ? Readers::thread_state().stripe : Readers::Stripes;
+        for (unsigned s = 0; s < Readers::Stripes; s++) {
+            if (s != own_stripe && slot_in(s).load() == this) { return true; }
+        }
+        return false;
+    }
+
+    /**
+     * \brief Disables reader bias and waits for visible readers to leave.
+     *
+     * Must be called with the writer bit set. If wait is false, no waiting is done and the bias is
+     * restored if there are visible readers other than the caller, in which case false is returned.
+     */
+    bool revoke_bias(bool wait, const void* ignore_own)
+    {
+        if (!read_bias_.load(std::memory_order_relaxed)) { return true; }
+        read_bias_.store(false);
+
+        if (!wait) {
+            if (has_fast_reader(ignore_own)) {
+                read_bias_.store(true);
+                return false;
+            }
+            return true;
+        }
+
+        uint64_t start = now();
+        for (unsigned s = 0; s < Readers::Stripes; s++) {
+            internal::Backoff backoff;
+            while (slot_in(s).load() == this) {
+                if (!backoff.spin()) { std::this_thread::yield(); }
+            }
+        }
+        uint64_t end = now();
+        inhibit_until_.store(end + (end - start) * InhibitMultiplier, std::memory_order_relaxed);
+        return true;
+    }
+
+    /// \brief Clears the writer bit set by a failed attempt, giving back the given reader count
+    void undo_write(uint32_t own_count)
+    {
+        uint32_t old = word_.fetch_add(own_count - WRITER_MASK, std::memory_order_release);
+        if (old & WAITER_MASK) { wake(); }
+    }
+
+    /// \brief Spins or, when the spin budget is exhausted, blocks until the word changes
+    void wait(uint32_t w, internal::Backoff& backoff)
+    {
+        if (backoff.spin()) { return; }
+        if (!(w & WAITER_MASK)) {
+            if (!word_.compare_exchange_strong(w, w | WAITER_MASK)) { return; }
+            w |= WAITER_MASK;
+        }
+        internal::futex_wait(&word_, w);
+    }
+
+    void wake()
+    {
+        if (word_.fetch_and(~WAITER_MASK) & WAITER_MASK) {
+            internal::futex_wake_all(&word_);
+        }
+    }
+};
+
+} // namespace foster
+
+#endif
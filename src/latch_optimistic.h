@@ -0,0 +1,209 @@
+/*
+ * MIT License
+ *
+ * Copyright (c) 2016 Caetano Sauer
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy of this software and
+ * associated documentation files (the "Software"), to deal in the Software without restriction,
+ * including without limitation the rights to use, copy, modify, merge, publish, distribute,
+ * sublicense, and/or sell copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all copies or
+ * substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR IMPLIED, INCLUDING BUT
+ * NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM,
+ * DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+#ifndef FOSTER_LATCH_OPTIMISTIC_H
+#define FOSTER_LATCH_OPTIMISTIC_H
+
+/**
+ * \file latch_optimistic.h
+ *
+ * Latch implementation with a version counter that supports optimistic (i.e., non-writing) reads.
+ */
+
+#include <atomic>
+#include <cstdint>
+#include <thread>
+
+#include "assertions.h"
+
+namespace foster {
+
+/**
+ * \brief Reader-writer latch with a version counter for optimistic lock coupling.
+ *
+ * In addition to the regular shared/exclusive protocol of MutexLatch, this latch supports
+ * optimistic reads: a reader obtains a version number with optimistic_read() without writing to
+ * the latch word, reads the protected data, and then checks with validate_read() whether a writer
+ * was active in the meantime. If validation fails, whatever was read must be discarded. This avoids
+ * cache-line invalidations on hot nodes (e.g., the root), which are only read during traversals.
+ *
+ * The whole state is kept in a single 64-bit word:
+ *
+ *     | 63 ... 16 | 15 ... 1     | 0      |
+ *     | version   | reader count | writer |
+ *
+ * The version is incremented every time a writer releases the latch (either with release_write()
+ * or downgrade()). Shared latches do not affect the version, so optimistic readers are not
+ * invalidated by other readers, but only by writers.
+ *
+ * The attempt_upgrade() and downgrade() methods behave like the ones in MutexLatch, i.e., an
+ * upgrade only succeeds if the caller is the only shared holder. This is required by EagerAdoption.
+ */
+class OptimisticLatch {
+public:
+
+    using VersionType = uint64_t;
+
+    OptimisticLatch()
+        : word_(0)
+    {}
+
+    /** @name Optimistic read protocol **/
+    /**@{**/
+
+    /**
+     * \brief Begins an optimistic read, returning the current version.
+     *
+     * If a writer currently holds the latch, we wait until it leaves, since any data read would be
+     * invalid anyway.
+     */
+    VersionType optimistic_read() const
+    {
+        VersionType w = word_.load(std::memory_order_acquire);
+        while (w & WRITER_MASK) {
+            std::this_thread::yield();
+            w = word_.load(std::memory_order_acquire);
+        }
+        return w & ~READER_BITS;
+    }
+
+    /**
+     * \brief Checks if no writer acquired the latch since the given version was read.
+     */
+    bool validate_read(VersionType version) const
+    {
+        std::atomic_thread_fence(std::memory_order_acquire);
+        return (word_.load(std::memory_order_relaxed) & ~READER_BITS) == version;
+    }
+
+    /**
+     * \brief Converts an optimistic read into a shared latch, if version is still valid.
+     */
+    bool attempt_read(VersionType version)
+    {
+        VersionType w = word_.load();
+        while ((w & ~READER_BITS) == version) {
+            assert<1>((w & READER_BITS) != READER_BITS, "Reader count overflow");
+            if (word_.compare_exchange_weak(w, w + READER_UNIT)) {
+                std::atomic_thread_fence(std::memory_order_acquire);
+                return true;
+            }
+        }
+        return false;
+    }
+
+    /**@}**/
+
+    /** @name Regular shared/exclusive protocol (same contract as MutexLatch) **/
+    /**@{**/
+
+    void acquire_read()
+    {
+        VersionType w = word_.load();
+        while (true) {
+            if (w & WRITER_MASK) {
+                std::this_thread::yield();
+                w = word_.load();
+                continue;
+            }
+            if (word_.compare_exchange_weak(w, w + READER_UNIT)) { break; }
+        }
+        std::atomic_thread_fence(std::memory_order_acquire);
+    }
+
+    void release_read()
+    {
+        assert<1>(has_reader());
+        std::atomic_thread_fence(std::memory_order_release);
+        word_ -= READER_UNIT;
+    }
+
+    void acquire_write()
+    {
+        // First block out other writers and new readers by setting the writer bit
+        VersionType w = word_.load();
+        while (true) {
+            if (w & WRITER_MASK) {
+                std::this_thread::yield();
+                w = word_.load();
+                continue;
+            }
+            if (word_.compare_exchange_weak(w, w | WRITER_MASK)) { break; }
+        }
+
+        // now spin until all readers leave
+        while (has_reader()) { std::this_thread::yield(); }
+
+        std::atomic_thread_fence(std::memory_order_acquire);
+    }
+
+    void release_write()
+    {
+        std::atomic_thread_fence(std::memory_order_release);
+        assert<1>((word_.load() & (READER_BITS | WRITER_MASK)) == WRITER_MASK);
+        // Clear writer bit and increment version in one step
+        word_ += VERSION_UNIT - WRITER_MASK;
+    }
+
+    bool attempt_upgrade()
+    {
+        assert<1>(has_reader());
+        VersionType w = word_.load();
+        // Only the sole reader may upgrade
+        if ((w & (READER_BITS | WRITER_MASK)) != READER_UNIT) { return false; }
+        bool success = word_.compare_exchange_strong(w, (w - READER_UNIT) | WRITER_MASK);
+        std::atomic_thread_fence(std::memory_order_acquire);
+        return success;
+    }
+
+    void downgrade()
+    {
+        std::atomic_thread_fence(std::memory_order_release);
+        assert<1>((word_.load() & (READER_BITS | WRITER_MASK)) == WRITER_MASK);
+        // Clear writer bit, add one reader, and increment version in one step
+        word_ += VERSION_UNIT + READER_UNIT - WRITER_MASK;
+        std::atomic_thread_fence(std::memory_order_acquire);
+    }
+
+    bool has_reader() const
+    {
+        return word_.load() & READER_BITS;
+    }
+
+    bool has_writer() const
+    {
+        return word_.load() & WRITER_MASK;
+    }
+
+    /**@}**/
+
+private:
+    std::atomic<VersionType> word_;
+
+    static constexpr VersionType WRITER_MASK = 0x01;
+    static constexpr VersionType READER_UNIT = 0x02;
+    static constexpr VersionType READER_BITS = 0xFFFE;
+    static constexpr VersionType VERSION_UNIT = 0x10000;
+};
+
+} // namespace foster
+
+#endif
@@ -120,6 +120,17 @@ using SignedInteger = typename MetaIntegerImpl<true, N>::type;
 template<bool Condition, typename T = void>
 using EnableIf = typename std::enable_if<Condition, T>::type;
 
+/**
+ * Maps any list of types to void. Used to detect members with SFINAE (i.e., C++17's void_t).
+ */
+template<typename ... T>
+struct VoidTypeImpl {
+    using type = void;
+};
+
+template<typename ... T>
+using VoidType = typename VoidTypeImpl<T...>::type;
+
 /**
  * Return size of the given object types aligned to the given block size.
  */
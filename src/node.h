@@ -28,11 +28,15 @@
  * Classes used to represent a single B-tree node.
  */
 
+#include <cstring>
 #include <string>
+#include <type_traits>
+#include <utility>
 using std::string;
 
 #include "assertions.h"
 #include "exceptions.h"
+#include "metaprog.h"
 
 // TODO: Fenster object and move_kv_records function are currently not parametrized, so we must
 // include the headers here.
@@ -51,6 +55,53 @@ struct DummyLatch {
     void downgrade() {}
 };
 
+/**
+ * \brief Type trait that detects latches supporting optimistic reads (\see OptimisticLatch).
+ *
+ * A latch is considered optimistic if it provides the method optimistic_read(), which returns a
+ * version number that can later be checked with validate_read().
+ */
+template <class Latch, class = void>
+struct SupportsOptimisticRead : std::false_type {};
+
+template <class Latch>
+struct SupportsOptimisticRead<Latch,
+    meta::VoidType<decltype(std::declval<Latch>().optimistic_read())>> : std::true_type {};
+
+/**
+ * \brief Type trait that detects if values of type V are node pointers of the given template.
+ *
+ * A node whose values are pointers to other nodes is a branch node; otherwise, it is a leaf.
+ */
+template <class V, template <class> class Pointer>
+struct IsNodePointer : std::false_type {};
+
+template <class T, template <class> class Pointer>
+struct IsNodePointer<Pointer<T>, Pointer> : std::true_type {};
+
+namespace internal {
+
+/**
+ * \brief Returns the shortest key s such that left < s <= right, given that left < right.
+ *
+ * This is used to pick separator keys in leaf splits (i.e., suffix truncation), which results in
+ * shorter keys on branch nodes and thus higher fan-out. Only variable-length keys can be shortened
+ * -- for any other type, the right key is returned.
+ */
+template <class K>
+K shortest_separator(const K&, const K& right) { return right; }
+
+inline string shortest_separator(const string& left, const string& right)
+{
+    // Keys are sorted, so right is longer than the common prefix as long as left < right
+    size_t i = 0;
+    while (i < left.length() && i < right.length() && left[i] == right[i]) { i++; }
+    assert<1>(i < right.length(), "Separator keys must be given in sorted order");
+    return right.substr(0, i + 1);
+}
+
+} // namespace internal
+
 /**
  * \brief Basic class that represents a node of a Foster B-tree.
  *
@@ -95,6 +146,7 @@ public:
     using ParentType = BtreeNode<K, NodePointer, KeyValueArray, Pointer, IdType, Latch>;
     using ParentPointer = Pointer<ParentType>;
     using KeyType = K;
+    using KeyView = typename KeyViewOf<K>::type;
     using ValueType = V;
     using SlotNumber = typename KeyValueArray<K, V>::SlotNumber;
     using PayloadPtr = typename KeyValueArray<K, V>::PayloadPtr;
@@ -102,6 +154,8 @@ public:
     template <class T> using PointerType = Pointer<T>;
 
     static constexpr bool LatchingEnabled = !std::is_same<Latch, DummyLatch>::value;
+    static constexpr bool IsBranch = IsNodePointer<V, Pointer>::value;
+    static constexpr bool OptimisticLatching = SupportsOptimisticRead<Latch>::value;
 
     /**
      * \brief Constructs an empty node with a given ID
@@ -146,7 +200,8 @@ public:
                 "Only an empty node can be added as a foster child");
         }
 
-        // Foster key is equal to high key of parent, which is equal to both fence keys on child
+        // Foster key is equal to high key of parent, which is equal to both fence keys on child --
+        // unless there is an old foster child, whose key is then the low fence key of the new one
         KeyType low_key, high_key;
         get_fence_keys(&low_key, &high_key);
         KeyType* low_ptr = is_low_key_infinity() ? nullptr : &low_key;
@@ -157,7 +212,11 @@ public:
         get_foster_key(&old_foster_key);
         KeyType* old_foster_key_ptr = is_foster_empty() ? nullptr : &old_foster_key;
         NodePointer old_foster_child = get_foster_child();
-        bool success = child->update_fenster(high_ptr, high_ptr, old_foster_key_ptr, old_foster_child);
+        // The foster key must lie within the fence keys, since keys are encoded relative to their
+        // common prefix (\see Fenster)
+        KeyType* child_low_ptr = old_foster_key_ptr ? old_foster_key_ptr : high_ptr;
+        bool success = child->update_fenster(child_low_ptr, high_ptr, old_foster_key_ptr,
+                old_foster_child);
         assert<1>(success, "Keys will not fit into new empty foster child");
 
         // A newly inserted foster child is always empty, which means the foster key is the same as
@@ -188,6 +247,71 @@ public:
         assert<1>(success && !get_foster_child(), "Unable to unlink foster child");
     }
 
+    /**
+     * \brief Makes the given right sibling a foster child of this node (i.e., de-adoption).
+     *
+     * This is the first step of a node merge, after which the caller must remove the separator key
+     * of the sibling from the parent. The high fence of this node becomes the high fence of the
+     * sibling, while the old one (which is the low fence of the sibling) becomes the foster key, so
+     * that this node and its new foster child cover the same key range as before. Neither node may
+     * have a foster child.
+     *
+     * \returns false if there is no space left for the foster key.
+     */
+    bool adopt_sibling_as_foster(NodePointer sibling)
+    {
+        assert<1>(!get_foster_child() && !sibling->get_foster_child());
+
+        KeyType low_key, sibling_low, sibling_high;
+        get_fence_keys(&low_key, nullptr);
+        sibling->get_fence_keys(&sibling_low, &sibling_high);
+        KeyType* low_ptr = is_low_key_infinity() ? nullptr : &low_key;
+        KeyType* high_ptr = sibling->is_high_key_infinity() ? nullptr : &sibling_high;
+
+        return update_fenster(low_ptr, high_ptr, &sibling_low, sibling);
+    }
+
+    /**
+     * \brief Moves all records of the foster child into this node and unlinks it.
+     *
+     * This is the second step of a node merge, i.e., the opposite of rebalance_foster_child. The
+     * foster child is left empty and with an empty key range, so that any thread still holding a
+     * pointer to it (e.g., an optimistic reader) notices that the key is not there. The foster
+     * child must not have a foster child of its own.
+     *
+     * \returns false if the records do not fit, in which case nothing is changed.
+     */
+    bool absorb_foster_child()
+    {
+        NodePointer child = get_foster_child();
+        assert<1>(child && !child->get_foster_child());
+
+        // Ghosts are purged here, so that only live records are moved and counted as used space
+        this->compact();
+        child->compact();
+        if (child->slot_count() > 0) {
+            bool moved = internal::move_kv_records(*this, SlotNumber(this->slot_count()),
+                    *child, SlotNumber(0), child->slot_count());
+            if (!moved) { return false; }
+        }
+
+        KeyType low_key, high_key, foster_key;
+        get_fence_keys(&low_key, &high_key);
+        get_foster_key(&foster_key);
+        KeyType* low_ptr = is_low_key_infinity() ? nullptr : &low_key;
+        KeyType* high_ptr = is_high_key_infinity() ? nullptr : &high_key;
+        // If foster child was empty, foster key is not stored and is equal to the high fence key
+        KeyType* foster_key_ptr = is_foster_empty() ? high_ptr : &foster_key;
+
+        bool success = update_fenster(low_ptr, high_ptr, nullptr, NodePointer{nullptr});
+        assert<1>(success, "Unable to unlink absorbed foster child");
+        success = child->update_fenster(foster_key_ptr, foster_key_ptr, nullptr, NodePointer{nullptr});
+        assert<1>(success, "Unable to reset fence keys of absorbed foster child");
+
+        assert<3>(this->is_consistent());
+        return true;
+    }
+
     /**
      * \brief Rebalances records between this node and its foster child.
      *
@@ -197,20 +321,34 @@ public:
      *
      * This method uses the move_kv_records function template to move key-value pairs from one
      * key-value array to another.
+     *
+     * If the key whose insertion caused the split is given and it is greater than all keys in this
+     * node, the split is asymmetric: only (100 - AppendSplitPercent)% of the records are moved. With
+     * increasing keys, this node will receive no further insertions, so it is left almost full.
+     *
+     * On leaf nodes, the new foster key (i.e., the separator later adopted by the parent) is the
+     * shortest key between the last key that stays and the first key that moves -- with long string
+     * keys, this is usually a short prefix of the latter (\see internal::shortest_separator). This
+     * does not work on branch nodes, whose first key must be equal to the low fence key, because it
+     * is the one that leads to the first child.
      */
-    bool rebalance_foster_child()
+    bool rebalance_foster_child(const KeyType* insert_key = nullptr)
     {
         // TODO support different policies for picking the split key
-        // (pick middle key, divide by total payload size, suffix compression, etc.)
+        // (pick middle key, divide by total payload size, etc.)
         // e.g., template <class RebalancePolicy = void>
 
-        // TODO support merge and node deletion, i.e., rebalance in the opposite direction
-
-        // STEP 1: determine split key
+        // STEP 1: determine split key among live records only
+        this->compact();
         SlotNumber slot_count = this->slot_count();
-        SlotNumber split_slot = slot_count / 2;
+        SlotNumber split_slot = pick_split_slot(insert_key);
         KeyType split_key;
         this->read_slot(split_slot, &split_key, nullptr);
+        if (!IsBranch && split_slot > 0) {
+            KeyType left_key;
+            this->read_slot(split_slot - 1, &left_key, nullptr);
+            split_key = internal::shortest_separator(left_key, split_key);
+        }
 
         // STEP 2: move records
         NodePointer child = get_foster_child();
@@ -265,7 +403,7 @@ public:
         add_foster_child(new_node);
 
         // STEP 2: Move records into the new foster child using rebalance operation
-        bool rebalanced = rebalance_foster_child();
+        bool rebalanced = rebalance_foster_child(&key);
         assert<1>(rebalanced, "Could not rebalance records into new foster child");
 
         // STEP 3: Decide if insertion should go into old or new node and return it
@@ -280,27 +418,34 @@ public:
         }
     }
 
+    /**
+     * \brief Overwrites fence keys, foster key, and foster child pointer.
+     *
+     * Unlike the methods above, this does not maintain any invariant of foster relationships, and
+     * thus it should only be used to build nodes from scratch (e.g., in bulk loading).
+     *
+     * \returns false if there is no space left to encode the given keys.
+     */
+    bool reset_fenster(KeyType* low, KeyType* high, KeyType* foster, NodePointer foster_ptr)
+    {
+        return update_fenster(low, high, foster, foster_ptr);
+    }
+
     /**@}**/
 
     /** @name Methods for keys against fence and foster keys **/
     /**@{**/
 
-    /// \brief Checks if given key is within the fence borders
-    bool fence_contains(const KeyType& key) const
+    /**
+     * \brief Checks if given key is within the fence borders
+     *
+     * The low fence key is inclusive and the high fence key is exclusive, since the high fence of
+     * a node is the low fence of the node that follows it in key order. Fence keys are compared in
+     * place, i.e., without decoding them (\see Fenster::fence_contains).
+     */
+    bool fence_contains(const KeyView& key) const
     {
-        KeyType low, high;
-        get_fence_keys(&low, &high);
-
-        if (key >= low && key <= high) { return true; }
-
-        // comparison failed, but key may still be contained if one of the keys is infinity
-        if (key >= low && is_high_key_infinity()) { return true; }
-        if (key <= high && is_low_key_infinity()) { return true; }
-        if (is_low_key_infinity() && is_high_key_infinity()) {
-            return true;
-        }
-
-        return false;
+        return get_fenster()->fence_contains(key);
     }
 
     /**
@@ -309,19 +454,29 @@ public:
      * This is stricter than fence_contains, because it returns false if the key is not in this node
      * but in its foster child, whereas the former returns true.
      */
-    bool key_range_contains(const KeyType& key) const
+    bool key_range_contains(const KeyView& key) const
     {
-        if (!fence_contains(key)) { return false; }
-        if (!is_foster_empty()) {
-            KeyType foster;
-            get_foster_key(&foster);
-            return key < foster;
-        }
-        return true;
+        return get_fenster()->key_range_contains(key);
     }
 
     /**@}**/
 
+    /**
+     * \brief Issues software prefetches for the cache lines of this node that are read first.
+     *
+     * These are the slot array header (beginning of the node) and the fenster payload, node ID, and
+     * latch (end of the node), i.e., the lines required to check key ranges and to start a search.
+     */
+    void prefetch() const
+    {
+        const char* begin = reinterpret_cast<const char*>(this);
+        const char* end = begin + sizeof(ThisType);
+        __builtin_prefetch(begin);
+        for (size_t i = 1; i <= PrefetchTailLines && i * CacheLineSize < sizeof(ThisType); i++) {
+            __builtin_prefetch(end - i * CacheLineSize);
+        }
+    }
+
     /** @name Convenience methods to access header and fenster data **/
     /**@{**/
 
@@ -354,6 +509,53 @@ public:
 
     /**@}**/
 
+    /** @name Methods for snapshots (\see snapshot.h) **/
+    /**@{**/
+
+    /// Size of the image of a node in a snapshot, i.e., its key-value array and fenster location
+    static constexpr size_t PageBytes = sizeof(KeyValueArray<K, V>) + sizeof(PayloadPtr);
+
+    /**
+     * \brief Copies the contents of this node into a page image.
+     *
+     * The latch and the ID are not part of the image. Pointers to other nodes (i.e., values of
+     * branch nodes and the foster child) are copied as they are, so they must be translated before
+     * the image is used by another process (\see swizzle_children and set_foster_ptr).
+     */
+    void write_page(char* page) const
+    {
+        using Array = KeyValueArray<K, V>;
+        memcpy(page, reinterpret_cast<const char*>(static_cast<const Array*>(this)), sizeof(Array));
+        memcpy(page + sizeof(Array), &fenster_ptr_, sizeof(PayloadPtr));
+    }
+
+    /// \brief Replaces the contents of this node with a page image (\see write_page)
+    void read_page(const char* page)
+    {
+        using Array = KeyValueArray<K, V>;
+        memcpy(reinterpret_cast<char*>(static_cast<Array*>(this)), page, sizeof(Array));
+        memcpy(&fenster_ptr_, page + sizeof(Array), sizeof(PayloadPtr));
+    }
+
+    /**
+     * \brief Replaces each child pointer p of a branch node with f(p). Leaves are not affected.
+     *
+     * Ghost slots are skipped, since they may point to nodes that were already retired.
+     */
+    template <class F>
+    void swizzle_children(F f)
+    {
+        swizzle_children(f, std::integral_constant<bool, IsBranch>{});
+    }
+
+    /// \brief Replaces the foster child pointer without changing the foster key
+    void set_foster_ptr(NodePointer ptr)
+    {
+        get_fenster()->set_foster_ptr(ptr);
+    }
+
+    /**@}**/
+
     /// Debugging/testing method to verify node's state
     bool is_consistent()
     {
@@ -393,9 +595,16 @@ protected:
         PayloadPtr& ptr = fenster_ptr_;
         if (new_length != current_length) {
             int diff = current_length - new_length;
+            // Free space must be checked here, since first + diff may wrap around otherwise
+            size_t required = diff < 0 ? size_t(-diff) * this->Alignment : 0;
+            if (this->free_space() < required && this->ghost_count() > 0) {
+                // Purging ghosts never moves the fenster, which is the last payload in the array
+                this->compact();
+            }
+            if (this->free_space() < required) { return false; }
             PayloadPtr first = this->get_first_payload();
             bool shifted = this->shift_payloads(first + diff, first, ptr - first);
-            if (!shifted) { return false; }
+            assert<1>(shifted);
             ptr = ptr + diff;
         }
 
@@ -404,8 +613,45 @@ protected:
         return true;
     }
 
+    /// Percentage of records kept in a node split for an insertion beyond its last key
+    static constexpr unsigned AppendSplitPercent = 90;
+
+    /// Picks the first slot to be moved into the foster child (\see rebalance_foster_child)
+    SlotNumber pick_split_slot(const KeyType* insert_key)
+    {
+        SlotNumber slot_count = this->slot_count();
+        if (insert_key && slot_count > 1) {
+            KeyType last_key;
+            this->read_slot(slot_count - 1, &last_key, nullptr);
+            if (last_key < *insert_key) {
+                SlotNumber moved = slot_count - slot_count * AppendSplitPercent / 100;
+                return slot_count - (moved > 0 ? moved : 1);
+            }
+        }
+        return slot_count / 2;
+    }
+
 private:
 
+    template <class F>
+    void swizzle_children(F f, std::true_type)
+    {
+        for (SlotNumber i = 0; i < this->slot_count(); i++) {
+            if (this->is_ghost(i)) { continue; }
+            KeyType key;
+            V child;
+            this->read_slot(i, &key, &child);
+            PutStatus status = this->template put<PutMode::Update>(key, f(child));
+            assert<1>(status == PutStatus::Updated, "Child pointer could not be replaced in place");
+        }
+    }
+
+    template <class F>
+    void swizzle_children(F, std::false_type) {}
+
+    static constexpr size_t CacheLineSize = 64;
+    static constexpr size_t PrefetchTailLines = 2;
+
     IdType id_;
     PayloadPtr fenster_ptr_;
 };
@@ -87,7 +87,17 @@ public:
         return NodePointer {new (addr) Node(id)};
     }
 
-    // TODO implement destroy_node method
+    /*
+     * \brief Destroy a node and free its memory.
+     *
+     * The caller must guarantee that no other thread can still reach the node.
+     */
+    void destroy_node(NodePointer node)
+    {
+        Node* addr = &(*node);
+        addr->~Node();
+        allocator_.deallocate(addr, 1 /* number of nodes to free */);
+    }
 
 protected:
 
@@ -57,18 +57,19 @@ public:
     using SuperType = BtreeNode<string, V, KeyValueArray, Pointer, IdType>;
     using ThisType = BtreeNodePrefixTrunc<string, V, KeyValueArray, Pointer, IdType>;
     using NodePointer = Pointer<ThisType>;
+    using KeyView = typename SuperType::KeyView;
 
-    bool insert(const string& key, const V& value)
+    bool insert(const KeyView& key, const V& value)
     {
         return SuperType::insert(truncate(key), value);
     }
 
-    bool find(const string& key, V* value = nullptr)
+    bool find(const KeyView& key, V* value = nullptr)
     {
         return SuperType::find(truncate(key), value);
     }
 
-    void remove(const string& key)
+    void remove(const KeyView& key)
     {
         return SuperType::remove(truncate(key));
     }
@@ -90,10 +91,14 @@ public:
 
         bool next(string* key, V* value)
         {
-            if (current_slot_ >= kv_->size()) { return false; }
-
-            kv_->read_slot(current_slot_, key, value);
-            kv_->add_prefix(*key);
+            while (current_slot_ < kv_->slot_count() && kv_->is_ghost(current_slot_)) {
+                current_slot_++;
+            }
+            if (current_slot_ >= kv_->slot_count()) { return false; }
+
+            KeyView suffix;
+            kv_->read_slot_view(current_slot_, &suffix, value);
+            if (key) { kv_->add_prefix(suffix, key); }
             current_slot_++;
 
             return true;
@@ -144,19 +149,19 @@ public:
 
 protected:
 
-    const string truncate(const string& key)
+    /// Truncated keys are views on the given key, so no string is allocated for a search
+    KeyView truncate(const KeyView& key) const
     {
-        size_t prefix_len = this->get_fenster()->get_prefix_size();
-        if (prefix_len == 0) { return key; }
-        else { return key.substr(prefix_len); }
+        return key.substr(this->get_fenster()->get_prefix_size());
     }
 
-    void add_prefix(string& key)
+    /// Builds the full key from the encoded suffix with a single allocation (at most)
+    void add_prefix(const KeyView& suffix, string* key) const
     {
-        // TODO this could be optimized to avoid extra copies using string::iterator
-        string prefix;
-        this->get_fenster()->get_prefix(prefix);
-        key.insert(0, prefix);
+        KeyView prefix = this->get_fenster()->get_prefix_view();
+        key->reserve(prefix.length() + suffix.length());
+        key->assign(prefix.data(), prefix.length());
+        key->append(suffix.data(), suffix.length());
     }
 };
 
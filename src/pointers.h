@@ -29,6 +29,10 @@
  * shared_ptr and unique_ptr.
  */
 
+#include <atomic>
+#include <cstdint>
+#include <mutex>
+
 #include "assertions.h"
 
 namespace foster {
@@ -64,6 +68,161 @@ private:
     T* ptr_;
 };
 
+namespace internal {
+
+/**
+ * \brief Program-wide table of page resolvers (i.e., buffer pools), through which unswizzled
+ * pointers are dereferenced (\see SwizzlingPtr and BufferPool).
+ *
+ * Like the counter of AtomicCounterIdGenerator, the table is a local static variable, so that a
+ * single instance exists without a translation unit to define it.
+ */
+class PageResolvers
+{
+public:
+
+    /// Function that returns the address of a page, faulting it in if necessary
+    using Resolve = void* (*)(void* context, uint64_t page);
+
+    static constexpr unsigned IdBits = 10;
+    static constexpr unsigned MaxCount = 1u << IdBits;
+
+    /// \brief Registers a resolver and returns its ID, or MaxCount if the table is full
+    static unsigned add(Resolve func, void* context)
+    {
+        Table& t = table();
+        std::lock_guard<std::mutex> lock {t.mutex};
+        for (unsigned i = 0; i < MaxCount; i++) {
+            if (!t.entries[i].context.load()) {
+                t.entries[i].func = func;
+                t.entries[i].context.store(context);
+                return i;
+            }
+        }
+        return MaxCount;
+    }
+
+    static void remove(unsigned id)
+    {
+        Table& t = table();
+        std::lock_guard<std::mutex> lock {t.mutex};
+        t.entries[id].context.store(nullptr);
+    }
+
+    static void* resolve(unsigned id, uint64_t page)
+    {
+        Entry& e = table().entries[id];
+        void* context = e.context.load(std::memory_order_acquire);
+        assert<1>(context, "Dereferencing a page of an unregistered buffer pool");
+        return e.func(context, page);
+    }
+
+private:
+
+    struct Entry
+    {
+        Resolve func;
+        std::atomic<void*> context;
+    };
+
+    struct Table
+    {
+        std::mutex mutex;
+        Entry entries[MaxCount];
+    };
+
+    static Table& table()
+    {
+        static Table t;
+        return t;
+    }
+};
+
+} // namespace internal
+
+/**
+ * \brief Pointer that holds either the address of a node in memory (swizzled) or the page ID of a
+ * node that may have to be faulted in from a buffer pool (unswizzled).
+ *
+ * Both states fit in a single word, told apart by the lowest bit, which is always zero in the
+ * address of an aligned object. An unswizzled pointer consists of the page number and the ID of
+ * the buffer pool (\see internal::PageResolvers) above the tag bit. Dereferencing a swizzled
+ * pointer costs a test of the tag bit on top of a plain pointer, whereas dereferencing an
+ * unswizzled one costs a lookup in the page table of the buffer pool -- plus the copy of the page
+ * if it is not resident (\see BufferPool::fix).
+ *
+ * Pointers are never swizzled in place: a page is always reached through its page ID, so that it
+ * can be evicted without finding and unswizzling the pointers to it. Nodes created in memory are
+ * referenced with swizzled pointers. Consequently, two pointers may refer to the same node with
+ * different representations, and operator== compares representations.
+ */
+template <class T>
+class SwizzlingPtr {
+public:
+
+    using PointeeType = T;
+
+    explicit SwizzlingPtr(T* p = nullptr) : word_(reinterpret_cast<uintptr_t>(p))
+    {
+        assert<1>(!(word_ & TagBit), "Misaligned node address");
+    }
+
+    static SwizzlingPtr unswizzled(unsigned pool_id, uint64_t page)
+    {
+        SwizzlingPtr ptr;
+        ptr.word_ = (page << PageShift) | (uintptr_t(pool_id) << 1) | TagBit;
+        return ptr;
+    }
+
+    bool is_swizzled() const { return !(word_ & TagBit); }
+    unsigned pool_id() const { return (word_ >> 1) & (internal::PageResolvers::MaxCount - 1); }
+    uint64_t page_id() const { return word_ >> PageShift; }
+
+    operator bool() const { return word_; }
+    T* operator->() const { return get(); }
+    T& operator*() const { return *get(); }
+    bool operator!() const { return !word_; }
+    bool operator==(const SwizzlingPtr& other) const { return other.word_ == word_; }
+
+    operator void*() { return get(); }
+
+    friend std::ostream& operator<< (std::ostream& out, const SwizzlingPtr<T>& ptr)
+    {
+        if (ptr.is_swizzled()) { return out << reinterpret_cast<T*>(ptr.word_); }
+        return out << "page " << ptr.page_id() << "@" << ptr.pool_id();
+    }
+
+    /// The tag bit and pool ID are kept, since they are the same for any pointee type
+    template <class OtherT>
+    static SwizzlingPtr<T> static_pointer_cast(SwizzlingPtr<OtherT> other)
+    {
+        SwizzlingPtr<T> ptr;
+        ptr.word_ = other.word_;
+        if (ptr.is_swizzled()) {
+            ptr.word_ = reinterpret_cast<uintptr_t>(
+                    static_cast<T*>(reinterpret_cast<OtherT*>(other.word_)));
+        }
+        return ptr;
+    }
+
+private:
+
+    template <class> friend class SwizzlingPtr;
+
+    static constexpr uintptr_t TagBit = 1;
+    static constexpr unsigned PageShift = internal::PageResolvers::IdBits + 1;
+
+    uintptr_t word_;
+
+    T* get() const
+    {
+        if (word_ & TagBit) {
+            return static_cast<T*>(internal::PageResolvers::resolve(pool_id(), page_id()));
+        }
+        return reinterpret_cast<T*>(word_);
+    }
+};
+
 } // namespace foster
 
 #endif
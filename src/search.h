@@ -28,6 +28,18 @@
  * Search algorithms for locating a slot in a slot array given a key.
  */
 
+#include <algorithm>
+#include <cstddef>
+#include <cstdint>
+#include <type_traits>
+
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+#ifdef __SSE4_2__
+#include <nmmintrin.h>
+#endif
+
 namespace foster {
 
 /**
@@ -96,6 +108,190 @@ public:
 
 };
 
+namespace internal {
+
+/**
+ * \brief Computes the movemask bits which belong to keys in a 16-byte vector.
+ *
+ * Keys of KeySize bytes are stored with a stride of Stride keys (e.g., 2 if each slot contains a
+ * key followed by a payload pointer of the same size). Only the bytes of every Stride-th key must
+ * be considered in the result of _mm_movemask_epi8.
+ */
+constexpr unsigned simd_key_mask(size_t key_size, size_t stride, unsigned b = 0)
+{
+    return b == 16 ? 0u :
+        ((((b / key_size) % stride) == 0) ? (1u << b) : 0u) | simd_key_mask(key_size, stride, b+1);
+}
+
+/**
+ * \brief Scalar fallback to count keys smaller than a given one in a strided key sequence.
+ *
+ * Counting (instead of branching on each comparison) makes the loop free of unpredictable
+ * branches, which also allows the compiler to auto-vectorize it.
+ */
+template <class Key, size_t Stride>
+struct ScalarCountLess
+{
+    static size_t count(const Key* keys, size_t n, const Key& key)
+    {
+        size_t result = 0;
+        for (size_t i = 0; i < n; i++) {
+            result += keys[i * Stride] < key;
+        }
+        return result;
+    }
+};
+
+/**
+ * \brief Counts keys smaller than a given one using SIMD compare-and-movemask instructions.
+ *
+ * The general template falls back to the scalar implementation. Specializations are provided for
+ * 16-, 32-, and 64-bit unsigned keys whenever the instruction set is available (SSE2 for 16- and
+ * 32-bit; SSE4.2 for 64-bit) and the key stride allows more than one key per vector.
+ */
+template <class Key, size_t Stride, class Enable = void>
+struct SimdCountLess : ScalarCountLess<Key, Stride> {};
+
+#ifdef __SSE2__
+
+/// Maps unsigned comparison into signed comparison by flipping the sign bit of both operands.
+template <class Key> struct SimdOps;
+
+template <> struct SimdOps<uint16_t>
+{
+    static __m128i set(uint16_t k) { return _mm_set1_epi16(static_cast<short>(k ^ 0x8000)); }
+    static __m128i bias() { return _mm_set1_epi16(static_cast<short>(0x8000)); }
+    static __m128i less(__m128i a, __m128i b) { return _mm_cmplt_epi16(a, b); }
+};
+
+template <> struct SimdOps<uint32_t>
+{
+    static __m128i set(uint32_t k) { return _mm_set1_epi32(static_cast<int>(k ^ 0x80000000u)); }
+    static __m128i bias() { return _mm_set1_epi32(static_cast<int>(0x80000000u)); }
+    static __m128i less(__m128i a, __m128i b) { return _mm_cmplt_epi32(a, b); }
+};
+
+#ifdef __SSE4_2__
+template <> struct SimdOps<uint64_t>
+{
+    static __m128i set(uint64_t k)
+    {
+        return _mm_set1_epi64x(static_cast<long long>(k ^ 0x8000000000000000ull));
+    }
+    static __m128i bias() { return _mm_set1_epi64x(static_cast<long long>(0x8000000000000000ull)); }
+    static __m128i less(__m128i a, __m128i b) { return _mm_cmpgt_epi64(b, a); }
+};
+#endif
+
+template <class Key> struct HasSimdOps : std::false_type {};
+template <> struct HasSimdOps<uint16_t> : std::true_type {};
+template <> struct HasSimdOps<uint32_t> : std::true_type {};
+#ifdef __SSE4_2__
+template <> struct HasSimdOps<uint64_t> : std::true_type {};
+#endif
+
+template <class Key, size_t Stride>
+struct SimdCountLess<Key, Stride, typename std::enable_if<HasSimdOps<Key>::value
+    && (16 % (sizeof(Key) * Stride) == 0) && (16 / (sizeof(Key) * Stride) > 1)>::type>
+{
+    static constexpr size_t KeysPerVector = 16 / (sizeof(Key) * Stride);
+    static constexpr unsigned Mask = simd_key_mask(sizeof(Key), Stride);
+
+    static size_t count(const Key* keys, size_t n, const Key& key)
+    {
+        using Ops = SimdOps<Key>;
+        const __m128i bias = Ops::bias();
+        const __m128i search = Ops::set(key);
+
+        size_t result = 0;
+        while (n >= KeysPerVector) {
+            __m128i v = _mm_loadu_si128(reinterpret_cast<const __m128i*>(keys));
+            __m128i lt = Ops::less(_mm_xor_si128(v, bias), search);
+            unsigned bits = static_cast<unsigned>(_mm_movemask_epi8(lt)) & Mask;
+            result += __builtin_popcount(bits) / sizeof(Key);
+            keys += KeysPerVector * Stride;
+            n -= KeysPerVector;
+        }
+
+        return result + ScalarCountLess<Key, Stride>::count(keys, n, key);
+    }
+};
+
+#endif // __SSE2__
+
+} // namespace internal
+
+/**
+ * \brief Hybrid search that narrows down the range with binary search and then counts keys
+ * smaller than the searched one with SIMD instructions.
+ *
+ * Poor man's normalized keys are short, so a few cache lines hold many of them. Once the range is
+ * smaller than LinearThreshold slots, a linear scan that compares several keys per instruction is
+ * cheaper than the remaining (branchy and dependent) binary search steps. The result is the same as
+ * in BinarySearch: the first occurrence of the key or the position where it would be inserted.
+ *
+ * Keys are read directly from the slot vector, i.e., with a stride of SArray::KeyStride keys (see
+ * SoASlotArray for a layout with dense keys). SIMD is used for unsigned 16-, 32-, and 64-bit keys
+ * if the instruction set is available; any other key type uses a scalar (but branch-free)
+ * fallback.
+ *
+ * \tparam SArray Slot array class.
+ * \tparam LinearThreshold Size of the range below which the linear scan is performed.
+ */
+template <class SArray, size_t LinearThreshold = 16>
+class SimdSearch
+{
+public:
+
+    using SlotNumber = typename SArray::SlotNumber;
+    using Key = typename SArray::KeyType;
+    static constexpr size_t KeyStride = SArray::KeyStride;
+    static constexpr bool Strided = KeyStride != 0;
+
+    using CountLess = typename std::conditional<Strided && std::is_unsigned<Key>::value,
+          internal::SimdCountLess<Key, (Strided ? KeyStride : 1)>,
+          internal::ScalarCountLess<Key, (Strided ? KeyStride : 1)>>::type;
+
+    /// \see BinarySearch::operator()
+    bool operator()(const SArray& array, const Key& key, SlotNumber& ret,
+            SlotNumber begin, SlotNumber end)
+    {
+        size_t lo = begin;
+        size_t hi = std::min<size_t>(end, array.slot_count());
+
+        while (hi - lo > LinearThreshold) {
+            size_t mid = lo + (hi - lo) / 2;
+            if (array[mid].key < key) { lo = mid + 1; }
+            else { hi = mid; }
+        }
+
+        if (lo < hi) {
+            lo += count_less(array, lo, hi - lo, key, std::integral_constant<bool, Strided>{});
+        }
+        ret = lo;
+        return ret < array.slot_count() && array[ret].key == key;
+    }
+
+private:
+
+    static size_t count_less(const SArray& array, size_t first, size_t n, const Key& key,
+            std::true_type /* strided */)
+    {
+        return CountLess::count(&array[first].key, n, key);
+    }
+
+    /// Fallback for slot layouts in which the slot size is not a multiple of the key size
+    static size_t count_less(const SArray& array, size_t first, size_t n, const Key& key,
+            std::false_type /* strided */)
+    {
+        size_t result = 0;
+        for (size_t i = first; i < first + n; i++) {
+            result += array[i].key < key;
+        }
+        return result;
+    }
+};
+
 } // namespace foster
 
 #endif
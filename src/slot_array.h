@@ -29,6 +29,7 @@
  */
 
 #include <array>
+#include <bitset>
 #include <cstring>
 #include <cstdint>
 #include <type_traits>
@@ -98,8 +99,9 @@ public:
      * \brief Type of individual slots in the slot vector.
      *
      * Contains key and a payload pointer, where the last bit is the ghost bit (uses C++ bit fields).
-     * Ghost bits are not used internally by this class, but managed exclusively by the caller for
-     * its own purposes.
+     * Ghost bits are interpreted exclusively by the caller (e.g., as deleted records), but they
+     * must be set with set_ghost(), so that the space occupied by ghosts can be reclaimed with
+     * purge_ghosts().
      */
     struct Slot {
         Key key;
@@ -112,6 +114,11 @@ public:
 
     /** @name Compile-time constants and types **/
     /**@{**/
+    /** Space occupied by a single slot */
+    static constexpr size_t SlotSize = sizeof(Slot);
+    /** Distance (in number of keys) between two consecutive keys, or 0 if not a multiple */
+    static constexpr size_t KeyStride =
+        sizeof(Slot) % sizeof(Key) == 0 ? sizeof(Slot) / sizeof(Key) : 0;
     /** Number of slots that fit into the allocated memory */
     static constexpr size_t MaxSlotCount = ArrayBytes / sizeof(Slot);
     /** Size (in bytes) of integer variable required to address all slots */
@@ -130,11 +137,14 @@ protected:
      *
      * Manages free space information by keeping a pointer to the first used payload block and the
      * first slot beyond the last used one. Amount of free space is given by converting them to byte
-     * offsets and computing the difference (see SlotArray::free_space()).
+     * offsets and computing the difference (see SlotArray::free_space()). The number of ghost slots
+     * and of payload blocks they occupy is also kept (see SlotArray::ghost_space()).
      */
     struct alignas(Alignment) HeaderData {
         SlotNumber slot_end;
+        SlotNumber ghost_count;
         PayloadPtr payload_begin;
+        PayloadPtr ghost_blocks;
     };
 
     /** @name Compile-time constants and types **/
@@ -173,7 +183,7 @@ private:
 public:
 
     /** \brief Default constructor. No arguments required */
-    SlotArray() : header_{0, PayloadCount}
+    SlotArray() : header_{0, 0, PayloadCount, 0}
     {};
 
     ~SlotArray() {};
@@ -317,6 +327,7 @@ public:
         if (free_space() < sizeof(Slot)) { return false; }
         memmove(&slots_[slot+1], &slots_[slot], sizeof(Slot) * (slot_count() - slot));
         header_.slot_end++;
+        slots_[slot].ghost = false;
 
         // Non-numeric keys should be empty-constructed
         if (!std::is_integral<Key>::value && !std::is_floating_point<Key>::value) {
@@ -332,12 +343,58 @@ public:
      */
     void delete_slot(SlotNumber slot)
     {
+        assert<1>(!slots_[slot].ghost, "Ghost slots must be purged instead of deleted");
         if (slot < slot_count() - 1) {
             memmove(&slots_[slot], &slots_[slot+1], sizeof(Slot) * (slot_count() - slot));
         }
         header_.slot_end--;
     }
 
+    /**
+     * \brief Inserts a range of new empty slots, shifting other slots only once.
+     * \param[in] slot Position of the first new slot.
+     * \param[in] count Number of slots to insert.
+     * \returns true if insertion succeeded; false if there is no space for all slots.
+     */
+    bool insert_slots(SlotNumber slot, size_t count)
+    {
+        assert(slot <= slot_count(), DBGINFO, "Slot number out of bounds");
+
+        if (free_space() < sizeof(Slot) * count) { return false; }
+        memmove(&slots_[slot+count], &slots_[slot], sizeof(Slot) * (slot_count() - slot));
+        header_.slot_end += count;
+
+        for (size_t i = slot; i < slot + count; i++) {
+            slots_[i].ghost = false;
+            if (!std::is_integral<Key>::value && !std::is_floating_point<Key>::value) {
+                new (&slots_[i]) Key;
+            }
+        }
+
+        return true;
+    }
+
+    /**
+     * \brief Deletes a range of slots and frees their payloads in a single pass.
+     *
+     * This is equivalent to calling free_payload() and delete_slot() for each slot in the range,
+     * but the payload area and the slot vector are compacted only once (\see purge_ghosts). Ghosts
+     * in the range are deleted too.
+     *
+     * \param[in] slot Position of the first slot to be deleted.
+     * \param[in] count Number of slots to delete.
+     * \param[in] get_length Function object that yields the length (in bytes) of a given payload.
+     */
+    template <class GetLength>
+    void delete_slots(SlotNumber slot, size_t count, GetLength get_length)
+    {
+        assert<1>(slot + count <= slot_count(), "Slot range out of bounds");
+
+        std::bitset<MaxSlotCount> removed;
+        for (size_t i = slot; i < slot + count; i++) { removed.set(i); }
+        remove_slots(removed, get_length);
+    }
+
     /** \brief Provides access to slot in the given position.  */
     Slot& get_slot(SlotNumber slot) { return slots_[slot]; }
     const Slot& get_slot(SlotNumber slot) const { return slots_[slot]; }
@@ -347,6 +404,71 @@ public:
 
     /**@}**/
 
+    /**
+     * @name Ghost management methods
+     */
+    /**@{**/
+
+    /** \brief Number of slots currently marked as ghosts */
+    size_t ghost_count() const
+    {
+        return header_.ghost_count;
+    }
+
+    /** \brief Space (in bytes) occupied by ghost slots and their payloads. \see purge_ghosts */
+    size_t ghost_space() const
+    {
+        return header_.ghost_blocks * sizeof(PayloadBlock) + header_.ghost_count * sizeof(Slot);
+    }
+
+    /**
+     * \brief Sets or clears the ghost bit of a slot.
+     *
+     * The length (in bytes) of the slot's payload must be given, since the total number of payload
+     * blocks occupied by ghosts is maintained in the header.
+     */
+    void set_ghost(SlotNumber slot, bool ghost, size_t length)
+    {
+        if (slots_[slot].ghost == ghost) { return; }
+        slots_[slot].ghost = ghost;
+
+        size_t blocks = get_payload_count(length);
+        if (ghost) {
+            header_.ghost_count++;
+            header_.ghost_blocks += blocks;
+        }
+        else {
+            header_.ghost_count--;
+            header_.ghost_blocks -= blocks;
+        }
+    }
+
+    /**
+     * \brief Deletes all ghost slots and frees their payloads in a single pass.
+     *
+     * Unlike calling free_payload() and delete_slot() for each ghost, which would shift the payload
+     * area and scan the slot vector once per slot, all remaining payload blocks are shifted towards
+     * the end of the array in one sweep, keeping their relative order. This includes blocks not
+     * associated with any slot (e.g., node metadata allocated by a derived class), which are never
+     * moved if allocated before all slot payloads.
+     *
+     * \param[in] get_length Function object that yields the length (in bytes) of a given payload,
+     *      since the payload blocks of each ghost must be known.
+     */
+    template <class GetLength>
+    void purge_ghosts(GetLength get_length)
+    {
+        if (header_.ghost_count == 0) { return; }
+
+        std::bitset<MaxSlotCount> removed;
+        for (SlotNumber i = 0; i < slot_count(); i++) {
+            if (slots_[i].ghost) { removed.set(i); }
+        }
+        remove_slots(removed, get_length);
+    }
+
+    /**@}**/
+
     /** \brief Print method used for debugging */
     void print_info()
     {
@@ -363,6 +485,52 @@ public:
         }
         cout << "-----------------------------------" << endl;
     }
+
+private:
+
+    /**
+     * Deletes the slots marked in the given set and frees their payloads by shifting all other
+     * payload blocks towards the end of the array in one sweep and compacting the slot vector.
+     */
+    template <class GetLength>
+    void remove_slots(const std::bitset<MaxSlotCount>& removed, GetLength get_length)
+    {
+        // 1. Mark payload blocks of removed slots as free
+        std::bitset<PayloadCount> free_blocks;
+        for (SlotNumber i = 0; i < slot_count(); i++) {
+            if (!removed[i]) { continue; }
+            size_t begin = slots_[i].ptr;
+            size_t blocks = get_payload_count(get_length(get_payload(slots_[i].ptr)));
+            for (size_t b = begin; b < begin + blocks; b++) { free_blocks.set(b); }
+            if (slots_[i].ghost) {
+                header_.ghost_count--;
+                header_.ghost_blocks -= blocks;
+            }
+        }
+
+        // 2. Shift used blocks towards the end, from back to front, recording their new positions.
+        // A block is only ever copied into a position greater than or equal to its own, which was
+        // already processed, so no block is overwritten before it is copied.
+        PayloadPtr new_position[PayloadCount];
+        size_t to = PayloadCount;
+        for (size_t b = PayloadCount; b-- > header_.payload_begin; ) {
+            if (free_blocks[b]) { continue; }
+            to--;
+            if (to != b) { memcpy(&payloads_[to], &payloads_[b], sizeof(PayloadBlock)); }
+            new_position[b] = to;
+        }
+        header_.payload_begin = to;
+
+        // 3. Compact the slot vector, redirecting payload pointers of the remaining slots
+        SlotNumber j = 0;
+        for (SlotNumber i = 0; i < slot_count(); i++) {
+            if (removed[i]) { continue; }
+            if (i != j) { memcpy(&slots_[j], &slots_[i], sizeof(Slot)); }
+            slots_[j].ptr = new_position[slots_[j].ptr];
+            j++;
+        }
+        header_.slot_end = j;
+    }
 };
 
 } // namespace foster
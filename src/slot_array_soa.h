@@ -0,0 +1,493 @@
+/*
+ * MIT License
+ *
+ * Copyright (c) 2016 Caetano Sauer
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy of this software and
+ * associated documentation files (the "Software"), to deal in the Software without restriction,
+ * including without limitation the rights to use, copy, modify, merge, publish, distribute,
+ * sublicense, and/or sell copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all copies or
+ * substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR IMPLIED, INCLUDING BUT
+ * NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM,
+ * DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+#ifndef FOSTER_BTREE_SLOT_ARRAY_SOA_H
+#define FOSTER_BTREE_SLOT_ARRAY_SOA_H
+
+/**
+ * \file slot_array_soa.h
+ *
+ * Slot array variant with a structure-of-arrays layout, i.e., keys are kept in a dense vector.
+ */
+
+#include <algorithm>
+#include <array>
+#include <bitset>
+#include <cstring>
+#include <cstdint>
+#include <type_traits>
+
+using std::size_t;
+
+#include "assertions.h"
+#include "metaprog.h"
+
+namespace foster {
+
+/**
+ * \brief Slot array that stores keys and payload pointers in two separate vectors.
+ *
+ * This class is a drop-in replacement for SlotArray (same template parameters, same interface, and
+ * same space accounting), but instead of a vector of slots where each key is interleaved with its
+ * payload pointer and ghost bit, it keeps the keys in a contiguous *key vector*, followed by a
+ * parallel vector of payload pointers and ghost bits (the *slot data vector*). Payloads are managed
+ * exactly like in SlotArray, i.e., they grow from the end of the array towards the beginning.
+ *
+ *     | header | key vector -> | slot data vector -> | free space | <- payloads |
+ *
+ * Searches only touch the key vector, which means that no cache line is wasted on payload pointers
+ * and that keys can be compared with SIMD instructions without any masking (see SimdSearch). The
+ * price is paid on insertion and deletion of slots, which must shift both vectors -- the slot data
+ * vector is always shifted as a whole, since it starts right after the last key.
+ *
+ * Because a key and its payload pointer are not adjacent in memory, get_slot() returns a proxy
+ * object (SlotRef) instead of a reference. It offers the same members as SlotArray::Slot (i.e.,
+ * key, ptr, and ghost), so callers must only take care of not binding it to a non-const lvalue
+ * reference (e.g., use auto&& instead of auto&).
+ *
+ * \tparam Key The type used for keys. Must be integral or floating-point.
+ * \tparam ArrayBytes The total size of the array in bytes.
+ * \tparam Alignment The size of a payload block.
+ * \see SlotArray
+ */
+template<class Key, size_t ArrayBytes = 8192, size_t Alignment = 8>
+class SoASlotArray {
+public:
+
+    /** @name Compile-time constants and types **/
+    /**@{**/
+    /** Number of payload blocks that fit into the allocated memory */
+    static constexpr size_t MaxPayloadCount = ArrayBytes / Alignment;
+    /** Pointer size (in bytes) required to address all possible payload blocks */
+    static constexpr size_t PayloadPtrSize = meta::get_pointer_size(MaxPayloadCount);
+    /** Type of payload block pointers */
+    using PayloadPtr = typename meta::UnsignedInteger<PayloadPtrSize>;
+    /** Type of payload blocks (a fixed-length byte array) */
+    using PayloadBlock = typename std::array<char, Alignment>;
+    /** For acessing the alignment size externally **/
+    static constexpr size_t AlignmentSize = Alignment;
+    /**@}**/
+
+    /**
+     * \brief Entry of the slot data vector: payload pointer and ghost bit of a slot.
+     */
+    struct SlotData {
+        PayloadPtr ptr : (PayloadPtrSize*8)-1; /// Uses all bits but one
+        bool ghost : 1;
+    };
+
+    /**
+     * \brief Proxy object for accessing a slot, mimicking the members of SlotArray::Slot.
+     */
+    struct SlotRef {
+        /** \brief Assignable reference to the payload pointer of a slot */
+        struct PtrRef {
+            SlotData& data;
+            operator PayloadPtr() const { return data.ptr; }
+            PtrRef& operator=(PayloadPtr p) { data.ptr = p; return *this; }
+            PtrRef& operator=(const PtrRef& other) { data.ptr = other.data.ptr; return *this; }
+        };
+
+        /** \brief Assignable reference to the ghost bit of a slot */
+        struct GhostRef {
+            SlotData& data;
+            operator bool() const { return data.ghost; }
+            GhostRef& operator=(bool g) { data.ghost = g; return *this; }
+            GhostRef& operator=(const GhostRef& other) { data.ghost = other.data.ghost; return *this; }
+        };
+
+        Key& key;
+        PtrRef ptr;
+        GhostRef ghost;
+
+        SlotRef(Key& k, SlotData& d) : key(k), ptr{d}, ghost{d} {}
+    };
+
+    /**
+     * \brief Read-only proxy object for accessing a slot.
+     */
+    struct ConstSlotRef {
+        const Key& key;
+        PayloadPtr ptr;
+        bool ghost;
+
+        ConstSlotRef(const Key& k, const SlotData& d) : key(k), ptr(d.ptr), ghost(d.ghost) {}
+    };
+
+    /** @name Compile-time constants and types **/
+    /**@{**/
+    /** Space occupied by a single slot (i.e., one entry of each vector) */
+    static constexpr size_t SlotSize = sizeof(Key) + sizeof(SlotData);
+    /** Distance (in number of keys) between two consecutive keys, as used by SimdSearch */
+    static constexpr size_t KeyStride = 1;
+    /** Number of slots that fit into the allocated memory */
+    static constexpr size_t MaxSlotCount = ArrayBytes / SlotSize;
+    /** Size (in bytes) of integer variable required to address all slots */
+    static constexpr size_t SlotPtrSize = meta::get_pointer_size(MaxSlotCount);
+    /** Slot number type (derived from SlotPtrSize */
+    using SlotNumber = typename meta::UnsignedInteger<SlotPtrSize>;
+    /**@}**/
+
+    /** Type alias for convenience of objects using this class **/
+    using KeyType = Key;
+
+protected:
+
+    /** \brief Header object containing metadata about the slot array \see SlotArray::HeaderData */
+    struct alignas(Alignment) HeaderData {
+        SlotNumber slot_end;
+        SlotNumber ghost_count;
+        PayloadPtr payload_begin;
+        PayloadPtr ghost_blocks;
+    };
+
+    /** @name Compile-time constants and types **/
+    /**@{**/
+    /** Actual maximum number of payload blocks, taking space occupied by header into account */
+    static constexpr size_t PayloadCount = (ArrayBytes - sizeof(HeaderData)) / Alignment;
+    /**@}**/
+
+private:
+
+    HeaderData header_;
+
+    union {
+        alignas(Alignment) char bytes_[PayloadCount * Alignment];
+        PayloadBlock payloads_[PayloadCount];
+    };
+
+    static_assert(std::is_integral<Key>::value || std::is_floating_point<Key>::value,
+            "SoASlotArray only supports numeric keys");
+    static_assert(sizeof(Key) % alignof(SlotData) == 0,
+            "SoASlotArray: slot data vector would not be aligned after the key vector");
+    static_assert(ArrayBytes % Alignment == 0,
+            "SoASlotArray template argument error: ArrayBytes must be a multiple of Aligment");
+    static_assert(sizeof(HeaderData) % Alignment == 0,
+            "SoASlotArray::HeaderData is not aligned properly");
+    static_assert(sizeof(payloads_) + sizeof(HeaderData) == ArrayBytes,
+            "SoASlotArray takes more space than the given ArrayBytes");
+
+    Key* keys() { return reinterpret_cast<Key*>(bytes_); }
+    const Key* keys() const { return reinterpret_cast<const Key*>(bytes_); }
+
+    /// The slot data vector begins right after the last key, i.e., its position depends on slot_end
+    SlotData* slot_data() { return reinterpret_cast<SlotData*>(keys() + header_.slot_end); }
+    const SlotData* slot_data() const
+    {
+        return reinterpret_cast<const SlotData*>(keys() + header_.slot_end);
+    }
+
+public:
+
+    /** \brief Default constructor. No arguments required */
+    SoASlotArray() : header_{0, 0, PayloadCount, 0}
+    {};
+
+    ~SoASlotArray() {};
+
+    /** \brief Amount of free space (in bytes) between end of slot vectors and begin of payloads. */
+    size_t free_space()
+    {
+        return header_.payload_begin * sizeof(PayloadBlock) - header_.slot_end * SlotSize;
+    }
+
+    /**
+     * @name Payload management methods
+     */
+    /**@{**/
+
+    /** \see SlotArray::get_payload_count */
+    static size_t get_payload_count(size_t length)
+    {
+        return length / sizeof(PayloadBlock) + (length % sizeof(PayloadBlock) != 0);
+    }
+
+    /** \see SlotArray::allocate_payload */
+    bool allocate_payload(PayloadPtr& ptr, size_t length)
+    {
+        size_t space_needed = get_payload_count(length) * Alignment;
+        if (free_space() < space_needed) { return false; }
+        header_.payload_begin -= get_payload_count(length);
+        ptr = header_.payload_begin;
+        return true;
+    }
+
+    /** \see SlotArray::free_payload */
+    void free_payload(PayloadPtr ptr, size_t length)
+    {
+        assert<3>(ptr >= header_.payload_begin, DBGINFO, "Invalid payload pointer");
+
+        size_t count = get_payload_count(length);
+        size_t shift = ptr - header_.payload_begin;
+
+        shift_payloads(header_.payload_begin + count, header_.payload_begin, shift);
+    }
+
+    /** \see SlotArray::shift_payloads */
+    bool shift_payloads(PayloadPtr to, PayloadPtr from, size_t count)
+    {
+        PayloadPtr first_affected = std::min(from, to);
+        PayloadPtr last_affected = std::max(from, to) + count - 1;
+        int shift = to - from;
+
+        if (shift < 0 && free_space() < sizeof(PayloadBlock) * (-shift)) {
+            return false;
+        }
+
+        memmove(&payloads_[to], &payloads_[from], count * sizeof(PayloadBlock));
+
+        // Only the slot data vector must be touched to adjust the pointers
+        SlotData* data = slot_data();
+        for (SlotNumber i = 0; i < slot_count(); i++) {
+            if (data[i].ptr >= first_affected && data[i].ptr <= last_affected) {
+                data[i].ptr += shift;
+            }
+        }
+
+        if (first_affected <= header_.payload_begin) {
+            header_.payload_begin += shift;
+        }
+
+        return true;
+    }
+
+    /** \see SlotArray::get_first_payload */
+    PayloadPtr get_first_payload() const
+    {
+        return header_.payload_begin;
+    }
+
+    /** \see SlotArray::get_payload */
+    void* get_payload(PayloadPtr ptr) { return payloads_[ptr].data(); }
+    const void* get_payload(PayloadPtr ptr) const { return payloads_[ptr].data(); }
+    void* get_payload_for_slot(SlotNumber slot) { return get_payload(slot_data()[slot].ptr); }
+    const void* get_payload_for_slot(SlotNumber slot) const
+    {
+        return get_payload(slot_data()[slot].ptr);
+    }
+
+    /**@}**/
+
+    /**
+     * @name Slot-vector management methods
+     */
+    /**@{**/
+
+    /** \brief Number of slots currently stored in the slot vectors */
+    size_t slot_count() const
+    {
+        return header_.slot_end;
+    }
+
+    /**
+     * \brief Insert a new empty slot into a given position, shifting other slots to make room.
+     * \see SlotArray::insert_slot
+     */
+    bool insert_slot(SlotNumber slot)
+    {
+        assert(slot <= slot_count(), DBGINFO, "Slot number out of bounds");
+
+        if (free_space() < SlotSize) { return false; }
+
+        size_t count = slot_count();
+        SlotData* old_data = slot_data();
+        SlotData* new_data = reinterpret_cast<SlotData*>(keys() + count + 1);
+
+        // Shift slot data first (from the back), since the key vector grows into its space
+        memmove(&new_data[slot+1], &old_data[slot], sizeof(SlotData) * (count - slot));
+        memmove(&new_data[0], &old_data[0], sizeof(SlotData) * slot);
+        memmove(&keys()[slot+1], &keys()[slot], sizeof(Key) * (count - slot));
+        header_.slot_end++;
+        new_data[slot].ghost = false;
+
+        return true;
+    }
+
+    /**
+     * \brief Deletes a slot from a given position, shitfing other slots if necessary.
+     * \see SlotArray::delete_slot
+     */
+    void delete_slot(SlotNumber slot)
+    {
+        assert<1>(!slot_data()[slot].ghost, "Ghost slots must be purged instead of deleted");
+        size_t count = slot_count();
+        SlotData* old_data = slot_data();
+        SlotData* new_data = reinterpret_cast<SlotData*>(keys() + count - 1);
+
+        // Inverse order of insert_slot: the key vector shrinks first
+        memmove(&keys()[slot], &keys()[slot+1], sizeof(Key) * (count - slot - 1));
+        memmove(&new_data[0], &old_data[0], sizeof(SlotData) * slot);
+        memmove(&new_data[slot], &old_data[slot+1], sizeof(SlotData) * (count - slot - 1));
+        header_.slot_end--;
+    }
+
+    /** \see SlotArray::insert_slots */
+    bool insert_slots(SlotNumber slot, size_t n)
+    {
+        assert(slot <= slot_count(), DBGINFO, "Slot number out of bounds");
+
+        if (free_space() < SlotSize * n) { return false; }
+
+        size_t count = slot_count();
+        SlotData* old_data = slot_data();
+        SlotData* new_data = reinterpret_cast<SlotData*>(keys() + count + n);
+
+        // Same order as in insert_slot, since the key vector grows into the slot data vector
+        memmove(&new_data[slot+n], &old_data[slot], sizeof(SlotData) * (count - slot));
+        memmove(&new_data[0], &old_data[0], sizeof(SlotData) * slot);
+        memmove(&keys()[slot+n], &keys()[slot], sizeof(Key) * (count - slot));
+        header_.slot_end += n;
+        for (size_t i = slot; i < slot + n; i++) { new_data[i].ghost = false; }
+
+        return true;
+    }
+
+    /** \see SlotArray::delete_slots */
+    template <class GetLength>
+    void delete_slots(SlotNumber slot, size_t n, GetLength get_length)
+    {
+        assert<1>(slot + n <= slot_count(), "Slot range out of bounds");
+
+        std::bitset<MaxSlotCount> removed;
+        for (size_t i = slot; i < slot + n; i++) { removed.set(i); }
+        remove_slots(removed, get_length);
+    }
+
+    /** \brief Provides access to slot in the given position.  */
+    SlotRef get_slot(SlotNumber slot) { return SlotRef{keys()[slot], slot_data()[slot]}; }
+    ConstSlotRef get_slot(SlotNumber slot) const
+    {
+        return ConstSlotRef{keys()[slot], slot_data()[slot]};
+    }
+    /** \brief Convenience alias for slot() **/
+    SlotRef operator[](SlotNumber slot) { return get_slot(slot); }
+    ConstSlotRef operator[](SlotNumber slot) const { return get_slot(slot); }
+
+    /**@}**/
+
+    /**
+     * @name Ghost management methods
+     */
+    /**@{**/
+
+    /** \see SlotArray::ghost_count */
+    size_t ghost_count() const
+    {
+        return header_.ghost_count;
+    }
+
+    /** \see SlotArray::ghost_space */
+    size_t ghost_space() const
+    {
+        return header_.ghost_blocks * sizeof(PayloadBlock) + header_.ghost_count * SlotSize;
+    }
+
+    /** \see SlotArray::set_ghost */
+    void set_ghost(SlotNumber slot, bool ghost, size_t length)
+    {
+        SlotData& data = slot_data()[slot];
+        if (data.ghost == ghost) { return; }
+        data.ghost = ghost;
+
+        size_t blocks = get_payload_count(length);
+        if (ghost) {
+            header_.ghost_count++;
+            header_.ghost_blocks += blocks;
+        }
+        else {
+            header_.ghost_count--;
+            header_.ghost_blocks -= blocks;
+        }
+    }
+
+    /**
+     * \brief Deletes all ghost slots and frees their payloads in a single pass.
+     * \see SlotArray::purge_ghosts
+     */
+    template <class GetLength>
+    void purge_ghosts(GetLength get_length)
+    {
+        if (header_.ghost_count == 0) { return; }
+
+        std::bitset<MaxSlotCount> removed;
+        const SlotData* data = slot_data();
+        for (size_t i = 0; i < slot_count(); i++) {
+            if (data[i].ghost) { removed.set(i); }
+        }
+        remove_slots(removed, get_length);
+    }
+
+    /**@}**/
+
+private:
+
+    /** \see SlotArray::remove_slots */
+    template <class GetLength>
+    void remove_slots(const std::bitset<MaxSlotCount>& removed, GetLength get_length)
+    {
+        size_t count = slot_count();
+        SlotData* old_data = slot_data();
+
+        // 1. Mark payload blocks of removed slots as free
+        std::bitset<PayloadCount> free_blocks;
+        for (size_t i = 0; i < count; i++) {
+            if (!removed[i]) { continue; }
+            size_t begin = old_data[i].ptr;
+            size_t blocks = get_payload_count(get_length(get_payload(old_data[i].ptr)));
+            for (size_t b = begin; b < begin + blocks; b++) { free_blocks.set(b); }
+            if (old_data[i].ghost) {
+                header_.ghost_count--;
+                header_.ghost_blocks -= blocks;
+            }
+        }
+
+        // 2. Shift used blocks towards the end (\see SlotArray::remove_slots)
+        PayloadPtr new_position[PayloadCount];
+        size_t to = PayloadCount;
+        for (size_t b = PayloadCount; b-- > header_.payload_begin; ) {
+            if (free_blocks[b]) { continue; }
+            to--;
+            if (to != b) { memcpy(&payloads_[to], &payloads_[b], sizeof(PayloadBlock)); }
+            new_position[b] = to;
+        }
+        header_.payload_begin = to;
+
+        // 3. Compact the key vector first, and then the slot data vector, which moves down into
+        // the space previously occupied by the last keys
+        size_t new_count = 0;
+        for (size_t i = 0; i < count; i++) {
+            if (!removed[i]) { keys()[new_count++] = keys()[i]; }
+        }
+        SlotData* new_data = reinterpret_cast<SlotData*>(keys() + new_count);
+        for (size_t i = 0, j = 0; i < count; i++) {
+            if (removed[i]) { continue; }
+            SlotData data = old_data[i];
+            data.ptr = new_position[data.ptr];
+            new_data[j++] = data;
+        }
+
+        header_.slot_end = new_count;
+    }
+};
+
+} // namespace foster
+
+#endif
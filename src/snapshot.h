@@ -0,0 +1,417 @@
+/*
+ * MIT License
+ *
+ * Copyright (c) 2016 Caetano Sauer
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy of this software and
+ * associated documentation files (the "Software"), to deal in the Software without restriction,
+ * including without limitation the rights to use, copy, modify, merge, publish, distribute,
+ * sublicense, and/or sell copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all copies or
+ * substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR IMPLIED, INCLUDING BUT
+ * NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM,
+ * DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+#ifndef FOSTER_BTREE_SNAPSHOT_H
+#define FOSTER_BTREE_SNAPSHOT_H
+
+/**
+ * \file snapshot.h
+ *
+ * Files that contain the images of all nodes of a tree, which can be reloaded much faster than
+ * inserting all key-value pairs again.
+ *
+ * A snapshot consists of a header followed by one section per level of the tree, from the root
+ * level down to the leaves. Each section contains the page images of all nodes of the level (\see
+ * BtreeNode::write_page), including nodes only reachable through foster pointers, in key order.
+ * Pointers to other nodes are replaced by page numbers, i.e., positions of the nodes in the section
+ * of their level, plus one (so that a null pointer remains null).
+ *
+ * The snapshot is read through a memory mapping, and pointers are swizzled back eagerly, i.e., all
+ * nodes are allocated and copied from the mapping when the snapshot is loaded. This only costs a
+ * memory copy per node, instead of a traversal and an insertion per key-value pair. Leaves may
+ * also be loaded lazily, if their node manager provides a buffer pool (\see BufferPool).
+ *
+ * Snapshots are only meant to be read by the same build of the same program that wrote them: the
+ * page images are raw memory copies, so they depend on the node types and the platform. Page sizes
+ * are verified, but nothing else about the types.
+ */
+
+#include <cerrno>
+#include <cstdint>
+#include <cstring>
+#include <fstream>
+#include <memory>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "assertions.h"
+#include "exceptions.h"
+
+namespace foster {
+
+namespace internal {
+
+/// Header at the beginning of a snapshot file
+struct SnapshotHeader
+{
+    static constexpr uint32_t CurrentVersion = 1;
+
+    char magic[8];
+    uint32_t version;
+    uint32_t level_count;
+};
+
+/// Location and size of a section, one of which follows the header for each level
+struct SnapshotSection
+{
+    uint64_t offset;
+    uint64_t page_count;
+    uint64_t page_bytes;
+};
+
+constexpr char SnapshotMagic[8] = {'F', 'O', 'S', 'T', 'E', 'R', 'S', 'N'};
+
+} // namespace internal
+
+/**
+ * \brief Writes the sections of a snapshot, one level at a time (\see StaticBtree::save).
+ */
+class SnapshotWriter
+{
+public:
+
+    SnapshotWriter(const string& path, unsigned level_count) :
+        path_(path), out_(path, std::ios::binary | std::ios::trunc),
+        sections_(level_count, internal::SnapshotSection{0, 0, 0}), page_bytes_(0)
+    {
+        if (!out_) { throw SnapshotException(path_, string{"cannot open: "} + strerror(errno)); }
+
+        // The header is written again with the location of each section by finish()
+        write_header();
+    }
+
+    /// \brief Starts the section of the given level, whose pages must be written next
+    void begin_level(unsigned level, uint64_t page_count, uint64_t page_bytes)
+    {
+        assert<1>(level < sections_.size(), "Invalid level in snapshot");
+        sections_[level] = internal::SnapshotSection{uint64_t(out_.tellp()), page_count, page_bytes};
+        page_bytes_ = page_bytes;
+    }
+
+    void write_page(const char* page)
+    {
+        out_.write(page, page_bytes_);
+    }
+
+    /// \brief Writes the location of each section into the header and closes the file
+    void finish()
+    {
+        out_.seekp(0);
+        write_header();
+        out_.close();
+        if (!out_) { throw SnapshotException(path_, "write failed"); }
+    }
+
+private:
+
+    string path_;
+    std::ofstream out_;
+    std::vector<internal::SnapshotSection> sections_;
+    /// Page size of the current section
+    std::streamsize page_bytes_;
+
+    void write_header()
+    {
+        internal::SnapshotHeader header;
+        memcpy(header.magic, internal::SnapshotMagic, sizeof(header.magic));
+        header.version = internal::SnapshotHeader::CurrentVersion;
+        header.level_count = sections_.size();
+        out_.write(reinterpret_cast<const char*>(&header), sizeof(header));
+        out_.write(reinterpret_cast<const char*>(sections_.data()),
+                sections_.size() * sizeof(internal::SnapshotSection));
+    }
+};
+
+/**
+ * \brief Maps a snapshot file into memory and gives access to its pages (\see StaticBtree::load).
+ *
+ * The structure of the file (header and section boundaries) is validated when it is opened.
+ */
+class SnapshotReader
+{
+public:
+
+    SnapshotReader(const string& path, unsigned level_count) :
+        path_(path), data_(nullptr), size_(0)
+    {
+        int fd = ::open(path.c_str(), O_RDONLY);
+        if (fd < 0) { throw SnapshotException(path_, string{"cannot open: "} + strerror(errno)); }
+
+        struct stat st;
+        if (::fstat(fd, &st) == 0 && st.st_size > 0) {
+            size_ = st.st_size;
+            void* addr = ::mmap(nullptr, size_, PROT_READ, MAP_PRIVATE, fd, 0);
+            if (addr != MAP_FAILED) {
+                data_ = static_cast<const char*>(addr);
+                // Pages are read once, in order within each section
+                ::madvise(addr, size_, MADV_WILLNEED);
+            }
+        }
+        ::close(fd);
+        if (!data_) { throw SnapshotException(path_, "cannot map file"); }
+
+        try { validate(level_count); }
+        catch (...) { unmap(); throw; }
+    }
+
+    ~SnapshotReader() { unmap(); }
+
+    SnapshotReader(const SnapshotReader&) = delete;
+    SnapshotReader& operator=(const SnapshotReader&) = delete;
+
+    /// \brief Number of pages of the given level, whose pages must have the given size
+    size_t page_count(unsigned level, size_t page_bytes) const
+    {
+        const internal::SnapshotSection& s = section(level);
+        if (s.page_bytes != page_bytes) {
+            throw SnapshotException(path_, "page size does not match node type of level "
+                    + std::to_string(level));
+        }
+        return s.page_count;
+    }
+
+    const char* page(unsigned level, uint64_t i) const
+    {
+        const internal::SnapshotSection& s = section(level);
+        assert<1>(i < s.page_count, "Page number out of bounds");
+        return data_ + s.offset + i * s.page_bytes;
+    }
+
+    /// \brief Throws if a page number read from a page is not valid for a section of size count
+    void check_page_number(uint64_t page, size_t count) const
+    {
+        if (page >= count) { throw SnapshotException(path_, "invalid page number"); }
+    }
+
+    const string& path() const { return path_; }
+
+private:
+
+    string path_;
+    const char* data_;
+    size_t size_;
+
+    const internal::SnapshotSection& section(unsigned level) const
+    {
+        return reinterpret_cast<const internal::SnapshotSection*>(
+                data_ + sizeof(internal::SnapshotHeader))[level];
+    }
+
+    void validate(unsigned level_count) const
+    {
+        using internal::SnapshotHeader;
+        using internal::SnapshotSection;
+
+        SnapshotHeader header;
+        if (size_ < sizeof(header)) { throw SnapshotException(path_, "file too short"); }
+        memcpy(&header, data_, sizeof(header));
+        if (memcmp(header.magic, internal::SnapshotMagic, sizeof(header.magic)) != 0
+                || header.version != SnapshotHeader::CurrentVersion)
+        {
+            throw SnapshotException(path_, "not a snapshot file or unknown version");
+        }
+        if (header.level_count != level_count) {
+            throw SnapshotException(path_, "number of levels does not match the tree");
+        }
+        if (size_ < sizeof(header) + level_count * sizeof(SnapshotSection)) {
+            throw SnapshotException(path_, "file too short");
+        }
+        for (unsigned i = 0; i < level_count; i++) {
+            const SnapshotSection& s = section(i);
+            if (s.page_count == 0 || s.page_bytes == 0 || s.offset > size_
+                    || s.page_count > (size_ - s.offset) / s.page_bytes)
+            {
+                throw SnapshotException(path_, "section of level " + std::to_string(i)
+                        + " is missing or truncated");
+            }
+        }
+    }
+
+    void unmap()
+    {
+        if (data_) { ::munmap(const_cast<char*>(data_), size_); }
+        data_ = nullptr;
+    }
+};
+
+namespace internal {
+
+/**
+ * \brief Encodes a page number into a pointer value (\see snapshot.h)
+ *
+ * The word of the pointer is accessed directly, so that pointers which interpret their contents
+ * (\see SwizzlingPtr) are neither constructed from nor dereferenced as an address.
+ */
+template <class Pointer>
+Pointer page_to_pointer(uint64_t page)
+{
+    static_assert(sizeof(Pointer) == sizeof(uintptr_t), "Pointer must consist of a single word");
+    uintptr_t word = page + 1;
+    Pointer ptr {nullptr};
+    memcpy(static_cast<void*>(&ptr), &word, sizeof(word));
+    return ptr;
+}
+
+/// \brief Decodes a page number from a pointer value encoded with page_to_pointer
+template <class Pointer>
+uint64_t pointer_to_page(Pointer ptr)
+{
+    uintptr_t word;
+    memcpy(&word, static_cast<const void*>(&ptr), sizeof(word));
+    return word - 1;
+}
+
+/// \brief Appends a node and its foster chain to a list of nodes
+template <class NodePointer>
+void append_foster_chain(std::vector<NodePointer>& nodes, NodePointer node)
+{
+    while (node) {
+        nodes.push_back(node);
+        node = node->get_foster_child();
+    }
+}
+
+/// Child pointer translation for leaves, which do not have children
+struct NoChildren
+{
+    template <class T> T operator()(T ptr) const { return ptr; }
+};
+
+/// Translates child pointers into page numbers, given all nodes of the child level in order
+template <class ChildPointer>
+class ChildPageNumbers
+{
+public:
+    ChildPageNumbers(const std::vector<ChildPointer>& children)
+    {
+        pages_.reserve(children.size());
+        for (size_t i = 0; i < children.size(); i++) { pages_[&(*children[i])] = i; }
+    }
+
+    ChildPointer operator()(ChildPointer child) const
+    {
+        return page_to_pointer<ChildPointer>(pages_.at(&(*child)));
+    }
+
+private:
+    std::unordered_map<const void*, uint64_t> pages_;
+};
+
+/// Translates page numbers back into child pointers, given all loaded nodes of the child level
+template <class ChildPointer>
+class ChildPointers
+{
+public:
+    ChildPointers(const std::vector<ChildPointer>& children, const SnapshotReader& reader)
+        : children_(children), reader_(reader)
+    {}
+
+    ChildPointer operator()(ChildPointer page_ptr) const
+    {
+        uint64_t page = pointer_to_page(page_ptr);
+        reader_.check_page_number(page, children_.size());
+        return children_[page];
+    }
+
+private:
+    const std::vector<ChildPointer>& children_;
+    const SnapshotReader& reader_;
+};
+
+/**
+ * \brief Writes the section of a level, given all its nodes in key order.
+ *
+ * Each node is copied into a scratch node, in which ghosts are purged and pointers are translated
+ * into page numbers, so that the tree itself is not modified. No other thread may access the tree.
+ */
+template <class NodePointer, class ChildFunc>
+void save_level(SnapshotWriter& writer, unsigned level, const std::vector<NodePointer>& nodes,
+        ChildFunc child_page)
+{
+    using Node = typename NodePointer::PointeeType;
+    static_assert(!Node::ExternalPayloads, "Snapshots cannot contain values stored out of line");
+
+    std::unordered_map<const void*, uint64_t> pages;
+    pages.reserve(nodes.size());
+    for (size_t i = 0; i < nodes.size(); i++) { pages[&(*nodes[i])] = i; }
+
+    writer.begin_level(level, nodes.size(), Node::PageBytes);
+    std::unique_ptr<Node> scratch {new Node};
+    std::vector<char> page(Node::PageBytes);
+    for (NodePointer node : nodes) {
+        node->write_page(page.data());
+        scratch->read_page(page.data());
+        scratch->compact();
+        scratch->swizzle_children(child_page);
+        NodePointer foster = scratch->get_foster_child();
+        if (foster) { scratch->set_foster_ptr(page_to_pointer<NodePointer>(pages.at(&(*foster)))); }
+        scratch->write_page(page.data());
+        writer.write_page(page.data());
+    }
+}
+
+/**
+ * \brief Allocates all nodes of a level, copies their pages from a snapshot, and translates page
+ * numbers back into pointers -- to nodes of the same level for foster pointers and using the given
+ * function for child pointers.
+ */
+template <class NodeMgr, class NodePointer, class ChildFunc>
+void load_level(const SnapshotReader& reader, unsigned level, NodeMgr& node_mgr,
+        std::vector<NodePointer>& nodes, ChildFunc child_pointer)
+{
+    using Node = typename NodePointer::PointeeType;
+
+    size_t count = reader.page_count(level, Node::PageBytes);
+    nodes.reserve(count);
+    for (size_t i = 0; i < count; i++) { nodes.push_back(node_mgr.construct_node()); }
+
+    try {
+        for (size_t i = 0; i < count; i++) {
+            NodePointer node = nodes[i];
+            node->read_page(reader.page(level, i));
+            node->swizzle_children(child_pointer);
+            NodePointer foster = node->get_foster_child();
+            if (foster) {
+                uint64_t page = pointer_to_page(foster);
+                reader.check_page_number(page, count);
+                node->set_foster_ptr(nodes[page]);
+            }
+        }
+    }
+    catch (...) {
+        // Pointers in the nodes may not be translated yet, so only the nodes themselves are freed
+        for (NodePointer node : nodes) { node_mgr.destroy_node(node); }
+        nodes.clear();
+        throw;
+    }
+}
+
+} // namespace internal
+
+} // namespace foster
+
+#endif
@@ -70,7 +70,12 @@ public:
 
     ~SortedList()
     {
-        // TODO: destroy all nodes in the linked list
+        NodePointer p = head_;
+        while (p) {
+            NodePointer next = p->get_foster_child();
+            destroy_node(p);
+            p = next;
+        }
     }
 
     /**
@@ -140,7 +145,13 @@ protected:
         return NodePointer(new (addr) Node());
     }
 
-    // TODO implement destroy_node
+    /// \brief: Destroy a node and free its memory.
+    void destroy_node(NodePointer node)
+    {
+        Node* addr = &(*node);
+        addr->~Node();
+        allocator_.deallocate(addr, 1 /* number of nodes to free */);
+    }
 
 };
 
@@ -0,0 +1,347 @@
+/*
+ * MIT License
+ *
+ * Copyright (c) 2016 Caetano Sauer
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy of this software and
+ * associated documentation files (the "Software"), to deal in the Software without restriction,
+ * including without limitation the rights to use, copy, modify, merge, publish, distribute,
+ * sublicense, and/or sell copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all copies or
+ * substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR IMPLIED, INCLUDING BUT
+ * NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM,
+ * DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+#ifndef FOSTER_BTREE_STATISTICS_H
+#define FOSTER_BTREE_STATISTICS_H
+
+/**
+ * \file statistics.h
+ *
+ * Policies for collecting statistics about events on the hot paths of a B-tree (latch waits,
+ * failed latch upgrades, splits, adoptions, foster chain lengths, and hash index hits).
+ */
+
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <ostream>
+#include <thread>
+#include <vector>
+
+namespace foster {
+
+/// \brief Events counted by a statistics policy
+enum class Counter : unsigned {
+    /// Root-to-leaf traversals, including restarted optimistic ones
+    Traversals,
+    /// Optimistic traversals restarted because a version could not be validated
+    TraversalRestarts,
+    /// Pointers to foster children followed during traversals
+    FosterHops,
+    LeafSplits,
+    BranchSplits,
+    Adoptions,
+    /// Adoptions abandoned because the latch on the parent could not be upgraded
+    ParentUpgradeFailures,
+    /// Adoptions abandoned because the latch on the child could not be upgraded
+    ChildUpgradeFailures,
+    Merges,
+    /// Point lookups answered through the adaptive hash index, i.e., without a traversal
+    HashIndexHits,
+    NumCounters
+};
+
+/// \brief Distributions recorded by a statistics policy
+enum class Histogram : unsigned {
+    /// Time (in nanoseconds) to acquire a latch in shared mode during traversals
+    ReadLatchWait,
+    /// Time (in nanoseconds) to acquire a latch in exclusive mode during traversals
+    WriteLatchWait,
+    /// Number of foster pointers followed from the child found on a level (if not zero)
+    FosterChainLength,
+    NumHistograms
+};
+
+/**
+ * \brief Distribution of values in power-of-two buckets.
+ *
+ * Bucket 0 contains only the value zero, and bucket i > 0 contains values in [2^(i-1), 2^i).
+ * Percentiles are thus only approximated by the upper bound of the bucket in which they fall.
+ */
+struct HistogramData
+{
+    static constexpr unsigned Buckets = 65;
+
+    uint64_t buckets[Buckets];
+    uint64_t sum;
+
+    HistogramData() : sum(0)
+    {
+        for (unsigned i = 0; i < Buckets; i++) { buckets[i] = 0; }
+    }
+
+    static unsigned bucket_of(uint64_t value)
+    {
+        return value == 0 ? 0 : 64 - __builtin_clzll(value);
+    }
+
+    uint64_t count() const
+    {
+        uint64_t c = 0;
+        for (unsigned i = 0; i < Buckets; i++) { c += buckets[i]; }
+        return c;
+    }
+
+    double mean() const
+    {
+        uint64_t c = count();
+        return c > 0 ? static_cast<double>(sum) / c : 0.0;
+    }
+
+    /// \brief Upper bound of the bucket that contains the given fraction (0 to 1) of the values
+    uint64_t percentile(double fraction) const
+    {
+        uint64_t c = count();
+        if (c == 0) { return 0; }
+        uint64_t target = static_cast<uint64_t>(fraction * (c - 1)) + 1;
+        uint64_t seen = 0;
+        for (unsigned i = 0; i < Buckets; i++) {
+            seen += buckets[i];
+            if (seen >= target) { return i == 0 ? 0 : (i == 64 ? UINT64_MAX : (1ull << i) - 1); }
+        }
+        return UINT64_MAX;
+    }
+
+    HistogramData& operator+=(const HistogramData& other)
+    {
+        for (unsigned i = 0; i < Buckets; i++) { buckets[i] += other.buckets[i]; }
+        sum += other.sum;
+        return *this;
+    }
+};
+
+/**
+ * \brief Statistics aggregated over all threads at a given point in time.
+ */
+struct StatisticsSnapshot
+{
+    static constexpr unsigned NumCounters = static_cast<unsigned>(Counter::NumCounters);
+    static constexpr unsigned NumHistograms = static_cast<unsigned>(Histogram::NumHistograms);
+
+    uint64_t counters[NumCounters];
+    HistogramData histograms[NumHistograms];
+
+    StatisticsSnapshot()
+    {
+        for (unsigned i = 0; i < NumCounters; i++) { counters[i] = 0; }
+    }
+
+    uint64_t operator[](Counter c) const { return counters[static_cast<unsigned>(c)]; }
+
+    const HistogramData& operator[](Histogram h) const
+    {
+        return histograms[static_cast<unsigned>(h)];
+    }
+
+    void print(std::ostream& out) const
+    {
+        static const char* counter_names[NumCounters] = {
+            "traversals", "traversal_restarts", "foster_hops", "leaf_splits", "branch_splits",
+            "adoptions", "parent_upgrade_failures", "child_upgrade_failures", "merges",
+            "hash_index_hits"
+        };
+        static const char* histogram_names[NumHistograms] = {
+            "read_latch_wait_ns", "write_latch_wait_ns", "foster_chain_length"
+        };
+
+        for (unsigned i = 0; i < NumCounters; i++) {
+            out << counter_names[i] << " " << counters[i] << std::endl;
+        }
+        for (unsigned i = 0; i < NumHistograms; i++) {
+            const HistogramData& h = histograms[i];
+            out << histogram_names[i] << " count " << h.count() << " mean " << h.mean()
+                << " p50 " << h.percentile(0.5) << " p99 " << h.percentile(0.99)
+                << " max " << h.percentile(1.0) << std::endl;
+        }
+    }
+};
+
+/**
+ * \brief Statistics policy that does not collect anything, which is the default.
+ *
+ * All methods are empty and inlined, and timers are empty objects, so the instrumented code paths
+ * compile to exactly the same code as without instrumentation (just like DummyLatch).
+ */
+struct NoStatistics
+{
+    static constexpr bool Enabled = false;
+
+    struct Timer {};
+
+    Timer start_timer() { return Timer{}; }
+    void add(Counter, uint64_t = 1) {}
+    void record(Histogram, uint64_t) {}
+    void record_time(Histogram, Timer) {}
+
+    StatisticsSnapshot snapshot() const { return StatisticsSnapshot{}; }
+    void reset() {}
+};
+
+/**
+ * \brief Statistics policy that keeps per-thread counters and histograms.
+ *
+ * Each thread updates its own record, registered on first use (as in EpochManager), so the hot
+ * paths only issue plain loads and stores on thread-private cache lines. Records are aggregated
+ * on demand with snapshot(), which may run concurrently with updates; values of a snapshot are
+ * then only approximately consistent with each other.
+ */
+class TreeStatistics
+{
+public:
+
+    static constexpr bool Enabled = true;
+
+    /// Start time of a latency measurement, in nanoseconds
+    using Timer = uint64_t;
+
+    TreeStatistics() : id_(next_id()) {}
+
+    TreeStatistics(const TreeStatistics&) = delete;
+    TreeStatistics& operator=(const TreeStatistics&) = delete;
+
+    Timer start_timer() { return now(); }
+
+    void add(Counter c, uint64_t n = 1)
+    {
+        increment(thread_record().counters[static_cast<unsigned>(c)], n);
+    }
+
+    void record(Histogram h, uint64_t value)
+    {
+        ThreadRecord& r = thread_record();
+        unsigned i = static_cast<unsigned>(h);
+        increment(r.buckets[i][HistogramData::bucket_of(value)], 1);
+        increment(r.sums[i], value);
+    }
+
+    void record_time(Histogram h, Timer start) { record(h, now() - start); }
+
+    /// \brief Aggregates the records of all threads
+    StatisticsSnapshot snapshot() const
+    {
+        StatisticsSnapshot s;
+        std::lock_guard<std::mutex> lock(records_mutex_);
+        for (auto& r : records_) {
+            for (unsigned i = 0; i < StatisticsSnapshot::NumCounters; i++) {
+                s.counters[i] += r->counters[i].load(std::memory_order_relaxed);
+            }
+            for (unsigned i = 0; i < StatisticsSnapshot::NumHistograms; i++) {
+                HistogramData& h = s.histograms[i];
+                for (unsigned b = 0; b < HistogramData::Buckets; b++) {
+                    h.buckets[b] += r->buckets[i][b].load(std::memory_order_relaxed);
+                }
+                h.sum += r->sums[i].load(std::memory_order_relaxed);
+            }
+        }
+        return s;
+    }
+
+    /// \brief Sets all values to zero. Updates concurrent with a reset may be lost.
+    void reset()
+    {
+        std::lock_guard<std::mutex> lock(records_mutex_);
+        for (auto& r : records_) {
+            for (auto& c : r->counters) { c.store(0, std::memory_order_relaxed); }
+            for (auto& s : r->sums) { s.store(0, std::memory_order_relaxed); }
+            for (auto& h : r->buckets) {
+                for (auto& b : h) { b.store(0, std::memory_order_relaxed); }
+            }
+        }
+    }
+
+private:
+
+    using Value = std::atomic<uint64_t>;
+
+    struct ThreadRecord
+    {
+        Value counters[StatisticsSnapshot::NumCounters];
+        Value sums[StatisticsSnapshot::NumHistograms];
+        Value buckets[StatisticsSnapshot::NumHistograms][HistogramData::Buckets];
+        std::thread::id owner;
+
+        ThreadRecord()
+        {
+            for (auto& c : counters) { c.store(0, std::memory_order_relaxed); }
+            for (auto& s : sums) { s.store(0, std::memory_order_relaxed); }
+            for (auto& h : buckets) {
+                for (auto& b : h) { b.store(0, std::memory_order_relaxed); }
+            }
+        }
+    };
+
+    const uint64_t id_;
+    mutable std::mutex records_mutex_;
+    std::vector<std::unique_ptr<ThreadRecord>> records_;
+
+    /// Only the owning thread writes to a value, so no atomic read-modify-write is needed
+    static void increment(Value& v, uint64_t n)
+    {
+        v.store(v.load(std::memory_order_relaxed) + n, std::memory_order_relaxed);
+    }
+
+    static uint64_t now()
+    {
+        using namespace std::chrono;
+        return duration_cast<nanoseconds>(steady_clock::now().time_since_epoch()).count();
+    }
+
+    static uint64_t next_id()
+    {
+        // Zero is reserved to mark a thread-local cache slot as unused
+        static std::atomic<uint64_t> counter{0};
+        return ++counter;
+    }
+
+    /// Record of the calling thread, cached in a thread-local table (\see EpochManager::record)
+    ThreadRecord& thread_record()
+    {
+        struct CacheEntry { uint64_t id; ThreadRecord* record; };
+        static constexpr size_t CacheSlots = 16;
+        static thread_local CacheEntry cache[CacheSlots];
+
+        CacheEntry& entry = cache[id_ % CacheSlots];
+        if (entry.id != id_) {
+            entry.record = register_thread();
+            entry.id = id_;
+        }
+        return *entry.record;
+    }
+
+    ThreadRecord* register_thread()
+    {
+        std::lock_guard<std::mutex> lock(records_mutex_);
+        std::thread::id self = std::this_thread::get_id();
+        for (auto& r : records_) {
+            if (r->owner == self) { return r.get(); }
+        }
+
+        records_.emplace_back(new ThreadRecord);
+        records_.back()->owner = self;
+        return records_.back().get();
+    }
+};
+
+} // namespace foster
+
+#endif
@@ -0,0 +1,325 @@
+/*
+ * MIT License
+ *
+ * Copyright (c) 2016 Caetano Sauer
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy of this software and
+ * associated documentation files (the "Software"), to deal in the Software without restriction,
+ * including without limitation the rights to use, copy, modify, merge, publish, distribute,
+ * sublicense, and/or sell copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all copies or
+ * substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR IMPLIED, INCLUDING BUT
+ * NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM,
+ * DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+
+#ifndef FOSTER_BTREE_TASK_POOL_H
+#define FOSTER_BTREE_TASK_POOL_H
+
+/**
+ * \file task_pool.h
+ *
+ * Work-stealing pool of worker threads for parallel bulk loading and scans.
+ */
+
+#include <atomic>
+#include <condition_variable>
+#include <cstddef>
+#include <cstdint>
+#include <deque>
+#include <exception>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+#include "assertions.h"
+
+namespace foster {
+
+/**
+ * \brief Fixed set of worker threads that run tasks submitted from any thread.
+ *
+ * Each worker has its own queue of tasks. Tasks submitted by a worker (i.e., by a running task) are
+ * pushed to the back of its own queue, and tasks submitted by other threads are distributed among
+ * the queues in round-robin order. A worker takes tasks from the back of its own queue, so that
+ * subtasks are run while their input is still in the cache, and steals from the front of the other
+ * queues once its own is empty, which balances the load when tasks are uneven (e.g., key ranges
+ * with different numbers of records). Idle workers sleep until a task is submitted.
+ *
+ * Each task belongs to a Group, which is the pool's own group unless one is given to submit, and
+ * wait() returns once all tasks of a group are finished. Callers of wait() help running tasks
+ * (of any group) instead of blocking, so that a pool without workers runs everything in the
+ * waiting thread. A task may wait for subtasks it submitted to a group of its own, but never for
+ * the group it belongs to, which cannot finish before the task itself.
+ *
+ * Queues are protected by mutexes, which is cheap since tasks are coarse-grained (e.g., building
+ * a partition of the leaves of a tree).
+ */
+class TaskPool
+{
+public:
+
+    using Task = std::function<void()>;
+
+    /**
+     * \brief Set of tasks that are waited for together (\see wait).
+     *
+     * A group must outlive its tasks, which is guaranteed by waiting for it before destruction.
+     */
+    class Group
+    {
+    public:
+        Group() : unfinished_(0) {}
+
+        ~Group() { assert<1>(unfinished_.load() == 0, "Task group destroyed before its tasks"); }
+
+        Group(const Group&) = delete;
+        Group& operator=(const Group&) = delete;
+
+    private:
+        friend class TaskPool;
+
+        /// Number of tasks submitted and not finished yet
+        std::atomic<size_t> unfinished_;
+        /// First exception thrown by a task of the group since the last wait
+        std::exception_ptr error_;
+    };
+
+    /// \brief Starts the given number of workers, by default one per hardware thread.
+    explicit TaskPool(size_t threads = std::thread::hardware_concurrency())
+        : queues_(threads > 0 ? threads : 1), next_queue_(0), queued_(0), unfinished_(0),
+        stopped_(false)
+    {
+        for (auto& q : queues_) { q.reset(new Queue); }
+        for (size_t i = 0; i < threads; i++) {
+            workers_.emplace_back(&TaskPool::run_worker, this, i);
+        }
+    }
+
+    /// \brief Stops the workers once all submitted tasks are finished.
+    ~TaskPool()
+    {
+        wait_all();
+        {
+            std::lock_guard<std::mutex> lock {mutex_};
+            stopped_ = true;
+        }
+        cond_.notify_all();
+        for (auto& w : workers_) { w.join(); }
+    }
+
+    TaskPool(const TaskPool&) = delete;
+    TaskPool& operator=(const TaskPool&) = delete;
+
+    /// \brief Number of worker threads, which may be zero
+    size_t size() const { return workers_.size(); }
+
+    /// \brief Submits a task to the pool's own group
+    void submit(Task task)
+    {
+        submit(std::move(task), group_);
+    }
+
+    void submit(Task task, Group& group)
+    {
+        size_t q = worker_index();
+        if (q >= queues_.size()) {
+            q = next_queue_.fetch_add(1, std::memory_order_relaxed) % queues_.size();
+        }
+
+        unfinished_.fetch_add(1);
+        group.unfinished_.fetch_add(1);
+        {
+            std::lock_guard<std::mutex> lock {queues_[q]->mutex};
+            queues_[q]->tasks.push_back(Entry {std::move(task), &group});
+        }
+        {
+            std::lock_guard<std::mutex> lock {mutex_};
+            queued_.fetch_add(1);
+        }
+        cond_.notify_all();
+    }
+
+    /**
+     * \brief Runs tasks until all tasks of the pool's own group are finished, including the ones
+     * submitted in the meantime. Must not be called by a task of that group.
+     *
+     * \throws the first exception thrown by a task of the group since the last wait, if any
+     */
+    void wait()
+    {
+        wait(group_);
+    }
+
+    /// \brief Same as wait(), but for the given group, to which the caller must not belong
+    void wait(Group& group)
+    {
+        assert<1>(running_group() != &group, "A task cannot wait for its own group");
+
+        size_t first = worker_index();
+        if (first >= queues_.size()) { first = 0; }
+
+        Entry entry;
+        while (group.unfinished_.load() > 0) {
+            if (take(first, entry)) {
+                run(entry);
+                continue;
+            }
+            std::unique_lock<std::mutex> lock {mutex_};
+            cond_.wait(lock, [this, &group] {
+                return group.unfinished_.load() == 0 || queued_.load() > 0;
+            });
+        }
+
+        std::exception_ptr error;
+        {
+            std::lock_guard<std::mutex> lock {mutex_};
+            std::swap(error, group.error_);
+        }
+        if (error) { std::rethrow_exception(error); }
+    }
+
+private:
+
+    struct Entry
+    {
+        Task task;
+        Group* group;
+    };
+
+    struct Queue
+    {
+        std::mutex mutex;
+        std::deque<Entry> tasks;
+    };
+
+    std::vector<std::unique_ptr<Queue>> queues_;
+    std::vector<std::thread> workers_;
+    std::atomic<size_t> next_queue_;
+
+    /// Number of tasks in the queues, which idle threads wait for
+    std::atomic<size_t> queued_;
+    /// Number of tasks of all groups submitted and not finished yet
+    std::atomic<size_t> unfinished_;
+    bool stopped_;
+    Group group_;
+    std::mutex mutex_;
+    std::condition_variable cond_;
+
+    struct WorkerId
+    {
+        const TaskPool* pool;
+        size_t index;
+    };
+
+    /// Pool and queue of the calling thread, if it is a worker
+    static WorkerId& current_worker()
+    {
+        static thread_local WorkerId id {nullptr, 0};
+        return id;
+    }
+
+    /// Group of the task run by the calling thread, if any
+    static const Group*& running_group()
+    {
+        static thread_local const Group* group {nullptr};
+        return group;
+    }
+
+    /// Queue of the calling thread if it is a worker of this pool, or SIZE_MAX
+    size_t worker_index() const
+    {
+        const WorkerId& id = current_worker();
+        return id.pool == this ? id.index : SIZE_MAX;
+    }
+
+    /// Takes a task from the back of the first queue or else from the front of the others
+    bool take(size_t first, Entry& entry)
+    {
+        for (size_t i = 0; i < queues_.size(); i++) {
+            Queue& q = *queues_[(first + i) % queues_.size()];
+            std::lock_guard<std::mutex> lock {q.mutex};
+            if (q.tasks.empty()) { continue; }
+            if (i == 0) {
+                entry = std::move(q.tasks.back());
+                q.tasks.pop_back();
+            }
+            else {
+                entry = std::move(q.tasks.front());
+                q.tasks.pop_front();
+            }
+            queued_.fetch_sub(1);
+            return true;
+        }
+        return false;
+    }
+
+    void run(Entry& entry)
+    {
+        Group& group = *entry.group;
+        const Group* outer = running_group();
+        running_group() = &group;
+        try {
+            entry.task();
+        }
+        catch (...) {
+            std::lock_guard<std::mutex> lock {mutex_};
+            if (!group.error_) { group.error_ = std::current_exception(); }
+        }
+        running_group() = outer;
+        entry.task = nullptr;
+
+        // Waiters check the counters under the mutex, so they cannot miss the notification
+        bool group_done = group.unfinished_.fetch_sub(1) == 1;
+        bool pool_done = unfinished_.fetch_sub(1) == 1;
+        if (group_done || pool_done) {
+            std::lock_guard<std::mutex> lock {mutex_};
+            cond_.notify_all();
+        }
+    }
+
+    void run_worker(size_t index)
+    {
+        current_worker() = WorkerId {this, index};
+        Entry entry;
+        while (true) {
+            if (take(index, entry)) {
+                run(entry);
+                continue;
+            }
+            std::unique_lock<std::mutex> lock {mutex_};
+            cond_.wait(lock, [this] { return stopped_ || queued_.load() > 0; });
+            if (stopped_) { return; }
+        }
+    }
+
+    /// Runs tasks until the tasks of all groups are finished
+    void wait_all()
+    {
+        size_t first = worker_index();
+        if (first >= queues_.size()) { first = 0; }
+
+        Entry entry;
+        while (unfinished_.load() > 0) {
+            if (take(first, entry)) {
+                run(entry);
+                continue;
+            }
+            std::unique_lock<std::mutex> lock {mutex_};
+            cond_.wait(lock, [this] { return unfinished_.load() == 0 || queued_.load() > 0; });
+        }
+    }
+};
+
+} // namespace foster
+
+#endif
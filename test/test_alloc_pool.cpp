@@ -0,0 +1,201 @@
+/*
+ * MIT License
+ *
+ * Copyright (c) 2016 Caetano Sauer
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy of this software and
+ * associated documentation files (the "Software"), to deal in the Software without restriction,
+ * including without limitation the rights to use, copy, modify, merge, publish, distribute,
+ * sublicense, and/or sell copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all copies or
+ * substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR IMPLIED, INCLUDING BUT
+ * NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM,
+ * DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+#include <gtest/gtest.h>
+#include <algorithm>
+#include <cstdint>
+#include <set>
+#include <thread>
+#include <vector>
+
+#include "alloc_pool.h"
+#include "alloc_hugepage.h"
+
+struct alignas(8) Object {
+    char data[200];
+};
+
+using Pool = foster::PoolAllocator<Object, 64 * 1024, 64>;
+
+TEST(TestPoolAllocator, AlignmentAndReuse)
+{
+    Pool pool;
+    std::vector<Object*> objects;
+    for (int i = 0; i < 1000; i++) {
+        Object* o = pool.allocate(1);
+        EXPECT_EQ(0u, reinterpret_cast<uintptr_t>(o) % 64);
+        o->data[0] = static_cast<char>(i);
+        objects.push_back(o);
+    }
+
+    // No two objects overlap
+    std::sort(objects.begin(), objects.end());
+    for (size_t i = 1; i < objects.size(); i++) {
+        EXPECT_GE(reinterpret_cast<char*>(objects[i]) - reinterpret_cast<char*>(objects[i-1]),
+                static_cast<std::ptrdiff_t>(Pool::BlockSize));
+    }
+
+    size_t chunks = pool.chunk_count();
+    EXPECT_EQ(1000 / (64 * 1024 / Pool::BlockSize) + 1, chunks);
+
+    // Freed blocks are reused without allocating new chunks
+    for (int r = 0; r < 10; r++) {
+        for (auto o : objects) { pool.deallocate(o, 1); }
+        for (auto& o : objects) { o = pool.allocate(1); }
+    }
+    EXPECT_EQ(chunks, pool.chunk_count());
+    for (auto o : objects) { pool.deallocate(o, 1); }
+}
+
+TEST(TestPoolAllocator, SharedBetweenCopies)
+{
+    Pool pool;
+    Pool copy = pool;
+    Object* o = copy.allocate(1);
+    EXPECT_EQ(1u, pool.chunk_count());
+    pool.deallocate(o, 1);
+    EXPECT_EQ(o, pool.allocate(1));
+}
+
+TEST(TestPoolAllocator, ManyPools)
+{
+    // More pools than thread cache slots, used alternately by the same thread
+    std::vector<Pool> pools(40);
+    std::vector<Object*> objects;
+    for (int r = 0; r < 20; r++) {
+        for (auto& p : pools) { objects.push_back(p.allocate(1)); }
+    }
+    for (size_t i = 0; i < objects.size(); i++) {
+        pools[i % pools.size()].deallocate(objects[i], 1);
+    }
+    for (auto& p : pools) {
+        p.deallocate(p.allocate(1), 1);
+        EXPECT_EQ(1u, p.chunk_count());
+    }
+}
+
+TEST(TestPoolAllocator, ConcurrentAllocations)
+{
+    Pool pool;
+    const int num_threads = 4;
+    const int count = 5000;
+    std::vector<std::vector<Object*>> allocated(num_threads);
+
+    // Each thread frees the objects allocated by the previous one, so blocks migrate across threads
+    auto f = [&pool, &allocated, count] (int t) {
+        for (int i = 0; i < count; i++) {
+            Object* o = pool.allocate(1);
+            std::fill(o->data, o->data + sizeof(o->data), static_cast<char>(t));
+            allocated[t].push_back(o);
+        }
+        for (auto o : allocated[t]) {
+            ASSERT_TRUE(std::all_of(o->data, o->data + sizeof(o->data),
+                        [t] (char c) { return c == static_cast<char>(t); }));
+        }
+    };
+
+    std::vector<std::thread> threads;
+    for (int t = 0; t < num_threads; t++) { threads.emplace_back(f, t); }
+    for (auto& t : threads) { t.join(); }
+
+    std::set<Object*> unique;
+    for (auto& v : allocated) {
+        unique.insert(v.begin(), v.end());
+    }
+    EXPECT_EQ(static_cast<size_t>(num_threads * count), unique.size());
+
+    threads.clear();
+    for (int t = 0; t < num_threads; t++) {
+        threads.emplace_back([&pool, &allocated, t, num_threads] {
+            for (auto o : allocated[(t + 1) % num_threads]) { pool.deallocate(o, 1); }
+        });
+    }
+    for (auto& t : threads) { t.join(); }
+}
+
+TEST(TestPoolAllocator, HugePageChunks)
+{
+    using Chunks = foster::HugePageChunks<2 * 1024 * 1024, foster::NumaPlacement::Interleave>;
+    using HugePool = foster::PoolAllocator<Object, 2 * 1024 * 1024, 64, Chunks>;
+    size_t mapped = Chunks::hugetlb_chunks() + Chunks::transparent_chunks();
+
+    // Chunks are page-aligned, so that each one fills a huge page exactly
+    HugePool pool;
+    const size_t per_chunk = 2 * 1024 * 1024 / HugePool::BlockSize;
+    std::vector<Object*> objects;
+    for (size_t i = 0; i < 2 * per_chunk + 1; i++) {
+        Object* o = pool.allocate(1);
+        EXPECT_EQ(0u, reinterpret_cast<uintptr_t>(o) % 64);
+        o->data[0] = static_cast<char>(i);
+        objects.push_back(o);
+    }
+    EXPECT_EQ(3u, pool.chunk_count());
+    EXPECT_EQ(mapped + 3, Chunks::hugetlb_chunks() + Chunks::transparent_chunks());
+    Object* first = *std::min_element(objects.begin(), objects.begin() + per_chunk);
+    EXPECT_EQ(0u, reinterpret_cast<uintptr_t>(first) % (2 * 1024 * 1024));
+
+    for (size_t i = 0; i < objects.size(); i++) {
+        EXPECT_EQ(static_cast<char>(i), objects[i]->data[0]);
+        pool.deallocate(objects[i], 1);
+    }
+}
+
+TEST(TestPoolAllocator, LocalHugePageChunks)
+{
+    // One free list per NUMA node, which is node zero on machines without NUMA support
+    using Chunks = foster::HugePageChunks<2 * 1024 * 1024, foster::NumaPlacement::Local>;
+    using HugePool = foster::PoolAllocator<Object, 2 * 1024 * 1024, 64, Chunks>;
+    HugePool pool;
+    const int num_threads = 4;
+    const int count = 5000;
+    std::vector<std::vector<Object*>> allocated(num_threads);
+
+    std::vector<std::thread> threads;
+    for (int t = 0; t < num_threads; t++) {
+        threads.emplace_back([&pool, &allocated, t, count] {
+            for (int i = 0; i < count; i++) {
+                Object* o = pool.allocate(1);
+                std::fill(o->data, o->data + sizeof(o->data), static_cast<char>(t));
+                allocated[t].push_back(o);
+            }
+        });
+    }
+    for (auto& t : threads) { t.join(); }
+
+    std::set<Object*> unique;
+    for (int t = 0; t < num_threads; t++) {
+        for (auto o : allocated[t]) {
+            ASSERT_TRUE(std::all_of(o->data, o->data + sizeof(o->data),
+                        [t] (char c) { return c == static_cast<char>(t); }));
+            unique.insert(o);
+        }
+    }
+    EXPECT_EQ(static_cast<size_t>(num_threads * count), unique.size());
+    for (auto& v : allocated) {
+        for (auto o : v) { pool.deallocate(o, 1); }
+    }
+}
+
+int main(int argc, char **argv)
+{
+    ::testing::InitGoogleTest(&argc, argv);
+    return RUN_ALL_TESTS();
+}
@@ -0,0 +1,264 @@
+/*
+ * MIT License
+ *
+ * Copyright (c) 2016 Caetano Sauer
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy of this software and
+ * associated documentation files (the "Software"), to deal in the Software without restriction,
+ * including without limitation the rights to use, copy, modify, merge, publish, distribute,
+ * sublicense, and/or sell copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all copies or
+ * substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR IMPLIED, INCLUDING BUT
+ * NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM,
+ * DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+#define ENABLE_TESTING
+
+#include <gtest/gtest.h>
+#include <cstring>
+#include <algorithm>
+#include <memory>
+#include <thread>
+#include <vector>
+
+#include "slot_array.h"
+#include "encoding.h"
+#include "search.h"
+#include "kv_array.h"
+#include "node.h"
+#include "node_mgr.h"
+#include "pointers.h"
+#include "btree_level.h"
+#include "btree_dynamic.h"
+#include "btree_adoption.h"
+#include "latch_optimistic.h"
+#include "latch_mutex.h"
+
+constexpr size_t DftArrayBytes = 4096;
+constexpr size_t DftAlignment = 8;
+
+template<class PMNK_Type>
+using SArray = foster::SlotArray<PMNK_Type, DftArrayBytes, DftAlignment>;
+
+template<class K, class V>
+using KVArray = foster::KeyValueArray<K, V,
+      SArray<uint16_t>,
+      foster::BinarySearch<SArray<uint16_t>>,
+      foster::DefaultEncoder<K, V, uint16_t>
+>;
+
+template<class K, class V>
+using KVArrayNoPMNK = foster::KeyValueArray<K, V,
+      SArray<K>,
+      foster::BinarySearch<SArray<K>>,
+      foster::DefaultEncoder<K, V, K>
+>;
+
+template<class K, class V>
+using BTNode = foster::BtreeNode<K, V,
+    KVArray,
+    foster::PlainPtr,
+    unsigned
+>;
+
+template<class K, class V>
+using BTNodeNoPMNK = foster::BtreeNode<K, V,
+    KVArrayNoPMNK,
+    foster::PlainPtr,
+    unsigned
+>;
+
+template<class K, class V>
+using BTNodeMutex = foster::BtreeNode<K, V,
+    KVArrayNoPMNK,
+    foster::PlainPtr,
+    unsigned,
+    foster::MutexLatch
+>;
+
+template<class K, class V>
+using BTNodeOptimistic = foster::BtreeNode<K, V,
+    KVArrayNoPMNK,
+    foster::PlainPtr,
+    unsigned,
+    foster::OptimisticLatch
+>;
+
+template<class Node>
+using NodeMgr = foster::BtreeNodeManager<Node, foster::AtomicCounterIdGenerator<unsigned>>;
+
+template<class K, class V, unsigned L>
+using BTLevel = foster::BtreeLevel<
+    K, V, L,
+    BTNode,
+    foster::EagerAdoption,
+    NodeMgr
+>;
+
+template<class K, class V, unsigned L>
+using BTLevelNoPMNK = foster::BtreeLevel<
+    K, V, L,
+    BTNodeNoPMNK,
+    foster::EagerAdoption,
+    NodeMgr
+>;
+
+template<class K, class V, unsigned L>
+using BTLevelMutex = foster::BtreeLevel<
+    K, V, L,
+    BTNodeMutex,
+    foster::EagerAdoption,
+    NodeMgr
+>;
+
+template<class K, class V, unsigned L>
+using BTLevelOptimistic = foster::BtreeLevel<
+    K, V, L,
+    BTNodeOptimistic,
+    foster::EagerAdoption,
+    NodeMgr
+>;
+
+template<class K, class V, unsigned L>
+using DBtree = foster::DynamicBtree<K, V, L, BTLevel>;
+
+template<class K, class V, unsigned L>
+using DBtreeNoPMNK = foster::DynamicBtree<K, V, L, BTLevelNoPMNK>;
+
+template<class K, class V, unsigned L>
+using DBtreeMutex = foster::DynamicBtree<K, V, L, BTLevelMutex>;
+
+template<class K, class V, unsigned L>
+using DBtreeOptimistic = foster::DynamicBtree<K, V, L, BTLevelOptimistic>;
+
+template<class Tree>
+void concurrent_insertions(Tree& tree, int num_threads, int count)
+{
+    auto f = [&tree,count,num_threads] (int thread) {
+        for (int i = 0; i < count; i++) {
+            int k = i * num_threads + thread;
+            tree.put(k, k);
+            int v;
+            ASSERT_TRUE(tree.get(k, v));
+            ASSERT_EQ(k, v);
+        }
+    };
+
+    std::vector<std::thread> threads;
+    for (int i = 0; i < num_threads; i++) { threads.emplace_back(f, i); }
+    for (auto& t : threads) { t.join(); }
+
+    for (int k = 0; k < count * num_threads; k++) {
+        int v;
+        ASSERT_TRUE(tree.get(k, v));
+        ASSERT_EQ(k, v);
+    }
+}
+
+TEST(DynamicHeightTest, SmallTree)
+{
+    DBtree<string, string, 4> tree;
+    EXPECT_EQ(0u, tree.height());
+
+    tree.put("key", "value");
+    tree.put("key2", "value_2");
+    tree.put("key0", "value__0");
+
+    // A few records fit into the root leaf, so no branch level is required
+    EXPECT_EQ(0u, tree.height());
+
+    string v;
+    ASSERT_TRUE(tree.get("key0", v));
+    ASSERT_EQ("value__0", v);
+    ASSERT_TRUE(tree.remove("key"));
+    ASSERT_FALSE(tree.get("key", v));
+}
+
+TEST(DynamicHeightTest, GrowingTree)
+{
+    DBtree<string, string, 4> tree;
+    int max = 100000;
+    unsigned height = 0;
+
+    for (int i = 0; i < max; i++) {
+        tree.put("key" + std::to_string(i), "value" + std::to_string(i));
+        // Height never decreases
+        ASSERT_GE(tree.height(), height);
+        height = tree.height();
+    }
+    EXPECT_GE(height, 2u);
+    EXPECT_LE(height, 4u);
+
+    for (int i = 0; i < max; i++) {
+        string expected = "value" + std::to_string(i);
+        string delivered;
+        ASSERT_TRUE(tree.get("key" + std::to_string(i), delivered));
+        ASSERT_EQ(expected, delivered);
+    }
+}
+
+TEST(DynamicHeightTest, MaximumHeight)
+{
+    // Root grows a foster chain once the maximum height is reached
+    DBtreeNoPMNK<int, int, 1> tree;
+    int max = 100000;
+    for (int i = 0; i < max; i++) { tree.put((i * 7919) % max, i); }
+    EXPECT_EQ(1u, tree.height());
+
+    for (int i = 0; i < max; i++) {
+        int v;
+        ASSERT_TRUE(tree.get((i * 7919) % max, v));
+        ASSERT_EQ(i, v);
+    }
+}
+
+TEST(DynamicHeightTest, ScanAndRemove)
+{
+    DBtreeNoPMNK<int, int, 3> tree;
+    int max = 50000;
+    for (int i = 0; i < max; i++) { tree.put((i * 7919) % max, i); }
+
+    auto cursor = tree.scan(100, max - 100);
+    int k, v, expected = 100;
+    while (cursor.next(&k, &v)) {
+        ASSERT_EQ(expected, k);
+        expected++;
+    }
+    EXPECT_EQ(max - 100, expected);
+    cursor.close();
+
+    // Removals cause merges along the way
+    for (int k = 0; k < max; k++) {
+        if (k % 10 != 0) { ASSERT_TRUE(tree.remove(k)); }
+    }
+    for (int k = 0; k < max; k++) {
+        ASSERT_EQ(k % 10 == 0, tree.get(k, v));
+    }
+}
+
+TEST(DynamicHeightTest, ConcurrentInsertions)
+{
+    DBtreeMutex<int, int, 4> tree;
+    concurrent_insertions(tree, 4, 1000);
+    EXPECT_GE(tree.height(), 1u);
+}
+
+TEST(DynamicHeightTest, OptimisticConcurrentInsertions)
+{
+    DBtreeOptimistic<int, int, 4> tree;
+    concurrent_insertions(tree, 4, 20000);
+    EXPECT_GE(tree.height(), 2u);
+}
+
+int main(int argc, char **argv)
+{
+    ::testing::InitGoogleTest(&argc, argv);
+    return RUN_ALL_TESTS();
+}
@@ -22,18 +22,39 @@
 #define ENABLE_TESTING
 
 #include <gtest/gtest.h>
+#include <cstdio>
 #include <cstring>
+#include <algorithm>
+#include <chrono>
+#include <fstream>
+#include <iterator>
+#include <map>
+#include <memory>
+#include <sstream>
+#include <thread>
+#include <vector>
 
 #include "slot_array.h"
 #include "encoding.h"
 #include "search.h"
 #include "kv_array.h"
+#include "kv_array_inline.h"
+#include "kv_array_delta.h"
+#include "kv_array_buffered.h"
 #include "node.h"
 #include "node_mgr.h"
 #include "pointers.h"
 #include "btree_level.h"
 #include "btree_static.h"
 #include "btree_adoption.h"
+#include "latch_optimistic.h"
+#include "latch_bravo.h"
+#include "alloc_pool.h"
+#include "alloc_hugepage.h"
+#include "buffer_pool.h"
+#include "hash_index.h"
+#include "statistics.h"
+#include "task_pool.h"
 
 constexpr size_t DftArrayBytes = 4096;
 constexpr size_t DftAlignment = 8;
@@ -55,6 +76,28 @@ using KVArrayNoPMNK = foster::KeyValueArray<K, V,
       foster::DefaultEncoder<K, V, K>
 >;
 
+template<class K, class V>
+using KVArrayInline = foster::SelectKeyValueArray<K, V, KVArrayNoPMNK, DftArrayBytes>;
+
+using TestBlobs = foster::BlobAllocator<64, 4096, 256 * 1024>;
+
+template<class K, class V>
+using KVArrayOverflow = foster::KeyValueArray<K, V,
+      SArray<uint16_t>,
+      foster::BinarySearch<SArray<uint16_t>>,
+      foster::OverflowDefaultEncoder<K, V, uint16_t, 256, TestBlobs>
+>;
+
+template<class K, class V>
+using KVArrayDelta = foster::DeltaKeyValueArray<K, V, DftArrayBytes>;
+
+template<class K, class V>
+using KVArrayInsertBuf = foster::BufferedKeyValueArray<K, V,
+      SArray<K>,
+      foster::BinarySearch<SArray<K>>,
+      foster::DefaultEncoder<K, V, K>
+>;
+
 template<class K, class V>
 using BTNode = foster::BtreeNode<K, V,
     KVArray,
@@ -69,9 +112,71 @@ using BTNodeNoPMNK = foster::BtreeNode<K, V,
     unsigned
 >;
 
+template<class K, class V>
+using BTNodeOptimistic = foster::BtreeNode<K, V,
+    KVArrayNoPMNK,
+    foster::PlainPtr,
+    unsigned,
+    foster::OptimisticLatch
+>;
+
+template<class K, class V>
+using BTNodeBravo = foster::BtreeNode<K, V,
+    KVArrayNoPMNK,
+    foster::PlainPtr,
+    unsigned,
+    foster::BravoLatch
+>;
+
+template<class K, class V>
+using BTNodeInline = foster::BtreeNode<K, V,
+    KVArrayInline,
+    foster::PlainPtr,
+    unsigned,
+    foster::OptimisticLatch
+>;
+
+template<class K, class V>
+using BTNodeOverflow = foster::BtreeNode<K, V,
+    KVArrayOverflow,
+    foster::PlainPtr,
+    unsigned
+>;
+
+template<class K, class V>
+using BTNodeDelta = foster::BtreeNode<K, V,
+    KVArrayDelta,
+    foster::PlainPtr,
+    unsigned,
+    foster::OptimisticLatch
+>;
+
+template<class K, class V>
+using BTNodeInsertBuf = foster::BtreeNode<K, V,
+    KVArrayInsertBuf,
+    foster::PlainPtr,
+    unsigned,
+    foster::BravoLatch
+>;
+
+template<class K, class V>
+using BTNodeSwizzling = foster::BtreeNode<K, V,
+    KVArrayNoPMNK,
+    foster::SwizzlingPtr,
+    unsigned,
+    foster::OptimisticLatch
+>;
+
 template<class Node>
 using NodeMgr = foster::BtreeNodeManager<Node, foster::AtomicCounterIdGenerator<unsigned>>;
 
+template<class Node>
+using BufferedNodeMgr = foster::BufferedNodeManager<Node, foster::AtomicCounterIdGenerator<unsigned>>;
+
+template<class Node>
+using PooledNodeMgr = foster::BtreeNodeManager<Node, foster::AtomicCounterIdGenerator<unsigned>,
+      foster::PoolAllocator<Node>>;
+
 template<class K, class V, unsigned L>
 using BTLevel = foster::BtreeLevel<
     K, V, L,
@@ -88,12 +193,209 @@ using BTLevelNoPMNK = foster::BtreeLevel<
     NodeMgr
 >;
 
+template<class K, class V, unsigned L>
+using BTLevelOptimistic = foster::BtreeLevel<
+    K, V, L,
+    BTNodeOptimistic,
+    foster::EagerAdoption,
+    NodeMgr
+>;
+
+template<class K, class V, unsigned L>
+using BTLevelBravo = foster::BtreeLevel<
+    K, V, L,
+    BTNodeBravo,
+    foster::EagerAdoption,
+    NodeMgr
+>;
+
+template<class K, class V, unsigned L>
+using BTLevelInline = foster::BtreeLevel<
+    K, V, L,
+    BTNodeInline,
+    foster::EagerAdoption,
+    NodeMgr
+>;
+
+template<class K, class V, unsigned L>
+using BTLevelOverflow = foster::BtreeLevel<
+    K, V, L,
+    BTNodeOverflow,
+    foster::EagerAdoption,
+    NodeMgr
+>;
+
+template<class K, class V, unsigned L>
+using BTLevelDelta = foster::BtreeLevel<
+    K, V, L,
+    BTNodeDelta,
+    foster::EagerAdoption,
+    NodeMgr
+>;
+
+template<class K, class V, unsigned L>
+using BTLevelStats = foster::BtreeLevel<
+    K, V, L,
+    BTNodeBravo,
+    foster::EagerAdoption,
+    NodeMgr,
+    foster::TreeStatistics
+>;
+
+template<class K, class LeafPointer>
+using SmallHashIndex = foster::BasicAdaptiveHashIndex<K, LeafPointer, 10, 2>;
+
+template<class K, class V, unsigned L>
+using BTLevelHashed = foster::BtreeLevel<
+    K, V, L,
+    BTNodeOptimistic,
+    foster::EagerAdoption,
+    NodeMgr,
+    foster::TreeStatistics,
+    SmallHashIndex
+>;
+
+template<class K, class V, unsigned L>
+using BTLevelInsertBuf = foster::BtreeLevel<
+    K, V, L,
+    BTNodeInsertBuf,
+    foster::EagerAdoption,
+    NodeMgr,
+    foster::TreeStatistics,
+    SmallHashIndex
+>;
+
+template<class K, class V, unsigned L>
+using BTLevelLazy = foster::BtreeLevel<
+    K, V, L,
+    BTNodeBravo,
+    foster::LazyAdoption,
+    NodeMgr,
+    foster::TreeStatistics
+>;
+
+template<class K, class V, unsigned L>
+using BTLevelLazyOptimistic = foster::BtreeLevel<
+    K, V, L,
+    BTNodeOptimistic,
+    foster::LazyAdoption,
+    NodeMgr,
+    foster::TreeStatistics
+>;
+
+template<class K, class V, unsigned L>
+using BTLevelBackground = foster::BtreeLevel<
+    K, V, L,
+    BTNodeOptimistic,
+    foster::BackgroundAdoption,
+    NodeMgr,
+    foster::TreeStatistics
+>;
+
+template<class K, class V, unsigned L>
+using BTLevelPooled = foster::BtreeLevel<
+    K, V, L,
+    BTNodeOptimistic,
+    foster::EagerAdoption,
+    PooledNodeMgr
+>;
+
+// Branch nodes are interleaved over all NUMA nodes and leaves are local to the inserting thread
+template<class Node>
+using HugePageNodeMgr = foster::BtreeNodeManager<Node, foster::AtomicCounterIdGenerator<unsigned>,
+      foster::PoolAllocator<Node, 2 * 1024 * 1024, 64, foster::HugePageChunks<2 * 1024 * 1024,
+        Node::IsBranch ? foster::NumaPlacement::Interleave : foster::NumaPlacement::Local>>>;
+
+template<class K, class V, unsigned L>
+using BTLevelHugePages = foster::BtreeLevel<
+    K, V, L,
+    BTNodeOptimistic,
+    foster::EagerAdoption,
+    HugePageNodeMgr
+>;
+
+template<class K, class V, unsigned L>
+using BTLevelBuffered = foster::BtreeLevel<
+    K, V, L,
+    BTNodeSwizzling,
+    foster::EagerAdoption,
+    BufferedNodeMgr
+>;
+
 template<class K, class V, unsigned L>
 using SBtree = foster::StaticBtree<K, V, L, BTLevel>;
 
 template<class K, class V, unsigned L>
 using SBtreeNoPMNK = foster::StaticBtree<K, V, L, BTLevelNoPMNK>;
 
+template<class K, class V, unsigned L>
+using SBtreeOptimistic = foster::StaticBtree<K, V, L, BTLevelOptimistic>;
+
+template<class K, class V, unsigned L>
+using SBtreeBravo = foster::StaticBtree<K, V, L, BTLevelBravo>;
+
+template<class K, class V, unsigned L>
+using SBtreeInline = foster::StaticBtree<K, V, L, BTLevelInline>;
+
+template<class K, class V, unsigned L>
+using SBtreeOverflow = foster::StaticBtree<K, V, L, BTLevelOverflow>;
+
+template<class K, class V, unsigned L>
+using SBtreeDelta = foster::StaticBtree<K, V, L, BTLevelDelta>;
+
+template<class K, class V, unsigned L>
+using SBtreeStats = foster::StaticBtree<K, V, L, BTLevelStats>;
+
+template<class K, class V, unsigned L>
+using SBtreeLazy = foster::StaticBtree<K, V, L, BTLevelLazy>;
+
+template<class K, class V, unsigned L>
+using SBtreeLazyOptimistic = foster::StaticBtree<K, V, L, BTLevelLazyOptimistic>;
+
+template<class K, class V, unsigned L>
+using SBtreeBackground = foster::StaticBtree<K, V, L, BTLevelBackground>;
+
+template<class K, class V, unsigned L>
+using SBtreePooled = foster::StaticBtree<K, V, L, BTLevelPooled>;
+
+template<class K, class V, unsigned L>
+using SBtreeHugePages = foster::StaticBtree<K, V, L, BTLevelHugePages>;
+
+template<class K, class V, unsigned L>
+using SBtreeBuffered = foster::StaticBtree<K, V, L, BTLevelBuffered>;
+
+template<class K, class V, unsigned L>
+using SBtreeHashed = foster::StaticBtree<K, V, L, BTLevelHashed>;
+
+template<class K, class V, unsigned L>
+using SBtreeInsertBuf = foster::StaticBtree<K, V, L, BTLevelInsertBuf>;
+
+template<class Tree>
+void concurrent_insertions(Tree& tree, int num_threads, int count)
+{
+    auto f = [&tree,count] (int thread) {
+        for (int i = 0; i < count; i++) {
+            int k = i * 16 + thread;
+            tree.put(k, k);
+            int v;
+            ASSERT_TRUE(tree.get(k, v));
+            ASSERT_EQ(k, v);
+        }
+    };
+
+    std::vector<std::thread> threads;
+    for (int i = 0; i < num_threads; i++) { threads.emplace_back(f, i); }
+    for (auto& t : threads) { t.join(); }
+
+    for (int t = 0; t < num_threads; t++) {
+        for (int i = 0; i < count; i++) {
+            int k = i * 16 + t, v;
+            ASSERT_TRUE(tree.get(k, v));
+            ASSERT_EQ(k, v);
+        }
+    }
+}
+
 
 TEST(MainTest, SimpleInsertions)
 {
@@ -132,6 +434,43 @@ TEST(MainTest, ManyInsertions)
     }
 }
 
+TEST(UpsertTest, ManyOverwrites)
+{
+    using foster::PutStatus;
+
+    SBtree<string, string, 2> tree;
+    int max = 20000;
+
+    for (int i = 0; i < max; i++) {
+        ASSERT_EQ(PutStatus::Inserted, tree.try_insert("key" + std::to_string(i), "v"));
+    }
+    ASSERT_EQ(PutStatus::KeyExists, tree.try_insert("key0", "w"));
+    ASSERT_EQ(PutStatus::KeyNotFound, tree.update("nokey", "w"));
+    ASSERT_THROW(tree.put("key1", "w"), foster::ExistentKeyException<string>);
+
+    // Values grow, so leaves must be split during updates; a retry after the exception
+    // above would deadlock if the leaf latch had been leaked
+    for (int i = 0; i < max; i++) {
+        string key = "key" + std::to_string(i);
+        if (i % 2 == 0) {
+            ASSERT_EQ(PutStatus::Updated, tree.update(key, "value" + std::to_string(i)));
+        }
+        else {
+            ASSERT_EQ(PutStatus::Updated, tree.upsert(key, "value" + std::to_string(i)));
+        }
+    }
+    for (int i = max; i < 2 * max; i++) {
+        ASSERT_EQ(PutStatus::Inserted,
+                tree.upsert("key" + std::to_string(i), "value" + std::to_string(i)));
+    }
+
+    for (int i = 0; i < 2 * max; i++) {
+        string value;
+        ASSERT_TRUE(tree.get("key" + std::to_string(i), value));
+        ASSERT_EQ("value" + std::to_string(i), value);
+    }
+}
+
 TEST(DeletionTest, ManyDeletions)
 {
     SBtree<string, string, 1> tree;
@@ -180,6 +519,1232 @@ TEST(IntegerKeyTest, ManyInsertions)
     }
 }
 
+TEST(ScanTest, IntegerRangeScan)
+{
+    SBtreeNoPMNK<int, int, 2> tree;
+    int max = 100000;
+
+    // insert only even keys, in reverse order to produce foster chains
+    for (int i = max - 2; i >= 0; i -= 2) {
+        tree.put(i, i * 10);
+    }
+
+    // full scan from lower bound
+    auto cursor = tree.lower_bound(0);
+    int k, v, expected = 0;
+    while (cursor.next(&k, &v)) {
+        ASSERT_EQ(expected, k);
+        ASSERT_EQ(expected * 10, v);
+        expected += 2;
+    }
+    EXPECT_EQ(max, expected);
+
+    // bounded scan with bounds that do not exist in the tree
+    auto range = tree.scan(1001, 50001);
+    expected = 1002;
+    while (range.next(&k, &v)) {
+        ASSERT_EQ(expected, k);
+        expected += 2;
+    }
+    EXPECT_EQ(50002, expected);
+
+    // empty ranges
+    auto empty = tree.scan(10, 10);
+    EXPECT_FALSE(empty.next(&k, &v));
+    auto beyond = tree.lower_bound(max);
+    EXPECT_FALSE(beyond.next(&k, &v));
+}
+
+TEST(ScanTest, StringRangeScan)
+{
+    SBtree<string, string, 2> tree;
+    int max = 20000;
+
+    for (int i = 0; i < max; i++) {
+        tree.put("key" + std::to_string(i), "value" + std::to_string(i));
+    }
+
+    std::vector<string> keys;
+    for (int i = 0; i < max; i++) { keys.push_back("key" + std::to_string(i)); }
+    std::sort(keys.begin(), keys.end());
+
+    auto cursor = tree.scan(keys[100], keys[15000]);
+    string k, v;
+    size_t i = 100;
+    while (cursor.next(&k, &v)) {
+        ASSERT_EQ(keys[i], k);
+        ASSERT_EQ("value" + k.substr(3), v);
+        i++;
+    }
+    EXPECT_EQ(15000, i);
+}
+
+TEST(BulkLoadTest, IntegerBulkLoad)
+{
+    SBtreeNoPMNK<int, int, 2> tree;
+    int max = 100000;
+
+    std::vector<std::pair<int, int>> input;
+    for (int i = 0; i < max; i += 2) { input.emplace_back(i, i * 10); }
+    tree.bulk_load(input.begin(), input.end(), 0.8);
+
+    for (int i = 0; i < max; i++) {
+        int delivered;
+        bool found = tree.get(i, delivered);
+        ASSERT_EQ(i % 2 == 0, found);
+        if (found) { ASSERT_EQ(i * 10, delivered); }
+    }
+
+    // tree must remain usable for regular insertions, which fill the gaps
+    for (int i = 1; i < max; i += 2) { tree.put(i, i * 10); }
+
+    auto cursor = tree.lower_bound(0);
+    int k, v, expected = 0;
+    while (cursor.next(&k, &v)) {
+        ASSERT_EQ(expected, k);
+        ASSERT_EQ(expected * 10, v);
+        expected++;
+    }
+    EXPECT_EQ(max, expected);
+}
+
+TEST(BulkLoadTest, StringBulkLoad)
+{
+    SBtree<string, string, 1> tree;
+    int max = 20000;
+
+    std::map<string, string> input;
+    for (int i = 0; i < max; i++) {
+        input["key" + std::to_string(i)] = "value" + std::to_string(i);
+    }
+    tree.bulk_load(input.begin(), input.end(), 1.0);
+
+    for (int i = 0; i < max; i++) {
+        string delivered;
+        bool found = tree.get("key" + std::to_string(i), delivered);
+        ASSERT_TRUE(found);
+        ASSERT_EQ("value" + std::to_string(i), delivered);
+    }
+
+    auto cursor = tree.lower_bound("");
+    string k, v;
+    auto it = input.begin();
+    while (cursor.next(&k, &v)) {
+        ASSERT_EQ(it->first, k);
+        ++it;
+    }
+    EXPECT_TRUE(it == input.end());
+}
+
+TEST(BulkLoadTest, ParallelBulkLoadAndScan)
+{
+    SBtreeNoPMNK<int, int, 2> tree;
+    foster::TaskPool pool {4};
+    int max = 300000;
+
+    std::vector<std::pair<int, int>> input;
+    for (int i = 0; i < max; i += 2) { input.emplace_back(i, i * 10); }
+    tree.parallel_bulk_load(pool, input.begin(), input.end(), 0.8);
+
+    for (int i = 0; i < max; i++) {
+        int delivered;
+        bool found = tree.get(i, delivered);
+        ASSERT_EQ(i % 2 == 0, found);
+        if (found) { ASSERT_EQ(i * 10, delivered); }
+    }
+
+    // Each range is scanned in order, and ranges cover the keys in order without overlaps
+    const size_t max_ranges = 16;
+    std::vector<int> first(max_ranges), last(max_ranges), count(max_ranges, 0);
+    size_t ranges = tree.parallel_scan(pool, max_ranges,
+            [&] (size_t range, SBtreeNoPMNK<int, int, 2>::Cursor& cursor) {
+                int k, v;
+                while (cursor.next(&k, &v)) {
+                    EXPECT_EQ(k * 10, v);
+                    if (count[range]++ == 0) { first[range] = k; }
+                    else { EXPECT_EQ(last[range] + 2, k); }
+                    last[range] = k;
+                }
+            });
+    EXPECT_GT(ranges, 1u);
+    EXPECT_LE(ranges, max_ranges);
+
+    int total = 0;
+    for (size_t r = 0; r < ranges; r++) {
+        ASSERT_GT(count[r], 0);
+        if (r > 0) { EXPECT_EQ(last[r - 1] + 2, first[r]); }
+        total += count[r];
+    }
+    EXPECT_EQ(0, first[0]);
+    EXPECT_EQ(max / 2, total);
+
+    // Tree remains usable for regular insertions, which fill the gaps
+    for (int i = 1; i < max; i += 2) { tree.put(i, i * 10); }
+    auto cursor = tree.lower_bound(0);
+    int k, v, expected = 0;
+    while (cursor.next(&k, &v)) {
+        ASSERT_EQ(expected, k);
+        expected++;
+    }
+    EXPECT_EQ(max, expected);
+}
+
+TEST(BulkLoadTest, ParallelStringBulkLoad)
+{
+    SBtree<string, string, 1> tree;
+    foster::TaskPool pool {3};
+    int max = 60000;
+
+    // Partition boundaries fall between long keys with common prefixes
+    std::map<string, string> input;
+    for (int i = 0; i < max; i++) {
+        input["key_with_a_common_prefix_" + std::to_string(i)] = "value" + std::to_string(i);
+    }
+    std::vector<std::pair<string, string>> sorted {input.begin(), input.end()};
+    tree.parallel_bulk_load(pool, sorted.begin(), sorted.end(), 1.0);
+
+    for (int i = 0; i < max; i++) {
+        string delivered;
+        bool found = tree.get("key_with_a_common_prefix_" + std::to_string(i), delivered);
+        ASSERT_TRUE(found);
+        ASSERT_EQ("value" + std::to_string(i), delivered);
+    }
+
+    auto cursor = tree.lower_bound("");
+    string k, v;
+    auto it = input.begin();
+    while (cursor.next(&k, &v)) {
+        ASSERT_EQ(it->first, k);
+        ++it;
+    }
+    EXPECT_TRUE(it == input.end());
+}
+
+TEST(OptimisticLatchTest, ManyInsertions)
+{
+    SBtreeOptimistic<int, int, 2> tree;
+    int max = 100000;
+
+    for (int i = 0; i < max; i++) {
+        tree.put(i, i);
+    }
+
+    for (int i = 0; i < max; i++) {
+        int delivered;
+        bool found = tree.get(i, delivered);
+        ASSERT_TRUE(found);
+        ASSERT_EQ(i, delivered);
+    }
+
+    auto cursor = tree.scan(100, max - 100);
+    int k, v, expected = 100;
+    while (cursor.next(&k, &v)) {
+        ASSERT_EQ(expected, k);
+        expected++;
+    }
+    EXPECT_EQ(max - 100, expected);
+}
+
+TEST(OptimisticLatchTest, ConcurrentInsertions)
+{
+    SBtreeOptimistic<int, int, 2> tree;
+    concurrent_insertions(tree, 4, 20000);
+}
+
+TEST(BravoLatchTest, UpgradeContract)
+{
+    foster::BravoLatch latch;
+    EXPECT_TRUE(latch.is_read_biased());
+
+    // Sole reader (on the fast path) may upgrade, and downgrading yields a shared latch again
+    latch.acquire_read();
+    EXPECT_TRUE(latch.has_reader());
+    EXPECT_TRUE(latch.attempt_upgrade());
+    EXPECT_TRUE(latch.has_writer());
+    EXPECT_FALSE(latch.has_reader());
+    latch.downgrade();
+    EXPECT_FALSE(latch.has_writer());
+    EXPECT_TRUE(latch.has_reader());
+    EXPECT_FALSE(latch.attempt_write());
+
+    // Upgrade of the slow-path reader left by the downgrade
+    EXPECT_TRUE(latch.attempt_upgrade());
+    latch.release_write();
+    EXPECT_FALSE(latch.has_reader());
+    EXPECT_FALSE(latch.has_writer());
+
+    // Upgrade fails while another thread holds a shared latch
+    latch.acquire_read();
+    bool upgraded = true;
+    std::thread other{[&latch, &upgraded] {
+        latch.acquire_read();
+        upgraded = latch.attempt_upgrade();
+        latch.release_read();
+    }};
+    other.join();
+    EXPECT_FALSE(upgraded);
+    EXPECT_TRUE(latch.attempt_upgrade());
+    latch.release_write();
+
+    // Writers revoke the reader bias, which is restored by readers later
+    latch.acquire_write();
+    EXPECT_FALSE(latch.is_read_biased());
+    EXPECT_FALSE(latch.attempt_read());
+    latch.release_write();
+    EXPECT_TRUE(latch.attempt_read());
+    latch.release_read();
+}
+
+TEST(BravoLatchTest, ConcurrentInsertions)
+{
+    SBtreeBravo<int, int, 2> tree;
+    concurrent_insertions(tree, 8, 20000);
+}
+
+TEST(StatisticsTest, HotPathEvents)
+{
+    using foster::Counter;
+    using foster::Histogram;
+
+    SBtreeStats<int, int, 2> tree;
+    const int threads = 4, count = 20000;
+    concurrent_insertions(tree, threads, count);
+
+    foster::StatisticsSnapshot stats = tree.statistics();
+    // Each thread performs two lookups per key, and insertions traverse on leaf hint misses
+    EXPECT_GE(stats[Counter::Traversals], uint64_t(2 * threads * count));
+    EXPECT_GT(stats[Counter::LeafSplits], 0u);
+    EXPECT_GT(stats[Counter::Adoptions], 0u);
+    EXPECT_LE(stats[Counter::Adoptions], stats[Counter::LeafSplits] + stats[Counter::BranchSplits]);
+
+    // Every traversal latches at least the root and a leaf
+    const foster::HistogramData& reads = stats[Histogram::ReadLatchWait];
+    const foster::HistogramData& writes = stats[Histogram::WriteLatchWait];
+    EXPECT_GE(reads.count() + writes.count(), 2 * stats[Counter::Traversals]);
+    EXPECT_LE(reads.percentile(0.5), reads.percentile(0.99));
+    EXPECT_LE(reads.percentile(0.99), reads.percentile(1.0));
+    EXPECT_GE(stats[Counter::FosterHops], stats[Histogram::FosterChainLength].sum);
+
+    std::stringstream ss;
+    stats.print(ss);
+    EXPECT_NE(std::string::npos, ss.str().find("leaf_splits"));
+
+    tree.reset_statistics();
+    int v;
+    ASSERT_TRUE(tree.get(16, v));
+    stats = tree.statistics();
+    EXPECT_EQ(1u, stats[Counter::Traversals]);
+    EXPECT_EQ(0u, stats[Counter::LeafSplits]);
+    // Root, branch, and leaf node (plus any foster children on the way)
+    EXPECT_GE(stats[Histogram::ReadLatchWait].count(), 3u);
+
+    // Default policy collects nothing
+    SBtreeOptimistic<int, int, 2> plain;
+    plain.put(1, 1);
+    EXPECT_EQ(0u, plain.statistics()[Counter::Traversals]);
+}
+
+TEST(StatisticsTest, StandaloneLevel)
+{
+    // A level constructed without a statistics object collects into its own
+    BTLevelStats<int, int, 2> level;
+    auto root = level.construct_recursively();
+    auto leaf = level.traverse(root, 42, true /* for_update */);
+    EXPECT_TRUE(leaf->insert(42, 1));
+    leaf->release_write();
+
+    leaf = level.traverse(root, 42, false /* for_update */);
+    int value;
+    EXPECT_TRUE(leaf->find(42, &value));
+    EXPECT_EQ(1, value);
+    leaf->release_read();
+    level.destroy_recursively(root);
+}
+
+TEST(PoolAllocatorTest, ManyInsertions)
+{
+    // Trees are constructed and destroyed repeatedly, so that nodes are returned to the pools
+    for (int r = 0; r < 3; r++) {
+        SBtreePooled<int, int, 2> tree;
+        int max = 50000;
+        for (int i = 0; i < max; i++) { tree.put((i * 7919) % max, i); }
+        for (int i = 0; i < max; i++) {
+            int v;
+            ASSERT_TRUE(tree.get((i * 7919) % max, v));
+            ASSERT_EQ(i, v);
+        }
+    }
+
+    SBtreePooled<int, int, 2> tree;
+    concurrent_insertions(tree, 4, 20000);
+}
+
+TEST(PoolAllocatorTest, HugePageNodes)
+{
+    using Chunks = foster::HugePageChunks<2 * 1024 * 1024, foster::NumaPlacement::Local>;
+    size_t chunks = Chunks::hugetlb_chunks() + Chunks::transparent_chunks();
+    {
+        SBtreeHugePages<int, int, 2> tree;
+        int max = 50000;
+        for (int i = 0; i < max; i++) { tree.put((i * 7919) % max, i); }
+        for (int i = 0; i < max; i++) {
+            int v;
+            ASSERT_TRUE(tree.get((i * 7919) % max, v));
+            ASSERT_EQ(i, v);
+        }
+    }
+    // At least one chunk for leaves and one for each branch level, whether or not the kernel has
+    // huge pages reserved
+    EXPECT_LE(chunks + 3, Chunks::hugetlb_chunks() + Chunks::transparent_chunks());
+
+    SBtreeHugePages<int, int, 2> tree;
+    concurrent_insertions(tree, 4, 20000);
+}
+
+template<class Tree, class K>
+void check_multi_get(Tree& tree, const std::vector<K>& keys, const std::map<K, K>& expected)
+{
+    const size_t batch = 200;
+    for (size_t b = 0; b < keys.size(); b += batch) {
+        size_t n = std::min(batch, keys.size() - b);
+        std::vector<K> values(n);
+        std::unique_ptr<bool[]> found(new bool[n]);
+        size_t count = tree.multi_get(&keys[b], values.data(), found.get(), n);
+
+        size_t expected_count = 0;
+        for (size_t i = 0; i < n; i++) {
+            auto it = expected.find(keys[b + i]);
+            ASSERT_EQ(it != expected.end(), found[i]);
+            if (found[i]) {
+                ASSERT_EQ(it->second, values[i]);
+                expected_count++;
+            }
+        }
+        ASSERT_EQ(expected_count, count);
+    }
+}
+
+TEST(MultiGetTest, IntegerMultiGet)
+{
+    SBtreeNoPMNK<int, int, 2> tree;
+    std::map<int, int> expected;
+    std::vector<int> keys;
+    int max = 50000;
+
+    // Random order causes splits with foster children that are not adopted yet
+    for (int i = 0; i < max; i++) {
+        int k = ((i * 7919) % max) * 2;
+        tree.put(k, k + 1);
+        expected[k] = k + 1;
+    }
+    for (int i = -10; i < 2 * max + 10; i++) { keys.push_back(i); }
+    check_multi_get(tree, keys, expected);
+
+    // Unsorted batch with repeated keys
+    std::reverse(keys.begin(), keys.end());
+    for (int i = 0; i < 1000; i++) { keys[i] = 42; }
+    check_multi_get(tree, keys, expected);
+}
+
+TEST(MultiGetTest, StringMultiGet)
+{
+    SBtree<string, string, 3> tree;
+    std::map<string, string> expected;
+    std::vector<string> keys;
+
+    for (int i = 0; i < 10000; i++) {
+        string k = "key_" + std::to_string((i * 7919) % 20000);
+        tree.put(k, k);
+        expected[k] = k;
+    }
+    for (int i = 0; i < 20000; i++) { keys.push_back("key_" + std::to_string(i)); }
+    check_multi_get(tree, keys, expected);
+}
+
+TEST(MultiGetTest, ConcurrentMultiGet)
+{
+    SBtreeOptimistic<int, int, 2> tree;
+    std::map<int, int> expected;
+    std::vector<int> keys;
+    for (int i = 0; i < 20000; i++) {
+        tree.put(i * 2, i);
+        expected[i * 2] = i;
+        keys.push_back(i * 2);
+    }
+
+    // Odd keys are inserted concurrently, causing splits of the leaves being looked up
+    std::thread writer([&tree] {
+        for (int i = 0; i < 20000; i++) { tree.put(i * 2 + 1, i); }
+    });
+    for (int r = 0; r < 5; r++) { check_multi_get(tree, keys, expected); }
+    writer.join();
+}
+
+template<class Tree>
+size_t count_leaves(Tree& tree)
+{
+    std::ostringstream out;
+    tree.print(out);
+    std::istringstream in {out.str()};
+    size_t count = 0;
+    string line;
+    while (std::getline(in, line)) {
+        if (line.find("Leaf node") != string::npos) { count++; }
+    }
+    return count;
+}
+
+TEST(MergeTest, IntegerMerge)
+{
+    SBtreeNoPMNK<int, int, 2> tree;
+    int max = 50000;
+    for (int i = 0; i < max; i++) { tree.put((i * 7919) % max, i); }
+    size_t leaves_before = count_leaves(tree);
+
+    // Delete 90% of the keys, which leaves most nodes underflown
+    for (int i = 0; i < max; i++) {
+        int k = (i * 7919) % max;
+        if (k % 10 != 0) { ASSERT_TRUE(tree.remove(k)); }
+    }
+    size_t leaves_after = count_leaves(tree);
+    EXPECT_LT(leaves_after * 4, leaves_before);
+
+    for (int k = 0; k < max; k++) {
+        int v;
+        ASSERT_EQ(k % 10 == 0, tree.get(k, v));
+    }
+
+    auto cursor = tree.scan(0, max);
+    int k, v, expected = 0;
+    while (cursor.next(&k, &v)) {
+        ASSERT_EQ(expected, k);
+        expected += 10;
+    }
+    EXPECT_EQ(max, expected);
+
+    // Merged nodes must still accept insertions
+    for (int k = 1; k < max; k += 10) { tree.put(k, k); }
+    for (int k = 0; k < max; k++) {
+        int v;
+        ASSERT_EQ(k % 10 == 0 || k % 10 == 1, tree.get(k, v));
+    }
+}
+
+TEST(InlineRecordTest, InsertionsDeletionsAndScans)
+{
+    using Leaf = BTNodeInline<int, int>;
+    static_assert(Leaf::InlineRecords && Leaf::ParentType::InlineRecords,
+            "Leaves and branches with int keys should store pairs inline");
+    static_assert(!BTNodeInline<string, int>::InlineRecords,
+            "String keys cannot be stored inline");
+
+    SBtreeInline<int, int, 2> tree;
+    int max = 100000;
+    for (int i = 0; i < max; i++) { tree.put((i * 7919) % max, i); }
+    size_t leaves_before = count_leaves(tree);
+
+    for (int i = 0; i < max; i++) {
+        int v;
+        ASSERT_TRUE(tree.get((i * 7919) % max, v));
+        ASSERT_EQ(i, v);
+    }
+    EXPECT_EQ(foster::PutStatus::Updated, tree.upsert(42, -42));
+    int v;
+    ASSERT_TRUE(tree.get(42, v));
+    EXPECT_EQ(-42, v);
+
+    // Removals shift the vectors right away and underflown nodes are merged
+    for (int k = 0; k < max; k++) {
+        if (k % 10 != 0) { ASSERT_TRUE(tree.remove(k)); }
+    }
+    EXPECT_LT(count_leaves(tree) * 4, leaves_before);
+
+    auto cursor = tree.scan(0, max);
+    int k, expected = 0;
+    while (cursor.next(&k, &v)) {
+        ASSERT_EQ(expected, k);
+        expected += 10;
+    }
+    EXPECT_EQ(max, expected);
+
+    SBtreeInline<int, int, 2> loaded;
+    std::vector<std::pair<int, int>> input;
+    for (int i = 0; i < max; i++) { input.emplace_back(i, i * 10); }
+    loaded.bulk_load(input.begin(), input.end(), 0.9);
+    for (int i = 0; i < max; i++) {
+        ASSERT_TRUE(loaded.get(i, v));
+        ASSERT_EQ(i * 10, v);
+    }
+}
+
+TEST(DeltaRecordTest, DenseAndSparseKeys)
+{
+    SBtreeDelta<int64_t, int, 2> tree;
+    SBtreeNoPMNK<int64_t, int, 2> plain;
+    int max = 100000;
+    for (int i = 0; i < max; i++) {
+        int64_t k = (int64_t(i) * 7919) % max + 5000000000;
+        tree.put(k, i);
+        plain.put(k, i);
+    }
+    // Dense keys are encoded with 1- or 2-byte deltas
+    EXPECT_LT(count_leaves(tree) * 2, count_leaves(plain));
+
+    for (int i = 0; i < max; i++) {
+        int v;
+        ASSERT_TRUE(tree.get((int64_t(i) * 7919) % max + 5000000000, v));
+        ASSERT_EQ(i, v);
+    }
+
+    // Sparse and negative keys widen the frames of the nodes they land on
+    for (int i = 1; i < 1000; i++) {
+        tree.put(-int64_t(i) * 1000000007, -i);
+        tree.put(int64_t(i) << 40, i);
+    }
+    for (int i = 1; i < 1000; i++) {
+        int v;
+        ASSERT_TRUE(tree.get(-int64_t(i) * 1000000007, v));
+        ASSERT_EQ(-i, v);
+        ASSERT_TRUE(tree.get(int64_t(i) << 40, v));
+        ASSERT_EQ(i, v);
+    }
+
+    for (int k = 0; k < max; k++) {
+        if (k % 10 != 0) { ASSERT_TRUE(tree.remove(k + 5000000000)); }
+    }
+    auto cursor = tree.scan(5000000000, 5000000000 + max);
+    int64_t k, expected = 5000000000;
+    int v;
+    while (cursor.next(&k, &v)) {
+        ASSERT_EQ(expected, k);
+        expected += 10;
+    }
+    EXPECT_EQ(5000000000 + max, expected);
+}
+
+TEST(InsertBufferTest, InsertionsScansAndRemovals)
+{
+    using foster::Counter;
+    using foster::PutStatus;
+    SBtreeInsertBuf<int, int, 3> tree;
+    int max = 100000, v;
+    for (int i = 0; i < max; i++) {
+        int k = (i * 7919) % max;
+        ASSERT_EQ(PutStatus::Inserted, tree.try_insert(2 * k, k));
+        ASSERT_TRUE(tree.get(2 * k, v));
+        ASSERT_EQ(k, v);
+        ASSERT_EQ(PutStatus::KeyExists, tree.try_insert(2 * k, -k));
+    }
+
+    // A few odd keys per leaf stay in the buffers until a scan merges them
+    for (int k = 0; k < max; k += 97) { tree.put(2 * k + 1, -k); }
+    std::vector<int> keys;
+    for (int k = 0; k < max; k++) {
+        keys.push_back(2 * k);
+        if (k % 97 == 0) { keys.push_back(2 * k + 1); }
+    }
+    auto cursor = tree.scan(0, 2 * max);
+    size_t i = 0;
+    int k;
+    while (cursor.next(&k, &v)) {
+        ASSERT_LT(i, keys.size());
+        ASSERT_EQ(keys[i], k);
+        ASSERT_EQ(k % 2 == 0 ? k / 2 : -(k / 2), v);
+        i++;
+    }
+    EXPECT_EQ(keys.size(), i);
+
+    // Removed keys are reinserted into their ghosts and existing ones are overwritten
+    for (int k = 0; k < max; k++) {
+        if (k % 3 != 0) { ASSERT_TRUE(tree.remove(2 * k)); }
+    }
+    for (int k = 0; k < max; k += 6) {
+        ASSERT_EQ(PutStatus::Inserted, tree.try_insert(2 * k + 2, -k));
+        ASSERT_EQ(PutStatus::Updated, tree.upsert(2 * k, k + 1));
+    }
+    for (int k = 0; k < max; k++) {
+        bool exists = k % 3 == 0 || k % 6 == 1;
+        ASSERT_EQ(exists, tree.get(2 * k, v));
+        if (k % 6 == 0) { ASSERT_EQ(k + 1, v); }
+        else if (k % 6 == 1) { ASSERT_EQ(-(k - 1), v); }
+        else if (exists) { ASSERT_EQ(k, v); }
+    }
+
+    // Hot keys are found in the buffer of their leaf by the hash index
+    tree.reset_statistics();
+    for (int i = 0; i < 10; i++) {
+        ASSERT_EQ(PutStatus::Inserted, tree.try_insert(2 * max + i, i));
+        for (int round = 0; round < 4; round++) {
+            ASSERT_TRUE(tree.get(2 * max + i, v));
+            ASSERT_EQ(i, v);
+        }
+    }
+    EXPECT_GT(tree.statistics()[Counter::HashIndexHits], 0u);
+
+    SBtreeInsertBuf<int, int, 2> concurrent;
+    concurrent_insertions(concurrent, 4, 20000);
+}
+
+TEST(OverflowTest, LargeValues)
+{
+    {
+        SBtreeOverflow<string, string, 3> tree;
+        SBtree<string, string, 3> plain;
+        int max = 2000;
+        for (int i = 0; i < max; i++) {
+            string value(1000, 'a' + i % 26);
+            tree.put("key" + std::to_string(i), value);
+            plain.put("key" + std::to_string(i), value);
+        }
+        // Leaves only hold references to the values
+        EXPECT_LT(count_leaves(tree) * 10, count_leaves(plain));
+        EXPECT_EQ(size_t(max), TestBlobs::blob_count());
+
+        // Values larger than a node and than the 16-bit length of inline values
+        string huge(100000, 'h');
+        tree.put("huge", huge);
+        string v;
+        ASSERT_TRUE(tree.get("huge", v));
+        EXPECT_EQ(huge, v);
+
+        // Overwritten values are released, regardless of whether the new one is stored inline
+        for (int i = 0; i < max; i += 2) {
+            string value = i % 4 == 0 ? std::to_string(i) : string(5000, 'z');
+            EXPECT_EQ(foster::PutStatus::Updated, tree.upsert("key" + std::to_string(i), value));
+        }
+        for (int i = 1; i < max; i += 4) { ASSERT_TRUE(tree.remove("key" + std::to_string(i))); }
+        for (int i = 0; i < max; i++) {
+            bool found = tree.get("key" + std::to_string(i), v);
+            ASSERT_EQ(i % 4 != 1, found);
+            if (!found) { continue; }
+            if (i % 4 == 0) { ASSERT_EQ(std::to_string(i), v); }
+            else if (i % 4 == 2) { ASSERT_EQ(string(5000, 'z'), v); }
+            else { ASSERT_EQ(string(1000, 'a' + i % 26), v); }
+        }
+        // Removed values may still be held by ghosts until they are purged
+        EXPECT_LE(size_t(max / 2 + 1), TestBlobs::blob_count());
+        EXPECT_GE(size_t(3 * max / 4 + 1), TestBlobs::blob_count());
+    }
+    EXPECT_EQ(0u, TestBlobs::blob_count());
+}
+
+template<class Tree, class K, class V>
+std::vector<std::pair<K, V>> scan_all(Tree& tree, const K& from, const K& to)
+{
+    std::vector<std::pair<K, V>> result;
+    auto cursor = tree.scan(from, to);
+    K k;
+    V v;
+    while (cursor.next(&k, &v)) { result.emplace_back(k, v); }
+    return result;
+}
+
+TEST(SnapshotTest, SaveAndLoad)
+{
+    string path = ::testing::TempDir() + "foster_snapshot_test";
+
+    SBtreeOptimistic<int, int, 2> tree;
+    int max = 100000;
+    for (int i = 0; i < max; i++) { tree.put((i * 7919) % max, i); }
+    // Removed keys leave ghosts, which are not written
+    for (int k = 3; k < max; k += 10) { tree.remove(k); }
+    tree.save(path);
+
+    SBtreeOptimistic<int, int, 2> loaded;
+    loaded.put(-1, -1);
+    loaded.load(path);
+    int v;
+    EXPECT_FALSE(loaded.get(-1, v));
+    EXPECT_EQ(count_leaves(tree), count_leaves(loaded));
+    EXPECT_TRUE((scan_all<decltype(tree), int, int>(tree, 0, max)
+                == scan_all<decltype(loaded), int, int>(loaded, 0, max)));
+
+    // The loaded tree is independent of the original one
+    for (int k = 3; k < max; k += 10) { loaded.put(k, -k); }
+    for (int k = max; k < 2 * max; k++) { loaded.put(k, k); }
+    for (int k = 0; k < 2 * max; k++) {
+        ASSERT_TRUE(loaded.get(k, v));
+        if (k % 10 == 3 && k < max) { ASSERT_EQ(-k, v); }
+    }
+    EXPECT_FALSE(tree.get(3, v));
+    EXPECT_FALSE(tree.get(max, v));
+
+    // Snapshots of a different tree type or truncated files are rejected
+    SBtreeOptimistic<int, int, 3> taller;
+    EXPECT_THROW(taller.load(path), foster::SnapshotException);
+    SBtree<string, string, 2> strings;
+    EXPECT_THROW(strings.load(path), foster::SnapshotException);
+    {
+        std::ifstream in {path, std::ios::binary};
+        string contents {std::istreambuf_iterator<char>(in), std::istreambuf_iterator<char>()};
+        std::ofstream out {path, std::ios::binary | std::ios::trunc};
+        out.write(contents.data(), contents.size() / 2);
+    }
+    EXPECT_THROW(loaded.load(path), foster::SnapshotException);
+    EXPECT_TRUE(loaded.get(max, v));
+
+    // Sections whose size in bytes overflows are rejected as well
+    auto corrupt_section = [&path] (uint64_t page_count, uint64_t page_bytes) {
+        std::fstream io {path, std::ios::binary | std::ios::in | std::ios::out};
+        foster::internal::SnapshotSection section {0, page_count, page_bytes};
+        io.seekg(sizeof(foster::internal::SnapshotHeader));
+        io.read(reinterpret_cast<char*>(&section.offset), sizeof(section.offset));
+        io.seekp(sizeof(foster::internal::SnapshotHeader));
+        io.write(reinterpret_cast<const char*>(&section), sizeof(section));
+    };
+    tree.save(path);
+    corrupt_section(uint64_t(-1) / 4096 + 1, 4096);
+    EXPECT_THROW(loaded.load(path), foster::SnapshotException);
+    tree.save(path);
+    corrupt_section(1, 0);
+    EXPECT_THROW(loaded.load(path), foster::SnapshotException);
+    EXPECT_TRUE(loaded.get(max, v));
+
+    // Variable-length keys and values
+    for (int i = 0; i < 20000; i++) {
+        strings.put("key" + std::to_string(i), "value" + std::to_string(i));
+    }
+    strings.save(path);
+    SBtree<string, string, 2> strings_loaded;
+    strings_loaded.load(path);
+    EXPECT_TRUE((scan_all<decltype(strings), string, string>(strings, "", "zzz")
+                == scan_all<decltype(strings_loaded), string, string>(strings_loaded, "", "zzz")));
+
+    std::remove(path.c_str());
+}
+
+TEST(BufferPoolTest, LazyLoadAndEviction)
+{
+    using Ptr = foster::SwizzlingPtr<int>;
+    int x = 0;
+    Ptr swizzled {&x};
+    Ptr unswizzled = Ptr::unswizzled(5, 123456789);
+    EXPECT_TRUE(swizzled.is_swizzled());
+    EXPECT_FALSE(unswizzled.is_swizzled());
+    EXPECT_EQ(5u, unswizzled.pool_id());
+    EXPECT_EQ(123456789u, unswizzled.page_id());
+    EXPECT_FALSE(Ptr{nullptr});
+
+    string path = ::testing::TempDir() + "foster_buffer_pool_test";
+    SBtreeBuffered<int, int, 2> tree;
+    int max = 100000;
+    for (int i = 0; i < max; i++) { tree.put((i * 7919) % max, i); }
+    size_t leaves = count_leaves(tree);
+    tree.save(path);
+
+    // Leaves are only read on first access
+    SBtreeBuffered<int, int, 2> loaded;
+    loaded.load(path);
+    EXPECT_EQ(0u, loaded.resident_pages());
+    int v;
+    ASSERT_TRUE(loaded.get(4242, v));
+    EXPECT_EQ(1u, loaded.resident_pages());
+    EXPECT_TRUE((scan_all<decltype(tree), int, int>(tree, 0, max)
+                == scan_all<decltype(loaded), int, int>(loaded, 0, max)));
+    EXPECT_EQ(leaves, loaded.resident_pages());
+
+    // All leaves were accessed since the last sweep, so the first one only clears their reference
+    // bits, after which only the leaf accessed again is hot
+    EXPECT_EQ(0u, loaded.evict(leaves));
+    ASSERT_TRUE(loaded.get(4242, v));
+    EXPECT_EQ(leaves - 1, loaded.evict(leaves));
+    EXPECT_EQ(1u, loaded.resident_pages());
+    ASSERT_TRUE(loaded.get(4242, v));
+    EXPECT_EQ(1u, loaded.resident_pages());
+
+    // Evicted leaves are faulted in again
+    EXPECT_EQ(0u, loaded.evict(leaves));
+    EXPECT_EQ(1u, loaded.evict(leaves));
+    for (int i = 0; i < max; i++) {
+        ASSERT_TRUE(loaded.get((i * 7919) % max, v));
+        ASSERT_EQ(i, v);
+    }
+
+    // Modified leaves are not evicted, and splits and merges release pages to the pool
+    for (int k = max; k < 2 * max; k++) { loaded.put(k, k); }
+    for (int k = 0; k < max / 2; k++) { ASSERT_TRUE(loaded.remove(k)); }
+    loaded.evict(2 * leaves);
+    loaded.evict(2 * leaves);
+    size_t dirty = loaded.resident_pages();
+    EXPECT_GT(dirty, 0u);
+    EXPECT_LT(dirty, leaves);
+    for (int k = 0; k < 2 * max; k++) { ASSERT_EQ(k >= max / 2, loaded.get(k, v)); }
+
+    // Replacing the contents releases the previous pool
+    loaded.load(path);
+    EXPECT_EQ(0u, loaded.resident_pages());
+    EXPECT_TRUE((scan_all<decltype(tree), int, int>(tree, 0, 2 * max)
+                == scan_all<decltype(loaded), int, int>(loaded, 0, 2 * max)));
+
+    std::remove(path.c_str());
+}
+
+TEST(HashIndexTest, SkewedLookups)
+{
+    using foster::Counter;
+    SBtreeHashed<int, int, 2> tree;
+    int max = 50000;
+    for (int i = 0; i < max; i++) {
+        int k = (i * 7919) % max;
+        tree.put(2 * k, k);
+    }
+
+    // After the first lookups of each hot key, the hash index answers without traversals
+    int hot = 200, v;
+    for (int round = 0; round < 10; round++) {
+        for (int k = 0; k < hot; k++) {
+            ASSERT_TRUE(tree.get(2 * k * 97, v));
+            ASSERT_EQ(k * 97, v);
+        }
+    }
+    EXPECT_GT(tree.statistics()[Counter::HashIndexHits], uint64_t(hot * 5));
+    EXPECT_FALSE(tree.get(2 * 97 + 1, v));
+
+    // Splits, merges, and removals invalidate entries, while lookups keep running
+    std::atomic<bool> done {false};
+    auto lookups = [&] {
+        int v;
+        while (!done) {
+            for (int k = 0; k < hot; k++) {
+                if (tree.get(2 * k * 97, v)) { ASSERT_EQ(k * 97, v); }
+                if (tree.get(2 * k * 97 + 1, v)) { ASSERT_EQ(-k * 97, v); }
+            }
+        }
+    };
+    std::vector<std::thread> threads;
+    for (int i = 0; i < 3; i++) { threads.emplace_back(lookups); }
+    for (int k = 0; k < max; k++) { tree.put(2 * k + 1, -k); }
+    for (int k = 0; k < max; k++) {
+        if (k % 10 != 0) {
+            ASSERT_TRUE(tree.remove(2 * k));
+            ASSERT_TRUE(tree.remove(2 * k + 1));
+        }
+    }
+    done = true;
+    for (auto& t : threads) { t.join(); }
+
+    EXPECT_GT(tree.statistics()[Counter::Merges], 0u);
+    for (int round = 0; round < 3; round++) {
+        for (int k = 0; k < hot; k++) {
+            int key = k * 97;
+            ASSERT_EQ(key % 10 == 0, tree.get(2 * key, v));
+            if (key % 10 == 0) { ASSERT_EQ(key, v); }
+            ASSERT_EQ(key % 10 == 0, tree.get(2 * key + 1, v));
+        }
+    }
+}
+
+/// Inserts increasing keys until a leaf splits, which leaves a foster child pending
+/// \returns the number of keys inserted
+template<class Tree>
+int insert_until_split(Tree& tree)
+{
+    int count = 0;
+    while (tree.statistics()[foster::Counter::LeafSplits] == 0) {
+        tree.put(count, count);
+        count++;
+    }
+    return count;
+}
+
+TEST(AdoptionTest, LazyAdoption)
+{
+    using foster::Counter;
+
+    // Eager adoption lets the first lookup adopt the foster child
+    SBtreeStats<int, int, 1> eager;
+    int count = insert_until_split(eager);
+    eager.reset_statistics();
+    int v;
+    ASSERT_TRUE(eager.get(count - 1, v));
+    EXPECT_EQ(1u, eager.statistics()[Counter::Adoptions]);
+
+    // Lazy adoption leaves it to the next insertion
+    SBtreeLazy<int, int, 1> tree;
+    count = insert_until_split(tree);
+    tree.reset_statistics();
+    for (int round = 0; round < 2; round++) {
+        for (int i = 0; i < count; i++) {
+            ASSERT_TRUE(tree.get(i, v));
+            ASSERT_EQ(i, v);
+        }
+    }
+    EXPECT_EQ(0u, tree.statistics()[Counter::Adoptions]);
+    EXPECT_GT(tree.statistics()[Counter::FosterHops], 0u);
+
+    tree.put(count, count);
+    EXPECT_EQ(1u, tree.statistics()[Counter::Adoptions]);
+    tree.reset_statistics();
+    ASSERT_TRUE(tree.get(count - 1, v));
+    EXPECT_EQ(0u, tree.statistics()[Counter::FosterHops]);
+
+    SBtreeLazy<int, int, 2> concurrent;
+    concurrent_insertions(concurrent, 8, 20000);
+}
+
+TEST(AdoptionTest, LazyAdoptionOfLongChain)
+{
+    // Leaves are split without going through the parent, so that their foster chain grows
+    BTLevelLazyOptimistic<int, int, 1> level;
+    auto root = level.construct_recursively();
+    auto first = level.traverse(root, 0, true /* for_update */);
+    auto leaf = first;
+    unsigned splits = 0;
+    int count = 0;
+    while (splits < 4) {
+        while (!leaf->insert(count, count)) {
+            leaf = leaf->split_for_insertion(count, level.leaf_level()->construct_node());
+            splits++;
+        }
+        count++;
+    }
+    leaf->release_write();
+    ASSERT_EQ(4u, foster::internal::foster_chain_length(first, 10));
+
+    // A lookup that reaches a chain of four nodes adopts the first foster child, after which the
+    // remaining chain of three nodes is too short for lookups to adopt
+    auto adopted = first->get_foster_child();
+    int v;
+    for (int round = 0; round < 2; round++) {
+        leaf = level.traverse(root, count - 1, false /* for_update */);
+        EXPECT_TRUE(leaf->find(count - 1, &v));
+        EXPECT_EQ(count - 1, v);
+        leaf->release_read();
+        EXPECT_EQ(2u, root->size());
+        EXPECT_EQ(0u, foster::internal::foster_chain_length(first, 10));
+        EXPECT_EQ(3u, foster::internal::foster_chain_length(adopted, 10));
+    }
+
+    level.destroy_recursively(root);
+}
+
+TEST(AdoptionTest, LazyAdoptionOptimisticLatch)
+{
+    // Lookups decide on adoptions of branch nodes read optimistically while others split them
+    SBtreeLazyOptimistic<int, int, 2> tree;
+    std::atomic<bool> done {false};
+    auto lookups = [&tree, &done] {
+        while (!done) {
+            for (int k = 0; k < 10000 && !done; k++) {
+                int v;
+                if (tree.get(k * 16, v)) { ASSERT_EQ(k * 16, v); }
+            }
+        }
+    };
+    std::vector<std::thread> readers;
+    for (int i = 0; i < 2; i++) { readers.emplace_back(lookups); }
+    concurrent_insertions(tree, 8, 20000);
+    done = true;
+    for (auto& t : readers) { t.join(); }
+}
+
+TEST(AdoptionTest, BackgroundAdoption)
+{
+    using foster::Counter;
+    using foster::Histogram;
+
+    // A lookup queues the pending foster child, which the worker then adopts
+    SBtreeBackground<int, int, 1> single;
+    int last = insert_until_split(single) - 1, v;
+    single.reset_statistics();
+    ASSERT_TRUE(single.get(last, v));
+    for (int i = 0; i < 500 && single.statistics()[Counter::Adoptions] == 0; i++) {
+        std::this_thread::sleep_for(std::chrono::milliseconds(10));
+    }
+    EXPECT_EQ(1u, single.statistics()[Counter::Adoptions]);
+    single.reset_statistics();
+    ASSERT_TRUE(single.get(last, v));
+    EXPECT_EQ(0u, single.statistics()[Counter::FosterHops]);
+
+    SBtreeBackground<int, int, 2> tree;
+    int threads = 8, count = 20000;
+    concurrent_insertions(tree, threads, count);
+    EXPECT_GT(tree.statistics()[Counter::Adoptions], 0u);
+
+    // Lookups queue the remaining foster children, until the worker has adopted all of them
+    bool adopted = false;
+    for (int round = 0; round < 500 && !adopted; round++) {
+        tree.reset_statistics();
+        for (int t = 0; t < threads; t++) {
+            for (int i = 0; i < count; i++) {
+                int k = i * 16 + t, v;
+                ASSERT_TRUE(tree.get(k, v));
+                ASSERT_EQ(k, v);
+            }
+        }
+        adopted = tree.statistics()[Histogram::FosterChainLength].count() == 0;
+        if (!adopted) { std::this_thread::sleep_for(std::chrono::milliseconds(10)); }
+    }
+    EXPECT_TRUE(adopted);
+
+    // The worker is excluded while the tree is replaced
+    std::vector<std::pair<int, int>> pairs;
+    for (int i = 0; i < 1000; i++) { pairs.emplace_back(i, i); }
+    SBtreeBackground<int, int, 2> loaded;
+    loaded.bulk_load(pairs.begin(), pairs.end());
+    for (int i = 1000; i < 20000; i++) { loaded.put(i, i); }
+    for (int i = 0; i < 20000; i++) {
+        int v;
+        ASSERT_TRUE(loaded.get(i, v));
+        ASSERT_EQ(i, v);
+    }
+}
+
+TEST(MergeTest, StringMerge)
+{
+    SBtree<string, string, 3> tree;
+    int max = 20000;
+    for (int i = 0; i < max; i++) {
+        tree.put("key" + std::to_string(i), "value" + std::to_string(i));
+    }
+    size_t leaves_before = count_leaves(tree);
+
+    // Delete all keys, which must collapse each level into a single node
+    for (int i = 0; i < max; i++) {
+        ASSERT_TRUE(tree.remove("key" + std::to_string(i)));
+    }
+    EXPECT_LT(count_leaves(tree), leaves_before);
+
+    string v;
+    EXPECT_FALSE(tree.get("key42", v));
+    auto cursor = tree.scan("", "zzz");
+    string k;
+    EXPECT_FALSE(cursor.next(&k, &v));
+}
+
+TEST(MergeTest, ConcurrentMerge)
+{
+    SBtreePooled<int, int, 2> tree;
+    int max = 80000, num_threads = 4;
+    for (int i = 0; i < max; i++) { tree.put(i, i); }
+
+    // Each thread deletes its own keys, except multiples of 8, which are read concurrently
+    auto f = [&tree, max, num_threads] (int thread) {
+        for (int k = thread; k < max; k += num_threads) {
+            int v;
+            if (k % 8 != 0) { ASSERT_TRUE(tree.remove(k)); }
+            int other = (k / 8) * 8;
+            ASSERT_TRUE(tree.get(other, v));
+            ASSERT_EQ(other, v);
+        }
+    };
+
+    std::vector<std::thread> threads;
+    for (int i = 0; i < num_threads; i++) { threads.emplace_back(f, i); }
+    for (auto& t : threads) { t.join(); }
+
+    for (int k = 0; k < max; k++) {
+        int v;
+        ASSERT_EQ(k % 8 == 0, tree.get(k, v));
+    }
+}
+
+TEST(AppendTest, SequentialInsertions)
+{
+    SBtreeNoPMNK<int, int, 2> ascending, descending;
+    int max = 50000;
+    for (int i = 0; i < max; i++) {
+        ascending.put(i, i);
+        descending.put(max - 1 - i, i);
+    }
+
+    // Splits of the last leaf leave it almost full, unlike the middle splits of descending keys
+    size_t ascending_leaves = count_leaves(ascending);
+    size_t descending_leaves = count_leaves(descending);
+    EXPECT_LT(ascending_leaves * 10, descending_leaves * 7);
+
+    for (int k = 0; k < max; k++) {
+        int v;
+        ASSERT_TRUE(ascending.get(k, v));
+        ASSERT_EQ(k, v);
+    }
+    auto cursor = ascending.scan(0, max);
+    int k, v, expected = 0;
+    while (cursor.next(&k, &v)) { ASSERT_EQ(expected++, k); }
+    EXPECT_EQ(max, expected);
+}
+
+TEST(AppendTest, InsertionsAfterMerge)
+{
+    SBtreeNoPMNK<int, int, 2> tree;
+    int max = 20000;
+    for (int i = 0; i < max; i++) { tree.put(i, i); }
+
+    // Merges retire leaves, possibly the hinted one, which must not be used anymore
+    for (int k = 0; k < max; k++) {
+        if (k % 10 != 0) { ASSERT_TRUE(tree.remove(k)); }
+    }
+    for (int k = max; k < 2 * max; k++) { tree.put(k, k); }
+    for (int k = 1; k < max; k += 10) { tree.put(k, k); }
+
+    for (int k = 0; k < 2 * max; k++) {
+        int v;
+        bool expected = k >= max || k % 10 == 0 || k % 10 == 1;
+        ASSERT_EQ(expected, tree.get(k, v));
+    }
+}
+
+template<class Tree>
+size_t count_branches(Tree& tree)
+{
+    std::ostringstream out;
+    tree.print(out);
+    std::istringstream in {out.str()};
+    size_t count = 0;
+    string line;
+    while (std::getline(in, line)) {
+        if (line.find("Node ") != string::npos) { count++; }
+    }
+    return count;
+}
+
+TEST(SeparatorTest, LongStringKeys)
+{
+    // Keys differ in their first bytes, so leaf splits only need a short prefix as separator
+    auto make_key = [] (int i) { return std::to_string(i) + string(200, '#'); };
+
+    SBtree<string, string, 2> tree;
+    int max = 20000;
+    for (int i = 0; i < max; i++) {
+        tree.put(make_key((i * 7919) % max), std::to_string(i));
+    }
+    // Each branch node would hold less than 20 separators if they were not shortened
+    EXPECT_LT(count_branches(tree) * 20, count_leaves(tree));
+
+    for (int i = 0; i < max; i++) {
+        string v;
+        ASSERT_TRUE(tree.get(make_key((i * 7919) % max), v));
+        ASSERT_EQ(std::to_string(i), v);
+    }
+
+    // Prefixes of existing keys fall between separators and the first key of a leaf
+    for (int i = 0; i < max; i += 7) {
+        string v;
+        ASSERT_FALSE(tree.get(std::to_string(i), v));
+        tree.put(std::to_string(i), "gap");
+    }
+    for (int i = 0; i < max; i += 7) {
+        string v;
+        ASSERT_TRUE(tree.get(std::to_string(i), v));
+        ASSERT_EQ("gap", v);
+    }
+
+    std::map<string, string> input;
+    for (int i = 0; i < max; i++) { input[make_key(i)] = std::to_string(i); }
+    SBtree<string, string, 2> loaded;
+    loaded.bulk_load(input.begin(), input.end(), 1.0);
+    EXPECT_LT(count_branches(loaded) * 20, count_leaves(loaded));
+
+    auto cursor = loaded.lower_bound("");
+    string k, v;
+    auto it = input.begin();
+    while (cursor.next(&k, &v)) {
+        ASSERT_EQ(it->first, k);
+        ++it;
+    }
+    EXPECT_TRUE(it == input.end());
+}
+
 int main(int argc, char **argv)
 {
     ::testing::InitGoogleTest(&argc, argv);
@@ -22,7 +22,11 @@
 #define ENABLE_TESTING
 
 #include <gtest/gtest.h>
+#include <algorithm>
 #include <cstring>
+#include <limits>
+#include <tuple>
+#include <vector>
 
 #include "encoding.h"
 
@@ -36,6 +40,164 @@ TEST(TestStringPMNK, MainTest)
     ASSERT_TRUE(enc.get_pmnk("acb") < enc.get_pmnk("cba"));
 }
 
+TEST(TestKeyView, Comparisons)
+{
+    using foster::KeyView;
+
+    std::vector<string> keys {"", "a", "ab", "abc", "abd", "b", "\x7f", "\x80", "\xff"};
+    for (auto& a : keys) {
+        for (auto& b : keys) {
+            EXPECT_EQ(a < b, KeyView{a} < KeyView{b});
+            EXPECT_EQ(a == b, KeyView{a} == KeyView{b});
+            EXPECT_EQ(a > b, KeyView{a} > KeyView{b});
+        }
+    }
+
+    // Comparison against a prefix and a suffix stored separately
+    KeyView key {"prefix_mid"};
+    EXPECT_EQ(0, key.compare("prefix_", "mid"));
+    EXPECT_GT(key.compare("prefix_", "abc"), 0);
+    EXPECT_LT(key.compare("prefix_", "mide"), 0);
+    EXPECT_LT(key.compare("prefiy", ""), 0);
+    EXPECT_GT(key.compare("prefix", ""), 0);
+    EXPECT_LT(KeyView{"pre"}.compare("prefix_", "mid"), 0);
+    EXPECT_EQ(KeyView{"mid"}, key.substr(7));
+}
+
+TEST(TestKeyView, DecodeView)
+{
+    using Encoder = foster::DefaultEncoder<string, int, uint16_t>;
+
+    string key {"some key"};
+    char buffer[64];
+    Encoder::encode(key, 42, buffer);
+
+    foster::KeyView view;
+    int value;
+    Encoder::decode_view(buffer, &view, &value);
+    EXPECT_EQ(key, view.to_string());
+    EXPECT_EQ(42, value);
+    // The view points into the encoded payload instead of a copy
+    EXPECT_TRUE(view.data() >= buffer && view.data() < buffer + sizeof(buffer));
+    EXPECT_EQ(Encoder::get_pmnk(key), Encoder::get_pmnk(view));
+}
+
+TEST(TestOverflowEncoder, InlineAndOutOfLineValues)
+{
+    using Allocator = foster::BlobAllocator<64, 1024, 64 * 1024>;
+    using ValueEncoder = foster::OverflowEncoder<16, Allocator>;
+    using Encoder = foster::CompoundEncoder<foster::VariableLengthEncoder<string>, ValueEncoder,
+          uint16_t>;
+
+    char buffer[64];
+    string small(16, 's');
+    Encoder::encode("k", small, buffer);
+    EXPECT_EQ(Encoder::get_payload_length("k", small), Encoder::get_payload_length(buffer));
+    string key, value;
+    Encoder::decode(buffer, &key, &value);
+    EXPECT_EQ(small, value);
+    EXPECT_FALSE(ValueEncoder::is_overflow(buffer + 3));
+    EXPECT_EQ(0u, Allocator::blob_count());
+
+    // Values of any length only take a reference in the payload
+    for (size_t length : {17, 1000, 70000}) {
+        string large(length, 'x');
+        large.back() = 'y';
+        Encoder::encode("k", large, buffer);
+        EXPECT_EQ(3 + sizeof(uint16_t) + sizeof(char*) + sizeof(size_t),
+                Encoder::get_payload_length(buffer));
+        EXPECT_TRUE(ValueEncoder::is_overflow(buffer + 3));
+        EXPECT_EQ(1u, Allocator::blob_count());
+
+        Encoder::decode(buffer, &key, &value);
+        EXPECT_EQ("k", key);
+        EXPECT_EQ(large, value);
+
+        // A view points into the blob instead of a copy
+        foster::KeyView view;
+        ValueEncoder::decode(buffer + 3, &view);
+        EXPECT_TRUE(view.data() < buffer || view.data() >= buffer + sizeof(buffer));
+        EXPECT_EQ(large, view.to_string());
+
+        Encoder::release(buffer);
+        EXPECT_EQ(0u, Allocator::blob_count());
+    }
+}
+
+template <class K, class PMNK_Type>
+void check_normalized_order(std::vector<K> keys)
+{
+    foster::PMNKEncoder<K, PMNK_Type, foster::NormalizedPrefixing> enc;
+    std::sort(keys.begin(), keys.end());
+    for (size_t i = 1; i < keys.size(); i++) {
+        // Order must be preserved, although distinct keys may share a PMNK
+        EXPECT_LE(enc.get_pmnk(keys[i - 1]), enc.get_pmnk(keys[i])) << "at key " << i;
+    }
+}
+
+TEST(TestNormalizedPMNK, ScalarKeys)
+{
+    std::vector<int32_t> ints {std::numeric_limits<int32_t>::min(), -70000, -256, -1, 0, 1, 255,
+        256, 70000, std::numeric_limits<int32_t>::max()};
+    check_normalized_order<int32_t, uint16_t>(ints);
+    check_normalized_order<int32_t, uint32_t>(ints);
+    check_normalized_order<int32_t, uint64_t>(ints);
+
+    std::vector<int64_t> longs {std::numeric_limits<int64_t>::min(), -(1ll << 40), -3, 0, 3,
+        1ll << 40, std::numeric_limits<int64_t>::max()};
+    check_normalized_order<int64_t, uint16_t>(longs);
+
+    std::vector<double> doubles {-std::numeric_limits<double>::infinity(), -1e300, -2.5, -1e-300,
+        0.0, 1e-300, 2.5, 1e300, std::numeric_limits<double>::infinity()};
+    check_normalized_order<double, uint64_t>(doubles);
+    check_normalized_order<float, uint16_t>({-3.5f, -1.0f, 0.0f, 0.25f, 1.0f, 100.0f});
+
+    // Equal keys must have equal PMNKs
+    foster::PMNKEncoder<double, uint64_t, foster::NormalizedPrefixing> enc;
+    EXPECT_EQ(enc.get_pmnk(0.0), enc.get_pmnk(-0.0));
+
+    // With 4 bytes, a PMNK of an int decides all comparisons
+    foster::PMNKEncoder<int32_t, uint32_t, foster::NormalizedPrefixing> int_enc;
+    EXPECT_LT(int_enc.get_pmnk(-1), int_enc.get_pmnk(0));
+    EXPECT_LT(int_enc.get_pmnk(255), int_enc.get_pmnk(256));
+}
+
+TEST(TestNormalizedPMNK, StringAndTupleKeys)
+{
+    std::vector<string> strings {"", "a", "ab", "abcdefgh", "abcdefgi", "abcdefghij", "b", "\xff"};
+    check_normalized_order<string, uint64_t>(strings);
+
+    // 8-byte PMNKs are distinct for strings that differ in their first 8 bytes
+    foster::PMNKEncoder<string, uint64_t, foster::NormalizedPrefixing> enc;
+    EXPECT_LT(enc.get_pmnk("abcdefg"), enc.get_pmnk("abcdefgh"));
+    EXPECT_EQ(enc.get_pmnk("abcdefgh"), enc.get_pmnk("abcdefghij"));
+
+    using Key = std::tuple<string, int>;
+    check_normalized_order<Key, uint64_t>({Key{"", 5}, Key{"a", -1}, Key{"a", 3}, Key{"ab", -7},
+            Key{string("a\0b", 3), 0}, Key{"b", 0}});
+    using IntKey = std::tuple<int16_t, int32_t>;
+    check_normalized_order<IntKey, uint32_t>({IntKey{-2, 10}, IntKey{-1, -5}, IntKey{-1, 7},
+            IntKey{0, -100000}, IntKey{3, 0}});
+}
+
+TEST(TestNormalizedPMNK, TupleEncoding)
+{
+    using Key = std::tuple<string, int, string>;
+    using Encoder = foster::NormalizedEncoder<Key, string>;
+
+    Key key {"first", -42, "third"};
+    string value {"value"};
+    char buffer[128];
+    Encoder::encode(key, value, buffer);
+    EXPECT_EQ(Encoder::get_payload_length(key, value), Encoder::get_payload_length(buffer));
+
+    Key decoded_key;
+    string decoded_value;
+    Encoder::decode(buffer, &decoded_key, &decoded_value);
+    EXPECT_TRUE(key == decoded_key);
+    EXPECT_EQ(value, decoded_value);
+}
+
 int main(int argc, char **argv)
 {
     ::testing::InitGoogleTest(&argc, argv);
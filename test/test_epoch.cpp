@@ -0,0 +1,133 @@
+/*
+ * MIT License
+ *
+ * Copyright (c) 2016 Caetano Sauer
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy of this software and
+ * associated documentation files (the "Software"), to deal in the Software without restriction,
+ * including without limitation the rights to use, copy, modify, merge, publish, distribute,
+ * sublicense, and/or sell copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all copies or
+ * substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR IMPLIED, INCLUDING BUT
+ * NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM,
+ * DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+#include <gtest/gtest.h>
+#include <atomic>
+#include <thread>
+#include <vector>
+
+#include "epoch.h"
+
+struct Counted {
+    static std::atomic<int> live;
+    int value;
+    Counted(int v) : value(v) { live++; }
+    ~Counted() { live--; }
+};
+std::atomic<int> Counted::live{0};
+
+void delete_counted(void*, void* object) { delete static_cast<Counted*>(object); }
+
+TEST(TestEpochManager, ReclaimAfterReadersLeave)
+{
+    foster::EpochManager epochs;
+
+    std::atomic<int> stage{0};
+    std::thread reader([&] {
+        foster::EpochGuard guard {epochs};
+        stage = 1;
+        while (stage != 2) { std::this_thread::yield(); }
+    });
+    while (stage != 1) { std::this_thread::yield(); }
+
+    {
+        foster::EpochGuard guard {epochs};
+        epochs.retire(new Counted(1), delete_counted, nullptr);
+    }
+
+    // Reader entered before the object was retired, so it cannot be freed
+    for (int i = 0; i < 5; i++) { EXPECT_EQ(1u, epochs.reclaim()); }
+    EXPECT_EQ(1, Counted::live);
+
+    stage = 2;
+    reader.join();
+    epochs.reclaim();
+    epochs.reclaim();
+    EXPECT_EQ(0u, epochs.reclaim());
+    EXPECT_EQ(0, Counted::live);
+}
+
+TEST(TestEpochManager, NestedEpochs)
+{
+    foster::EpochManager epochs;
+    epochs.enter();
+    epochs.enter();
+    epochs.retire(new Counted(1), delete_counted, nullptr);
+    epochs.leave();
+
+    // Inner leave does not leave the epoch, so the global epoch cannot advance twice
+    for (int i = 0; i < 5; i++) { epochs.reclaim(); }
+    EXPECT_EQ(1, Counted::live);
+
+    epochs.leave();
+    for (int i = 0; i < 3; i++) { epochs.reclaim(); }
+    EXPECT_EQ(0, Counted::live);
+}
+
+TEST(TestEpochManager, DrainOnDestruction)
+{
+    {
+        foster::EpochManager epochs;
+        for (int i = 0; i < 10; i++) {
+            epochs.retire(new Counted(i), delete_counted, nullptr);
+        }
+    }
+    EXPECT_EQ(0, Counted::live);
+}
+
+TEST(TestEpochManager, ConcurrentReadersAndRetirement)
+{
+    foster::EpochManager epochs;
+    std::atomic<Counted*> shared {new Counted(0)};
+    std::atomic<bool> done {false};
+    const int iterations = 20000;
+
+    // Readers dereference the shared object, which would be a use-after-free if it was reclaimed
+    // too early (detectable with address sanitizer, or by the value check below)
+    auto reader = [&] {
+        while (!done) {
+            foster::EpochGuard guard {epochs};
+            Counted* c = shared.load();
+            ASSERT_GE(c->value, 0);
+        }
+    };
+
+    std::vector<std::thread> threads;
+    for (int i = 0; i < 3; i++) { threads.emplace_back(reader); }
+
+    for (int i = 1; i <= iterations; i++) {
+        foster::EpochGuard guard {epochs};
+        Counted* old = shared.exchange(new Counted(i));
+        epochs.retire(old, delete_counted, nullptr);
+    }
+    done = true;
+    for (auto& t : threads) { t.join(); }
+
+    delete shared.load();
+    epochs.drain();
+    EXPECT_EQ(0, Counted::live);
+}
+
+int main(int argc, char **argv)
+{
+    ::testing::InitGoogleTest(&argc, argv);
+    return RUN_ALL_TESTS();
+}
@@ -24,11 +24,17 @@
 #include <gtest/gtest.h>
 #include <cstring>
 #include <map>
+#include <tuple>
+#include <vector>
 
 #include "slot_array.h"
 #include "encoding.h"
 #include "search.h"
 #include "kv_array.h"
+#include "kv_array_inline.h"
+#include "kv_array_delta.h"
+#include "kv_array_buffered.h"
+#include "slot_array_soa.h"
 
 constexpr size_t DftArrayBytes = 8192;
 constexpr size_t DftAlignment = 8;
@@ -43,8 +49,24 @@ using KVArray = foster::KeyValueArray<K, V,
       foster::DefaultEncoder<K, V, PMNK_Type>
 >;
 
+template<class PMNK_Type>
+using SoAArray = foster::SoASlotArray<PMNK_Type, DftArrayBytes, DftAlignment>;
 
 template<class K, class V, class PMNK_Type>
+using SoAKVArray = foster::KeyValueArray<K, V,
+      SoAArray<PMNK_Type>,
+      foster::SimdSearch<SoAArray<PMNK_Type>>,
+      foster::DefaultEncoder<K, V, PMNK_Type>
+>;
+
+template<class K, class V, class PMNK_Type>
+using NormalizedKVArray = foster::KeyValueArray<K, V,
+      SArray<PMNK_Type>,
+      foster::BinarySearch<SArray<PMNK_Type>>,
+      foster::NormalizedEncoder<K, V, PMNK_Type>
+>;
+
+template<class K, class V, class PMNK_Type, class KV = KVArray<K, V, PMNK_Type>>
 class KVArrayValidator
 {
 public:
@@ -78,13 +100,13 @@ public:
         EXPECT_TRUE(kv_.is_sorted());
     }
 
-    KVArray<K, V, PMNK_Type>& get_kv() { return kv_; }
+    KV& get_kv() { return kv_; }
     std::map<K, V>& get_map() { return map_; }
 
 private:
 
     std::map<K, V> map_;
-    KVArray<K, V, PMNK_Type> kv_;
+    KV kv_;
 };
 
 TEST(TestInsertions, SimpleInsertions)
@@ -125,6 +147,27 @@ TEST(TestInsertionsFixedLength, SimpleInsertionsWithoutPMNK)
     kv.insert(4, 4000);
 }
 
+TEST(TestInsertions, StructureOfArraysWithSimdSearch)
+{
+    KVArrayValidator<string, string, uint16_t, SoAKVArray<string, string, uint16_t>> kv;
+    std::vector<string> keys;
+    for (int i = 0; i < 200; i++) {
+        keys.push_back(std::to_string((i * 7919) % 1000));
+        kv.insert(keys.back(), "value" + keys.back());
+    }
+    for (size_t i = 0; i < keys.size(); i += 3) {
+        kv.remove(keys[i]);
+    }
+
+    KVArrayValidator<uint64_t, uint32_t, uint64_t, SoAKVArray<uint64_t, uint32_t, uint64_t>> kv2;
+    for (uint64_t i = 0; i < 300; i++) {
+        kv2.insert((i * 7919) % 1000, i);
+    }
+    for (uint64_t i = 0; i < 300; i += 2) {
+        kv2.remove((i * 7919) % 1000);
+    }
+}
+
 TEST(TestDeletions, SimpleDeletions)
 {
     KVArrayValidator<string, string, uint16_t> kv;
@@ -148,6 +191,115 @@ TEST(TestDeletions, SimpleDeletions)
     kv.remove("d");
 }
 
+TEST(TestDeletions, GhostReuseAndCompaction)
+{
+    KVArrayValidator<uint32_t, uint64_t, uint32_t> kv;
+    auto& array = kv.get_kv();
+
+    // Fill the array completely
+    uint32_t count = 0;
+    while (array.insert(count, count * 10)) {
+        kv.get_map()[count] = count * 10;
+        count++;
+    }
+    kv.validate();
+
+    // Removals only leave ghosts behind, so no space is freed yet
+    size_t free_space = array.free_space();
+    for (uint32_t i = 0; i < count; i += 2) {
+        kv.remove(i);
+    }
+    EXPECT_EQ(free_space, array.free_space());
+    EXPECT_LT(0u, array.ghost_space());
+
+    // Reinserting a removed key reuses its ghost slot and payload
+    kv.insert(0, 42);
+    EXPECT_EQ(free_space, array.free_space());
+
+    // Inserting new keys into a full array purges the remaining ghosts
+    kv.insert(count, count * 10);
+    EXPECT_EQ(0u, array.ghost_space());
+    kv.insert(count + 1, count * 10);
+
+    // Iteration skips ghosts
+    auto iter = array.iterate();
+    uint32_t key;
+    uint64_t value;
+    size_t iterated = 0;
+    while (iter.next(&key, &value)) {
+        EXPECT_EQ(kv.get_map()[key], value);
+        iterated++;
+    }
+    EXPECT_EQ(kv.get_map().size(), iterated);
+}
+
+TEST(TestPutModes, UpsertAndUpdate)
+{
+    using foster::PutMode;
+    using foster::PutStatus;
+
+    KVArray<string, string, uint16_t> kv;
+    EXPECT_EQ(PutStatus::KeyNotFound, kv.put<PutMode::Update>("key1", "a"));
+    EXPECT_EQ(PutStatus::Inserted, kv.put<PutMode::Insert>("key1", "a"));
+    EXPECT_EQ(PutStatus::KeyExists, kv.put<PutMode::Insert>("key1", "b"));
+    EXPECT_EQ(PutStatus::Inserted, kv.put("key2", "b"));
+    EXPECT_EQ(PutStatus::Inserted, kv.put("key3", "c"));
+
+    // Same encoded length: value is overwritten in place
+    size_t free_space = kv.free_space();
+    EXPECT_EQ(PutStatus::Updated, kv.put<PutMode::Update>("key2", "x"));
+    EXPECT_EQ(free_space, kv.free_space());
+
+    // Longer and shorter values reallocate the payload
+    string long_value(100, 'y');
+    EXPECT_EQ(PutStatus::Updated, kv.put("key2", long_value));
+    EXPECT_GT(free_space, kv.free_space());
+    EXPECT_EQ(PutStatus::Updated, kv.put<PutMode::Update>("key2", "z"));
+    EXPECT_EQ(free_space, kv.free_space());
+
+    string value;
+    EXPECT_TRUE(kv.find("key1", &value));
+    EXPECT_EQ("a", value);
+    EXPECT_TRUE(kv.find("key2", &value));
+    EXPECT_EQ("z", value);
+    EXPECT_TRUE(kv.find("key3", &value));
+    EXPECT_EQ("c", value);
+    EXPECT_EQ(3u, kv.size());
+    EXPECT_TRUE(kv.is_sorted());
+
+    // A removed key is not updated, but it is reinserted by an upsert
+    kv.remove("key3");
+    EXPECT_EQ(PutStatus::KeyNotFound, kv.put<PutMode::Update>("key3", "d"));
+    EXPECT_EQ(PutStatus::Inserted, kv.put("key3", "d"));
+    EXPECT_TRUE(kv.find("key3", &value));
+    EXPECT_EQ("d", value);
+}
+
+TEST(TestPutModes, UpdateInFullArray)
+{
+    using foster::PutStatus;
+
+    KVArray<uint32_t, string, uint32_t> kv;
+    uint32_t count = 0;
+    while (kv.insert(count, "v")) { count++; }
+
+    // A value that needs more blocks does not fit, and the old value is kept
+    string long_value(64, 'x');
+    EXPECT_EQ(PutStatus::NoSpace, kv.put(0, long_value));
+    string value;
+    EXPECT_TRUE(kv.find(0, &value));
+    EXPECT_EQ("v", value);
+
+    // Ghosts are purged to make room
+    for (uint32_t i = 1; i <= 10; i++) { kv.remove(count - i); }
+    EXPECT_EQ(PutStatus::Updated, kv.put(0, long_value));
+    EXPECT_EQ(0u, kv.ghost_space());
+    EXPECT_TRUE(kv.find(0, &value));
+    EXPECT_EQ(long_value, value);
+    EXPECT_EQ(count - 10, kv.size());
+    EXPECT_TRUE(kv.is_sorted());
+}
+
 TEST(TestMovement, SimpleMovement)
 {
     using namespace foster;
@@ -223,6 +375,268 @@ TEST(TestMovement, SimpleMovementWithoutPMNK)
     kv2.validate();
 }
 
+TEST(TestMovement, BulkMovement)
+{
+    using namespace foster;
+
+    // Move the upper half of a full array, as in a node split, including a ghost
+    KVArrayValidator<uint64_t, uint32_t, uint64_t, SoAKVArray<uint64_t, uint32_t, uint64_t>> kv;
+    uint64_t count = 0;
+    while (kv.get_kv().insert(count, count)) {
+        kv.get_map()[count] = count;
+        count++;
+    }
+    kv.remove(count - 1);
+
+    KVArrayValidator<uint64_t, uint32_t, uint64_t, SoAKVArray<uint64_t, uint32_t, uint64_t>> kv2;
+    using SlotNumber = SoAKVArray<uint64_t, uint32_t, uint64_t>::SlotNumber;
+    SlotNumber split = kv.get_kv().slot_count() / 2;
+    size_t moved = kv.get_kv().slot_count() - split;
+    ASSERT_TRUE(internal::move_kv_records(kv2.get_kv(), SlotNumber(0), kv.get_kv(), split, moved));
+    for (uint64_t i = split; i < count - 1; i++) {
+        kv.get_map().erase(i);
+        kv2.get_map()[i] = i;
+    }
+    kv.validate();
+    kv2.validate();
+    EXPECT_EQ(moved, size_t(kv2.get_kv().slot_count()));
+    EXPECT_EQ(0u, kv.get_kv().ghost_space());
+    EXPECT_LT(0u, kv2.get_kv().ghost_space());
+
+    // Moving into an array without enough space leaves both arrays untouched
+    KVArrayValidator<string, string, uint16_t> kv3, kv4;
+    for (int i = 0; i < 10; i++) {
+        kv3.insert("key" + std::to_string(i), string(100, 'a' + i));
+    }
+    uint32_t i = 0;
+    while (kv4.get_kv().insert("other" + std::to_string(i), "value")) {
+        kv4.get_map()["other" + std::to_string(i)] = "value";
+        i++;
+    }
+    size_t free_space = kv4.get_kv().free_space();
+    EXPECT_FALSE(internal::move_kv_records(kv4.get_kv(), 0, kv3.get_kv(), 0, 10));
+    EXPECT_EQ(free_space, kv4.get_kv().free_space());
+    kv3.validate();
+    kv4.validate();
+}
+
+TEST(TestInlineRecords, InsertionsAndMovement)
+{
+    using namespace foster;
+    using InlineKV = InlineKeyValueArray<int64_t, uint32_t, DftArrayBytes>;
+
+    KVArrayValidator<int64_t, uint32_t, int64_t, InlineKV> kv;
+    int64_t count = 0;
+    while (kv.get_kv().insert(count * 2 - 100, count)) {
+        kv.get_map()[count * 2 - 100] = count;
+        count++;
+    }
+    kv.validate();
+    // Each pair only takes the space of its key and value
+    EXPECT_EQ(size_t(count), (DftArrayBytes - DftAlignment) / (sizeof(int64_t) + sizeof(uint32_t)));
+    EXPECT_THROW(kv.get_kv().insert(-100, 0), ExistentKeyException<int64_t>);
+
+    for (int64_t i = 0; i < count; i += 3) { kv.remove(i * 2 - 100); }
+    EXPECT_EQ(0u, kv.get_kv().ghost_space());
+    kv.insert(-99, 7);
+    EXPECT_EQ(PutStatus::Updated, kv.get_kv().put(-99, 8));
+    kv.get_map()[-99] = 8;
+    kv.validate();
+
+    // Unmatched searches yield the value of the previous slot (key -98), as in branch nodes
+    uint32_t value = 0;
+    EXPECT_FALSE(kv.get_kv().find(-97, &value));
+    EXPECT_EQ(1u, value);
+
+    KVArrayValidator<int64_t, uint32_t, int64_t, InlineKV> kv2;
+    using SlotNumber = InlineKV::SlotNumber;
+    SlotNumber split = kv.get_kv().slot_count() / 2;
+    size_t moved = kv.get_kv().slot_count() - split;
+    std::vector<std::pair<int64_t, uint32_t>> upper(std::next(kv.get_map().begin(), split),
+            kv.get_map().end());
+    ASSERT_TRUE(internal::move_kv_records(kv2.get_kv(), SlotNumber(0), kv.get_kv(), split, moved));
+    for (auto& p : upper) {
+        kv.get_map().erase(p.first);
+        kv2.get_map()[p.first] = p.second;
+    }
+    kv.validate();
+    kv2.validate();
+
+    // Moving into an array without enough space leaves both arrays untouched
+    kv.insert(1000000, 1);
+    while (kv2.get_kv().insert(-1000 - kv2.get_kv().size(), 0)) {
+        kv2.get_map()[-1000 - int64_t(kv2.get_map().size())] = 0;
+    }
+    ASSERT_FALSE(internal::move_kv_records(kv2.get_kv(), SlotNumber(0), kv.get_kv(), SlotNumber(0),
+                kv.get_kv().slot_count()));
+    kv.validate();
+    kv2.validate();
+}
+
+TEST(TestDeltaRecords, FrameReencoding)
+{
+    using namespace foster;
+    using DeltaKV = DeltaKeyValueArray<int64_t, uint32_t, DftArrayBytes>;
+    using InlineKV = InlineKeyValueArray<int64_t, uint32_t, DftArrayBytes>;
+
+    // Dense keys only take one byte each, so much more pairs fit than with inline keys
+    KVArrayValidator<int64_t, uint32_t, int64_t, DeltaKV> kv;
+    int64_t count = 0;
+    while (kv.get_kv().insert(count + 1000000, count)) {
+        kv.get_map()[count + 1000000] = count;
+        count++;
+        if (count == 200) { EXPECT_EQ(1u, kv.get_kv().key_width()); }
+    }
+    kv.validate();
+    EXPECT_EQ(2u, kv.get_kv().key_width());
+    EXPECT_GT(size_t(count) * 10, InlineKV::Capacity / (sizeof(int64_t) + sizeof(uint32_t)) * 17);
+    EXPECT_THROW(kv.get_kv().insert(1000000, 0), ExistentKeyException<int64_t>);
+
+    // Keys below the base and far above the last key widen the frame
+    for (int64_t i = 0; i < count; i++) {
+        if (i % 3 != 0) { kv.remove(i + 1000000); }
+    }
+    kv.insert(-5, 1);
+    EXPECT_EQ(4u, kv.get_kv().key_width());
+    kv.insert(int64_t(1) << 40, 2);
+    EXPECT_EQ(8u, kv.get_kv().key_width());
+    kv.validate();
+
+    // Unmatched searches yield the value of the previous slot, as in branch nodes
+    uint32_t value = 0;
+    EXPECT_FALSE(kv.get_kv().find(1000004, &value));
+    EXPECT_EQ(3u, value);
+    EXPECT_FALSE(kv.get_kv().find(-6, &value));
+    EXPECT_EQ(0u, kv.get_kv().lower_bound(-6));
+    EXPECT_EQ(kv.get_kv().slot_count(), kv.get_kv().lower_bound(int64_t(1) << 41));
+
+    std::vector<int64_t> keys(kv.get_kv().slot_count());
+    kv.get_kv().decode_keys(0, keys.size(), keys.data());
+    for (size_t i = 0; i < keys.size(); i++) {
+        int64_t key;
+        kv.get_kv().read_slot(i, &key, nullptr);
+        ASSERT_EQ(key, keys[i]);
+    }
+
+    // Moving the outliers away lets both arrays shrink their frames
+    KVArrayValidator<int64_t, uint32_t, int64_t, DeltaKV> kv2;
+    using SlotNumber = DeltaKV::SlotNumber;
+    SlotNumber last = kv.get_kv().slot_count() - 1;
+    ASSERT_TRUE(internal::move_kv_records(kv2.get_kv(), SlotNumber(0), kv.get_kv(), last, 1));
+    ASSERT_TRUE(internal::move_kv_records(kv2.get_kv(), SlotNumber(0), kv.get_kv(), SlotNumber(0), 1));
+    kv.get_map().erase(-5);
+    kv.get_map().erase(int64_t(1) << 40);
+    kv2.get_map()[-5] = 1;
+    kv2.get_map()[int64_t(1) << 40] = 2;
+    kv.validate();
+    kv2.validate();
+    EXPECT_EQ(2u, kv.get_kv().key_width());
+    EXPECT_EQ(8u, kv2.get_kv().key_width());
+
+    // Moving into an array without enough space leaves both arrays untouched
+    for (int64_t k = -1000; kv2.get_kv().insert(k, 0); k--) { kv2.get_map()[k] = 0; }
+    ASSERT_FALSE(internal::move_kv_records(kv2.get_kv(), SlotNumber(kv2.get_kv().slot_count() - 1),
+                kv.get_kv(), SlotNumber(0), kv.get_kv().slot_count()));
+    kv.validate();
+    kv2.validate();
+}
+
+TEST(TestBufferedInserts, MergeIntoSlotVector)
+{
+    using namespace foster;
+    using BufferedKV = BufferedKeyValueArray<string, int,
+          SArray<uint16_t>,
+          BinarySearch<SArray<uint16_t>>,
+          DefaultEncoder<string, int, uint16_t>,
+          8>;
+
+    // Keys share their first bytes, so PMNKs collide and full keys must be compared
+    BufferedKV kv;
+    std::map<string, int> map;
+    size_t max_buffered = 0;
+    for (int i = 0; ; i++) {
+        string key = "k" + std::to_string((i * 7919) % 10007);
+        PutStatus status = kv.put<PutMode::Insert>(key, i);
+        if (status == PutStatus::NoSpace) { break; }
+        ASSERT_EQ(PutStatus::Inserted, status);
+        map[key] = i;
+        max_buffered = std::max(max_buffered, kv.buffered_count());
+        ASSERT_EQ(map.size(), kv.size());
+        ASSERT_EQ(PutStatus::KeyExists, kv.put<PutMode::Insert>(key, -1));
+
+        if (i == 100) {
+            // Slot space of buffered pairs is reserved, so a merge does not change free space
+            ASSERT_GT(kv.buffered_count(), 0u);
+            size_t free = kv.free_space();
+            kv.merge_buffer();
+            EXPECT_EQ(0u, kv.buffered_count());
+            EXPECT_EQ(free, kv.free_space());
+            EXPECT_EQ(map.size(), kv.slot_count());
+            EXPECT_TRUE(kv.is_sorted());
+        }
+    }
+    EXPECT_EQ(8u, max_buffered);
+    for (auto& e : map) {
+        int v;
+        ASSERT_TRUE(kv.find(e.first, &v));
+        ASSERT_EQ(e.second, v);
+    }
+
+    // Removals merge the buffer, and reinsertions of removed keys reuse their ghosts
+    int removed = 0;
+    for (auto it = map.begin(); it != map.end(); removed++) {
+        if (removed % 3 == 0) {
+            kv.remove(it->first);
+            it = map.erase(it);
+        }
+        else { ++it; }
+    }
+    EXPECT_EQ(0u, kv.buffered_count());
+    EXPECT_EQ(map.size(), kv.size());
+    for (int i = 0; i < 20; i++) {
+        string key = "k" + std::to_string((i * 7919) % 10007);
+        bool exists = map.count(key) > 0;
+        EXPECT_EQ(exists ? PutStatus::Updated : PutStatus::Inserted, kv.put(key, -i));
+        map[key] = -i;
+    }
+
+    // Iteration merges the buffer and yields all pairs in order
+    auto iter = kv.iterate();
+    string key;
+    int value;
+    auto expected = map.begin();
+    while (iter.next(&key, &value)) {
+        ASSERT_TRUE(expected != map.end());
+        EXPECT_EQ(expected->first, key);
+        EXPECT_EQ(expected->second, value);
+        ++expected;
+    }
+    EXPECT_TRUE(expected == map.end());
+    EXPECT_TRUE(kv.is_sorted());
+}
+
+TEST(TestNormalizedKeys, SignedAndCompositeKeys)
+{
+    // Negative keys would be out of order in a PMNK taken from the raw bytes
+    KVArrayValidator<int, int, uint16_t, NormalizedKVArray<int, int, uint16_t>> ints;
+    for (int i = 0; i < 200; i++) {
+        int k = (i * 7919) % 200 - 100;
+        ints.insert(k * 1000, k);
+    }
+    for (int k = -100; k < 100; k += 3) { ints.remove(k * 1000); }
+
+    KVArrayValidator<double, int, uint64_t, NormalizedKVArray<double, int, uint64_t>> doubles;
+    for (int i = 0; i < 100; i++) { doubles.insert(((i * 37) % 100 - 50) * 0.75, i); }
+
+    using Key = std::tuple<string, int>;
+    KVArrayValidator<Key, string, uint64_t, NormalizedKVArray<Key, string, uint64_t>> tuples;
+    for (int i = 0; i < 100; i++) {
+        tuples.insert(Key{"user" + std::to_string(i % 7), (i * 13) % 100 - 50}, std::to_string(i));
+    }
+    EXPECT_THROW(tuples.insert(Key{"user0", -50}, "dup"),
+        foster::ExistentKeyException<Key>);
+}
+
 int main(int argc, char **argv)
 {
     ::testing::InitGoogleTest(&argc, argv);
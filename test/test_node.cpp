@@ -305,6 +305,36 @@ TEST(TestPrefixTruncation, SimpleTruncation)
     }
 }
 
+TEST(TestPrefixTruncation, FenceComparisons)
+{
+    using NodePointer = BTNodeTrunc<int>::NodePointer;
+
+    BTNodeTrunc<int> node;
+    for (char c = 'A'; c <= 'Z'; c++) { node.insert(string{"longkeyprefix"} + c, c); }
+    BTNodeTrunc<int> node2;
+    node.add_foster_child(NodePointer{&node2});
+    node.rebalance_foster_child();
+    BTNodeTrunc<int> node3;
+    node2.add_foster_child(NodePointer{&node3});
+    node2.rebalance_foster_child();
+    node2.unlink_foster_child();
+
+    // Fence keys of node2 share a prefix, which is compared in place against search keys
+    string low, high;
+    node2.get_fence_keys(&low, &high);
+    EXPECT_TRUE(node2.fence_contains(low));
+    EXPECT_FALSE(node2.fence_contains(high));
+    EXPECT_FALSE(node2.fence_contains("longkeyprefixA"));
+    EXPECT_FALSE(node2.fence_contains("longkey"));
+    EXPECT_FALSE(node2.fence_contains("a"));
+    EXPECT_FALSE(node2.fence_contains("zzz"));
+    EXPECT_FALSE(node2.fence_contains(""));
+    EXPECT_TRUE(node2.key_range_contains(low + "0"));
+    EXPECT_FALSE(node.key_range_contains(low));
+    EXPECT_TRUE(node.fence_contains(low));
+    EXPECT_TRUE(node.key_range_contains("longkeyprefixA"));
+}
+
 int main(int argc, char **argv)
 {
     ::testing::InitGoogleTest(&argc, argv);
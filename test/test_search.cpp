@@ -0,0 +1,130 @@
+/*
+ * MIT License
+ *
+ * Copyright (c) 2016 Caetano Sauer
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy of this software and
+ * associated documentation files (the "Software"), to deal in the Software without restriction,
+ * including without limitation the rights to use, copy, modify, merge, publish, distribute,
+ * sublicense, and/or sell copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all copies or
+ * substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR IMPLIED, INCLUDING BUT
+ * NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM,
+ * DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+#include <gtest/gtest.h>
+#include <algorithm>
+#include <cstdint>
+#include <limits>
+#include <random>
+#include <vector>
+
+#include "slot_array.h"
+#include "slot_array_soa.h"
+#include "search.h"
+
+constexpr size_t DftArrayBytes = 8192;
+constexpr size_t DftAlignment = 8;
+
+template<class PMNK_Type>
+using SArray = foster::SlotArray<PMNK_Type, DftArrayBytes, DftAlignment>;
+
+template<class PMNK_Type>
+using SoAArray = foster::SoASlotArray<PMNK_Type, DftArrayBytes, DftAlignment>;
+
+/**
+ * Fills the slot vector with sorted random keys (with many duplicates) and checks that SimdSearch
+ * returns the same result as BinarySearch for every key in the domain sampled.
+ */
+template<class PMNK_Type, size_t Threshold, template<class> class SlotArray = SArray>
+void compare_with_binary_search(unsigned max_key)
+{
+    using SA = SlotArray<PMNK_Type>;
+    using SlotNumber = typename SA::SlotNumber;
+
+    std::mt19937 rng(max_key);
+    std::uniform_int_distribution<unsigned> dist(0, max_key);
+    std::vector<PMNK_Type> keys;
+
+    SA slots;
+    while (slots.insert_slot(slots.slot_count())) {}
+
+    // Keys at the extremes of the domain exercise the unsigned comparison
+    keys.push_back(0);
+    keys.push_back(std::numeric_limits<PMNK_Type>::max());
+    while (keys.size() < slots.slot_count()) {
+        keys.push_back(static_cast<PMNK_Type>(dist(rng)));
+    }
+    std::sort(keys.begin(), keys.end());
+    for (SlotNumber i = 0; i < slots.slot_count(); i++) {
+        slots[i].key = keys[i];
+        slots[i].ghost = false;
+    }
+
+    auto check = [&slots](PMNK_Type key) {
+        SlotNumber expected, actual;
+        bool found = foster::BinarySearch<SA>{}(slots, key, expected, 0, slots.slot_count());
+        EXPECT_EQ(found,
+                (foster::SimdSearch<SA, Threshold>{}(slots, key, actual, 0, slots.slot_count())));
+        EXPECT_EQ(expected, actual);
+    };
+
+    for (unsigned k = 0; k <= max_key + 1; k++) { check(static_cast<PMNK_Type>(k)); }
+    check(std::numeric_limits<PMNK_Type>::max());
+    check(std::numeric_limits<PMNK_Type>::max() - 1);
+
+    // Empty range
+    SA empty;
+    SlotNumber ret;
+    EXPECT_FALSE((foster::SimdSearch<SA, Threshold>{}(empty, 42, ret, 0, 0)));
+    EXPECT_EQ(0, ret);
+}
+
+TEST(TestSimdSearch, UInt16)
+{
+    compare_with_binary_search<uint16_t, 0>(500);
+    compare_with_binary_search<uint16_t, 64>(500);
+    compare_with_binary_search<uint16_t, 100000>(500);
+}
+
+TEST(TestSimdSearch, UInt32)
+{
+    compare_with_binary_search<uint32_t, 0>(2000);
+    compare_with_binary_search<uint32_t, 64>(2000);
+    compare_with_binary_search<uint32_t, 100000>(2000);
+}
+
+TEST(TestSimdSearch, UInt64)
+{
+    compare_with_binary_search<uint64_t, 0>(2000);
+    compare_with_binary_search<uint64_t, 64>(2000);
+    compare_with_binary_search<uint64_t, 100000>(2000);
+}
+
+TEST(TestSimdSearch, StructureOfArrays)
+{
+    compare_with_binary_search<uint16_t, 0, SoAArray>(500);
+    compare_with_binary_search<uint16_t, 64, SoAArray>(500);
+    compare_with_binary_search<uint32_t, 0, SoAArray>(2000);
+    compare_with_binary_search<uint32_t, 64, SoAArray>(2000);
+    compare_with_binary_search<uint64_t, 0, SoAArray>(2000);
+    compare_with_binary_search<uint64_t, 64, SoAArray>(2000);
+}
+
+TEST(TestSimdSearch, SignedFallback)
+{
+    compare_with_binary_search<int32_t, 16>(2000);
+}
+
+int main(int argc, char **argv)
+{
+    ::testing::InitGoogleTest(&argc, argv);
+    return RUN_ALL_TESTS();
+}
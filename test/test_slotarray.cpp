@@ -23,6 +23,7 @@
 #include <cstring>
 
 #include "slot_array.h"
+#include "slot_array_soa.h"
 
 // Adding a \0 at the end means we don't have to keep track of length to read the payload
 char data[6] = {'d', 'a', 't', 'a', '0', '\0'};
@@ -113,7 +114,7 @@ void sequential_deletions(T& slots, bool forward, int count = -1)
         free_space = slots.free_space();
         slots.delete_slot(i);
         EXPECT_EQ(initial_slot_count - (j + 1), slots.slot_count());
-        EXPECT_EQ(free_space + sizeof(typename T::Slot), slots.free_space());
+        EXPECT_EQ(free_space + T::SlotSize, slots.free_space());
 
         if (slots.slot_count() == 0) { break; }
         EXPECT_EQ(get_key<KeyType>(100 + j + 1), slots[i].key);
@@ -122,7 +123,7 @@ void sequential_deletions(T& slots, bool forward, int count = -1)
 
         if (one_record_space == 0) {
             one_record_space = slots.free_space() - initial_free_space;
-            EXPECT_TRUE(one_record_space >= sizeof(data) + sizeof(typename T::Slot));
+            EXPECT_TRUE(one_record_space >= sizeof(data) + T::SlotSize);
         }
         else {
             EXPECT_TRUE(slots.free_space() == initial_free_space + (j+1) * one_record_space);
@@ -145,11 +146,67 @@ void test()
     EXPECT_EQ(initial_free_space, slots.free_space());
 }
 
+template<class T>
+void test_ghosts()
+{
+    using PayloadPtr = typename T::PayloadPtr;
+    using SlotNumber = typename T::SlotNumber;
+    using KeyType = typename T::KeyType;
+
+    T slots;
+
+    // Payload not referenced by any slot, which must survive the purge untouched
+    const char meta[16] = "metadata-block!";
+    PayloadPtr meta_ptr;
+    ASSERT_TRUE(slots.allocate_payload(meta_ptr, sizeof(meta)));
+    memcpy(slots.get_payload(meta_ptr), meta, sizeof(meta));
+
+    const size_t count = 20;
+    sequential_insertions(slots, true, count);
+    ASSERT_EQ(count, size_t(slots.slot_count()));
+
+    // Every other slot becomes a ghost
+    for (SlotNumber i = 0; i < count; i += 2) {
+        slots.set_ghost(i, true, sizeof(data));
+    }
+    EXPECT_EQ(count / 2, slots.ghost_count());
+    size_t ghost_space = slots.ghost_space();
+    EXPECT_EQ(count / 2 * (slots.get_payload_count(sizeof(data)) * sizeof(typename T::PayloadBlock)
+                + T::SlotSize), ghost_space);
+
+    size_t free_space = slots.free_space();
+    slots.purge_ghosts([] (const void*) { return sizeof(data); });
+    EXPECT_EQ(free_space + ghost_space, slots.free_space());
+    EXPECT_EQ(0u, slots.ghost_count());
+    EXPECT_EQ(0u, slots.ghost_space());
+    ASSERT_EQ(count / 2, size_t(slots.slot_count()));
+
+    for (SlotNumber i = 0; i < slots.slot_count(); i++) {
+        SlotNumber original = 2 * i + 1;
+        EXPECT_FALSE(slots[i].ghost);
+        EXPECT_EQ(get_key<KeyType>(100 + original), slots[i].key);
+        data[4] = '0' + (original % 10);
+        EXPECT_TRUE(strncmp(data, (char*) slots.get_payload(slots[i].ptr), 6) == 0);
+    }
+    EXPECT_TRUE(memcmp(meta, slots.get_payload(meta_ptr), sizeof(meta)) == 0);
+}
+
+TEST(TestSlotArray, GhostPurge) {
+    test_ghosts<foster::SlotArray<uint16_t>>();
+    test_ghosts<foster::SoASlotArray<uint64_t>>();
+}
+
 TEST(TestSlotArray, MainTest) {
     test<foster::SlotArray<uint16_t>>();
     test<foster::SlotArray<string>>();
 }
 
+TEST(TestSlotArray, StructureOfArrays) {
+    test<foster::SoASlotArray<uint16_t>>();
+    test<foster::SoASlotArray<uint64_t>>();
+    test<foster::SoASlotArray<uint32_t, 4096, 4>>();
+}
+
 int main(int argc, char **argv)
 {
     ::testing::InitGoogleTest(&argc, argv);
@@ -0,0 +1,143 @@
+/*
+ * MIT License
+ *
+ * Copyright (c) 2016 Caetano Sauer
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy of this software and
+ * associated documentation files (the "Software"), to deal in the Software without restriction,
+ * including without limitation the rights to use, copy, modify, merge, publish, distribute,
+ * sublicense, and/or sell copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all copies or
+ * substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR IMPLIED, INCLUDING BUT
+ * NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM,
+ * DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+
+#include <gtest/gtest.h>
+#include <atomic>
+#include <cstdint>
+#include <functional>
+#include <stdexcept>
+#include <vector>
+
+#include "task_pool.h"
+
+TEST(TestTaskPool, RunsAllTasks)
+{
+    foster::TaskPool pool {4};
+    std::vector<std::atomic<int>> runs(1000);
+    for (auto& r : runs) { r = 0; }
+
+    for (size_t i = 0; i < runs.size(); i++) {
+        pool.submit([&runs, i] { runs[i]++; });
+    }
+    pool.wait();
+
+    for (auto& r : runs) { EXPECT_EQ(1, r.load()); }
+}
+
+TEST(TestTaskPool, NestedTasks)
+{
+    foster::TaskPool pool {3};
+    std::atomic<int> leaves {0};
+
+    // Each task splits its range into two subtasks, which are pushed to the worker's own queue
+    // and stolen by the other workers
+    std::function<void(int, int)> split = [&] (int lo, int hi) {
+        if (hi - lo == 1) {
+            leaves++;
+            return;
+        }
+        int mid = lo + (hi - lo) / 2;
+        pool.submit([&split, lo, mid] { split(lo, mid); });
+        pool.submit([&split, mid, hi] { split(mid, hi); });
+    };
+    pool.submit([&split] { split(0, 4096); });
+    pool.wait();
+
+    EXPECT_EQ(4096, leaves.load());
+}
+
+TEST(TestTaskPool, TaskWaitsForSubtasks)
+{
+    // Each task sums its range with two subtasks of its own group and waits for them, which
+    // occupies all workers with waiting tasks, so the waiting threads must run the subtasks
+    for (size_t workers : {0, 1, 3}) {
+        foster::TaskPool pool {workers};
+        std::function<int64_t(int, int)> sum = [&] (int lo, int hi) -> int64_t {
+            if (hi - lo == 1) { return lo; }
+            int mid = lo + (hi - lo) / 2;
+            int64_t left = 0, right = 0;
+            foster::TaskPool::Group group;
+            pool.submit([&] { left = sum(lo, mid); }, group);
+            pool.submit([&] { right = sum(mid, hi); }, group);
+            pool.wait(group);
+            return left + right;
+        };
+
+        int64_t total = 0;
+        pool.submit([&] { total = sum(0, 1024); });
+        pool.wait();
+        EXPECT_EQ(1023 * 1024 / 2, total);
+    }
+}
+
+TEST(TestTaskPool, GroupExceptionIsRethrown)
+{
+    // Only the waiter of the failed group sees the exception
+    foster::TaskPool pool {2};
+    foster::TaskPool::Group failing, other;
+    std::atomic<int> runs {0};
+    pool.submit([] { throw std::runtime_error("task failed"); }, failing);
+    pool.submit([&runs] { runs++; }, other);
+    EXPECT_NO_THROW(pool.wait(other));
+    EXPECT_THROW(pool.wait(failing), std::runtime_error);
+    EXPECT_NO_THROW(pool.wait());
+    EXPECT_EQ(1, runs.load());
+}
+
+TEST(TestTaskPool, NoWorkers)
+{
+    // Tasks are run by the thread that waits
+    foster::TaskPool pool {0};
+    EXPECT_EQ(0u, pool.size());
+
+    int sum = 0;
+    for (int i = 1; i <= 100; i++) {
+        pool.submit([&sum, i] { sum += i; });
+    }
+    pool.wait();
+    EXPECT_EQ(5050, sum);
+}
+
+TEST(TestTaskPool, ExceptionIsRethrown)
+{
+    foster::TaskPool pool {2};
+    std::atomic<int> runs {0};
+    for (int i = 0; i < 10; i++) {
+        pool.submit([&runs, i] {
+            runs++;
+            if (i == 5) { throw std::runtime_error("task failed"); }
+        });
+    }
+    EXPECT_THROW(pool.wait(), std::runtime_error);
+    EXPECT_EQ(10, runs.load());
+
+    // Pool remains usable, and the exception is only reported once
+    pool.submit([&runs] { runs++; });
+    pool.wait();
+    EXPECT_EQ(11, runs.load());
+}
+
+int main(int argc, char **argv)
+{
+    ::testing::InitGoogleTest(&argc, argv);
+    return RUN_ALL_TESTS();
+}